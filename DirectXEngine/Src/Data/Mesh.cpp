@@ -310,44 +310,9 @@ Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
     }
 }
 
-Mesh::Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, std::vector<std::vector<float>>& heightMap, bool normals /* = false */, bool uvs /* = true */)
+Mesh::Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, const CHeightField& heightMap, bool normals /* = false */, bool uvs /* = true */, int sampleStep /* = 1 */)
 {
-    // Create a single node, disable skinning
-    mNodes.push_back({ "Grid", MatrixIdentity(), MatrixIdentity(), 0, {}, {0} });
-    mHasBones = false;
-
-    mSubMeshes.resize(1); // Grid will be in a single sub-mesh  
-     
-    std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
-    unsigned int offset = 0;
-
-    unsigned int positionOffset = offset;
-    vertexElements.push_back({ "position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-    offset += 12;
-
-    unsigned int normalOffset = offset;
-    if (normals)
-    {
-        vertexElements.push_back({ "normal", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-        offset += 12;
-    }
-
-    unsigned int uvOffset = offset;
-    if (uvs)
-    {
-        vertexElements.push_back({ "uv", 0, DXGI_FORMAT_R32G32_FLOAT, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-        offset += 8;
-    }
-
-    mSubMeshes[0].vertexSize = offset;
-
-    // Create a vertex layout object from above array - used by DirectX to understand the data in each vertex of this mesh
-    auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
-    HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
-        shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
-        &mSubMeshes[0].vertexLayout);
-    if (shaderSignature)  shaderSignature->Release();
-    if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for grid mesh");
+    CreateGridLayout(normals, uvs);
 
 
 
@@ -392,14 +357,14 @@ Mesh::Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, std::vector
             uv.x += uStep;
 
             //set the Y value of the vertex point to the HeightMap value
-            pt.y = heightMap[z][x];
+            pt.y = heightMap.Get(x * sampleStep, z * sampleStep);
         }
         //Reset the Point and UV's X value
         pt.x = minPt.x;
         uv.x = 0;
 
         //Set the current Points Y value to the HeightMap value at the Z coordinate
-        pt.y = heightMap[z][0];
+        pt.y = heightMap.Get(0, z * sampleStep);
 
         //Increase the pt and uv's Z and T position
         pt.z += zStep;
@@ -442,8 +407,59 @@ Mesh::Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, std::vector
     GenerateBuffers(vertexData.get(), indexData.get());  
 }
 
+//Mesh Constructor for vertices and indices built elsewhere (e.g. terrain chunks), in the grid layout with normals and uvs
+Mesh::Mesh(const void* vertices, unsigned int numVertices, const uint32_t* indices, unsigned int numIndices)
+{
+    CreateGridLayout(true, true);
+
+    mSubMeshes[0].numVertices = numVertices;
+    mSubMeshes[0].numIndices = numIndices;
+    GenerateBuffers(vertices, indices);
+}
+
+//Create the single node, sub-mesh and vertex layout of a grid mesh (position, then optional normal and uv)
+void Mesh::CreateGridLayout(bool normals, bool uvs)
+{
+    // Create a single node, disable skinning
+    mNodes.push_back({ "Grid", MatrixIdentity(), MatrixIdentity(), 0, {}, {0} });
+    mHasBones = false;
+
+    mSubMeshes.resize(1); // Grid will be in a single sub-mesh  
+     
+    std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
+    unsigned int offset = 0;
+
+    unsigned int positionOffset = offset;
+    vertexElements.push_back({ "position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+    offset += 12;
+
+    unsigned int normalOffset = offset;
+    if (normals)
+    {
+        vertexElements.push_back({ "normal", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+        offset += 12;
+    }
+
+    unsigned int uvOffset = offset;
+    if (uvs)
+    {
+        vertexElements.push_back({ "uv", 0, DXGI_FORMAT_R32G32_FLOAT, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+        offset += 8;
+    }
+
+    mSubMeshes[0].vertexSize = offset;
+
+    // Create a vertex layout object from above array - used by DirectX to understand the data in each vertex of this mesh
+    auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
+    HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
+        shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
+        &mSubMeshes[0].vertexLayout);
+    if (shaderSignature)  shaderSignature->Release();
+    if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for grid mesh");
+}
+
 //Update the vertices of the Mesh
-void Mesh::UpdateVertices(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, std::vector<std::vector<float>>& heightMap, bool normals /* = false */, bool uvs /* = true */)
+void Mesh::UpdateVertices(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, const CHeightField& heightMap, bool normals /* = false */, bool uvs /* = true */, int sampleStep /* = 1 */)
 {
     //-----------------------------------
     // Allocate space to create the grid vertices (CPU-side first)
@@ -485,14 +501,14 @@ void Mesh::UpdateVertices(CVector3 minPt, CVector3 maxPt, int subDivX, int subDi
             uv.x += uStep;
 
             //set the Y value of the vertex point to the HeightMap value
-            pt.y = heightMap[z][x];
+            pt.y = heightMap.Get(x * sampleStep, z * sampleStep);
         }
         //Reset the Point and UV's X value
         pt.x = minPt.x;
         uv.x = 0;
 
         //Set the current Points Y value to the HeightMap value at the Z coordinate
-        pt.y = heightMap[z][0];
+        pt.y = heightMap.Get(0, z * sampleStep);
 
         //Increase the pt and uv's Z and T position
         pt.z += zStep;
@@ -529,14 +545,68 @@ void Mesh::UpdateVertices(CVector3 minPt, CVector3 maxPt, int subDivX, int subDi
         ++tlIndex;
     }
 
-    //Release the vertex buffer to ensure that the Mesh is regenerated properly 
+    //Release the vertex and index buffers to ensure that the Mesh is regenerated properly 
     mSubMeshes[0].vertexBuffer->Release();
     mSubMeshes[0].vertexBuffer = 0;
+    mSubMeshes[0].indexBuffer->Release();
+    mSubMeshes[0].indexBuffer = 0;
 
     //Generate the Vertex and Index Buffers
     GenerateBuffers(vertexData.get(), indexData.get());
 }
 
+//Updates the vertices of a grid mesh in the rectangle [firstX, lastX] x [firstZ, lastZ] of vertices, only that part of the vertex buffer is uploaded
+void Mesh::UpdateVertexRegion(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, const CHeightField& heightMap,
+                              int firstX, int firstZ, int lastX, int lastZ, bool normals /* = true */, bool uvs /* = true */, int sampleStep /* = 1 */)
+{
+    firstX = std::max(firstX, 0);
+    firstZ = std::max(firstZ, 0);
+    lastX = std::min(lastX, subDivX);
+    lastZ = std::min(lastZ, subDivZ);
+    if (firstX > lastX || firstZ > lastZ) return;
+
+    float xStep = (maxPt.x - minPt.x) / subDivX;
+    float zStep = (maxPt.z - minPt.z) / subDivZ;
+    float uStep = 1.0f / subDivX;
+    float vStep = 1.0f / subDivZ;
+    CVector3 normal = CVector3(0, 1, 0);
+
+    //One row of the rectangle at a time, each row is contiguous in the vertex buffer
+    const unsigned int vertexSize = mSubMeshes[0].vertexSize;
+    const int rowVertices = lastX - firstX + 1;
+    auto rowData = std::make_unique<char[]>(rowVertices * vertexSize);
+
+    for (int z = firstZ; z <= lastZ; ++z)
+    {
+        auto currVert = rowData.get();
+        for (int x = firstX; x <= lastX; ++x)
+        {
+            //Same heights as the full update, where each vertex takes the HeightMap value of the vertex before it
+            CVector3 pt = { minPt.x + x * xStep, minPt.y, minPt.z + z * zStep };
+            if (x > 0)      pt.y = heightMap.Get((x - 1) * sampleStep, z * sampleStep);
+            else if (z > 0) pt.y = heightMap.Get(0, (z - 1) * sampleStep);
+
+            *reinterpret_cast<CVector3*>(currVert) = pt;
+            currVert += sizeof(CVector3);
+            if (normals)
+            {
+                *reinterpret_cast<CVector3*>(currVert) = normal;
+                currVert += sizeof(CVector3);
+            }
+            if (uvs)
+            {
+                *reinterpret_cast<CVector2*>(currVert) = CVector2(x * uStep, 1.0f - z * vStep);
+                currVert += sizeof(CVector2);
+            }
+        }
+
+        //Copy the row into its place in the vertex buffer
+        const UINT rowStart = (z * (subDivX + 1) + firstX) * vertexSize;
+        D3D11_BOX box = { rowStart, 0, 0, rowStart + rowVertices * vertexSize, 1, 1 };
+        gD3DContext->UpdateSubresource(mSubMeshes[0].vertexBuffer, 0, &box, rowData.get(), 0, 0);
+    }
+}
+
 //Generate the Vertex and Index buffers with the new vertices of the mesh
 void Mesh::GenerateBuffers(const void* vertices, const void* indices)
 {
@@ -570,6 +640,17 @@ void Mesh::GenerateBuffers(const void* vertices, const void* indices)
     }
 }
 
+//Size in bytes of the vertex and index buffers of every sub-mesh
+size_t Mesh::BufferBytes() const
+{
+    size_t bytes = 0;
+    for (const SubMesh& subMesh : mSubMeshes)
+    {
+        bytes += static_cast<size_t>(subMesh.numVertices) * subMesh.vertexSize + static_cast<size_t>(subMesh.numIndices) * 4;
+    }
+    return bytes;
+}
+
 //Release all buffers and layouts of the mesh before deconstruction of the class
 Mesh::~Mesh()
 {
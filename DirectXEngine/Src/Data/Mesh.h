@@ -8,6 +8,7 @@
 #include "project/common.h"
 #include "Math/CVector2.h" 
 #include "Math/CVector3.h" 
+#include "Terrain/CHeightField.h"
 #include "assimp/Exporter.hpp"
 
 
@@ -26,8 +27,11 @@ public:
     // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
     Mesh(const std::string& fileName, bool requireTangents = false);
 
-    //Mesh Constructor to generate a Grid Mesh 
-    Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, std::vector<std::vector<float>>& temp, bool normals = true, bool uvs = true);
+    //Mesh Constructor to generate a Grid Mesh, each vertex reads every sampleStep samples of the HeightMap
+    Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, const CHeightField& heightMap, bool normals = true, bool uvs = true, int sampleStep = 1);
+
+    //Mesh Constructor for vertices and indices built elsewhere (e.g. terrain chunks), in the grid layout with normals and uvs
+    Mesh(const void* vertices, unsigned int numVertices, const uint32_t* indices, unsigned int numIndices);
 
     //Class deconstructor
     ~Mesh();
@@ -49,7 +53,14 @@ public:
     void GenerateBuffers(const void* vertices, const void* indices);
 
     //Updates the vertices and indices for the mesh 
-    void UpdateVertices(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, std::vector<std::vector<float>>& temp, bool normals = true, bool uvs = true);
+    void UpdateVertices(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, const CHeightField& heightMap, bool normals = true, bool uvs = true, int sampleStep = 1);
+
+    //Updates the vertices of a grid mesh in the rectangle [firstX, lastX] x [firstZ, lastZ] of vertices, only that part of the vertex buffer is uploaded
+    void UpdateVertexRegion(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, const CHeightField& heightMap,
+                            int firstX, int firstZ, int lastX, int lastZ, bool normals = true, bool uvs = true, int sampleStep = 1);
+
+    //Size in bytes of the vertex and index buffers of every sub-mesh
+    size_t BufferBytes() const;
 
 
 //--------------------------------------------------------------------------------------
@@ -106,6 +117,9 @@ private:
 	// Helper function for Render function - renders a given sub-mesh. World matrices / textures / states etc. must already be set
 	void RenderSubMesh(const SubMesh& subMesh);
 
+    //Create the single node, sub-mesh and vertex layout of a grid mesh (position, then optional normal and uv)
+    void CreateGridLayout(bool normals, bool uvs);
+
 //--------------------------------------------------------------------------------------
 // Member data
 //--------------------------------------------------------------------------------------
@@ -113,9 +113,33 @@ void Model::Setup(ID3D11VertexShader* VertexShader, ID3D11PixelShader* PixelShad
 	gD3DContext->PSSetShader(PixelShader, nullptr, 0);
 }
 
-//Resizes the model with the new HeighMap values that are generated
-void Model::ResizeModel(std::vector<std::vector<float>>& heightMap, int Width, CVector3 MinX, CVector3 MaxX)
+//Resizes the model with the new HeighMap values that are generated, each vertex reading every sampleStep samples
+void Model::ResizeModel(const CHeightField& heightMap, int Width, CVector3 MinX, CVector3 MaxX, int sampleStep)
 {
 	//Calls the UpdateVertices function from the Mesh to regenerate the mesh of the model
-	mMesh->UpdateVertices(MinX, MaxX, Width, Width, heightMap);
+	mMesh->UpdateVertices(MinX, MaxX, Width, Width, heightMap, true, true, sampleStep);
+}
+
+//Updates the part of the model covered by tiles of the HeightMap that have changed (indices tileZ * TilesX + tileX)
+void Model::UpdateModelTiles(const CHeightField& heightMap, const std::vector<int>& tiles, int Width, CVector3 MinX, CVector3 MaxX, int sampleStep)
+{
+	//Tiles are in order, so neighbouring dirty tiles on the same row are uploaded together
+	for (size_t i = 0; i < tiles.size(); )
+	{
+		const int tileZ = tiles[i] / heightMap.TilesX();
+		const int firstTileX = tiles[i] % heightMap.TilesX();
+		int lastTileX = firstTileX;
+		while (++i < tiles.size() && tiles[i] == tiles[i - 1] + 1 && tiles[i] / heightMap.TilesX() == tileZ)
+		{
+			++lastTileX;
+		}
+
+		//Each vertex takes the height of the sample before it, so the rectangle reaches one vertex past the tiles.
+		//When the mesh reads every few samples the tiles are divided down to the vertices reading them
+		const int firstX = (firstTileX << CHeightField::TileShift) / sampleStep;
+		const int firstZ = (tileZ << CHeightField::TileShift) / sampleStep;
+		const int lastX = ((lastTileX << CHeightField::TileShift) + heightMap.TileWidth(lastTileX) - 1) / sampleStep + 1;
+		const int lastZ = ((tileZ << CHeightField::TileShift) + heightMap.TileHeight(tileZ) - 1) / sampleStep + 1;
+		mMesh->UpdateVertexRegion(MinX, MaxX, Width, Width, heightMap, firstX, firstZ, lastX, lastZ, true, true, sampleStep);
+	}
 }
\ No newline at end of file
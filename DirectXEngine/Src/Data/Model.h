@@ -8,6 +8,7 @@
 #include "Math/CVector3.h"
 #include "Math/CMatrix4x4.h"
 #include "Utility/Input.h"
+#include "Terrain/CHeightField.h"
 
 #ifndef _MODEL_H_INCLUDED_
 #define _MODEL_H_INCLUDED_
@@ -91,8 +92,11 @@ public:
     void Setup(ID3D11PixelShader* PixelShader);
     void Setup(ID3D11VertexShader* VertexShader, ID3D11PixelShader* PixelShader);
 
-    //Resizes the model with the new HeighMap values that are generated
-    void ResizeModel(std::vector<std::vector<float>>& heightMap, int Width, CVector3 MinX, CVector3 MaxX);
+    //Resizes the model with the new HeighMap values that are generated, each vertex reading every sampleStep samples
+    void ResizeModel(const CHeightField& heightMap, int Width, CVector3 MinX, CVector3 MaxX, int sampleStep = 1);
+
+    //Updates the part of the model covered by tiles of the HeightMap that have changed (indices tileZ * TilesX + tileX)
+    void UpdateModelTiles(const CHeightField& heightMap, const std::vector<int>& tiles, int Width, CVector3 MinX, CVector3 MaxX, int sampleStep = 1);
 
 	//-------------------------------------
 	// Private data / members
@@ -0,0 +1,188 @@
+#include "CFourierTransform.h"
+
+//Product of two complex numbers, written out so no checks for infinities are made
+static inline CFourierTransform::Complex Multiply(CFourierTransform::Complex a, CFourierTransform::Complex b)
+{
+	return CFourierTransform::Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+//Function to fill a table with the bit reversed order of count values
+static void BitReversedOrder(std::vector<int>& order, int count)
+{
+	int bits = 0;
+	while ((1 << bits) < count) ++bits;
+
+	order.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		int reversed = 0;
+		for (int bit = 0; bit < bits; ++bit)
+		{
+			if (i & (1 << bit)) reversed |= 1 << (bits - 1 - bit);
+		}
+		order[i] = reversed;
+	}
+}
+
+//Constructor
+CFourierTransform::CFourierTransform(int size) : m_Size(size)
+{
+	if (size < 4 || (size & (size - 1)) != 0)
+	{
+		throw std::runtime_error("Fourier transforms need a size that is a power of 2 of at least 4");
+	}
+
+	//Worked out in double so the large transforms don't pile up the error of the twiddles
+	m_Twiddles.resize(size / 2);
+	for (int j = 0; j < size / 2; ++j)
+	{
+		const double angle = 2.0 * 3.14159265358979323846 * j / size;
+		m_Twiddles[j] = Complex(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+	}
+
+	BitReversedOrder(m_ColumnOrder, size);
+	BitReversedOrder(m_RowOrder, size / 2);
+}
+
+//Function to turn a half spectrum into a size x size map
+void CFourierTransform::InverseReal(Complex* spectrum, float* out, int stride, CThreadPool& pool) const
+{
+	//Every row needs all of its columns transformed, so the passes run one after the other
+	const int blocks = (HalfWidth() + ColumnBlock - 1) / ColumnBlock;
+	pool.ParallelFor(blocks, [&](int begin, int end)
+	{
+		for (int block = begin; block < end; ++block)
+		{
+			const int firstColumn = block * ColumnBlock;
+			InverseColumns(spectrum, firstColumn, std::min(ColumnBlock, HalfWidth() - firstColumn));
+		}
+	});
+
+	pool.ParallelFor(m_Size, [&](int begin, int end)
+	{
+		for (int z = begin; z < end; ++z)
+		{
+			InverseRow(spectrum + static_cast<size_t>(z) * HalfWidth(), out + static_cast<size_t>(z) * stride);
+		}
+	});
+}
+
+//Function to transform a block of columns of the half spectrum along z
+void CFourierTransform::InverseColumns(Complex* spectrum, int firstColumn, int columns) const
+{
+	thread_local std::vector<Complex> block;
+	block.resize(static_cast<size_t>(m_Size) * columns);
+
+	//Rows of the block go in bit reversed order, so the butterflies can run in place
+	const size_t halfWidth = HalfWidth();
+	for (int z = 0; z < m_Size; ++z)
+	{
+		const Complex* row = spectrum + z * halfWidth + firstColumn;
+		std::copy(row, row + columns, block.begin() + static_cast<size_t>(m_ColumnOrder[z]) * columns);
+	}
+
+	Butterflies(block.data(), m_Size, columns);
+
+	for (int z = 0; z < m_Size; ++z)
+	{
+		const Complex* row = block.data() + static_cast<size_t>(z) * columns;
+		std::copy(row, row + columns, spectrum + z * halfWidth + firstColumn);
+	}
+}
+
+//Function to transform one row of the half spectrum into a row of the map
+void CFourierTransform::InverseRow(const Complex* spectrumRow, float* out) const
+{
+	const int half = m_Size / 2;
+	thread_local std::vector<Complex> values;
+	values.resize(half);
+
+	//Frequency k and k + size / 2 land on the same frequency of the half length transform. Added together
+	//they give the even samples, and the difference turned by e^(2 pi i k / size) gives the odd samples
+	for (int k = 0; k < half; ++k)
+	{
+		const Complex value = spectrumRow[k];
+		const Complex mirror = std::conj(spectrumRow[half - k]);
+		const Complex even = value + mirror;
+		const Complex odd = Multiply(value - mirror, m_Twiddles[k]);
+		values[m_RowOrder[k]] = Complex(even.real() - odd.imag(), even.imag() + odd.real());
+	}
+
+	Butterflies(values.data(), half, 1);
+
+	for (int n = 0; n < half; ++n)
+	{
+		out[2 * n] = values[n].real();
+		out[2 * n + 1] = values[n].imag();
+	}
+}
+
+//Function to run the butterflies of a transform of count values, already in bit reversed order
+void CFourierTransform::Butterflies(Complex* data, int count, int width) const
+{
+	//std::complex is laid out as a real and imaginary float, so the values are worked on as floats
+	float* values = reinterpret_cast<float*>(data);
+	const float* twiddles = reinterpret_cast<const float*>(m_Twiddles.data());
+
+	//The first two levels only turn by 1 and i, they have the most groups so they're done without any multiplies
+	const int lanes = 2 * width;
+	for (int start = 0; start < count; start += 2)
+	{
+		float* first = values + static_cast<size_t>(start) * lanes;
+		float* second = first + lanes;
+		for (int lane = 0; lane < lanes; ++lane)
+		{
+			const float a = first[lane];
+			const float b = second[lane];
+			first[lane] = a + b;
+			second[lane] = a - b;
+		}
+	}
+	if (count >= 4)
+	{
+		for (int start = 0; start < count; start += 4)
+		{
+			float* v0 = values + static_cast<size_t>(start) * lanes;
+			float* v1 = v0 + lanes;
+			float* v2 = v1 + lanes;
+			float* v3 = v2 + lanes;
+			for (int lane = 0; lane < lanes; lane += 2)
+			{
+				//v2 is turned by 1 and v3 by i
+				const float r0 = v0[lane], i0 = v0[lane + 1];
+				const float r1 = v1[lane], i1 = v1[lane + 1];
+				const float r2 = v2[lane], i2 = v2[lane + 1];
+				const float r3 = v3[lane], i3 = v3[lane + 1];
+				v0[lane] = r0 + r2;  v0[lane + 1] = i0 + i2;
+				v2[lane] = r0 - r2;  v2[lane + 1] = i0 - i2;
+				v1[lane] = r1 - i3;  v1[lane + 1] = i1 + r3;
+				v3[lane] = r1 + i3;  v3[lane + 1] = i1 - r3;
+			}
+		}
+	}
+
+	for (int length = 8; length <= count; length <<= 1)
+	{
+		const int half = length / 2;
+		const int step = m_Size / length;
+		for (int start = 0; start < count; start += length)
+		{
+			for (int j = 0; j < half; ++j)
+			{
+				const float twiddleReal = twiddles[2 * j * step];
+				const float twiddleImaginary = twiddles[2 * j * step + 1];
+				float* first = values + static_cast<size_t>(start + j) * lanes;
+				float* second = first + static_cast<size_t>(half) * lanes;
+				for (int lane = 0; lane < lanes; lane += 2)
+				{
+					const float turnedReal = second[lane] * twiddleReal - second[lane + 1] * twiddleImaginary;
+					const float turnedImaginary = second[lane] * twiddleImaginary + second[lane + 1] * twiddleReal;
+					second[lane] = first[lane] - turnedReal;
+					second[lane + 1] = first[lane + 1] - turnedImaginary;
+					first[lane] += turnedReal;
+					first[lane + 1] += turnedImaginary;
+				}
+			}
+		}
+	}
+}
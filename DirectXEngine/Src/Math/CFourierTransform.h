@@ -0,0 +1,71 @@
+//--------------------------------------------------------------------------------------
+// Inverse 2D fast Fourier transform from a half spectrum to a real map
+//--------------------------------------------------------------------------------------
+// A real size x size map has a spectrum where each frequency is the conjugate of the one
+// opposite it, so only the x frequencies 0 to size / 2 are kept (the half spectrum). The
+// transform runs in two passes, both radix 2 and spread over the thread pool:
+//  - Along z, on every column of the half spectrum. Columns are far apart in memory, so a
+//    block of them is copied into a small buffer with the rows side by side, transformed
+//    there a whole row of the block at a time while it is in cache, then copied back.
+//  - Along x, on every row. Each row is the half spectrum of a real row, which is turned
+//    into a complex transform of half the length with the even samples in the real part
+//    and the odd samples in the imaginary part, then pulled apart into the map.
+//
+// Nothing is scaled, a map sample is the sum of every frequency times e^(+2 pi i k.n / size).
+
+#pragma once
+#include "tepch.h"
+#include "Utility/CThreadPool.h"
+#include <complex>
+
+class CFourierTransform
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	typedef std::complex<float> Complex;
+
+	//Number of columns transformed together in the pass along z
+	static constexpr int ColumnBlock = 8;
+
+	//Constructor, the size must be a power of 2 of at least 4. Throws std::runtime_error if it isn't
+	CFourierTransform(int size);
+
+	int Size() const { return m_Size; }
+
+	//Number of values in each row of a half spectrum, the x frequencies 0 to size / 2
+	int HalfWidth() const { return m_Size / 2 + 1; }
+
+	//Function to turn a half spectrum (size rows of HalfWidth() values, for the z frequencies 0 to size - 1)
+	//into a size x size map written to out with the stride given. The spectrum is transformed in place
+	//along z on the way, so it is changed
+	void InverseReal(Complex* spectrum, float* out, int stride, CThreadPool& pool = CThreadPool::Global()) const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Function to transform a block of columns of the half spectrum along z
+	void InverseColumns(Complex* spectrum, int firstColumn, int columns) const;
+
+	//Function to transform one row of the half spectrum into a row of the map
+	void InverseRow(const Complex* spectrumRow, float* out) const;
+
+	//Function to run the butterflies of a transform of count values, already in bit reversed order.
+	//The values of width transforms are interleaved, value i of transform j at data[i * width + j]
+	void Butterflies(Complex* data, int count, int width) const;
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	int m_Size;
+
+	//e^(+2 pi i j / size) for j up to size / 2, shared by the transforms along z and x
+	std::vector<Complex> m_Twiddles;
+
+	//Bit reversed order of the transforms along z (size values) and x (size / 2 values)
+	std::vector<int> m_ColumnOrder;
+	std::vector<int> m_RowOrder;
+};
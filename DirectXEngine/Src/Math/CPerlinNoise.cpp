@@ -1,4 +1,5 @@
 #include "CPerlinNoise.h"
+#include "Math/RandomHelpers.h"
 
 CPerlinNoise::CPerlinNoise(unsigned int seed)
 {
@@ -8,17 +9,18 @@ CPerlinNoise::CPerlinNoise(unsigned int seed)
 	// Fill the permutationList with values from 0 to 255
 	std::iota(permutationList.begin(), permutationList.end(), 0);
 
-	// Initialize a random engine with seed
-	std::default_random_engine engine(seed);
-
-	// Randomly shuffle the Permutation List
-	std::shuffle(permutationList.begin(), permutationList.end(), engine);
+	// Shuffle the Permutation List (Fisher-Yates) with the counter-based generator, so a seed gives the same
+	// noise with every compiler and standard library
+	for (int i = 255; i > 0; --i)
+	{
+		std::swap(permutationList[i], permutationList[RandomInt(seed, i, 0, ERandomStream::PerlinPermutation, 0, i)]);
+	}
 
 	// Duplicate the permutation vector
 	permutationList.insert(permutationList.end(), permutationList.begin(), permutationList.end());
 }
 
-double CPerlinNoise::noise(double x, double y, double z)
+double CPerlinNoise::noise(double x, double y, double z) const
 {
 	// Find the unit cube that contains the point
 	int X = (int)floor(x) & 255;
@@ -48,13 +50,13 @@ double CPerlinNoise::noise(double x, double y, double z)
 	return (res + 1.0) / 2.0;
 }
 
-double CPerlinNoise::fade(double t)
+double CPerlinNoise::fade(double t) const
 {
 	return t * t * t * (t * (t * 6 - 15) + 10);
 }
 
 //Create a gradient with the position
-double CPerlinNoise::grad(int hash, double x, double y, double z)
+double CPerlinNoise::grad(int hash, double x, double y, double z) const
 {
 	int h = hash & 15;
 	// Convert lower 4 bits of hash into 12 gradient directions
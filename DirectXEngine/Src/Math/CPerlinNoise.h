@@ -23,12 +23,12 @@ public:
 	~CPerlinNoise() {}
 
 	//The Noise function to generate a value at the selected position
-	double noise(double x, double y, double z);
+	double noise(double x, double y, double z) const;
 
 private:
 
-	double fade(double t);
+	double fade(double t) const;
 
 	//Create a gradient with the position
-	double grad(int hash, double x, double y, double z);
+	double grad(int hash, double x, double y, double z) const;
 };
\ No newline at end of file
@@ -1,13 +1,30 @@
 #include "DiamondSquare.h"
-#include <stdlib.h>
-#include <time.h>
+#include "Math/RandomHelpers.h"
+#include <xmmintrin.h>
+
+//Function to read four values a stride apart. The finest level has a stride of 2, where two loads and a shuffle
+//are quicker than four separate loads
+static inline __m128 LoadStrided(const float* values, int stride)
+{
+	if (stride == 2) return _mm_shuffle_ps(_mm_loadu_ps(values), _mm_loadu_ps(values + 4), _MM_SHUFFLE(2, 0, 2, 0));
+	return _mm_setr_ps(values[0], values[stride], values[2 * stride], values[3 * stride]);
+}
+
+//Function to work out |(a + b + c + d) / 4 + offsets| for four cells into the offsets, added in the same order
+//as the scalar loops so the heightmap is the same
+static inline void AverageInto(__m128 a, __m128 b, __m128 c, __m128 d, float* offsets)
+{
+	const __m128 avg = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(a, b), c), d), _mm_set1_ps(0.25f));
+	_mm_storeu_ps(offsets, _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_add_ps(avg, _mm_loadu_ps(offsets))));
+}
 
 //Constructor to initialise the data
-DiamondSquare::DiamondSquare(int size, float spread, float spreadReduction)
+DiamondSquare::DiamondSquare(int size, float spread, float spreadReduction, unsigned int seed)
 {
 	m_Size = size + 1;
 	m_Spread = spread;
 	m_SpreadReduction = spreadReduction;
+	m_Seed = seed;
 }
 
 //Deconstructor 
@@ -15,106 +32,208 @@ DiamondSquare::~DiamondSquare()
 {
 }
 
-//Function to reset the time to generate a new seed for the random function
-void DiamondSquare::timeReset()
+//Function to go through the Diamond Square Algorithm and generate the new HeightMap
+void DiamondSquare::process(CHeightField& HeightMap, CThreadPool& pool, CJobProgress* progress)
 {
-	srand(time(0));
+	//The levels jump across the whole map, so they run on one flat array rather than the tiles.
+	//Every sample is written by one of the steps, so the array is left uninitialised
+	std::unique_ptr<float[]> values(new float[static_cast<size_t>(m_Size) * m_Size]);
+
+	//Set the corners of the HeightMap, then run every level
+	_on_start(values.get(), m_Size, 1, m_Spread);
+	if (!runLevels(values.get(), m_Size, 1, m_Size - 1, m_Spread, pool, progress)) return;
+	writeValues(HeightMap, values.get(), m_Size, pool);
 }
 
-//Function to go through the Diamond Square Algorithm and generate the new HeightMap
-void DiamondSquare::process(std::vector<std::vector<float>>& HeightMap)
+//Function to run only the levels down to squares of sampleStep samples
+void DiamondSquare::processLevels(CHeightField& levels, int sampleStep, CThreadPool& pool, CJobProgress* progress)
 {
-	//Reset the Seed of the random generator
-	timeReset();
+	if (sampleStep < 1 || (sampleStep & (sampleStep - 1)) != 0 || sampleStep > m_Size - 1)
+	{
+		throw std::runtime_error("Diamond Square levels need a sample step that is a power of 2 no larger than the map");
+	}
+
+	//The square of sampleStep samples on the HeightMap is a square of one value in the array
+	const int size = (m_Size - 1) / sampleStep + 1;
+	std::unique_ptr<float[]> values(new float[static_cast<size_t>(size) * size]);
+	_on_start(values.get(), size, sampleStep, m_Spread);
+	if (!runLevels(values.get(), size, sampleStep, size - 1, m_Spread, pool, progress)) return;
+	writeValues(levels, values.get(), size, pool);
+}
 
-	//Set the corners of the HeightMap
-	_on_start(HeightMap);
+//Function to generate the HeightMap from the levels processLevels made
+void DiamondSquare::process(CHeightField& HeightMap, const CHeightField& levels, CThreadPool& pool, CJobProgress* progress)
+{
+	const int sampleStep = levels.Width() > 1 ? (m_Size - 1) / (levels.Width() - 1) : 0;
+	if (levels.Width() != levels.Height() || sampleStep < 1 || (levels.Width() - 1) * sampleStep != m_Size - 1)
+	{
+		throw std::runtime_error("Diamond Square levels were made for a HeightMap of another size");
+	}
 
+	//The samples the levels hold are set, the rest are written by the finer levels
+	std::unique_ptr<float[]> values(new float[static_cast<size_t>(m_Size) * m_Size]);
+	std::vector<float> row(levels.Width());
+	for (int z = 0; z < levels.Height(); ++z)
+	{
+		levels.ReadRegion(0, z, levels.Width(), 1, row.data(), levels.Width());
+		float* out = values.get() + static_cast<size_t>(z) * sampleStep * m_Size;
+		for (int x = 0; x < levels.Width(); ++x) out[x * sampleStep] = row[x];
+	}
+
+	//The spread is divided down the same way as running every level, so the finer levels are the same
+	float spread = m_Spread;
+	for (int sideLength = m_Size - 1; sideLength > sampleStep; sideLength /= 2) spread /= m_SpreadReduction;
+	if (!runLevels(values.get(), m_Size, 1, sampleStep, spread, pool, progress)) return;
+	writeValues(HeightMap, values.get(), m_Size, pool);
+}
+
+//Function to set the corners of the HeightMap to a random value of the Spread
+void DiamondSquare::_on_start(float* values, int size, int sampleStep, float spread) const
+{
+	const int last = size - 1;
+	const int lastSample = last * sampleStep;
+	values[0] = RandomRange(m_Seed, 0, 0, ERandomStream::DiamondSquare, -spread, spread);
+	values[last] = RandomRange(m_Seed, lastSample, 0, ERandomStream::DiamondSquare, -spread, spread);
+	values[static_cast<size_t>(last) * size] = RandomRange(m_Seed, 0, lastSample, ERandomStream::DiamondSquare, -spread, spread);
+	values[static_cast<size_t>(last) * size + last] = RandomRange(m_Seed, lastSample, lastSample, ERandomStream::DiamondSquare, -spread, spread);
+}
+
+//Function to run every level from squares of firstSideLength values down to the smallest
+bool DiamondSquare::runLevels(float* values, int size, int sampleStep, int firstSideLength, float spread, CThreadPool& pool, CJobProgress* progress) const
+{
 	//side length is distance of a single square side
-	for (int sideLength = m_Size - 1; sideLength >= 2; sideLength /= 2, m_Spread /= m_SpreadReduction)
+	for (int sideLength = firstSideLength; sideLength >= 2; sideLength /= 2, spread /= m_SpreadReduction)
 	{
+		if (progress && progress->IsCancelled()) return false;
+
 		//side length must be >= 2 so we always have
 		//a new value (if its 1 we overwrite existing values
 		//on the last iteration)
-		
+
 		//each iteration we are looking at smaller squares
-		//diamonds, and we decrease the variation of the offset
-		 
-		//half the length of the side of a square
-		//or distance from diamond center to one corner
-		//(just to make calcs below a little clearer)
-		int halfSide = sideLength / 2;
-
-		//SQUARE STEP
-		for (int x = 0; x < m_Size - 1; x += sideLength) 
-		{
-			for (int y = 0; y < m_Size - 1; y += sideLength) 
-			{
-				//x, y is upper left corner of square
-				//calculate average of existing corners
-				double avg = HeightMap[x][y] //top left
-						   + HeightMap[x + sideLength][y]//top right
-					       + HeightMap[x][y + sideLength]//lower left
-						   + HeightMap[x + sideLength][y + sideLength];//lower right
-				avg /= 4.0;
-
-				//add a random value on to the average
-				HeightMap[x + halfSide][y + halfSide] = abs(avg + fRand2(-m_Spread, m_Spread));
-			}
-		}
+		//diamonds, and we decrease the variation of the offset.
+		//Every diamond reads square centres, so the steps run one after the other
+		squareStep(values, size, sampleStep, sideLength, spread, pool);
+		diamondStep(values, size, sampleStep, sideLength, spread, pool);
+	}
+	return true;
+}
 
-		//generate the diamond values
-		//since the diamonds are staggered we only move x
-		//by half side
-		//NOTE: if the data shouldn't wrap then x < DATA_SIZE
-		//to generate the far edge values
+//Function to copy the array into a heightfield of its size
+void DiamondSquare::writeValues(CHeightField& HeightMap, const float* values, int size, CThreadPool& pool)
+{
+	//Copy into the tiles a band of tile rows per worker, no two workers touch the same tile
+	HeightMap.ResizeUninitialised(size, size);
+	pool.ParallelFor(HeightMap.TilesZ(), [&](int begin, int end)
+	{
+		const int z0 = begin << CHeightField::TileShift;
+		const int z1 = std::min(end << CHeightField::TileShift, size);
+		HeightMap.WriteRegion(0, z0, size, z1 - z0, values + static_cast<size_t>(z0) * size, size);
+	});
+}
 
-		//DIAMOND STEP
-		for (int x = 0; x < m_Size - 1; x += halfSide) 
+//Function to run the square step of one level, filling the centre of every square
+void DiamondSquare::squareStep(float* values, int size, int sampleStep, int sideLength, float spread, CThreadPool& pool) const
+{
+	//half the length of the side of a square
+	//or distance from diamond center to one corner
+	const int halfSide = sideLength / 2;
+	const int squares = (size - 1) / sideLength;
+
+	//One row of squares at a time, x, z is upper left corner of square
+	pool.ParallelFor(squares, [&](int begin, int end)
+	{
+		thread_local std::vector<float> offsets;
+		offsets.resize(squares);
+		for (int row = begin; row < end; ++row)
 		{
-			//and y is x offset by half a side, but moved by
-			//the full side length
-			//NOTE: if the data shouldn't wrap then y < DATA_SIZE
-			//to generate the far edge values
-			for (int y = (x + halfSide) % sideLength; y < m_Size - 1; y += sideLength) 
+			const int z = row * sideLength;
+			const float* top = values + static_cast<size_t>(z) * size;
+			const float* bottom = top + static_cast<size_t>(sideLength) * size;
+			float* centre = values + static_cast<size_t>(z + halfSide) * size + halfSide;
+
+			RandomRangeBatch(m_Seed, halfSide * sampleStep, sideLength * sampleStep, (z + halfSide) * sampleStep, ERandomStream::DiamondSquare, squares, -spread, spread, offsets.data());
+
+			//calculate average of existing corners and add a random value on to it. Four squares at a time are worked
+			//out into their offsets with SSE, then written a side length apart. The last load of four squares reads
+			//the corner after them, so the corner after the last square stops the loop
+			int i = 0;
+			for (; (i + 4) * sideLength <= size - 1 - (sideLength == 2 ? 1 : 0); i += 4)
+			{
+				const int x = i * sideLength;
+				AverageInto(LoadStrided(top + x, sideLength), LoadStrided(top + x + sideLength, sideLength),
+				            LoadStrided(bottom + x, sideLength), LoadStrided(bottom + x + sideLength, sideLength), offsets.data() + i);
+				for (int n = 0; n < 4; ++n) centre[x + n * sideLength] = offsets[i + n];
+			}
+			for (; i < squares; ++i)
 			{
-				//x, y is center of diamond
-				//note we must use mod  and add DATA_SIZE for subtraction 
-				//so that we can wrap around the array to find the corners
-				double avg = HeightMap[(x - halfSide + m_Size - 1) % (m_Size - 1)][y] //left of center
-						   + HeightMap[(x + halfSide) % (m_Size - 1)][y]  //right of center
-						   + HeightMap[x][(y + halfSide) % (m_Size - 1)]  //below center
-						   + HeightMap[x][(y - halfSide + m_Size - 1) % (m_Size - 1)]; //above center
-
-
-				avg /= 4.0;
-
-				//add a random value on to the average
-				avg = abs(avg + fRand2(-m_Spread, m_Spread));
-				//update value for center of diamond
-				HeightMap[x][y] = avg;
-
-				//wrap values on the edges, remove
-				//this and adjust loop condition above
-				//for non-wrapping values.
-				if (x == 0)  HeightMap[m_Size - 1][y] = avg;
-				if (y == 0)  HeightMap[x][m_Size - 1] = avg;	              
+				const int x = i * sideLength;
+				const float avg = (top[x] + top[x + sideLength] + bottom[x] + bottom[x + sideLength]) * 0.25f;
+				centre[x] = std::abs(avg + offsets[i]);
 			}
 		}
-	}
+	});
 }
 
-//Function to set the corners of the HeightMap to a random value of the Spread
-void DiamondSquare::_on_start(std::vector<std::vector<float>>& HeightMap)
+//Function to run the diamond step of one level, filling the centre of every diamond
+void DiamondSquare::diamondStep(float* values, int size, int sampleStep, int sideLength, float spread, CThreadPool& pool) const
 {
-	HeightMap[0][0] = fRand2(-m_Spread, m_Spread);
-	HeightMap[0][m_Size - 1] = fRand2(-m_Spread, m_Spread);
-	HeightMap[m_Size - 1][0] = fRand2(-m_Spread, m_Spread);
-	HeightMap[m_Size - 1][m_Size - 1] = fRand2(-m_Spread, m_Spread);
-}
+	const int halfSide = sideLength / 2;
+	const int wrap = size - 1;
+	const int diamondRows = wrap / halfSide;
+	const int diamonds = wrap / sideLength;
+
+	//generate the diamond values, since the diamonds are staggered each row starts half a side
+	//further along than the one before. The data wraps, so the far row and column are copies
+	pool.ParallelFor(diamondRows, [&](int begin, int end)
+	{
+		thread_local std::vector<float> offsets;
+		offsets.resize(diamonds);
+		for (int row = begin; row < end; ++row)
+		{
+			const int z = row * halfSide;
+			const int firstX = (z + halfSide) % sideLength;
+			float* centre = values + static_cast<size_t>(z) * size;
+			const float* above = values + static_cast<size_t>((z - halfSide + wrap) % wrap) * size;
+			const float* below = values + static_cast<size_t>((z + halfSide) % wrap) * size;
 
-//Function to generate a random value between two values
-double DiamondSquare::fRand2(float dMin, float dMax)
-{
-	return dMin + (dMax - dMin) * (static_cast<double>(rand()) / RAND_MAX);
-}
\ No newline at end of file
+			RandomRangeBatch(m_Seed, firstX * sampleStep, sideLength * sampleStep, z * sampleStep, ERandomStream::DiamondSquare, diamonds, -spread, spread, offsets.data());
+
+			//x, z is the centre of the diamond, the ones at either end wrap around to the far side
+			auto diamond = [&](int i)
+			{
+				const int x = firstX + i * sideLength;
+				const float avg = (centre[(x - halfSide + wrap) % wrap] + centre[(x + halfSide) % wrap] + above[x] + below[x]) * 0.25f;
+				centre[x] = std::abs(avg + offsets[i]);
+			};
+			const int first = firstX == 0 ? 1 : 0;
+			const int last = firstX + (diamonds - 1) * sideLength + halfSide >= wrap ? diamonds - 1 : diamonds;
+			if (first == 1) diamond(0);
+
+			//Four diamonds at a time with SSE as in the square step, while the loads stay inside the row
+			int i = first;
+			for (; i + 4 <= last && firstX + (i + 3) * sideLength + halfSide + (sideLength == 2 ? 1 : 0) <= wrap; i += 4)
+			{
+				const int x = firstX + i * sideLength;
+				AverageInto(LoadStrided(centre + x - halfSide, sideLength), LoadStrided(centre + x + halfSide, sideLength),
+				            LoadStrided(above + x, sideLength), LoadStrided(below + x, sideLength), offsets.data() + i);
+				for (int n = 0; n < 4; ++n) centre[x + n * sideLength] = offsets[i + n];
+			}
+			for (; i < last; ++i)
+			{
+				const int x = firstX + i * sideLength;
+				const float avg = (centre[x - halfSide] + centre[x + halfSide] + above[x] + below[x]) * 0.25f;
+				centre[x] = std::abs(avg + offsets[i]);
+			}
+			if (last < diamonds) diamond(last);
+
+			//wrap values on the edges
+			if (firstX == 0) centre[wrap] = centre[0];
+			if (z == 0)
+			{
+				float* farRow = values + static_cast<size_t>(wrap) * size;
+				for (int i = 0; i < diamonds; ++i) farRow[firstX + i * sideLength] = centre[firstX + i * sideLength];
+			}
+		}
+	});
+}
@@ -1,5 +1,24 @@
+//--------------------------------------------------------------------------------------
+// Diamond-square fractal heightmap generation
+//--------------------------------------------------------------------------------------
+// Every level is run level-synchronously: all the square step cells of a level are
+// independent of each other, as are all the diamond step cells, so each step is split into
+// rows and spread over the thread pool with a barrier between steps. The random offset of
+// every cell comes from the counter-based generator, keyed by the seed and the cell's
+// coordinates, so the heightmap is the same whatever the number of threads and the same
+// seed always gives the same heightmap.
+//
+// The levels from the corners down to squares of some spacing only touch the samples on a
+// grid of that spacing, so they can be run on their own as a small preview of the map.
+// Running the rest of the levels from that preview gives the same map as running them all.
+// A job given to the functions is checked for cancellation once per level, a cancelled run
+// returns without writing the heightfield.
+
 #pragma once
 #include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Utility/CJobProgress.h"
+#include "Utility/CThreadPool.h"
 #include <wincrypt.h>
 class DiamondSquare
 {
@@ -8,23 +27,48 @@ class DiamondSquare
 //----------------------//
 public:
 	//Constructor
-	DiamondSquare(int size, float spread, float spreadReduction);
+	DiamondSquare(int size, float spread, float spreadReduction, unsigned int seed = 0);
 
 	//Destructor
 	~DiamondSquare();
 	
-	//Function to reset the time to generate a new seed for the random function
-	void timeReset();
+	//Function to choose the seed, the same seed always gives the same HeightMap
+	void setSeed(unsigned int seed) { m_Seed = seed; }
+
+	//Function to go through the Diamond Square Algorithm and generate the new HeightMap, using the workers of the pool given
+	void process(CHeightField& HeightMap, CThreadPool& pool = CThreadPool::Global(), CJobProgress* progress = nullptr);
+
+	//Function to run only the levels down to squares of sampleStep samples, into a heightfield holding every
+	//sampleStep-th sample of the HeightMap. sampleStep must be a power of 2 no larger than the size
+	void processLevels(CHeightField& levels, int sampleStep, CThreadPool& pool = CThreadPool::Global(), CJobProgress* progress = nullptr);
 
-	//Function to go through the Diamond Square Algorithm and generate the new HeightMap
-	void process(std::vector<std::vector<float>>& HeightMap);
+	//Function to generate the HeightMap from the levels processLevels made, running only the finer levels.
+	//Throws std::runtime_error if the levels weren't made for a HeightMap of this size
+	void process(CHeightField& HeightMap, const CHeightField& levels, CThreadPool& pool = CThreadPool::Global(), CJobProgress* progress = nullptr);
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//The functions below work on a square array of size x size values holding every sampleStep-th sample of
+	//the HeightMap, side lengths are in values of the array. The random offsets are keyed by the coordinates
+	//on the HeightMap, so every array gives the samples it holds the same values
 
 	//Function to set the corners of the HeightMap to a random value of the Spread
-	void _on_start(std::vector<std::vector<float>>& HeightMap);
+	void _on_start(float* values, int size, int sampleStep, float spread) const;
+
+	//Function to run every level from squares of firstSideLength values down to the smallest, returns false if the job was cancelled
+	bool runLevels(float* values, int size, int sampleStep, int firstSideLength, float spread, CThreadPool& pool, CJobProgress* progress) const;
+
+	//Function to run the square step of one level, filling the centre of every square
+	void squareStep(float* values, int size, int sampleStep, int sideLength, float spread, CThreadPool& pool) const;
+
+	//Function to run the diamond step of one level, filling the centre of every diamond
+	void diamondStep(float* values, int size, int sampleStep, int sideLength, float spread, CThreadPool& pool) const;
+
+	//Function to copy the array into a heightfield of its size
+	static void writeValues(CHeightField& HeightMap, const float* values, int size, CThreadPool& pool);
 
-	//Function to generate a random value between two values
-	double fRand2(float fMin, float dMax);
-	
 
 //-------------//
 // Member data //
@@ -38,4 +82,7 @@ private:
 
 	//The amount the Spread gets divided by each loop
 	float m_SpreadReduction;
+
+	//Seed of the random offset of each cell
+	unsigned int m_Seed = 0;
 };
\ No newline at end of file
@@ -41,33 +41,4 @@ inline float ToDegrees(float r)
     return  r * 180.0f / PI;
 }
 
-
-
-// Return random integer from a to b (inclusive)
-// Can only return up to RAND_MAX different values, spread evenly across the given range
-// RAND_MAX is defined in stdlib.h and is compiler-specific (32767 on VS-2005, higher elsewhere)
-inline uint32_t Random(const uint32_t a, const uint32_t b)
-{
-	// Could just use a + rand() % (b-a), but using a more complex form to allow range
-	// to exceed RAND_MAX and still return values spread across the range
-	uint32_t t = (b - a + 1) * rand();
-	return t == 0 ? a : a + (t - 1) / RAND_MAX;
-}
-
-// Return random 32-bit float from a to b (inclusive)
-// Can only return up to RAND_MAX different values, spread evenly across the given range
-// RAND_MAX is defined in stdlib.h and is compiler-specific (32767 on VS-2005, higher elsewhere)
-inline float Random(const float a, const float b)
-{
-	return a + (b - a) * (static_cast<float>(rand()) / RAND_MAX);
-}
-
-// Return random 64-bit float from a to b (inclusive)
-// Can only return up to RAND_MAX different values, spread evenly across the given range
-// RAND_MAX is defined in stdlib.h and is compiler-specific (32767 on VS-2005, higher elsewhere)
-inline double Random(const double a, const double b)
-{
-	return a + (b - a) * (static_cast<double>(rand()) / RAND_MAX);
-}
-
 #endif // _MATH_HELPERS_H_DEFINED_
@@ -0,0 +1,61 @@
+#include "RandomHelpers.h"
+
+//Function to fill out[i] with RandomBits(seed, x0 + i * xStep, y, stream) for count values
+void RandomBitsBatch(uint64_t seed, int x0, int xStep, int y, ERandomStream stream, int count, uint32_t* out)
+{
+	//Blocks of values go through the rounds together, each round is the same few instructions on
+	//every lane so the loops vectorise (32 x 32 -> 64 bit multiplies are a single SIMD instruction)
+	const int BlockSize = 64;
+	uint32_t c0[BlockSize], c1[BlockSize], c2[BlockSize], c3[BlockSize];
+
+	for (int begin = 0; begin < count; begin += BlockSize)
+	{
+		const int lanes = std::min(BlockSize, count - begin);
+		for (int i = 0; i < lanes; ++i)
+		{
+			c0[i] = static_cast<uint32_t>(x0 + (begin + i) * xStep);
+			c1[i] = static_cast<uint32_t>(y);
+			c2[i] = static_cast<uint32_t>(stream);
+			c3[i] = 0;
+		}
+
+		uint32_t k0 = static_cast<uint32_t>(seed);
+		uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+		for (int round = 0; round < 10; ++round)
+		{
+			for (int i = 0; i < lanes; ++i)
+			{
+				const uint64_t product0 = static_cast<uint64_t>(0xD2511F53u) * c0[i];
+				const uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57u) * c2[i];
+				const uint32_t next0 = static_cast<uint32_t>(product1 >> 32) ^ c1[i] ^ k0;
+				const uint32_t next2 = static_cast<uint32_t>(product0 >> 32) ^ c3[i] ^ k1;
+				c1[i] = static_cast<uint32_t>(product1);
+				c3[i] = static_cast<uint32_t>(product0);
+				c0[i] = next0;
+				c2[i] = next2;
+			}
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+
+		std::copy(c0, c0 + lanes, out + begin);
+	}
+}
+
+//Function to fill out[i] with RandomRange(seed, x0 + i * xStep, y, stream, min, max) for count values
+void RandomRangeBatch(uint64_t seed, int x0, int xStep, int y, ERandomStream stream, int count, float min, float max, float* out)
+{
+	//Same sum as RandomRange, scaling by a power of 2 is exact so the values are bit-identical
+	const float scale = (max - min) * (1.0f / 16777216.0f);
+	const int BlockSize = 256;
+	uint32_t bits[BlockSize];
+	for (int begin = 0; begin < count; begin += BlockSize)
+	{
+		const int lanes = std::min(BlockSize, count - begin);
+		RandomBitsBatch(seed, x0 + begin * xStep, xStep, y, stream, lanes, bits);
+		for (int i = 0; i < lanes; ++i)
+		{
+			out[begin + i] = min + static_cast<float>(bits[i] >> 8) * scale;
+		}
+	}
+}
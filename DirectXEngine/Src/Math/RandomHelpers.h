@@ -0,0 +1,89 @@
+//--------------------------------------------------------------------------------------
+// Counter-based random numbers for procedural generation
+//--------------------------------------------------------------------------------------
+// Rather than stepping a generator, every random value is a pure function of
+// (seed, x, y, stream): the counter (x, y, stream) is scrambled under a key made from the
+// seed by the Philox4x32-10 block cipher. Any value can be worked out on its own on any
+// thread, in any order, so parallel kernels give the same result whatever the number of
+// threads, and equal seeds always give bit-identical terrain (which lets it be cached).
+//
+// Each use of randomness has its own stream so two uses with the same seed and coordinates
+// never get correlated values. The batch functions work out a run of values along x with
+// plain 32 bit integer loops that the compiler vectorises.
+
+#pragma once
+#include "tepch.h"
+
+//Streams of random values, one per use so uses never share values
+enum class ERandomStream : uint32_t
+{
+	DiamondSquare,   //Offset of each diamond-square cell
+	FoliageX,        //Position of each plant on the single terrain patch
+	FoliageZ,
+	ChunkPlantX,     //Position of each plant in a streamed chunk
+	ChunkPlantZ,
+	MidpointDisplacement, //Offset of each midpoint displacement point
+	ErosionGrid,     //Offset of the erosion cell grid in each pass
+	ErosionX,        //Start of each erosion droplet
+	ErosionZ,
+	Spectral,        //Size and angle of the random value of each frequency in spectral synthesis
+	StampX,          //Position, size, rotation, height and shape of each placed stamp
+	StampZ,
+	StampRadius,
+	StampAngle,
+	StampHeight,
+	StampShape,
+	DetailUpsample,  //Offset of each point of the detail added when upsampling a coarse map
+	PerlinPermutation, //Swaps of the shuffle of the Perlin noise permutation
+};
+
+//Function to scramble the counter (x, y, stream) under the seed, returns 32 random bits (Philox4x32-10)
+inline uint32_t RandomBits(uint64_t seed, int x, int y, ERandomStream stream)
+{
+	uint32_t c0 = static_cast<uint32_t>(x);
+	uint32_t c1 = static_cast<uint32_t>(y);
+	uint32_t c2 = static_cast<uint32_t>(stream);
+	uint32_t c3 = 0;
+	uint32_t k0 = static_cast<uint32_t>(seed);
+	uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+
+	for (int round = 0; round < 10; ++round)
+	{
+		const uint64_t product0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+		const uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+		const uint32_t next0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+		const uint32_t next2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+		c1 = static_cast<uint32_t>(product1);
+		c3 = static_cast<uint32_t>(product0);
+		c0 = next0;
+		c2 = next2;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	return c0;
+}
+
+//Random float in [0, 1) for the counter, from the top 24 bits so every value is exact
+inline float RandomFloat(uint64_t seed, int x, int y, ERandomStream stream)
+{
+	return static_cast<float>(RandomBits(seed, x, y, stream) >> 8) * (1.0f / 16777216.0f);
+}
+
+//Random float in [min, max) for the counter
+inline float RandomRange(uint64_t seed, int x, int y, ERandomStream stream, float min, float max)
+{
+	return min + (max - min) * RandomFloat(seed, x, y, stream);
+}
+
+//Random integer from min to max (inclusive) for the counter
+inline int RandomInt(uint64_t seed, int x, int y, ERandomStream stream, int min, int max)
+{
+	const uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(max) - min + 1);
+	return min + static_cast<int>((RandomBits(seed, x, y, stream) * range) >> 32);
+}
+
+//Function to fill out[i] with RandomBits(seed, x0 + i * xStep, y, stream) for count values
+void RandomBitsBatch(uint64_t seed, int x0, int xStep, int y, ERandomStream stream, int count, uint32_t* out);
+
+//Function to fill out[i] with RandomRange(seed, x0 + i * xStep, y, stream, min, max) for count values
+void RandomRangeBatch(uint64_t seed, int x0, int xStep, int y, ERandomStream stream, int count, float min, float max, float* out);
@@ -0,0 +1,203 @@
+#include "CBackgroundGenerator.h"
+#include "Utility/CThreadPool.h"
+
+//Constructor, starts the background thread
+CBackgroundGenerator::CBackgroundGenerator()
+{
+	m_Thread = std::thread(&CBackgroundGenerator::WorkerLoop, this);
+}
+
+//Destructor, cancels every job and waits for the background thread
+CBackgroundGenerator::~CBackgroundGenerator()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+		m_Pending.reset();
+		if (m_Running) m_Running->Cancel();
+	}
+	m_Wake.notify_all();
+	m_Thread.join();
+}
+
+//Function to run a graph in the background into a heightfield of the size given, superseding every earlier job
+void CBackgroundGenerator::Start(const std::string& label, std::unique_ptr<CTerrainGraph> graph, CTerrainGraph::NodeId output, int width, int height,
+	std::unique_ptr<CTerrainGraph> preview, CTerrainGraph::NodeId previewOutput, int previewWidth, int previewHeight)
+{
+	std::unique_ptr<Job> job(new Job());
+	job->label = label;
+	job->graph = std::move(graph);
+	job->output = output;
+	job->width = width;
+	job->height = height;
+	job->preview = std::move(preview);
+	job->previewOutput = previewOutput;
+	job->previewWidth = previewWidth;
+	job->previewHeight = previewHeight;
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		//A job that never started is dropped here, the running one stops at its next tile
+		if (m_Pending) ++m_CancelledJobs;
+		if (m_Running) m_Running->Cancel();
+		m_HasResult = false;
+		m_HasPreview = false;
+		m_Pending = std::move(job);
+	}
+	m_Wake.notify_all();
+}
+
+//Function to cancel the running job and any job waiting, along with a result that has not been taken
+void CBackgroundGenerator::Cancel()
+{
+	std::unique_ptr<Job> pending;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Pending) ++m_CancelledJobs;
+		if (m_Running) m_Running->Cancel();
+		m_HasResult = false;
+		m_HasPreview = false;
+		pending = std::move(m_Pending);
+	}
+}
+
+//Function to take the heightfield of the last job to finish, returns false if no job has finished since the last call
+bool CBackgroundGenerator::TakeResult(Result& result)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_HasResult) return false;
+
+	//Only the tile pointers move, so the swap is quick whatever the size of the heightfield
+	result = std::move(m_Finished);
+	m_Finished = Result();
+	m_HasResult = false;
+	return true;
+}
+
+//Function to take the preview of the running job, returns false if there is no preview that hasn't been taken
+bool CBackgroundGenerator::TakePreview(CHeightField& preview)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_HasPreview) return false;
+
+	preview = std::move(m_Preview);
+	m_Preview = CHeightField();
+	m_HasPreview = false;
+	return true;
+}
+
+//Check whether a job is running or waiting to run
+bool CBackgroundGenerator::IsBusy() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Pending || m_Running;
+}
+
+//Progress of the running job between 0 and 1
+float CBackgroundGenerator::Progress() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Running ? m_Running->Progress() : 0.0f;
+}
+
+//Label of the running or waiting job, empty if there is none
+std::string CBackgroundGenerator::RunningLabel() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Pending) return m_Pending->label;
+	return m_Running ? m_RunningLabel : std::string();
+}
+
+//Error message of the last job that failed, empty if none has
+std::string CBackgroundGenerator::LastError() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_LastError;
+}
+
+//Function run by the background thread
+void CBackgroundGenerator::WorkerLoop()
+{
+	//The render thread is the one that must not wait for the pool, this thread can
+	CThreadPool::SetWaitWhenBusy(true);
+
+	while (true)
+	{
+		std::unique_ptr<Job> job;
+		std::shared_ptr<CJobProgress> progress(new CJobProgress());
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Wake.wait(lock, [&]() { return m_Stop || m_Pending; });
+			if (m_Stop) return;
+
+			job = std::move(m_Pending);
+			m_Running = progress;
+			m_RunningLabel = job->label;
+		}
+
+		//The back buffer, nothing else can see it until the job has finished
+		CHeightField back;
+		bool bFinished = false;
+		bool bCached = false;
+		std::string error;
+		try
+		{
+			//Settings that were generated before are copied out of the cache
+			const uint64_t key = job->graph->Hash(job->output, job->width, job->height);
+			if (key != 0 && m_Cache.Find(key, back))
+			{
+				bFinished = bCached = true;
+			}
+			else
+			{
+				//The preview is small, so it isn't worth a place in the cache
+				if (job->preview)
+				{
+					CHeightField preview;
+					job->preview->SetProgress(progress.get());
+					if (job->preview->Execute(job->previewOutput, preview, job->previewWidth, job->previewHeight))
+					{
+						std::lock_guard<std::mutex> lock(m_Mutex);
+						if (!progress->IsCancelled())
+						{
+							m_Preview = std::move(preview);
+							m_HasPreview = true;
+						}
+					}
+				}
+
+				job->graph->SetProgress(progress.get());
+				bFinished = !progress->IsCancelled() && job->graph->Execute(job->output, back, job->width, job->height);
+				if (bFinished && key != 0) m_Cache.Insert(key, back);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			error = e.what();
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Running.reset();
+		if (!error.empty())
+		{
+			m_LastError = job->label + ": " + error;
+		}
+		else if (!bFinished || progress->IsCancelled())
+		{
+			++m_CancelledJobs;
+		}
+		else
+		{
+			m_Finished.heightField = std::move(back);
+			m_Finished.label = job->label;
+			m_Finished.stats = bCached ? CTerrainGraph::ExecuteStats() : job->graph->LastStats();
+			m_Finished.bCached = bCached;
+			m_HasResult = true;
+			m_HasPreview = false;
+			m_Preview = CHeightField();
+			m_LastError.clear();
+			++m_FinishedJobs;
+		}
+	}
+}
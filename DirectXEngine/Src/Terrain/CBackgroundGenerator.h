@@ -0,0 +1,144 @@
+//--------------------------------------------------------------------------------------
+// Runs terrain graphs on a background thread so the render thread never waits for them
+//--------------------------------------------------------------------------------------
+// The background thread runs one graph at a time into its own heightfield (the back buffer)
+// while the scene keeps drawing the current one. A finished heightfield is handed over whole
+// by TakeResult, so the scene only ever sees complete terrain. Starting a job cancels the job
+// that is running and replaces any job still waiting, so dragging a slider only ever finishes
+// the latest settings. The graph itself spreads each pass over the thread pool.
+//
+// Every graph is hashed before it runs and finished heightfields are kept in an LRU cache
+// under that hash, so going back to settings that were generated before is a copy of the
+// cached tile pointers instead of a new run.
+//
+// A job can carry a preview: a second graph making a coarse version of the heightfield, a
+// small fraction of its size. The preview runs first and is handed over by TakePreview as
+// soon as it is done, so the scene can show something within milliseconds however large the
+// heightfield is, then the full graph runs. Work of the preview that the full graph can use
+// is shared between their operators (the levels of diamond-square). Settings in the cache
+// skip the preview.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Terrain/CTerrainGraph.h"
+#include "Terrain/CHeightFieldCache.h"
+#include "Utility/CJobProgress.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class CBackgroundGenerator
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Heightfield made by a finished job
+	struct Result
+	{
+		CHeightField heightField;
+		std::string label;
+		CTerrainGraph::ExecuteStats stats;
+		bool bCached = false;       //Taken from the cache rather than run
+	};
+
+	//Constructor, starts the background thread
+	CBackgroundGenerator();
+
+	//Destructor, cancels every job and waits for the background thread
+	~CBackgroundGenerator();
+
+	CBackgroundGenerator(const CBackgroundGenerator&) = delete;
+	CBackgroundGenerator& operator=(const CBackgroundGenerator&) = delete;
+
+	//Function to run a graph in the background into a heightfield of the size given, superseding every earlier job.
+	//A preview graph, if given, runs first into a heightfield of its own size
+	void Start(const std::string& label, std::unique_ptr<CTerrainGraph> graph, CTerrainGraph::NodeId output, int width, int height,
+		std::unique_ptr<CTerrainGraph> preview = nullptr, CTerrainGraph::NodeId previewOutput = 0, int previewWidth = 0, int previewHeight = 0);
+
+	//Function to cancel the running job and any job waiting, along with a result that has not been taken
+	void Cancel();
+
+	//Function to take the heightfield of the last job to finish, returns false if no job has finished since the last call
+	bool TakeResult(Result& result);
+
+	//Function to take the preview of the running job, returns false if there is no preview that hasn't been taken.
+	//A preview is dropped once its job finishes
+	bool TakePreview(CHeightField& preview);
+
+	//Check whether a job is running or waiting to run
+	bool IsBusy() const;
+
+	//Progress of the running job between 0 and 1
+	float Progress() const;
+
+	//Label of the running or waiting job, empty if there is none
+	std::string RunningLabel() const;
+
+	//Error message of the last job that failed, empty if none has
+	std::string LastError() const;
+
+	//Cache of finished heightfields, keyed by the hash of the graph that made them
+	CHeightFieldCache& Cache() { return m_Cache; }
+
+	//Number of jobs finished and cancelled so far
+	int FinishedJobs() const { return m_FinishedJobs; }
+	int CancelledJobs() const { return m_CancelledJobs; }
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	struct Job
+	{
+		std::string label;
+		std::unique_ptr<CTerrainGraph> graph;
+		CTerrainGraph::NodeId output = 0;
+		int width = 0;
+		int height = 0;
+
+		std::unique_ptr<CTerrainGraph> preview;
+		CTerrainGraph::NodeId previewOutput = 0;
+		int previewWidth = 0;
+		int previewHeight = 0;
+	};
+
+	//Function run by the background thread
+	void WorkerLoop();
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	std::thread m_Thread;
+
+	CHeightFieldCache m_Cache;
+
+	//Everything below is guarded by m_Mutex
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	bool m_Stop = false;
+
+	//Newest job that has not started yet
+	std::unique_ptr<Job> m_Pending;
+
+	//Job on the background thread, null when it is idle
+	std::shared_ptr<CJobProgress> m_Running;
+	std::string m_RunningLabel;
+
+	//Finished job waiting to be taken
+	bool m_HasResult = false;
+	Result m_Finished;
+
+	//Preview of the running job waiting to be taken
+	bool m_HasPreview = false;
+	CHeightField m_Preview;
+
+	std::string m_LastError;
+
+	//Read without the lock by the UI
+	std::atomic<int> m_FinishedJobs{ 0 };
+	std::atomic<int> m_CancelledJobs{ 0 };
+};
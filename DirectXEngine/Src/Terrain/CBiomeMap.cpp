@@ -0,0 +1,115 @@
+#include "CBiomeMap.h"
+#include <limits>
+
+//Constructor. The climate fields get seeds of their own, so they don't follow the terrain noise of the same seed
+CBiomeMap::CBiomeMap(const BiomeSettings& settings)
+	: m_Settings(settings), m_Temperature(settings.seed ^ 0x5bd1e995u), m_Moisture(settings.seed ^ 0x27d4eb2fu)
+{
+	if (settings.biomes.empty() || NumBiomes() > MaxBiomes)
+	{
+		throw std::runtime_error("Biome maps need between 1 and 64 biomes");
+	}
+	if (settings.transition <= 0.0f || settings.frequency <= 0.0f)
+	{
+		throw std::runtime_error("Biome maps need a transition and climate frequency above zero");
+	}
+}
+
+//Function to write the weight of every biome at every sample of a rectangle, biome i into weights + i * plane
+uint64_t CBiomeMap::Weights(int x0, int z0, int width, int height, float* weights, size_t plane, int stride) const
+{
+	const int biomes = NumBiomes();
+
+	//Lattice points around the rectangle, in samples of the whole terrain
+	const int sampleX0 = x0 + m_Settings.offsetX;
+	const int sampleZ0 = z0 + m_Settings.offsetZ;
+	const int latticeX0 = FloorDivide(sampleX0, LatticeStep);
+	const int latticeZ0 = FloorDivide(sampleZ0, LatticeStep);
+	const int latticeWidth = FloorDivide(sampleX0 + width - 1, LatticeStep) - latticeX0 + 2;
+	const int latticeHeight = FloorDivide(sampleZ0 + height - 1, LatticeStep) - latticeZ0 + 2;
+
+	thread_local std::vector<float> temperatures, moistures, rowTemperatures, rowMoistures, distances;
+	temperatures.resize(static_cast<size_t>(latticeWidth) * latticeHeight);
+	moistures.resize(temperatures.size());
+	rowTemperatures.resize(latticeWidth);
+	rowMoistures.resize(latticeWidth);
+	distances.resize(biomes);
+	for (int j = 0; j < latticeHeight; ++j)
+	{
+		for (int i = 0; i < latticeWidth; ++i)
+		{
+			temperatures[j * latticeWidth + i] = Field(m_Temperature, latticeX0 + i, latticeZ0 + j);
+			moistures[j * latticeWidth + i] = Field(m_Moisture, latticeX0 + i, latticeZ0 + j);
+		}
+	}
+
+	const float inverseTransition = 1.0f / m_Settings.transition;
+	const float inverseStep = 1.0f / LatticeStep;
+	uint64_t used = 0;
+	for (int z = 0; z < height; ++z)
+	{
+		//Climate along the row between the lattice rows above and below it
+		const int sampleZ = sampleZ0 + z;
+		const int cellZ = FloorDivide(sampleZ, LatticeStep);
+		const float tz = (sampleZ - cellZ * LatticeStep) * inverseStep;
+		const float* top = temperatures.data() + (cellZ - latticeZ0) * latticeWidth;
+		const float* topMoisture = moistures.data() + (cellZ - latticeZ0) * latticeWidth;
+		for (int i = 0; i < latticeWidth; ++i)
+		{
+			rowTemperatures[i] = top[i] + (top[i + latticeWidth] - top[i]) * tz;
+			rowMoistures[i] = topMoisture[i] + (topMoisture[i + latticeWidth] - topMoisture[i]) * tz;
+		}
+
+		float* row = weights + static_cast<size_t>(z) * stride;
+		for (int x = 0; x < width; ++x)
+		{
+			const int sampleX = sampleX0 + x;
+			const int cellX = FloorDivide(sampleX, LatticeStep);
+			const float tx = (sampleX - cellX * LatticeStep) * inverseStep;
+			const int i = cellX - latticeX0;
+			const float temperature = rowTemperatures[i] + (rowTemperatures[i + 1] - rowTemperatures[i]) * tx;
+			const float moisture = rowMoistures[i] + (rowMoistures[i + 1] - rowMoistures[i]) * tx;
+
+			//Distance in climate to every biome, and to the nearest
+			float nearest = std::numeric_limits<float>::max();
+			for (int biome = 0; biome < biomes; ++biome)
+			{
+				const float dt = temperature - m_Settings.biomes[biome].temperature;
+				const float dm = moisture - m_Settings.biomes[biome].moisture;
+				distances[biome] = std::sqrt(dt * dt + dm * dm);
+				nearest = std::min(nearest, distances[biome]);
+			}
+
+			//The nearest biome has a weight of 1 before normalising, the others fall smoothly to exactly zero
+			//over the transition, so the weights change smoothly as the nearest biome changes
+			float total = 0.0f;
+			for (int biome = 0; biome < biomes; ++biome)
+			{
+				const float t = (distances[biome] - nearest) * inverseTransition;
+				const float weight = t < 1.0f ? 1.0f - t * t * (3.0f - 2.0f * t) : 0.0f;
+				distances[biome] = weight;
+				total += weight;
+			}
+
+			const float inverseTotal = 1.0f / total;
+			for (int biome = 0; biome < biomes; ++biome)
+			{
+				row[biome * plane + x] = distances[biome] * inverseTotal;
+				if (distances[biome] > 0.0f) used |= 1ull << biome;
+			}
+		}
+	}
+	return used;
+}
+
+//Function to get the value of a climate field at a lattice point, from 0 to 1
+float CBiomeMap::Field(const CPerlinNoise& noise, int latticeX, int latticeZ) const
+{
+	//Same coordinates as the noise generators, with a second octave so the edges of the biomes wander. The noise
+	//is centred on a half, so each octave is moved to be centred on zero
+	const double step = m_Settings.frequency * m_Settings.scale / 20.0 * LatticeStep;
+	const double x = latticeX * step;
+	const double z = latticeZ * step;
+	const double value = (noise.noise(x, 0.0, z) - 0.5) + 0.5 * (noise.noise(2.0 * x, 0.0, 2.0 * z) - 0.5);
+	return std::min(std::max(0.5f + ClimateContrast * static_cast<float>(value), 0.0f), 1.0f);
+}
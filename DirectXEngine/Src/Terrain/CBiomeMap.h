@@ -0,0 +1,81 @@
+//--------------------------------------------------------------------------------------
+// Biomes picked from temperature and moisture, with blended transitions
+//--------------------------------------------------------------------------------------
+// Temperature and moisture are two fields of low frequency Perlin noise, so the climate
+// changes slowly over many tiles. Every biome is found around its own climate, and each
+// sample belongs to the biome whose climate is nearest its own. The other biomes fade in
+// as their climate gets within the transition distance of the nearest, so the terrains of
+// neighbouring biomes are blended where the climate is between them. Past the transition
+// a biome's weight is exactly zero, so inside a biome only its own terrain is needed.
+//
+// The climate changes so slowly that it is only worked out on a lattice every few samples
+// and interpolated in between. The lattice is fixed to the samples of the whole terrain,
+// so every sample gets the same climate however the heightfield is split up.
+
+#pragma once
+#include "tepch.h"
+#include "Math/CPerlinNoise.h"
+
+//Climate a biome is found in, both run from 0 to 1
+struct BiomeClimate
+{
+	float temperature = 0.5f;       //0 is the coldest
+	float moisture = 0.5f;          //0 is the driest
+};
+
+//Settings of the biome map
+struct BiomeSettings
+{
+	std::vector<BiomeClimate> biomes;
+	float frequency = 0.01f;        //Of the climate fields, in the same units as the noise generators
+	float scale = 1.0f;             //Resolution of the terrain divided by its size
+	int offsetX = 0;                //Sample of the whole terrain that sample (0, 0) of the heightfield is, so chunks line up
+	int offsetZ = 0;
+	float transition = 0.08f;       //Climate distance past the nearest biome over which the others fade in
+	unsigned int seed = 0;
+};
+
+class CBiomeMap
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Most biomes a map can have, one bit each in the mask of biomes used
+	static constexpr int MaxBiomes = 64;
+
+	//Constructor. Throws std::runtime_error if the settings can't be used
+	CBiomeMap(const BiomeSettings& settings);
+
+	const BiomeSettings& Settings() const { return m_Settings; }
+	int NumBiomes() const { return static_cast<int>(m_Settings.biomes.size()); }
+
+	//Function to write the weight of every biome at every sample of a rectangle, biome i into weights + i * plane
+	//with the given stride. Weights add up to 1 at every sample. Returns a bit for every biome with a weight above
+	//zero anywhere in the rectangle. Can be called from any number of threads at once
+	uint64_t Weights(int x0, int z0, int width, int height, float* weights, size_t plane, int stride) const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Function to get the value of a climate field at a lattice point, from 0 to 1
+	float Field(const CPerlinNoise& noise, int latticeX, int latticeZ) const;
+
+	//Function to round a division down rather than towards zero, so the lattice carries on past the origin
+	static int FloorDivide(int value, int divisor) { return value >= 0 ? value / divisor : -((divisor - 1 - value) / divisor); }
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	//Samples between the lattice points the climate is worked out at
+	static constexpr int LatticeStep = 8;
+
+	//Climate noise is mostly close to zero, this spreads it over most of the range from 0 to 1
+	static constexpr float ClimateContrast = 2.0f;
+
+	BiomeSettings m_Settings;
+	CPerlinNoise m_Temperature;
+	CPerlinNoise m_Moisture;
+};
@@ -0,0 +1,405 @@
+#include "CChunkManager.h"
+#include "Utility/CThreadPool.h"
+#include "Utility/HashHelpers.h"
+#include "Math/RandomHelpers.h"
+#include <chrono>
+
+//Constructor, starts the background thread
+CChunkManager::CChunkManager()
+{
+	m_Thread = std::thread(&CChunkManager::WorkerLoop, this);
+}
+
+//Destructor, drops every queued chunk and waits for the background thread
+CChunkManager::~CChunkManager()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+		m_Queue.clear();
+	}
+	m_Wake.notify_all();
+	m_Thread.join();
+}
+
+//Function to change the settings and graph of every chunk. Every chunk is retired and built again
+void CChunkManager::Reset(const ChunkSettings& settings, GraphBuilder builder)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RetireAll();
+	m_Settings = settings;
+	m_Settings.chunkSize = std::max(m_Settings.chunkSize, 1);
+	m_Settings.halo = std::max(m_Settings.halo, 1);
+	m_Builder = std::move(builder);
+	ApplyLod(m_Settings.maxLod, m_Settings.lodPixels);
+}
+
+//Function to retire every chunk and stop building, until Reset is called again
+void CChunkManager::Stop()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RetireAll();
+	m_Builder = nullptr;
+}
+
+//Function to change the number of chunks loaded on each side of the camera, without rebuilding any
+void CChunkManager::SetViewRadius(int radius)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Settings.viewRadius = std::max(radius, 0);
+}
+
+//Function to change how quickly far chunks drop detail, without rebuilding any until their level changes
+void CChunkManager::SetLod(int maxLod, float lodPixels)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	ApplyLod(maxLod, lodPixels);
+}
+
+//Function to queue the chunks around the camera and retire those too far away, the position is before the model is scaled
+void CChunkManager::Update(float cameraX, float cameraZ, float pixelsPerRadian)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Builder) return;
+
+		const float chunkWidth = m_Settings.chunkSize * m_Settings.sampleSpacing;
+		m_CameraChunk.x = static_cast<int>(std::floor(cameraX / chunkWidth));
+		m_CameraChunk.z = static_cast<int>(std::floor(cameraZ / chunkWidth));
+		m_CameraX = cameraX;
+		m_CameraZ = cameraZ;
+		m_PixelsPerRadian = pixelsPerRadian;
+
+		//Chunks are kept until they are a chunk past the view radius, so crossing a border back and forth keeps them
+		const int radius = m_Settings.viewRadius;
+		const int keepRadius = radius + 1;
+		for (auto chunk = m_Chunks.begin(); chunk != m_Chunks.end(); )
+		{
+			if (DistanceSquared(chunk->first) <= keepRadius * keepRadius)
+			{
+				++chunk;
+				continue;
+			}
+
+			//Chunks being built are dropped when they finish, ready ones are dropped here
+			if (chunk->second.shownLod >= 0)
+			{
+				m_Retired.push_back(chunk->first);
+				++m_RetiredCount;
+			}
+			if (chunk->second.state == EChunkState::Queued)
+			{
+				m_Queue.erase(std::find(m_Queue.begin(), m_Queue.end(), chunk->first));
+			}
+			else if (chunk->second.state == EChunkState::Ready)
+			{
+				const ChunkCoord coord = chunk->first;
+				m_Ready.erase(std::find_if(m_Ready.begin(), m_Ready.end(), [&](const ChunkData& ready) { return ready.coord == coord; }));
+			}
+			chunk = m_Chunks.erase(chunk);
+		}
+
+		//Shown chunks are queued again when the camera has moved far enough for their level to change. Waiting
+		//chunks follow the camera without being queued again, and are taken off the queue if the level they show
+		//is right again. Chunks being built are looked at again once the scene has taken them
+		for (auto chunk = m_Chunks.begin(); chunk != m_Chunks.end(); ++chunk)
+		{
+			ChunkEntry& entry = chunk->second;
+			if (entry.state == EChunkState::Building || entry.state == EChunkState::Ready) continue;
+
+			int lod = ChunkLod(chunk->first, 1.0f);
+			if (entry.shownLod >= 0 && lod > entry.shownLod) lod = std::max(entry.shownLod, ChunkLod(chunk->first, LodSlack));
+			if (entry.state == EChunkState::Queued)
+			{
+				entry.lod = lod;
+				if (lod == entry.shownLod)
+				{
+					entry.state = EChunkState::Loaded;
+					m_Queue.erase(std::find(m_Queue.begin(), m_Queue.end(), chunk->first));
+				}
+			}
+			else if (lod != entry.shownLod)
+			{
+				entry.state = EChunkState::Queued;
+				entry.lod = lod;
+				m_Queue.push_back(chunk->first);
+			}
+		}
+
+		//Queue every chunk in the circle around the camera that isn't known yet
+		for (int z = -radius; z <= radius; ++z)
+		{
+			for (int x = -radius; x <= radius; ++x)
+			{
+				if (x * x + z * z > radius * radius) continue;
+
+				ChunkCoord coord = { m_CameraChunk.x + x, m_CameraChunk.z + z };
+				ChunkEntry entry;
+				entry.lod = ChunkLod(coord, 1.0f);
+				if (m_Chunks.emplace(coord, entry).second) m_Queue.push_back(coord);
+			}
+		}
+
+		//Nearest first, the background thread takes from the back
+		std::sort(m_Queue.begin(), m_Queue.end(), [&](const ChunkCoord& a, const ChunkCoord& b) { return DistanceSquared(a) > DistanceSquared(b); });
+		if (m_Queue.empty()) return;
+	}
+	m_Wake.notify_all();
+}
+
+//Function to take the nearest chunk that has been built, returns false if there is none
+bool CChunkManager::TakeReadyChunk(ChunkData& chunk)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Ready.empty()) return false;
+
+	auto nearest = std::min_element(m_Ready.begin(), m_Ready.end(), [&](const ChunkData& a, const ChunkData& b)
+	{
+		return DistanceSquared(a.coord) < DistanceSquared(b.coord);
+	});
+	chunk = std::move(*nearest);
+	m_Ready.erase(nearest);
+	ChunkEntry& entry = m_Chunks[chunk.coord];
+	entry.state = EChunkState::Loaded;
+	entry.shownLod = chunk.lod;
+	return true;
+}
+
+//Function to get the chunks that have been retired since the last call, the scene releases their meshes
+std::vector<ChunkCoord> CChunkManager::TakeRetiredChunks()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::vector<ChunkCoord> retired;
+	retired.swap(m_Retired);
+	return retired;
+}
+
+//Current settings
+ChunkSettings CChunkManager::Settings() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Settings;
+}
+
+CChunkManager::Stats CChunkManager::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Stats stats;
+	for (const auto& chunk : m_Chunks)
+	{
+		if (chunk.second.shownLod >= 0)
+		{
+			++stats.loaded;
+			++stats.levels[chunk.second.shownLod];
+		}
+		if (chunk.second.state == EChunkState::Queued) ++stats.queued;
+		else if (chunk.second.state != EChunkState::Loaded) ++stats.building;
+	}
+	stats.built = m_Built;
+	stats.retired = m_RetiredCount;
+	stats.averageMilliseconds = m_Built > 0 ? m_BuildMilliseconds / m_Built : 0.0;
+	return stats;
+}
+
+//Seed of a chunk, the same for the same world seed and coordinates
+unsigned int CChunkManager::ChunkSeed(unsigned int worldSeed, const ChunkCoord& coord)
+{
+	return static_cast<unsigned int>(HashCombine(HashCombine(HashCombine(0, worldSeed), coord.x), coord.z));
+}
+
+//Function to build a chunk at a detail level, public so it can be used without the background thread
+void CChunkManager::BuildChunk(const ChunkSettings& settings, const GraphBuilder& builder, const ChunkCoord& coord, int lod, ChunkData& chunk)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	//A coarser chunk covers the same ground with fewer, wider quads. Positions stay in samples of the whole terrain
+	const int step = 1 << lod;
+	const int quads = settings.chunkSize / step;
+	const int halo = settings.halo;
+	const int originX = coord.x * settings.chunkSize;
+	const int originZ = coord.z * settings.chunkSize;
+
+	chunk.coord = coord;
+	chunk.lod = lod;
+	chunk.seed = ChunkSeed(settings.worldSeed, coord);
+
+	//Heights of the chunk plus the halo, the first sample is (originX - halo * step, originZ - halo * step) of the whole terrain
+	const int samples = quads + 1 + 2 * halo;
+	CTerrainGraph graph;
+	CTerrainGraph::NodeId output = builder(graph, originX - halo * step, originZ - halo * step, step, chunk.seed);
+	CHeightField heights;
+	graph.Execute(output, heights, samples, samples);
+	auto height = [&](int x, int z) { return heights.Get(x + halo, z + halo); };
+
+	//Grid vertices, with normals from the samples either side so edge normals use the neighbours' samples, then the
+	//skirt vertices. The sizes only depend on the detail level, so the arrays come from a few shared allocators
+	const int rowVertices = quads + 1;
+	const float spacing = settings.sampleSpacing * step;
+	chunk.vertices = CTileArray<ChunkVertex>(static_cast<size_t>(rowVertices) * rowVertices + 4 * rowVertices);
+	chunk.indices = CTileArray<uint32_t>(static_cast<size_t>(quads) * quads * 6 + 4 * quads * 12);
+	ChunkVertex* vertex = chunk.vertices.data();
+	for (int z = 0; z <= quads; ++z)
+	{
+		for (int x = 0; x <= quads; ++x, ++vertex)
+		{
+			vertex->position = { (originX + x * step) * settings.sampleSpacing, height(x, z), (originZ + z * step) * settings.sampleSpacing };
+			const float slopeX = (height(x + 1, z) - height(x - 1, z)) / (2.0f * spacing);
+			const float slopeZ = (height(x, z + 1) - height(x, z - 1)) / (2.0f * spacing);
+			vertex->normal = Normalise(CVector3(-slopeX, 1.0f, -slopeZ));
+			vertex->uv = CVector2((originX + x * step) * settings.uvScale, 1.0f - (originZ + z * step) * settings.uvScale);
+		}
+	}
+
+	//Same triangles as the grid mesh
+	uint32_t* index = chunk.indices.data();
+	for (int z = 0; z < quads; ++z)
+	{
+		for (int x = 0; x < quads; ++x)
+		{
+			const uint32_t tl = z * rowVertices + x;
+			for (uint32_t corner : { tl, tl + rowVertices, tl + 1, tl + 1, tl + rowVertices, tl + rowVertices + 1 }) *index++ = corner;
+		}
+	}
+
+	//Skirts, a copy of each edge moved down, joined to the edge with triangles of both windings so
+	//they can be seen from either side whatever the culling
+	const int edges[4][4] = { { 0, 0, 1, 0 }, { 0, quads, 1, 0 }, { 0, 0, 0, 1 }, { quads, 0, 0, 1 } }; //First vertex and step of each edge
+	for (const auto& edge : edges)
+	{
+		const uint32_t first = static_cast<uint32_t>(vertex - chunk.vertices.data());
+		for (int i = 0; i <= quads; ++i, ++vertex)
+		{
+			*vertex = chunk.vertices[(edge[1] + i * edge[3]) * rowVertices + edge[0] + i * edge[2]];
+			vertex->position.y -= settings.skirtDepth;
+		}
+		for (int i = 0; i < quads; ++i)
+		{
+			const uint32_t top0 = (edge[1] + i * edge[3]) * rowVertices + edge[0] + i * edge[2];
+			const uint32_t top1 = (edge[1] + (i + 1) * edge[3]) * rowVertices + edge[0] + (i + 1) * edge[2];
+			const uint32_t bottom0 = first + i;
+			const uint32_t bottom1 = first + i + 1;
+			for (uint32_t corner : { top0, bottom0, top1, top1, bottom0, bottom1, top0, top1, bottom0, top1, bottom1, bottom0 }) *index++ = corner;
+		}
+	}
+
+	//Plants are placed from the chunk seed on samples of the whole terrain, so they are in the same place every time
+	//the chunk is built, at any detail level. Their heights are read off the quads they stand on
+	chunk.plants.clear();
+	for (int i = 0; i < settings.plantsPerChunk; ++i)
+	{
+		const int x = RandomInt(chunk.seed, i, 0, ERandomStream::ChunkPlantX, 0, settings.chunkSize);
+		const int z = RandomInt(chunk.seed, i, 0, ERandomStream::ChunkPlantZ, 0, settings.chunkSize);
+		const int quadX = x / step, quadZ = z / step;
+		const float u = static_cast<float>(x - quadX * step) / step;
+		const float v = static_cast<float>(z - quadZ * step) / step;
+		const float top = height(quadX, quadZ) + (height(quadX + 1, quadZ) - height(quadX, quadZ)) * u;
+		const float bottom = height(quadX, quadZ + 1) + (height(quadX + 1, quadZ + 1) - height(quadX, quadZ + 1)) * u;
+		chunk.plants.push_back({ (originX + x) * settings.sampleSpacing, top + (bottom - top) * v, (originZ + z) * settings.sampleSpacing });
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	chunk.milliseconds = elapsed.count();
+}
+
+//Function run by the background thread
+void CChunkManager::WorkerLoop()
+{
+	//This thread waits for the pool rather than building chunks on its own
+	CThreadPool::SetWaitWhenBusy(true);
+
+	while (true)
+	{
+		//Take the nearest chunks, enough to give every worker one
+		std::vector<ChunkCoord> batch;
+		std::vector<int> lods;
+		ChunkSettings settings;
+		GraphBuilder builder;
+		uint64_t generation = 0;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Wake.wait(lock, [&]() { return m_Stop || (!m_Queue.empty() && m_Builder); });
+			if (m_Stop) return;
+
+			const size_t count = std::min(m_Queue.size(), static_cast<size_t>(CThreadPool::Global().NumThreads()));
+			batch.assign(m_Queue.end() - count, m_Queue.end());
+			m_Queue.resize(m_Queue.size() - count);
+			for (const ChunkCoord& coord : batch)
+			{
+				ChunkEntry& entry = m_Chunks[coord];
+				entry.state = EChunkState::Building;
+				lods.push_back(entry.lod);
+			}
+
+			settings = m_Settings;
+			builder = m_Builder;
+			generation = m_Generation;
+		}
+
+		//One chunk per worker, the graph of each chunk runs on the worker building it
+		std::vector<ChunkData> built(batch.size());
+		CThreadPool::Global().ParallelForDynamic(static_cast<int>(batch.size()), [&](int index)
+		{
+			BuildChunk(settings, builder, batch[index], lods[index], built[index]);
+		});
+
+		//Chunks retired or reset while they were being built are dropped
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (ChunkData& chunk : built)
+		{
+			++m_Built;
+			m_BuildMilliseconds += chunk.milliseconds;
+
+			auto known = m_Chunks.find(chunk.coord);
+			if (generation != m_Generation || known == m_Chunks.end() || known->second.state != EChunkState::Building) continue;
+
+			known->second.state = EChunkState::Ready;
+			m_Ready.push_back(std::move(chunk));
+		}
+	}
+}
+
+//Function to forget every chunk, moving those the scene holds to the retired list. m_Mutex must be held
+void CChunkManager::RetireAll()
+{
+	for (const auto& chunk : m_Chunks)
+	{
+		if (chunk.second.shownLod >= 0)
+		{
+			m_Retired.push_back(chunk.first);
+			++m_RetiredCount;
+		}
+	}
+	m_Chunks.clear();
+	m_Queue.clear();
+	m_Ready.clear();
+	++m_Generation;
+}
+
+//Function to set how quickly far chunks drop detail. m_Mutex must be held
+void CChunkManager::ApplyLod(int maxLod, float lodPixels)
+{
+	//The coarsest step has to go into the chunk size a whole number of times, so coarse samples land on the samples of
+	//the whole terrain and the origin of every chunk is a multiple of the step
+	m_Settings.maxLod = std::min(std::max(maxLod, 0), MaxLod);
+	while (m_Settings.maxLod > 0 && m_Settings.chunkSize % (1 << m_Settings.maxLod) != 0) --m_Settings.maxLod;
+	m_Settings.lodPixels = std::max(lodPixels, 0.1f);
+}
+
+//Function to choose the detail level of a chunk from how far it is from the camera
+int CChunkManager::ChunkLod(const ChunkCoord& coord, float slack) const
+{
+	if (m_PixelsPerRadian <= 0.0f || m_Settings.maxLod == 0) return 0;
+
+	//Distance from the camera to the nearest point of the chunk, zero inside it
+	const float chunkWidth = m_Settings.chunkSize * m_Settings.sampleSpacing;
+	const float dx = std::max({ coord.x * chunkWidth - m_CameraX, m_CameraX - (coord.x + 1) * chunkWidth, 0.0f });
+	const float dz = std::max({ coord.z * chunkWidth - m_CameraZ, m_CameraZ - (coord.z + 1) * chunkWidth, 0.0f });
+	const float distance = std::sqrt(dx * dx + dz * dz) / slack;
+
+	//A quad facing the camera covers about its width / distance radians, so the widest quad that still looks no
+	//bigger than lodPixels is lodPixels * distance / pixelsPerRadian wide. Take the coarsest step that fits
+	const float widest = m_Settings.lodPixels * distance / (m_PixelsPerRadian * m_Settings.sampleSpacing);
+	int lod = 0;
+	while (lod < m_Settings.maxLod && static_cast<float>(2 << lod) <= widest) ++lod;
+	return lod;
+}
@@ -0,0 +1,228 @@
+//--------------------------------------------------------------------------------------
+// Streams fixed size terrain chunks in a ring around the camera
+//--------------------------------------------------------------------------------------
+// The terrain is split into square chunks of ChunkSize quads. Every frame the scene passes
+// the camera position to Update, which queues the chunks within the view radius nearest
+// first and retires the chunks that have moved out of it (with one chunk of slack so a
+// camera on a border doesn't make chunks come and go).
+//
+// A background thread takes the queued chunks in batches and builds each batch across the
+// thread pool, one chunk per worker. Building a chunk runs its terrain graph, then works out
+// the mesh vertices, indices and plant positions, so the render thread only has to create
+// the GPU buffers for the chunks it takes with TakeReadyChunk.
+//
+// Heights come from generators sampled in whole-terrain coordinates (NoiseSettings offsets),
+// so neighbouring chunks agree on the samples they share. Each chunk is generated with a
+// halo of extra samples around it, which lets normals on its edge be worked out from the
+// same samples its neighbour uses, so lighting has no seam. A skirt hangs down from every
+// edge to hide cracks where neighbours differ (e.g. while one of them is being replaced).
+// Every chunk also has a seed made from the world seed and its coordinates, which places
+// its plants, so a chunk always looks the same however often it is rebuilt.
+//
+// Far chunks don't need every sample. Each chunk has a detail level: at level L it generates
+// every 2^L-th sample of the terrain, so its quads are 2^L times as wide and it takes about
+// 4^L times less work. The level is the coarsest whose quads still look no bigger than
+// lodPixels on screen from the camera, and a chunk is rebuilt when the camera moves closer
+// (the old mesh stays until the new one is taken, so no hole opens). Coarser chunks only get
+// coarser once the camera is a little further away again, so a camera on the boundary doesn't
+// rebuild them over and over. A coarse chunk's samples are samples of the full terrain, so the
+// long waves are exactly the same at every level and only the short detail appears when it is
+// refined. The graph builder is told the step and leaves out octaves too short to show.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Terrain/CTerrainGraph.h"
+#include "Math/CVector2.h"
+#include "Math/CVector3.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//Position of a chunk in the grid of chunks
+struct ChunkCoord
+{
+	int x = 0;
+	int z = 0;
+
+	bool operator<(const ChunkCoord& other) const { return x < other.x || (x == other.x && z < other.z); }
+	bool operator==(const ChunkCoord& other) const { return x == other.x && z == other.z; }
+};
+
+//Settings shared by every chunk, changing them rebuilds every chunk
+struct ChunkSettings
+{
+	int chunkSize = 64;                     //Quads along each side of a chunk
+	int halo = 1;                           //Samples generated past each edge for the normals
+	float sampleSpacing = 1000.0f / 256.0f; //Distance between samples, before the model is scaled
+	float uvScale = 1.0f / 256.0f;          //Texture coordinates per sample
+	int viewRadius = 4;                     //Chunks loaded on each side of the camera
+	float skirtDepth = 30.0f;               //How far the skirts hang below the edges
+	unsigned int worldSeed = 0;             //Mixed with the chunk coordinates to give each chunk its seed
+	int plantsPerChunk = 2;
+	int maxLod = 3;                         //Most detail levels a far chunk may drop, 0 builds every chunk at full detail
+	float lodPixels = 8.0f;                 //Widest a quad may look on screen, in pixels, before its chunk is refined
+};
+
+//Vertex of a chunk mesh, in the same layout as the grid mesh (position, normal, uv)
+struct ChunkVertex
+{
+	CVector3 position;
+	CVector3 normal;
+	CVector2 uv;
+};
+
+//Everything needed to show a chunk, made on the background thread
+struct ChunkData
+{
+	ChunkCoord coord;
+	int lod = 0;                        //Every 2^lod-th sample of the terrain was generated
+	unsigned int seed = 0;
+	CTileArray<ChunkVertex> vertices;   //Blocks of the shared tile allocators, as chunks are made and dropped all the time
+	CTileArray<uint32_t> indices;
+	std::vector<CVector3> plants;       //Plant positions, before the model is scaled
+	double milliseconds = 0.0;          //Time taken to build the chunk
+};
+
+class CChunkManager
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Function to add the terrain graph of a chunk, generators must sample every sampleStep-th sample of the
+	//whole terrain from (originX, originZ). The origin is a multiple of the step. Called from several worker
+	//threads at once
+	typedef std::function<CTerrainGraph::NodeId(CTerrainGraph& graph, int originX, int originZ, int sampleStep, unsigned int chunkSeed)> GraphBuilder;
+
+	//Most detail levels a chunk can drop
+	static constexpr int MaxLod = 5;
+
+	//Counters shown in the UI
+	struct Stats
+	{
+		int loaded = 0;          //Chunks taken by the scene
+		int queued = 0;          //Chunks waiting to be built, some may be shown at another detail level
+		int building = 0;        //Chunks being built or waiting to be taken
+		int levels[MaxLod + 1] = {}; //Chunks taken by the scene at each detail level
+		int64_t built = 0;       //Chunks built so far
+		int64_t retired = 0;     //Chunks retired so far
+		double averageMilliseconds = 0.0; //Average time to build a chunk on one worker
+	};
+
+	//Constructor, starts the background thread
+	CChunkManager();
+
+	//Destructor, drops every queued chunk and waits for the background thread
+	~CChunkManager();
+
+	CChunkManager(const CChunkManager&) = delete;
+	CChunkManager& operator=(const CChunkManager&) = delete;
+
+	//Function to change the settings and graph of every chunk. Every chunk is retired and built again
+	void Reset(const ChunkSettings& settings, GraphBuilder builder);
+
+	//Function to retire every chunk and stop building, until Reset is called again
+	void Stop();
+
+	//Function to change the number of chunks loaded on each side of the camera, without rebuilding any
+	void SetViewRadius(int radius);
+
+	//Function to change how quickly far chunks drop detail, without rebuilding any until their level changes
+	void SetLod(int maxLod, float lodPixels);
+
+	//Function to queue the chunks around the camera and retire those too far away, the position is before the model
+	//is scaled. The pixels a radian of view covers on screen choose the detail levels, 0 builds every chunk at full detail
+	void Update(float cameraX, float cameraZ, float pixelsPerRadian = 0.0f);
+
+	//Function to take the nearest chunk that has been built, returns false if there is none
+	bool TakeReadyChunk(ChunkData& chunk);
+
+	//Function to get the chunks that have been retired since the last call, the scene releases their meshes
+	std::vector<ChunkCoord> TakeRetiredChunks();
+
+	//Current settings
+	ChunkSettings Settings() const;
+
+	Stats GetStats() const;
+
+	//Seed of a chunk, the same for the same world seed and coordinates
+	static unsigned int ChunkSeed(unsigned int worldSeed, const ChunkCoord& coord);
+
+	//Function to build a chunk at a detail level, public so it can be used without the background thread
+	static void BuildChunk(const ChunkSettings& settings, const GraphBuilder& builder, const ChunkCoord& coord, int lod, ChunkData& chunk);
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//What has happened to a chunk the manager knows about
+	enum class EChunkState
+	{
+		Queued,
+		Building,
+		Ready,
+		Loaded
+	};
+
+	//A chunk the manager knows about
+	struct ChunkEntry
+	{
+		EChunkState state = EChunkState::Queued;
+		int lod = 0;            //Detail level it is queued, built or shown at
+		int shownLod = -1;      //Detail level of the mesh the scene holds, -1 if it holds none
+	};
+
+	//Function run by the background thread
+	void WorkerLoop();
+
+	//Function to forget every chunk, moving those the scene holds to the retired list. m_Mutex must be held
+	void RetireAll();
+
+	//Function to set how quickly far chunks drop detail. m_Mutex must be held
+	void ApplyLod(int maxLod, float lodPixels);
+
+	//Function to choose the detail level of a chunk from how far it is from the camera, with the distance divided
+	//by the slack. m_Mutex must be held
+	int ChunkLod(const ChunkCoord& coord, float slack) const;
+
+	//Square of the distance from the camera chunk to a chunk
+	int DistanceSquared(const ChunkCoord& coord) const
+	{
+		return (coord.x - m_CameraChunk.x) * (coord.x - m_CameraChunk.x) + (coord.z - m_CameraChunk.z) * (coord.z - m_CameraChunk.z);
+	}
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	std::thread m_Thread;
+
+	//Everything below is guarded by m_Mutex
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	bool m_Stop = false;
+
+	ChunkSettings m_Settings;
+	GraphBuilder m_Builder;
+
+	//Increased by every Reset so chunks built with old settings are dropped
+	uint64_t m_Generation = 0;
+
+	//A chunk only drops a detail level once it is this much further away than where it would be refined
+	static constexpr float LodSlack = 1.25f;
+
+	ChunkCoord m_CameraChunk;
+	float m_CameraX = 0.0f, m_CameraZ = 0.0f;
+	float m_PixelsPerRadian = 0.0f;
+	std::map<ChunkCoord, ChunkEntry> m_Chunks;
+	std::vector<ChunkCoord> m_Queue;
+	std::vector<ChunkData> m_Ready;
+	std::vector<ChunkCoord> m_Retired;
+
+	int64_t m_Built = 0;
+	int64_t m_RetiredCount = 0;
+	double m_BuildMilliseconds = 0.0;
+};
@@ -0,0 +1,741 @@
+#include "CConstraintSolver.h"
+
+//Smallest grid spread over the thread pool, smaller ones take less time than waking the workers
+static const int ParallelSamples = 16384;
+
+//Laplacian stencil at a sample, with the sign turned so the centre is positive
+static inline float LaplacianStencil(const float* values, size_t i, size_t stride)
+{
+	return 4.0f * values[i] - (values[i - 1] + values[i + 1] + values[i - stride] + values[i + stride]);
+}
+
+//Gauss-Seidel step at a sample
+static inline void RelaxSample(float* heights, float* curvatures, const float* rhs, const float* curvatureRhs, const uint8_t* fixed, size_t i, size_t stride,
+	float spacingSquared, float inverseSpacingSquared, bool bBiharmonic)
+{
+	//Both equations of a sample are solved together. Where the height is pinned the curvature is what its stencil
+	//comes to, elsewhere it is the average of its neighbours and feeds the height
+	const bool bFixed = fixed[i] != 0;
+	float curvature = 0.0f;
+	if (bBiharmonic)
+	{
+		if (bFixed)
+		{
+			curvature = LaplacianStencil(heights, i, stride) * inverseSpacingSquared - rhs[i];
+		}
+		else
+		{
+			const float neighbours = curvatures[i - 1] + curvatures[i + 1] + curvatures[i - stride] + curvatures[i + stride];
+			curvature = 0.25f * (neighbours + spacingSquared * curvatureRhs[i]);
+		}
+		curvatures[i] = curvature;
+	}
+	if (bFixed) return;
+
+	const float neighbours = heights[i - 1] + heights[i + 1] + heights[i - stride] + heights[i + stride];
+	heights[i] = 0.25f * (neighbours + spacingSquared * (rhs[i] + curvature));
+}
+
+//Constructor
+CConstraintSolver::CConstraintSolver(const std::vector<HeightConstraint>& constraints, const ConstraintSettings& settings)
+	: m_Constraints(constraints), m_Settings(settings)
+{
+	if (settings.maxCycles < 0 || settings.preSweeps < 0 || settings.postSweeps < 0 || settings.preSweeps + settings.postSweeps < 1 ||
+		settings.maxLevels < 1 || settings.tolerance < 0.0f)
+	{
+		throw std::runtime_error("The constraint solver needs at least one level and relaxation sweep, and no negative settings");
+	}
+
+	for (const HeightConstraint& constraint : constraints)
+	{
+		if (!(constraint.radius >= 0.0f) || !std::isfinite(constraint.x0 + constraint.z0 + constraint.x1 + constraint.z1 + constraint.height0 + constraint.height1))
+		{
+			throw std::runtime_error("Height constraints need a position and height, and a radius of at least zero");
+		}
+	}
+}
+
+//Function to fill the heightfield with the smooth surface through the pinned heights
+CConstraintSolver::SolveStats CConstraintSolver::Solve(CHeightField& field, CThreadPool& pool, CJobProgress* progress) const
+{
+	if (field.Width() < 3 || field.Height() < 3)
+	{
+		throw std::runtime_error("The constraint solver needs a heightfield of at least 3 x 3");
+	}
+
+	//Each grid has a sample on every other sample of the one above it, the edges included
+	const bool bBiharmonic = m_Settings.fill == EConstraintFill::Biharmonic;
+	std::vector<Level> levels;
+	int width = field.Width();
+	int height = field.Height();
+	float spacingSquared = 1.0f;
+	while (true)
+	{
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.stride = width + 2 * Border;
+		level.spacingSquared = spacingSquared;
+		const size_t samples = static_cast<size_t>(level.stride) * (height + 2 * Border);
+		level.values.assign(samples, 0.0f);
+		level.rhs.assign(samples, 0.0f);
+		level.scratch.assign(samples, 0.0f);
+		if (bBiharmonic)
+		{
+			level.curvatures.assign(samples, 0.0f);
+			level.curvatureRhs.assign(samples, 0.0f);
+			level.curvatureScratch.assign(samples, 0.0f);
+		}
+		level.fixed.assign(samples, 0);
+		levels.push_back(std::move(level));
+
+		if (static_cast<int>(levels.size()) >= m_Settings.maxLevels || std::min(width, height) <= CoarsestSize) break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		spacingSquared *= 4.0f;
+	}
+
+	SolveStats stats;
+	stats.levels = static_cast<int>(levels.size());
+
+	Level& finest = levels[0];
+	float lowest = 0.0f, highest = 0.0f;
+	if (PinConstraints(finest, lowest, highest))
+	{
+		for (size_t level = 1; level < levels.size(); ++level)
+		{
+			RestrictPins(levels[level - 1], levels[level]);
+		}
+		for (Level& level : levels)
+		{
+			FindNearPins(level);
+		}
+
+		//The first guess on the smallest grid is the average pinned height, solved there and stepped up a grid
+		//at a time with a V-cycle on each, which leaves little error for the cycles on the full grid
+		Level& coarsest = levels.back();
+		double total = 0.0;
+		int pinned = 0;
+		for (int z = 0; z < coarsest.height; ++z)
+		{
+			for (int x = 0; x < coarsest.width; ++x)
+			{
+				if (coarsest.fixed[coarsest.Index(x, z)])
+				{
+					total += coarsest.values[coarsest.Index(x, z)];
+					++pinned;
+				}
+			}
+		}
+		const float average = static_cast<float>(total / pinned);
+		for (int z = 0; z < coarsest.height; ++z)
+		{
+			for (int x = 0; x < coarsest.width; ++x)
+			{
+				if (!coarsest.fixed[coarsest.Index(x, z)]) coarsest.values[coarsest.Index(x, z)] = average;
+			}
+		}
+
+		//The residuals are measured against the one of every free sample at that height
+		std::vector<float> flat(finest.values);
+		for (size_t i = 0; i < flat.size(); ++i)
+		{
+			if (!finest.fixed[i]) flat[i] = average;
+		}
+		ExactResidual(finest, flat, finest.scratch, pool);
+		const double flatResidual = std::sqrt(Dot(finest, finest.scratch, finest.scratch, pool));
+		flat = std::vector<float>();
+
+		const int last = static_cast<int>(levels.size()) - 1;
+		VCycle(levels, last, pool);
+		for (int level = last - 1; level >= 0; --level)
+		{
+			if (progress && progress->IsCancelled())
+			{
+				stats.bCancelled = true;
+				return stats;
+			}
+			Prolong(levels[level + 1], levels[level], false, pool);
+			VCycle(levels, level, pool);
+		}
+
+		//Changes are measured against the range of the pinned heights, with a floor for pins all at one height
+		const float range = std::max(highest - lowest, 1.0f);
+		if (levels.size() > 1) ConjugateGradients(levels, range, stats, pool, progress);
+		else Cycles(levels, range, stats, pool, progress);
+		if (stats.bCancelled) return stats;
+
+		ExactResidual(finest, finest.values, finest.scratch, pool);
+		stats.residual = flatResidual > 0.0 ? static_cast<float>(std::sqrt(Dot(finest, finest.scratch, finest.scratch, pool)) / flatResidual) : 0.0f;
+	}
+
+	//Copy into the tiles a band of tile rows per worker, no two workers touch the same tile
+	pool.ParallelFor(field.TilesZ(), [&](int begin, int end)
+	{
+		const int z0 = begin << CHeightField::TileShift;
+		const int z1 = std::min(end << CHeightField::TileShift, field.Height());
+		field.WriteRegion(0, z0, field.Width(), z1 - z0, finest.values.data() + finest.Index(0, z0), finest.stride);
+	});
+	return stats;
+}
+
+//Function to improve the heights of the full grid with V-cycles until they stop changing
+void CConstraintSolver::Cycles(std::vector<Level>& levels, float range, SolveStats& stats, CThreadPool& pool, CJobProgress* progress) const
+{
+	//A change twice the smallest one so far means the cycles are going the wrong way, the heights from before
+	//it are kept
+	Level& finest = levels[0];
+	std::vector<float> previous;
+	float smallest = 0.0f;
+	while (stats.cycles < m_Settings.maxCycles)
+	{
+		if (progress && progress->IsCancelled())
+		{
+			stats.bCancelled = true;
+			return;
+		}
+
+		previous = finest.values;
+		VCycle(levels, 0, pool);
+		++stats.cycles;
+
+		const float change = LargestChange(finest, previous, finest.values, pool) / range;
+		if (stats.cycles > 1 && change > 2.0f * smallest)
+		{
+			finest.values.swap(previous);
+			stats.bDiverged = true;
+			break;
+		}
+		smallest = stats.cycles > 1 ? std::min(smallest, change) : change;
+		stats.change = change;
+		if (stats.change <= m_Settings.tolerance) break;
+	}
+}
+
+//Function to improve the heights of the full grid with conjugate gradients, with a V-cycle for the preconditioner
+void CConstraintSolver::ConjugateGradients(std::vector<Level>& levels, float range, SolveStats& stats, CThreadPool& pool, CJobProgress* progress) const
+{
+	//With the pinned heights taken out, harmonic fill is L height = 0 and biharmonic fill is L L height = 0 on the
+	//free samples, both symmetric. The residual is kept in the right hand side of the full grid that the V-cycle
+	//works out a correction for, the heights' one for harmonic fill and the curvatures' one for biharmonic fill,
+	//whose V-cycle then solves L correction = curvature, L curvature = residual. The heights are kept apart, they
+	//and the search direction never change where pinned. Each step goes as far along the direction as lowers the
+	//energy the fill keeps smallest the most, so the heights only ever get better, and the solver stops if a
+	//direction can't lower it
+	Level& finest = levels[0];
+	const bool bBiharmonic = m_Settings.fill == EConstraintFill::Biharmonic;
+	std::vector<float>& residual = bBiharmonic ? finest.curvatureRhs : finest.rhs;
+	std::vector<float> heights(finest.values);
+	std::vector<float> direction(finest.values.size(), 0.0f);
+	std::vector<float> lastResidual;
+	ExactResidual(finest, heights, residual, pool);
+
+	double previous = 0.0;
+	while (stats.cycles < m_Settings.maxCycles)
+	{
+		if (progress && progress->IsCancelled())
+		{
+			stats.bCancelled = true;
+			return;
+		}
+
+		std::fill(finest.values.begin(), finest.values.end(), 0.0f);
+		if (bBiharmonic) std::fill(finest.curvatures.begin(), finest.curvatures.end(), 0.0f);
+		VCycle(levels, 0, pool);
+
+		//The V-cycle isn't quite symmetric, so only the change in the residual counts towards the direction
+		//(Polak-Ribiere), which keeps the directions apart where the V-cycle differs from one to the next
+		const double residualSize = Dot(finest, residual, finest.values, pool);
+		const double lastPart = stats.cycles > 0 ? Dot(finest, lastResidual, finest.values, pool) : 0.0;
+		const float beta = stats.cycles > 0 ? static_cast<float>(std::max((residualSize - lastPart) / previous, 0.0)) : 0.0f;
+		previous = residualSize;
+		lastResidual = residual;
+		ForRows(finest, pool, [&](int begin, int end)
+		{
+			for (int z = begin; z < end; ++z)
+			{
+				for (size_t i = finest.Index(0, z); i < finest.Index(finest.width, z); ++i)
+				{
+					direction[i] = finest.values[i] + beta * direction[i];
+				}
+			}
+		});
+
+		//The stencil of the direction goes in the scratch values, the V-cycle is done with them. Biharmonic fill
+		//takes the Laplacian of the direction everywhere, pinned samples included, then of that where free
+		if (bBiharmonic)
+		{
+			Stencil(finest, direction, finest.curvatureScratch, false, pool);
+			Stencil(finest, finest.curvatureScratch, finest.scratch, true, pool);
+		}
+		else
+		{
+			Stencil(finest, direction, finest.scratch, true, pool);
+		}
+		const double descent = Dot(finest, residual, direction, pool);
+		const double curvature = Dot(finest, direction, finest.scratch, pool);
+		if (!(descent > 0.0 && curvature > 0.0))
+		{
+			//Either nothing is left to take away, or the V-cycle has turned uphill
+			stats.bDiverged = descent != 0.0;
+			break;
+		}
+
+		const float alpha = static_cast<float>(descent / curvature);
+		std::vector<float> rowLargest(finest.height, 0.0f);
+		ForRows(finest, pool, [&](int begin, int end)
+		{
+			for (int z = begin; z < end; ++z)
+			{
+				float largest = 0.0f;
+				for (size_t i = finest.Index(0, z); i < finest.Index(finest.width, z); ++i)
+				{
+					heights[i] += alpha * direction[i];
+					residual[i] -= alpha * finest.scratch[i];
+					largest = std::max(largest, std::abs(alpha * direction[i]));
+				}
+				rowLargest[z] = largest;
+			}
+		});
+		++stats.cycles;
+
+		stats.change = *std::max_element(rowLargest.begin(), rowLargest.end()) / range;
+		if (stats.change <= m_Settings.tolerance) break;
+	}
+	finest.values.swap(heights);
+}
+
+//Function to pin the samples of the full grid under the constraints
+bool CConstraintSolver::PinConstraints(Level& level, float& lowest, float& highest) const
+{
+	bool bPinned = false;
+	for (const HeightConstraint& constraint : m_Constraints)
+	{
+		//A radius of three quarters of a sample always reaches the nearest sample
+		const float radius = std::max(constraint.radius, 0.75f);
+		const int x0 = std::max(static_cast<int>(std::floor(std::min(constraint.x0, constraint.x1) - radius)), 0);
+		const int x1 = std::min(static_cast<int>(std::ceil(std::max(constraint.x0, constraint.x1) + radius)), level.width - 1);
+		const int z0 = std::max(static_cast<int>(std::floor(std::min(constraint.z0, constraint.z1) - radius)), 0);
+		const int z1 = std::min(static_cast<int>(std::ceil(std::max(constraint.z0, constraint.z1) + radius)), level.height - 1);
+
+		const float segmentX = constraint.x1 - constraint.x0;
+		const float segmentZ = constraint.z1 - constraint.z0;
+		const float lengthSquared = segmentX * segmentX + segmentZ * segmentZ;
+		for (int z = z0; z <= z1; ++z)
+		{
+			for (int x = x0; x <= x1; ++x)
+			{
+				//Nearest point of the segment to the sample, t is how far along it is
+				const float toX = x - constraint.x0;
+				const float toZ = z - constraint.z0;
+				const float t = lengthSquared > 0.0f ? std::min(std::max((toX * segmentX + toZ * segmentZ) / lengthSquared, 0.0f), 1.0f) : 0.0f;
+				const float offsetX = toX - t * segmentX;
+				const float offsetZ = toZ - t * segmentZ;
+				if (offsetX * offsetX + offsetZ * offsetZ > radius * radius) continue;
+
+				//Later constraints win where they overlap
+				const float value = constraint.height0 + t * (constraint.height1 - constraint.height0);
+				level.values[level.Index(x, z)] = value;
+				level.fixed[level.Index(x, z)] = 1;
+				lowest = bPinned ? std::min(lowest, value) : value;
+				highest = bPinned ? std::max(highest, value) : value;
+				bPinned = true;
+			}
+		}
+	}
+	return bPinned;
+}
+
+//Function to pin every sample of the next grid that is near a pinned sample of this one
+void CConstraintSolver::RestrictPins(const Level& fine, Level& coarse)
+{
+	//Pins that fall between the samples of the next grid would be lost otherwise, thin lines most of all
+	for (int z = 0; z < coarse.height; ++z)
+	{
+		for (int x = 0; x < coarse.width; ++x)
+		{
+			float total = 0.0f;
+			int pinned = 0;
+			for (int fineZ = std::max(2 * z - 1, 0); fineZ <= std::min(2 * z + 1, fine.height - 1); ++fineZ)
+			{
+				for (int fineX = std::max(2 * x - 1, 0); fineX <= std::min(2 * x + 1, fine.width - 1); ++fineX)
+				{
+					if (fine.fixed[fine.Index(fineX, fineZ)])
+					{
+						total += fine.values[fine.Index(fineX, fineZ)];
+						++pinned;
+					}
+				}
+			}
+			if (pinned > 0)
+			{
+				coarse.values[coarse.Index(x, z)] = total / pinned;
+				coarse.fixed[coarse.Index(x, z)] = 1;
+			}
+		}
+	}
+}
+
+//Function to run a V-cycle from this grid down
+void CConstraintSolver::VCycle(std::vector<Level>& levels, int level, CThreadPool& pool) const
+{
+	Level& fine = levels[level];
+	if (level + 1 == static_cast<int>(levels.size()))
+	{
+		//The smallest grid is only a few samples, relaxing it until it's solved costs next to nothing.
+		//Without any smaller grids this is plain relaxation, a sweep a cycle
+		Relax(fine, levels.size() > 1 ? CoarsestSweeps : 1, false, pool);
+		return;
+	}
+
+	Relax(fine, m_Settings.preSweeps, false, pool);
+	RelaxNearPins(fine, NearPinSweeps, false);
+
+	//The error left is smooth after relaxing, so the next grid can hold it. Its values are corrections, nothing
+	//to the pinned heights
+	Level& coarse = levels[level + 1];
+	Residual(fine, pool);
+	Restrict(fine, coarse, pool);
+	VCycle(levels, level + 1, pool);
+	Prolong(coarse, fine, true, pool);
+
+	RelaxNearPins(fine, NearPinSweeps, true);
+	Relax(fine, m_Settings.postSweeps, true, pool);
+}
+
+//Function to run red-black Gauss-Seidel sweeps over a grid
+void CConstraintSolver::Relax(Level& level, int sweeps, bool bReverse, CThreadPool& pool) const
+{
+	const bool bBiharmonic = m_Settings.fill == EConstraintFill::Biharmonic;
+	const size_t stride = level.stride;
+	const float spacingSquared = level.spacingSquared;
+	const float inverseSpacingSquared = 1.0f / spacingSquared;
+
+	for (int sweep = 0; sweep < sweeps; ++sweep)
+	{
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			const int colour = bReverse ? 1 - pass : pass;
+			MirrorBorder(level, level.values);
+			if (bBiharmonic) MirrorBorder(level, level.curvatures);
+			ForRows(level, pool, [&](int begin, int end)
+			{
+				for (int z = begin; z < end; ++z)
+				{
+					for (int x = (colour + z) & 1; x < level.width; x += 2)
+					{
+						RelaxSample(level.values.data(), level.curvatures.data(), level.rhs.data(), level.curvatureRhs.data(), level.fixed.data(),
+							level.Index(x, z), stride, spacingSquared, inverseSpacingSquared, bBiharmonic);
+					}
+				}
+			});
+		}
+	}
+}
+
+//Function to run red-black Gauss-Seidel sweeps over the samples near the edges of the pins of a grid
+void CConstraintSolver::RelaxNearPins(Level& level, int sweeps, bool bReverse) const
+{
+	//Only a thin band, so it isn't worth spreading over the thread pool
+	const bool bBiharmonic = m_Settings.fill == EConstraintFill::Biharmonic;
+	for (int sweep = 0; sweep < sweeps; ++sweep)
+	{
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			const int colour = bReverse ? 1 - pass : pass;
+			MirrorBorder(level, level.values);
+			if (bBiharmonic) MirrorBorder(level, level.curvatures);
+			for (size_t i : level.nearPins[colour])
+			{
+				RelaxSample(level.values.data(), level.curvatures.data(), level.rhs.data(), level.curvatureRhs.data(), level.fixed.data(),
+					i, level.stride, level.spacingSquared, 1.0f / level.spacingSquared, bBiharmonic);
+			}
+		}
+	}
+}
+
+//Function to list the samples of a grid near the edges of its pins
+void CConstraintSolver::FindNearPins(Level& level)
+{
+	//Pinned samples with a free neighbour are the edges, every sample in a square around them is near
+	std::vector<uint8_t> near(level.fixed.size(), 0);
+	for (int z = 0; z < level.height; ++z)
+	{
+		for (int x = 0; x < level.width; ++x)
+		{
+			const size_t i = level.Index(x, z);
+			if (!level.fixed[i]) continue;
+
+			const bool bEdge = (x > 0 && !level.fixed[i - 1]) || (x < level.width - 1 && !level.fixed[i + 1]) ||
+				(z > 0 && !level.fixed[i - level.stride]) || (z < level.height - 1 && !level.fixed[i + level.stride]);
+			if (!bEdge) continue;
+
+			for (int nearZ = std::max(z - NearPinDistance, 0); nearZ <= std::min(z + NearPinDistance, level.height - 1); ++nearZ)
+			{
+				for (int nearX = std::max(x - NearPinDistance, 0); nearX <= std::min(x + NearPinDistance, level.width - 1); ++nearX)
+				{
+					near[level.Index(nearX, nearZ)] = 1;
+				}
+			}
+		}
+	}
+
+	//In order, by colour, so the sweeps are the same every time
+	for (int z = 0; z < level.height; ++z)
+	{
+		for (int x = 0; x < level.width; ++x)
+		{
+			if (near[level.Index(x, z)]) level.nearPins[(x + z) & 1].push_back(level.Index(x, z));
+		}
+	}
+}
+
+//Function to work out the residuals into the scratch values
+void CConstraintSolver::Residual(Level& level, CThreadPool& pool) const
+{
+	const bool bBiharmonic = m_Settings.fill == EConstraintFill::Biharmonic;
+	const size_t stride = level.stride;
+	const float inverseSpacingSquared = 1.0f / level.spacingSquared;
+
+	MirrorBorder(level, level.values);
+	if (bBiharmonic) MirrorBorder(level, level.curvatures);
+	ForRows(level, pool, [&](int begin, int end)
+	{
+		const float* heights = level.values.data();
+		const float* curvatures = level.curvatures.data();
+		for (int z = begin; z < end; ++z)
+		{
+			for (size_t i = level.Index(0, z); i < level.Index(level.width, z); ++i)
+			{
+				const bool bFixed = level.fixed[i] != 0;
+				if (bBiharmonic)
+				{
+					//The curvature is free everywhere, so its equation holds at pinned samples as well
+					level.scratch[i] = level.rhs[i] - (LaplacianStencil(heights, i, stride) * inverseSpacingSquared - curvatures[i]);
+					level.curvatureScratch[i] = bFixed ? 0.0f : level.curvatureRhs[i] - LaplacianStencil(curvatures, i, stride) * inverseSpacingSquared;
+				}
+				else
+				{
+					level.scratch[i] = bFixed ? 0.0f : level.rhs[i] - LaplacianStencil(heights, i, stride) * inverseSpacingSquared;
+				}
+			}
+		}
+	});
+}
+
+//Function to work out the residual of a set of heights into out, nothing where pinned
+void CConstraintSolver::ExactResidual(const Level& level, std::vector<float>& heights, std::vector<float>& out, CThreadPool& pool) const
+{
+	//The curvatures of the rows either side are worked out again for each row, in doubles like the rest, and
+	//mirrored past the edges the same as the heights
+	const bool bBiharmonic = m_Settings.fill == EConstraintFill::Biharmonic;
+	const size_t stride = level.stride;
+	const double inverseSpacingSquared = 1.0 / level.spacingSquared;
+	auto laplacian = [&](size_t i)
+	{
+		const float* values = heights.data();
+		return (4.0 * values[i] - (static_cast<double>(values[i - 1]) + values[i + 1] + values[i - stride] + values[i + stride])) * inverseSpacingSquared;
+	};
+
+	MirrorBorder(level, heights);
+	ForRows(level, pool, [&](int begin, int end)
+	{
+		const int width = level.width;
+		std::vector<double> curvatures(bBiharmonic ? 3 * (width + 2) : 0);
+		for (int z = begin; z < end; ++z)
+		{
+			if (bBiharmonic)
+			{
+				for (int row = 0; row < 3; ++row)
+				{
+					int rowZ = z + row - 1;
+					rowZ = rowZ < 0 ? -rowZ : rowZ >= level.height ? 2 * (level.height - 1) - rowZ : rowZ;
+					double* curvature = curvatures.data() + row * (width + 2) + 1;
+					for (int x = 0; x < width; ++x)
+					{
+						curvature[x] = laplacian(level.Index(x, rowZ));
+					}
+					curvature[-1] = curvature[1];
+					curvature[width] = curvature[width - 2];
+				}
+			}
+
+			const double* above = curvatures.data() + 1;
+			const double* middle = above + width + 2;
+			const double* below = middle + width + 2;
+			for (int x = 0; x < width; ++x)
+			{
+				const size_t i = level.Index(x, z);
+				if (level.fixed[i]) out[i] = 0.0f;
+				else if (!bBiharmonic) out[i] = static_cast<float>(-laplacian(i));
+				else out[i] = static_cast<float>(-(4.0 * middle[x] - (middle[x - 1] + middle[x + 1] + above[x] + below[x])) * inverseSpacingSquared);
+			}
+		}
+	});
+}
+
+//Function to work out the Laplacian stencil of a grid into out, nothing where pinned if only the free samples are wanted
+void CConstraintSolver::Stencil(const Level& level, std::vector<float>& in, std::vector<float>& out, bool bFreeOnly, CThreadPool& pool)
+{
+	const size_t stride = level.stride;
+	const float inverseSpacingSquared = 1.0f / level.spacingSquared;
+
+	MirrorBorder(level, in);
+	ForRows(level, pool, [&](int begin, int end)
+	{
+		for (int z = begin; z < end; ++z)
+		{
+			for (size_t i = level.Index(0, z); i < level.Index(level.width, z); ++i)
+			{
+				out[i] = bFreeOnly && level.fixed[i] ? 0.0f : LaplacianStencil(in.data(), i, stride) * inverseSpacingSquared;
+			}
+		}
+	});
+}
+
+//Function to work out the dot product of two sets of values of a grid
+double CConstraintSolver::Dot(const Level& level, const std::vector<float>& a, const std::vector<float>& b, CThreadPool& pool)
+{
+	//Samples on the edge count half and corners a quarter, as they stand for half as much of the mirrored map.
+	//That makes the stencil symmetric, which conjugate gradients needs. Rows are added up in order, so the sum
+	//is the same whatever the number of threads
+	std::vector<double> rowSums(level.height, 0.0);
+	ForRows(level, pool, [&](int begin, int end)
+	{
+		for (int z = begin; z < end; ++z)
+		{
+			const size_t first = level.Index(0, z);
+			const size_t last = level.Index(level.width - 1, z);
+			double sum = 0.5 * (static_cast<double>(a[first]) * b[first] + static_cast<double>(a[last]) * b[last]);
+			for (size_t i = first + 1; i < last; ++i)
+			{
+				sum += static_cast<double>(a[i]) * b[i];
+			}
+			rowSums[z] = (z == 0 || z == level.height - 1) ? 0.5 * sum : sum;
+		}
+	});
+	return std::accumulate(rowSums.begin(), rowSums.end(), 0.0);
+}
+
+//Function to average the residuals of a grid down to the right hand sides of the next
+void CConstraintSolver::Restrict(Level& fine, Level& coarse, CThreadPool& pool) const
+{
+	const bool bBiharmonic = m_Settings.fill == EConstraintFill::Biharmonic;
+	const size_t stride = fine.stride;
+
+	//Full weighting, 1 2 1 across and down
+	auto fullWeighting = [stride](const float* residual, size_t i)
+	{
+		const float sides = residual[i - 1] + residual[i + 1] + residual[i - stride] + residual[i + stride];
+		const float corners = residual[i - stride - 1] + residual[i - stride + 1] + residual[i + stride - 1] + residual[i + stride + 1];
+		return (1.0f / 16.0f) * (4.0f * residual[i] + 2.0f * sides + corners);
+	};
+
+	MirrorBorder(fine, fine.scratch);
+	if (bBiharmonic) MirrorBorder(fine, fine.curvatureScratch);
+	ForRows(coarse, pool, [&](int begin, int end)
+	{
+		for (int z = begin; z < end; ++z)
+		{
+			for (int x = 0; x < coarse.width; ++x)
+			{
+				const size_t c = coarse.Index(x, z);
+				const size_t i = fine.Index(2 * x, 2 * z);
+				const bool bFixed = coarse.fixed[c] != 0;
+				coarse.values[c] = 0.0f;
+				if (bBiharmonic)
+				{
+					coarse.rhs[c] = fullWeighting(fine.scratch.data(), i);
+					coarse.curvatures[c] = 0.0f;
+					coarse.curvatureRhs[c] = bFixed ? 0.0f : fullWeighting(fine.curvatureScratch.data(), i);
+				}
+				else
+				{
+					coarse.rhs[c] = bFixed ? 0.0f : fullWeighting(fine.scratch.data(), i);
+				}
+			}
+		}
+	});
+}
+
+//Function to interpolate the values of the next grid up to this one, added on or replacing them
+void CConstraintSolver::Prolong(Level& coarse, Level& fine, bool bAdd, CThreadPool& pool) const
+{
+	const bool bBiharmonic = m_Settings.fill == EConstraintFill::Biharmonic;
+
+	//The border holds the sample past the edge that odd samples at the edge of an even sized grid need
+	MirrorBorder(coarse, coarse.values);
+	if (bBiharmonic) MirrorBorder(coarse, coarse.curvatures);
+	ForRows(fine, pool, [&](int begin, int end)
+	{
+		const size_t stride = coarse.stride;
+		auto bilinear = [](const float* values, size_t c, size_t right, size_t below)
+		{
+			return 0.25f * (values[c] + values[c + right] + values[c + below] + values[c + below + right]);
+		};
+
+		for (int z = begin; z < end; ++z)
+		{
+			const size_t below = (z & 1) ? stride : 0;
+			for (int x = 0; x < fine.width; ++x)
+			{
+				const size_t i = fine.Index(x, z);
+				const size_t c = coarse.Index(x >> 1, z >> 1);
+				const size_t right = x & 1;
+				if (bBiharmonic)
+				{
+					const float curvature = bilinear(coarse.curvatures.data(), c, right, below);
+					fine.curvatures[i] = bAdd ? fine.curvatures[i] + curvature : curvature;
+				}
+				if (fine.fixed[i]) continue;
+
+				const float value = bilinear(coarse.values.data(), c, right, below);
+				fine.values[i] = bAdd ? fine.values[i] + value : value;
+			}
+		}
+	});
+}
+
+//Function to copy the samples inside the edge of a grid into its border
+void CConstraintSolver::MirrorBorder(const Level& level, std::vector<float>& values)
+{
+	//Mirrored about the edge samples, so sample -1 is sample 1
+	const int width = level.width;
+	const int height = level.height;
+	for (int z = 0; z < height; ++z)
+	{
+		float* row = values.data() + level.Index(0, z);
+		row[-1] = row[1];
+		row[width] = row[width - 2];
+	}
+
+	//Whole rows, so the corners come from the columns just done
+	std::copy_n(values.data() + level.Index(-1, 1), level.stride, values.data() + level.Index(-1, -1));
+	std::copy_n(values.data() + level.Index(-1, height - 2), level.stride, values.data() + level.Index(-1, height));
+}
+
+//Function to get the largest difference between two sets of heights of a grid
+float CConstraintSolver::LargestChange(const Level& level, const std::vector<float>& a, const std::vector<float>& b, CThreadPool& pool)
+{
+	std::vector<float> rowLargest(level.height, 0.0f);
+	ForRows(level, pool, [&](int begin, int end)
+	{
+		for (int z = begin; z < end; ++z)
+		{
+			float largest = 0.0f;
+			for (size_t i = level.Index(0, z); i < level.Index(level.width, z); ++i)
+			{
+				largest = std::max(largest, std::abs(a[i] - b[i]));
+			}
+			rowLargest[z] = largest;
+		}
+	});
+	return *std::max_element(rowLargest.begin(), rowLargest.end());
+}
+
+//Function to run over the rows of a grid, on the thread pool unless the grid is small
+void CConstraintSolver::ForRows(const Level& level, CThreadPool& pool, const std::function<void(int begin, int end)>& func)
+{
+	if (level.width * level.height < ParallelSamples) func(0, level.height);
+	else pool.ParallelFor(level.height, func);
+}
@@ -0,0 +1,174 @@
+//--------------------------------------------------------------------------------------
+// Smooth terrain through pinned heights, solved with multigrid
+//--------------------------------------------------------------------------------------
+// Designers pin the height of some samples and every other sample is filled in as smoothly
+// as it can be: harmonic fill (Laplace) or biharmonic fill (thin plate). Past the map edge
+// the surface is mirrored. A first guess from the smaller grids is improved with V-cycles,
+// red-black Gauss-Seidel by rows, so the result doesn't depend on the number of threads.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Utility/CJobProgress.h"
+#include "Utility/CThreadPool.h"
+
+//How smoothly the surface is filled in between the pinned heights
+enum class EConstraintFill
+{
+	Harmonic,
+	Biharmonic
+};
+
+//A pinned height, every sample within the radius of the segment from (x0, z0) to (x1, z1) is pinned to the
+//height along it. A point has both ends the same, and a flat site is a point with a large radius
+struct HeightConstraint
+{
+	float x0 = 0.0f, z0 = 0.0f;     //In samples
+	float x1 = 0.0f, z1 = 0.0f;
+	float height0 = 0.0f;
+	float height1 = 0.0f;
+	float radius = 1.0f;            //In samples, the nearest samples are pinned however small it is
+};
+
+//Settings of the solver
+struct ConstraintSettings
+{
+	EConstraintFill fill = EConstraintFill::Biharmonic;
+	int maxCycles = 16;             //Most V-cycles on the full grid after the first guess
+	int preSweeps = 2;              //Relaxation sweeps before moving to the smaller grid
+	int postSweeps = 2;             //Relaxation sweeps after adding its correction
+	int maxLevels = 16;             //Grids used, 1 is plain relaxation with a sweep per cycle
+	float tolerance = 1e-4f;        //Cycles stop once no height changes by more than this part of the range of pinned heights
+};
+
+class CConstraintSolver
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//How the last solve went
+	struct SolveStats
+	{
+		int levels = 0;
+		int cycles = 0;             //V-cycles on the full grid after the first guess
+		float change = 0.0f;        //Largest change to a height in the last cycle, as a part of the range of pinned heights
+		float residual = 0.0f;      //Size of the residual left, as a part of the one with every free sample at the average pinned height
+		bool bDiverged = false;     //Stopped because the cycles made the heights worse, the heights from before are kept
+		bool bCancelled = false;    //Stopped because the job was cancelled, the heightfield is left as it was
+	};
+
+	//Constructor. Throws std::runtime_error if the settings or constraints can't be used
+	CConstraintSolver(const std::vector<HeightConstraint>& constraints, const ConstraintSettings& settings);
+
+	const std::vector<HeightConstraint>& Constraints() const { return m_Constraints; }
+	const ConstraintSettings& Settings() const { return m_Settings; }
+
+	//Function to fill the heightfield with the smooth surface through the pinned heights, spread over the
+	//thread pool. A heightfield without any pinned samples is filled with zero. The job is checked for cancellation
+	//before each grid of the first guess and each cycle
+	SolveStats Solve(CHeightField& field, CThreadPool& pool = CThreadPool::Global(), CJobProgress* progress = nullptr) const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//One grid, with a border of mirrored samples on every side so the stencils never need to check the edges.
+	//The equations are (L height) / h^2 - curvature = rhs and, where the height is free, (L curvature) / h^2 =
+	//curvatureRhs, where L is the Laplacian stencil turned to have a positive centre and h is the sample spacing.
+	//Harmonic fill has no curvatures
+	struct Level
+	{
+		int width = 0, height = 0, stride = 0;
+		float spacingSquared = 1.0f;
+		std::vector<float> values;      //The heights on the full grid or the first guess, the corrections on the rest
+		std::vector<float> rhs;
+		std::vector<float> scratch;     //Residuals of the heights
+		std::vector<float> curvatures;
+		std::vector<float> curvatureRhs;
+		std::vector<float> curvatureScratch;
+		std::vector<uint8_t> fixed;     //1 where the height is pinned
+		std::vector<size_t> nearPins[2];    //Samples near the edges of the pins, red then black
+
+		size_t Index(int x, int z) const { return static_cast<size_t>(z + Border) * stride + x + Border; }
+	};
+
+	//Function to pin the samples of the full grid under the constraints, returns the lowest and highest pinned heights
+	bool PinConstraints(Level& level, float& lowest, float& highest) const;
+
+	//Function to pin every sample of the next grid that is near a pinned sample of this one, at their average height
+	static void RestrictPins(const Level& fine, Level& coarse);
+
+	//Function to run a V-cycle from this grid down, improving its values towards its right hand side
+	void VCycle(std::vector<Level>& levels, int level, CThreadPool& pool) const;
+
+	//Function to improve the heights of the full grid with V-cycles until they stop changing. Only for a single
+	//grid, where a V-cycle is a relaxation sweep
+	void Cycles(std::vector<Level>& levels, float range, SolveStats& stats, CThreadPool& pool, CJobProgress* progress) const;
+
+	//Function to improve the heights of the full grid with conjugate gradients, with a V-cycle for the preconditioner.
+	//The pins on the smaller grids are only close to the real ones, which slows plain V-cycles and can turn them round
+	//on big maps. With the pinned heights taken out both fills are symmetric, so conjugate gradients takes out the few
+	//smooth shapes of error the smaller grids get wrong. Stops and says so if the residual still grows
+	void ConjugateGradients(std::vector<Level>& levels, float range, SolveStats& stats, CThreadPool& pool, CJobProgress* progress) const;
+
+	//Function to run red-black Gauss-Seidel sweeps over a grid, black first when reversed so a V-cycle is symmetric
+	void Relax(Level& level, int sweeps, bool bReverse, CThreadPool& pool) const;
+
+	//Function to run red-black Gauss-Seidel sweeps over the samples near the edges of the pins of a grid only
+	void RelaxNearPins(Level& level, int sweeps, bool bReverse) const;
+
+	//Function to list the samples of a grid near the edges of its pins, by colour
+	static void FindNearPins(Level& level);
+
+	//Function to work out the residuals (right hand side less the stencil) into the scratch values
+	void Residual(Level& level, CThreadPool& pool) const;
+
+	//Function to work out the residual of a set of heights of the full grid into out (nothing where pinned), in
+	//doubles. The thin plate stencil reaches two samples away and takes differences of differences of differences,
+	//which floats can't hold on a big map, so the grids solve for the curvature alongside the height with the small
+	//stencil (see Level) and only this residual is worked out in full
+	void ExactResidual(const Level& level, std::vector<float>& heights, std::vector<float>& out, CThreadPool& pool) const;
+
+	//Function to work out the Laplacian stencil of a grid into out, nothing where pinned if only the free samples are wanted
+	static void Stencil(const Level& level, std::vector<float>& in, std::vector<float>& out, bool bFreeOnly, CThreadPool& pool);
+
+	//Function to work out the dot product of two sets of values of a grid
+	static double Dot(const Level& level, const std::vector<float>& a, const std::vector<float>& b, CThreadPool& pool);
+
+	//Function to average the residuals of a grid down to the right hand sides of the next
+	void Restrict(Level& fine, Level& coarse, CThreadPool& pool) const;
+
+	//Function to interpolate the values of the next grid up to this one, added on or replacing them. Heights
+	//only change where they're free
+	void Prolong(Level& coarse, Level& fine, bool bAdd, CThreadPool& pool) const;
+
+	//Function to copy the samples inside the edge of a grid into its border
+	static void MirrorBorder(const Level& level, std::vector<float>& values);
+
+	//Function to get the largest difference between two sets of heights of a grid
+	static float LargestChange(const Level& level, const std::vector<float>& a, const std::vector<float>& b, CThreadPool& pool);
+
+	//Function to run over the rows of a grid, on the thread pool unless the grid is small
+	static void ForRows(const Level& level, CThreadPool& pool, const std::function<void(int begin, int end)>& func);
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	//Samples of border around every grid
+	static constexpr int Border = 1;
+
+	//Grids are halved until a side is this small, then relaxed until solved
+	static constexpr int CoarsestSize = 5;
+	static constexpr int CoarsestSweeps = 200;
+
+	//The smaller grids get the error next to the pins wrong, so a band this many samples wide around the edges of
+	//the pins gets this many more sweeps on either side of the smaller grid. It's only a thin band, so they cost
+	//little next to a sweep of the whole grid
+	static constexpr int NearPinDistance = 8;
+	static constexpr int NearPinSweeps = 16;
+
+	std::vector<HeightConstraint> m_Constraints;
+	ConstraintSettings m_Settings;
+};
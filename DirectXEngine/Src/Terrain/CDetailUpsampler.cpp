@@ -0,0 +1,299 @@
+#include "CDetailUpsampler.h"
+#include "Terrain/CHeightFieldFile.h"
+#include "Math/RandomHelpers.h"
+#include "Utility/CThreadPool.h"
+#include <limits>
+
+//Constructor, keeps the coarse map and works out the weights of the bicubic curve
+CDetailUpsampler::CDetailUpsampler(const CHeightField& coarse, const UpsampleSettings& settings)
+	: m_Settings(settings), m_Coarse(coarse)
+{
+	const int factor = settings.factor;
+	if (factor < 2 || factor > 16 || (factor & (factor - 1)) != 0)
+	{
+		throw std::runtime_error("Upsampling needs a factor of 2, 4, 8 or 16");
+	}
+	if (coarse.Width() < 2 || coarse.Height() < 2)
+	{
+		throw std::runtime_error("Upsampling needs a coarse map of at least 2 x 2 samples");
+	}
+	if (static_cast<int64_t>(coarse.Width() - 1) * factor + 1 > std::numeric_limits<int>::max() / 2 ||
+	    static_cast<int64_t>(coarse.Height() - 1) * factor + 1 > std::numeric_limits<int>::max() / 2)
+	{
+		throw std::runtime_error("Upsampled map is too large");
+	}
+	if (!(settings.spreadReduction > 0.0f))
+	{
+		throw std::runtime_error("Upsampling needs a spread reduction above zero");
+	}
+
+	while ((1 << m_Shift) < factor) ++m_Shift;
+
+	//Catmull-Rom at t = 0 weighs the second sample by exactly 1 and the others by exactly 0
+	m_Weights.resize(static_cast<size_t>(factor) * 4);
+	for (int k = 0; k < factor; ++k)
+	{
+		const float t = static_cast<float>(k) / factor;
+		const float t2 = t * t, t3 = t2 * t;
+		m_Weights[k * 4 + 0] = 0.5f * (-t3 + 2.0f * t2 - t);
+		m_Weights[k * 4 + 1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+		m_Weights[k * 4 + 2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+		m_Weights[k * 4 + 3] = 0.5f * (t3 - t2);
+	}
+}
+
+//Function to work out a rectangle of fine samples with the stride given
+void CDetailUpsampler::GenerateRegion(int x0, int z0, int width, int height, float* out, int stride) const
+{
+	if (width <= 0 || height <= 0) return;
+
+	//Samples outside the map are clamped to its edges. The factor is a power of 2, so cells are found with a shift
+	const int factor = m_Settings.factor;
+	const int shift = m_Shift;
+	const int lastX = Width() - 1;
+	const int lastZ = Height() - 1;
+	auto column = [&](int x) { return std::min(std::max(x, 0), lastX); };
+	auto row = [&](int z) { return std::min(std::max(z, 0), lastZ); };
+	const int neededX0 = column(x0), neededX1 = column(x0 + width - 1);
+	const int neededZ0 = row(z0), neededZ1 = row(z0 + height - 1);
+
+	//Coarse cells under the rectangle
+	const int cellX0 = neededX0 >> shift, cellX1 = neededX1 >> shift;
+	const int cellZ0 = neededZ0 >> shift, cellZ1 = neededZ1 >> shift;
+
+	//Coarse samples from one before the first cell to two after the last, enough for the bicubic curve and for
+	//the relief at the corners of every cell. Reads past the coarse map are clamped to its edges
+	const int coarseWidth = cellX1 - cellX0 + 4;
+	const int coarseHeight = cellZ1 - cellZ0 + 4;
+	thread_local std::vector<float> coarse, relief, columns, reliefRow;
+	coarse.resize(static_cast<size_t>(coarseWidth) * coarseHeight);
+	m_Coarse.ReadRegion(cellX0 - 1, cellZ0 - 1, coarseWidth, coarseHeight, coarse.data(), coarseWidth);
+
+	//Relief at the corners of the cells, the largest height difference to the four coarse neighbours
+	const int cornersX = cellX1 - cellX0 + 2;
+	const int cornersZ = cellZ1 - cellZ0 + 2;
+	relief.resize(static_cast<size_t>(cornersX) * cornersZ);
+	for (int j = 0; j < cornersZ; ++j)
+	{
+		const float* centre = coarse.data() + static_cast<size_t>(j + 1) * coarseWidth + 1;
+		for (int i = 0; i < cornersX; ++i)
+		{
+			const float h = centre[i];
+			const float across = std::max(std::abs(centre[i - 1] - h), std::abs(centre[i + 1] - h));
+			const float along = std::max(std::abs(centre[i - coarseWidth] - h), std::abs(centre[i + coarseWidth] - h));
+			relief[j * cornersX + i] = std::max(across, along);
+		}
+	}
+
+	//Detail over the cells and one cell around them, with the coarse samples at 0
+	const int detailX0 = (cellX0 - 1) * factor;
+	const int detailZ0 = (cellZ0 - 1) * factor;
+	const int detailWidth = (cellX1 - cellX0 + 3) * factor + 1;
+	const int detailHeight = (cellZ1 - cellZ0 + 3) * factor + 1;
+	thread_local std::vector<float> detail;
+	detail.resize(static_cast<size_t>(detailWidth) * detailHeight);
+	Detail(detailX0, detailZ0, detailWidth, detailHeight, detail.data());
+
+	//Each row is the bicubic curve down every coarse column, then along the row. Both the curve and the detail
+	//are worked out the same way for a sample in any rectangle
+	const float inverseFactor = 1.0f / factor;
+	columns.resize(coarseWidth);
+	reliefRow.resize(cornersX);
+	const int neededWidth = neededX1 - neededX0 + 1;
+	thread_local std::vector<float> values;
+	values.resize(static_cast<size_t>(neededWidth) * (neededZ1 - neededZ0 + 1));
+	for (int z = neededZ0; z <= neededZ1; ++z)
+	{
+		const int cellZ = z >> shift;
+		const int kz = z & (factor - 1);
+		const float* weights = m_Weights.data() + kz * 4;
+		const float* above = coarse.data() + static_cast<size_t>(cellZ - cellZ0) * coarseWidth;
+		for (int i = 0; i < coarseWidth; ++i)
+		{
+			columns[i] = weights[0] * above[i] + weights[1] * above[i + coarseWidth] + weights[2] * above[i + 2 * coarseWidth] + weights[3] * above[i + 3 * coarseWidth];
+		}
+
+		const float tz = kz * inverseFactor;
+		const float* reliefAbove = relief.data() + static_cast<size_t>(cellZ - cellZ0) * cornersX;
+		for (int i = 0; i < cornersX; ++i)
+		{
+			reliefRow[i] = reliefAbove[i] + (reliefAbove[i + cornersX] - reliefAbove[i]) * tz;
+		}
+
+		const float* detailRow = detail.data() + static_cast<size_t>(z - detailZ0) * detailWidth;
+		float* valueRow = values.data() + static_cast<size_t>(z - neededZ0) * neededWidth;
+		for (int x = neededX0; x <= neededX1; ++x)
+		{
+			const int cellX = x >> shift;
+			const int kx = x & (factor - 1);
+			const float* w = m_Weights.data() + kx * 4;
+			const float* c = columns.data() + (cellX - cellX0);
+			const float curve = w[0] * c[0] + w[1] * c[1] + w[2] * c[2] + w[3] * c[3];
+
+			const float* r = reliefRow.data() + (cellX - cellX0);
+			const float amount = m_Settings.minimumDetail + m_Settings.detail * (r[0] + (r[1] - r[0]) * (kx * inverseFactor));
+			valueRow[x - neededX0] = curve + amount * detailRow[x - detailX0];
+		}
+	}
+
+	for (int z = 0; z < height; ++z)
+	{
+		const float* source = values.data() + static_cast<size_t>(row(z0 + z) - neededZ0) * neededWidth;
+		float* dest = out + static_cast<size_t>(z) * stride;
+		for (int x = 0; x < width; ++x)
+		{
+			dest[x] = source[column(x0 + x) - neededX0];
+		}
+	}
+}
+
+//Function to fill a heightfield with the whole fine map, spread over the thread pool
+void CDetailUpsampler::Generate(CHeightField& field) const
+{
+	const int width = Width();
+	const int height = Height();
+	field.ResizeUninitialised(width, height);
+
+	//Blocks of tiles, large enough that the cell worked out around each block is a small part of it
+	const int BlockSize = 8 * CHeightField::TileSize;
+	const int blocksX = (width + BlockSize - 1) / BlockSize;
+	const int blocksZ = (height + BlockSize - 1) / BlockSize;
+	CThreadPool::Global().ParallelForDynamic(blocksX * blocksZ, [&](int index)
+	{
+		const int x0 = (index % blocksX) * BlockSize;
+		const int z0 = (index / blocksX) * BlockSize;
+		const int blockWidth = std::min(BlockSize, width - x0);
+		const int blockHeight = std::min(BlockSize, height - z0);
+
+		thread_local std::vector<float> block;
+		block.resize(static_cast<size_t>(blockWidth) * blockHeight);
+		GenerateRegion(x0, z0, blockWidth, blockHeight, block.data(), blockWidth);
+
+		//Blocks line up with the tiles, so no two workers write the same tile
+		field.WriteRegion(x0, z0, blockWidth, blockHeight, block.data(), blockWidth);
+	});
+}
+
+//Function to write the whole fine map to a tiled heightfield file, holding only a few blocks of it in memory at once
+bool CDetailUpsampler::GenerateToFile(const std::string& path, CJobProgress* progress) const
+{
+	const int width = Width();
+	const int height = Height();
+	CHeightFieldFile file(path, width, height);
+
+	const int BlockSize = 16 * CHeightField::TileSize;
+	const int blocksX = (width + BlockSize - 1) / BlockSize;
+	const int blocksZ = (height + BlockSize - 1) / BlockSize;
+	const int blocks = blocksX * blocksZ;
+	if (progress) progress->AddWork(blocks);
+
+	//One block per worker at a time, written out before the next batch starts
+	CThreadPool& pool = CThreadPool::Global();
+	const int batchSize = pool.NumThreads();
+	std::vector<std::vector<float>> buffers(batchSize);
+	std::vector<float> tile(CHeightField::TileSamples);
+	for (int first = 0; first < blocks; first += batchSize)
+	{
+		if (progress && progress->IsCancelled()) return false;
+
+		const int count = std::min(batchSize, blocks - first);
+		pool.ParallelForDynamic(count, [&](int index)
+		{
+			const int block = first + index;
+			const int x0 = (block % blocksX) * BlockSize;
+			const int z0 = (block / blocksX) * BlockSize;
+			const int blockWidth = std::min(BlockSize, width - x0);
+			const int blockHeight = std::min(BlockSize, height - z0);
+			buffers[index].resize(static_cast<size_t>(blockWidth) * blockHeight);
+			GenerateRegion(x0, z0, blockWidth, blockHeight, buffers[index].data(), blockWidth);
+		});
+
+		//The file is written from this thread only, a tile at a time with the samples past the map set to 0
+		for (int index = 0; index < count; ++index)
+		{
+			const int block = first + index;
+			const int x0 = (block % blocksX) * BlockSize;
+			const int z0 = (block / blocksX) * BlockSize;
+			const int blockWidth = std::min(BlockSize, width - x0);
+			const int blockHeight = std::min(BlockSize, height - z0);
+			for (int tileZ = 0; tileZ * CHeightField::TileSize < blockHeight; ++tileZ)
+			{
+				for (int tileX = 0; tileX * CHeightField::TileSize < blockWidth; ++tileX)
+				{
+					const int tileWidth = std::min(CHeightField::TileSize, blockWidth - tileX * CHeightField::TileSize);
+					const int tileHeight = std::min(CHeightField::TileSize, blockHeight - tileZ * CHeightField::TileSize);
+					std::fill(tile.begin(), tile.end(), 0.0f);
+					for (int z = 0; z < tileHeight; ++z)
+					{
+						const float* source = buffers[index].data() + static_cast<size_t>(tileZ * CHeightField::TileSize + z) * blockWidth + tileX * CHeightField::TileSize;
+						std::copy(source, source + tileWidth, tile.data() + z * CHeightField::TileSize);
+					}
+					file.WriteTile((x0 >> CHeightField::TileShift) + tileX, (z0 >> CHeightField::TileShift) + tileZ, tile.data());
+				}
+			}
+			if (progress) progress->CompleteWork(1);
+		}
+	}
+
+	file.Flush();
+	return true;
+}
+
+//Function to work out the detail of a window of whole coarse cells with the coarse samples at 0
+void CDetailUpsampler::Detail(int x0, int z0, int width, int height, float* detail) const
+{
+	//Every point that isn't a coarse sample is written by one of the levels
+	std::fill(detail, detail + static_cast<size_t>(width) * height, 0.0f);
+
+	thread_local std::vector<float> offsets;
+	offsets.resize(width);
+	float spread = 1.0f;
+	for (int side = m_Settings.factor; side >= 2; side /= 2, spread /= m_Settings.spreadReduction)
+	{
+		const int half = side / 2;
+
+		//Centre of every square is the average of its corners plus a random value, the same as diamond-square.
+		//The window is whole cells, so every square has all its corners
+		const int count = (width - 1) / side;
+		for (int z = half; z < height; z += side)
+		{
+			const float* top = detail + static_cast<size_t>(z - half) * width;
+			const float* bottom = detail + static_cast<size_t>(z + half) * width;
+			float* centre = detail + static_cast<size_t>(z) * width;
+			FillOffsets(x0 + half, side, z0 + z, count, spread, offsets.data());
+			for (int i = 0; i < count; ++i)
+			{
+				const int x = half + i * side;
+				centre[x] = (top[x - half] + top[x + half] + bottom[x - half] + bottom[x + half]) * 0.25f + offsets[i];
+			}
+		}
+
+		//Centre of every diamond, staggered so rows on the corners of the squares have them between the corners.
+		//Diamonds on the edge of the window average the neighbours they have, which only changes points less
+		//than half a cell in from the edge
+		for (int z = 0; z < height; z += half)
+		{
+			const int first = (z / half) % 2 == 0 ? half : 0;
+			const int diamonds = (width - 1 - first) / side + 1;
+			FillOffsets(x0 + first, side, z0 + z, diamonds, spread, offsets.data());
+			float* centre = detail + static_cast<size_t>(z) * width;
+			for (int i = 0; i < diamonds; ++i)
+			{
+				const int x = first + i * side;
+				float sum = 0.0f;
+				int neighbours = 0;
+				if (x - half >= 0) { sum += centre[x - half]; ++neighbours; }
+				if (x + half < width) { sum += centre[x + half]; ++neighbours; }
+				if (z - half >= 0) { sum += centre[x - static_cast<size_t>(half) * width]; ++neighbours; }
+				if (z + half < height) { sum += centre[x + static_cast<size_t>(half) * width]; ++neighbours; }
+				centre[x] = (neighbours == 4 ? sum * 0.25f : sum / neighbours) + offsets[i];
+			}
+		}
+	}
+}
+
+//Function to fill a row of random offsets for points x0, x0 + step... on row z
+void CDetailUpsampler::FillOffsets(int x0, int step, int z, int count, float spread, float* out) const
+{
+	RandomRangeBatch(m_Settings.seed, x0, step, z, ERandomStream::DetailUpsample, count, -spread, spread, out);
+}
@@ -0,0 +1,89 @@
+//--------------------------------------------------------------------------------------
+// Upsampling of coarse maps (imported elevation data) with fractal detail
+//--------------------------------------------------------------------------------------
+// A coarse map such as a 30 m elevation model is made factor times finer along each side.
+// Each coarse sample lands on a sample of the fine map, and the fine samples between them
+// are a bicubic (Catmull-Rom) curve through the coarse samples plus detail. Catmull-Rom
+// passes through the samples it is made from, so on the coarse samples the curve is the
+// sample itself.
+//
+// The detail comes from the square and diamond steps of diamond-square, run inside each
+// coarse cell with the corners pinned at 0: the first level starts at the coarse spacing
+// and every level adds smaller offsets, so the detail is zero on every coarse sample and
+// the coarse samples come through exactly. The detail is scaled by the relief of the
+// coarse map around each sample, so steep ground gets rough and flat ground stays flat.
+//
+// Random offsets come from the counter-based generator keyed by the fine coordinates, and
+// the diamonds on the edge of a cell read the cells either side, so any rectangle is
+// worked out from the coarse cells under it and one cell around them. Points near the
+// edge of that window read fewer neighbours, but the error moves less than half a cell in
+// from the edge over all the levels, so rectangles that share an edge agree bit for bit.
+// The map can be made a block at a time, in parallel, or streamed to a tiled file.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Utility/CJobProgress.h"
+
+//Settings of the upsampling
+struct UpsampleSettings
+{
+	int factor = 4;                 //Fine samples for each coarse sample along a side, a power of 2 from 2 to 16
+	float detail = 0.3f;            //Largest offset at the first level, as a part of the relief around the sample
+	float minimumDetail = 0.0f;     //Largest offset at the first level added on flat ground, in units of height
+	float spreadReduction = 2.0f;   //Amount the offsets are divided by at each finer level
+	unsigned int seed = 0;
+};
+
+class CDetailUpsampler
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Constructor, keeps the coarse map (copying a heightfield only shares its tiles). Throws std::runtime_error
+	//if the settings or the map can't be used
+	CDetailUpsampler(const CHeightField& coarse, const UpsampleSettings& settings);
+
+	const UpsampleSettings& Settings() const { return m_Settings; }
+	const CHeightField& Coarse() const { return m_Coarse; }
+
+	//Number of samples along each side of the fine map
+	int Width() const { return (m_Coarse.Width() - 1) * m_Settings.factor + 1; }
+	int Height() const { return (m_Coarse.Height() - 1) * m_Settings.factor + 1; }
+
+	//Function to work out a rectangle of fine samples with the stride given. Samples outside the map are
+	//clamped to its edges. Can be called from any number of threads at once
+	void GenerateRegion(int x0, int z0, int width, int height, float* out, int stride) const;
+
+	//Function to fill a heightfield with the whole fine map, spread over the thread pool
+	void Generate(CHeightField& field) const;
+
+	//Function to write the whole fine map to a tiled heightfield file, holding only a few blocks of it in
+	//memory at once. Returns false if cancelled. Throws std::runtime_error if the file can't be written
+	bool GenerateToFile(const std::string& path, CJobProgress* progress = nullptr) const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Function to work out the detail of a window of whole coarse cells, width x height fine samples from
+	//(x0, z0), with the coarse samples at 0
+	void Detail(int x0, int z0, int width, int height, float* detail) const;
+
+	//Function to fill a row of random offsets for points x0, x0 + step... on row z
+	void FillOffsets(int x0, int step, int z, int count, float spread, float* out) const;
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	UpsampleSettings m_Settings;
+	CHeightField m_Coarse;
+
+	//Factor as a power of 2
+	int m_Shift = 0;
+
+	//Catmull-Rom weights of the four coarse samples around each fine sample of a cell, factor x 4
+	std::vector<float> m_Weights;
+};
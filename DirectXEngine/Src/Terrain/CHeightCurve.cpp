@@ -0,0 +1,124 @@
+#include "CHeightCurve.h"
+
+//Constructor, bakes the curve into the table
+CHeightCurve::CHeightCurve(const CurveSettings& settings) : m_Settings(settings)
+{
+	std::vector<float> entries(TableSize);
+	m_Hash = HashCombine(0, static_cast<int>(settings.shape));
+	if (settings.shape == ECurveShape::Spline)
+	{
+		const std::vector<CurvePoint>& points = settings.points;
+		if (points.size() < 2) throw std::runtime_error("Remap curves need at least two points");
+		for (size_t i = 1; i < points.size(); ++i)
+		{
+			if (!(points[i].height > points[i - 1].height))
+			{
+				throw std::runtime_error("Remap curve points need to be in increasing order of height");
+			}
+		}
+
+		m_Low = points.front().height;
+		m_Scale = MaxPosition / (points.back().height - points.front().height);
+		BakeSpline(entries);
+		for (const CurvePoint& point : points)
+		{
+			m_Hash = HashCombine(HashCombine(m_Hash, point.height), point.remapped);
+		}
+	}
+	else
+	{
+		if (!(settings.terraceHeight > 0.0f) || !(settings.sharpness >= 1.0f))
+		{
+			throw std::runtime_error("Terraces need a height above zero and a sharpness of at least 1");
+		}
+
+		m_bRepeats = true;
+		m_Slope = settings.terraceHeight / TableSize;
+		m_Scale = TableSize / settings.terraceHeight;
+		BakeTerrace(entries);
+		m_Hash = HashCombine(HashCombine(m_Hash, settings.terraceHeight), settings.sharpness);
+	}
+
+	//The last entry of a spline is only ever read with a fraction of 0, the last of a terrace step leads on to
+	//the first of the next
+	const float end = m_bRepeats ? entries[0] : entries[TableSize - 1];
+	m_Table.resize(2 * TableSize);
+	for (int i = 0; i < TableSize; ++i)
+	{
+		m_Table[2 * i] = entries[i];
+		m_Table[2 * i + 1] = (i + 1 < TableSize ? entries[i + 1] : end) - entries[i];
+	}
+}
+
+//Function to work out the entries of a monotone cubic spline through the points
+void CHeightCurve::BakeSpline(std::vector<float>& entries) const
+{
+	const std::vector<CurvePoint>& points = m_Settings.points;
+	const size_t count = points.size();
+
+	//Slopes of the straight lines between the points, and a tangent at each point between the slopes either side
+	std::vector<double> slopes(count - 1), tangents(count);
+	for (size_t i = 0; i + 1 < count; ++i)
+	{
+		slopes[i] = (static_cast<double>(points[i + 1].remapped) - points[i].remapped) / (static_cast<double>(points[i + 1].height) - points[i].height);
+	}
+	tangents[0] = slopes[0];
+	tangents[count - 1] = slopes[count - 2];
+	for (size_t i = 1; i + 1 < count; ++i)
+	{
+		tangents[i] = slopes[i - 1] * slopes[i] > 0.0 ? 0.5 * (slopes[i - 1] + slopes[i]) : 0.0;
+	}
+
+	//Fritsch-Carlson: flat lines keep flat tangents, and tangents too steep for their line are scaled back so
+	//the curve can't overshoot
+	for (size_t i = 0; i + 1 < count; ++i)
+	{
+		if (slopes[i] == 0.0)
+		{
+			tangents[i] = tangents[i + 1] = 0.0;
+			continue;
+		}
+		const double a = tangents[i] / slopes[i];
+		const double b = tangents[i + 1] / slopes[i];
+		const double length = a * a + b * b;
+		if (length > 9.0)
+		{
+			const double scale = 3.0 / std::sqrt(length);
+			tangents[i] = scale * a * slopes[i];
+			tangents[i + 1] = scale * b * slopes[i];
+		}
+	}
+
+	//Cubic Hermite between the points either side of each entry
+	const double low = points.front().height;
+	const double spacing = (static_cast<double>(points.back().height) - low) / (TableSize - 1);
+	size_t segment = 0;
+	for (int i = 0; i < TableSize; ++i)
+	{
+		const double height = low + spacing * i;
+		while (segment + 2 < count && height > points[segment + 1].height) ++segment;
+
+		const double width = static_cast<double>(points[segment + 1].height) - points[segment].height;
+		const double t = std::min(std::max((height - points[segment].height) / width, 0.0), 1.0);
+		const double t2 = t * t, t3 = t2 * t;
+		entries[i] = static_cast<float>((2.0 * t3 - 3.0 * t2 + 1.0) * points[segment].remapped + (t3 - 2.0 * t2 + t) * width * tangents[segment] +
+		                                (-2.0 * t3 + 3.0 * t2) * points[segment + 1].remapped + (t3 - t2) * width * tangents[segment + 1]);
+	}
+}
+
+//Function to work out the entries of the profile of one terrace step
+void CHeightCurve::BakeTerrace(std::vector<float>& entries) const
+{
+	//f^s / (f^s + (1 - f)^s) rises from 0 to 1 across the step, flat at both ends and steepest half way, so the
+	//riser sits where rounding would put the hard edge. The steps meet without a jump because the profile
+	//reaches 1 where the next starts at 0. The ramp f is taken off, and what's left is in units of height
+	const double sharpness = m_Settings.sharpness;
+	const double period = m_Settings.terraceHeight;
+	for (int i = 0; i < TableSize; ++i)
+	{
+		const double f = static_cast<double>(i) / TableSize;
+		const double rise = std::pow(f, sharpness);
+		const double fall = std::pow(1.0 - f, sharpness);
+		entries[i] = static_cast<float>((rise / (rise + fall) - f) * period);
+	}
+}
@@ -0,0 +1,171 @@
+//--------------------------------------------------------------------------------------
+// Height remap curves baked into a lookup table
+//--------------------------------------------------------------------------------------
+// A curve maps each height to a new one: a monotone spline through points an artist places,
+// or terraces with a shaped profile instead of the hard steps of rounding. The curve is
+// baked once into a table of evenly spaced entries that heights are interpolated from, so
+// a spline costs the same whatever its number of points. The Remap benchmark compares it
+// with rounding.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/HeightExpressions.h"
+
+//What a curve is made from
+enum class ECurveShape
+{
+	Spline,
+	Terraces
+};
+
+//Point a spline curve passes through
+struct CurvePoint
+{
+	float height = 0.0f;    //Height in
+	float remapped = 0.0f;  //Height out
+};
+
+//Settings of a curve
+struct CurveSettings
+{
+	ECurveShape shape = ECurveShape::Spline;
+	std::vector<CurvePoint> points;     //Spline, in increasing order of height in
+	float terraceHeight = 10.0f;        //Terraces, height of each step
+	float sharpness = 4.0f;             //Terraces, 1 leaves the heights as they are, higher gives flatter steps and steeper risers
+};
+
+class CHeightCurve
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Entries in the table, enough that the straight lines between them can't be told from the curve
+	static constexpr int TableShift = 12;
+	static constexpr int TableSize = 1 << TableShift;
+
+	//Constructor, bakes the curve into the table. Throws std::runtime_error if the settings can't be used
+	CHeightCurve(const CurveSettings& settings);
+
+	const CurveSettings& Settings() const { return m_Settings; }
+
+	//Function to remap one height
+	float Scalar(float value) const
+	{
+		//The limit comes first in std::max so a NaN is replaced by it, as with _mm_max_ps
+		if (!m_bRepeats)
+		{
+			const float position = std::min(std::max(0.0f, (value - m_Low) * m_Scale), MaxPosition);
+			const int index = static_cast<int>(position);
+			return Lookup(index, position - static_cast<float>(index));
+		}
+
+		//Entries of every step one after the other, the top bits of the entry are the step and the rest the entry in it
+		const float position = std::min(std::max(-RepeatBias, value * m_Scale), RepeatLimit);
+		const int index = static_cast<int>(position + RepeatBias) - static_cast<int>(RepeatBias);
+		return position * m_Slope + Lookup(index & (TableSize - 1), position - static_cast<float>(index));
+	}
+
+	//Function to remap four heights, the same as four calls to Scalar
+	__m128 Vector(__m128 values) const
+	{
+		if (!m_bRepeats)
+		{
+			const __m128 position = _mm_mul_ps(_mm_sub_ps(values, _mm_set1_ps(m_Low)), _mm_set1_ps(m_Scale));
+			const __m128 clamped = _mm_min_ps(_mm_max_ps(position, _mm_setzero_ps()), _mm_set1_ps(MaxPosition));
+			const __m128i index = _mm_cvttps_epi32(clamped);
+			return Lookup(index, _mm_sub_ps(clamped, _mm_cvtepi32_ps(index)));
+		}
+
+		//Truncating a position made positive by the bias takes it down, as floor would
+		const __m128 position = _mm_min_ps(_mm_max_ps(_mm_mul_ps(values, _mm_set1_ps(m_Scale)), _mm_set1_ps(-RepeatBias)), _mm_set1_ps(RepeatLimit));
+		const __m128i index = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(position, _mm_set1_ps(RepeatBias))), _mm_set1_epi32(static_cast<int>(RepeatBias)));
+		const __m128 offset = Lookup(_mm_and_si128(index, _mm_set1_epi32(TableSize - 1)), _mm_sub_ps(position, _mm_cvtepi32_ps(index)));
+		return _mm_add_ps(_mm_mul_ps(position, _mm_set1_ps(m_Slope)), offset);
+	}
+
+	//Hash of the settings, so remaps can be found in the cache of generated heightmaps
+	uint64_t Hash(uint64_t hash) const { return HashCombine(hash, m_Hash); }
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Function to interpolate the table between an entry and the next
+	float Lookup(int index, float fraction) const
+	{
+		return m_Table[2 * index] + m_Table[2 * index + 1] * fraction;
+	}
+
+	//Function to interpolate the table between four entries and the next ones. SSE has no gather, so each entry is kept
+	//next to the difference to the next one and each pair is read with one 64 bit load. The last entry of a spline has a
+	//difference of zero and the last of a terrace step rises to the next step, so the end of the table needs no check
+	__m128 Lookup(__m128i index, __m128 fraction) const
+	{
+		alignas(16) int indices[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+
+		//(entry 0, difference 0, entry 1, difference 1) and the same for 2 and 3, shuffled into entries and differences
+		const __m64* pairs = reinterpret_cast<const __m64*>(m_Table.data());
+		const __m128 first = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), pairs + indices[0]), pairs + indices[1]);
+		const __m128 second = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), pairs + indices[2]), pairs + indices[3]);
+		const __m128 entries = _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0));
+		const __m128 differences = _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1));
+		return _mm_add_ps(entries, _mm_mul_ps(differences, fraction));
+	}
+
+	//Function to work out the entries of a monotone cubic spline through the points, which never overshoots between
+	//points that rise or fall steadily. Heights outside the points are held at the ends
+	void BakeSpline(std::vector<float>& entries) const;
+
+	//Function to work out the entries of the profile of one terrace step, less a straight ramp from 0 to 1 so it is 0
+	//at both ends. A terraced height is then the height plus the entry, with no need to work out the step
+	void BakeTerrace(std::vector<float>& entries) const;
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	//Splines span the table from the first entry to the last
+	static constexpr float MaxPosition = static_cast<float>(TableSize - 1);
+
+	//Terraces are clamped to 2^18 steps up, so the entry counted from step 0 fits in an int, and 2^11 steps down. Before
+	//truncating, the entry is moved up by the steps below so it's positive. Floats have whole numbers up to there, so
+	//the entry truncated to is at most one away from the floor, and reading the entry either side of a position
+	//with a fraction from -1 to 1 gives all but the same height, as the table is smooth and dense
+	static constexpr float RepeatLimit = 1073741824.0f;
+	static constexpr float RepeatBias = 8388608.0f;
+
+	CurveSettings m_Settings;
+
+	//Each entry of the curve followed by the difference to the next one
+	std::vector<float> m_Table;
+
+	//Height of the first entry for splines, and entries per unit of height
+	float m_Low = 0.0f;
+	float m_Scale = 1.0f;
+
+	//Terraces repeat every period, rising by the slope each entry on top of the table
+	bool m_bRepeats = false;
+	float m_Slope = 1.0f;
+
+	uint64_t m_Hash = 0;
+};
+
+//Node remapping an expression through a curve. The node only points at the curve, which has to outlive it
+template<typename Inner>
+struct HeightRemap : HeightExpression<HeightRemap<Inner>>
+{
+	HeightRemap(const CHeightCurve& curve, const Inner& inner) : m_Curve(&curve), m_Inner(inner) {}
+
+	float Scalar(float value) const { return m_Curve->Scalar(m_Inner.Scalar(value)); }
+	__m128 Vector(__m128 values) const { return m_Curve->Vector(m_Inner.Vector(values)); }
+	uint64_t Hash(uint64_t hash) const { return m_Curve->Hash(m_Inner.Hash(HashCombine(hash, 40u))); }
+
+	const CHeightCurve* m_Curve;
+	Inner m_Inner;
+};
+
+//Function to remap an expression through a curve
+template<typename E>
+HeightRemap<E> remap(const CHeightCurve& curve, const HeightExpression<E>& inner) { return HeightRemap<E>(curve, inner.Self()); }
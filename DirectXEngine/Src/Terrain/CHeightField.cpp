@@ -0,0 +1,297 @@
+#include "CHeightField.h"
+#include "Utility/CThreadPool.h"
+#include "Utility/HashHelpers.h"
+
+//Constructor to create a heightfield with every sample set to the value given
+CHeightField::CHeightField(int width, int height, float value)
+{
+	Resize(width, height, value);
+}
+
+//Copy constructor, shares every tile with the other heightfield
+CHeightField::CHeightField(const CHeightField& other)
+{
+	*this = other;
+}
+
+//Move constructor, takes the tiles of the other heightfield
+CHeightField::CHeightField(CHeightField&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+//Destructor, releases this heightfield's reference to every tile
+CHeightField::~CHeightField()
+{
+	Release();
+}
+
+CHeightField& CHeightField::operator=(const CHeightField& other)
+{
+	if (this == &other) return *this;
+
+	//Reference the new tiles before releasing the old ones in case they are the same
+	for (float* tile : other.m_Tiles)
+	{
+		AddRef(tile);
+	}
+	MarkReplacedTiles(other);
+	Release();
+
+	m_Width = other.m_Width;
+	m_Height = other.m_Height;
+	m_TilesX = other.m_TilesX;
+	m_TilesZ = other.m_TilesZ;
+	m_Tiles = other.m_Tiles;
+	return *this;
+}
+
+CHeightField& CHeightField::operator=(CHeightField&& other) noexcept
+{
+	if (this == &other) return *this;
+
+	MarkReplacedTiles(other);
+	Release();
+	m_Width = other.m_Width;
+	m_Height = other.m_Height;
+	m_TilesX = other.m_TilesX;
+	m_TilesZ = other.m_TilesZ;
+	m_Tiles = std::move(other.m_Tiles);
+
+	other.m_Width = other.m_Height = other.m_TilesX = other.m_TilesZ = 0;
+	other.m_Tiles.clear();
+	other.m_DirtyTiles.clear();
+	return *this;
+}
+
+//Function to change the size of the heightfield, every sample is set to the value given
+void CHeightField::Resize(int width, int height, float value)
+{
+	Release();
+
+	m_Width = width;
+	m_Height = height;
+	m_TilesX = (width + TileMask) >> TileShift;
+	m_TilesZ = (height + TileMask) >> TileShift;
+
+	//Each tile is allocated and first written by the worker that owns it in ParallelFor,
+	//so its pages are placed on that worker's NUMA node
+	m_Tiles.resize(m_TilesX * m_TilesZ);
+	m_DirtyTiles.assign(m_Tiles.size(), 1);
+	CThreadPool::Global().ParallelFor(static_cast<int>(m_Tiles.size()), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			m_Tiles[i] = NewTile();
+			std::fill(m_Tiles[i], m_Tiles[i] + TileSamples, value);
+		}
+	});
+}
+
+//Function to change the size of the heightfield leaving the samples uninitialised, for callers that write every tile
+void CHeightField::ResizeUninitialised(int width, int height)
+{
+	Release();
+
+	m_Width = width;
+	m_Height = height;
+	m_TilesX = (width + TileMask) >> TileShift;
+	m_TilesZ = (height + TileMask) >> TileShift;
+
+	m_Tiles.resize(m_TilesX * m_TilesZ);
+	m_DirtyTiles.assign(m_Tiles.size(), 1);
+	CThreadPool::Global().ParallelFor(static_cast<int>(m_Tiles.size()), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			m_Tiles[i] = NewTile();
+		}
+	});
+}
+
+//Function to copy a rectangle of samples into a buffer with the stride given, coordinates
+//outside the heightfield are clamped to the nearest edge so halos can be read
+void CHeightField::ReadRegion(int x0, int z0, int width, int height, float* out, int stride) const
+{
+	//Part of each row that lies inside the heightfield
+	const int insideBegin = std::min(std::max(x0, 0), m_Width - 1);
+	const int insideEnd = std::max(std::min(x0 + width, m_Width), insideBegin + 1);
+
+	for (int row = 0; row < height; ++row)
+	{
+		const int z = std::min(std::max(z0 + row, 0), m_Height - 1);
+		float* dest = out + static_cast<size_t>(row) * stride;
+
+		//Copy the inside part one tile at a time
+		for (int x = std::max(x0, 0); x < std::min(insideEnd, x0 + width); )
+		{
+			const int tileX = x >> TileShift;
+			const int count = std::min(std::min(insideEnd, x0 + width), (tileX + 1) << TileShift) - x;
+			const float* source = Tile(tileX, z >> TileShift) + ((z & TileMask) << TileShift) + (x & TileMask);
+			std::copy(source, source + count, dest + (x - x0));
+			x += count;
+		}
+
+		//Clamp the parts that hang off the left and right edges
+		const float left = Get(insideBegin, z);
+		const float right = Get(insideEnd - 1, z);
+		for (int x = x0; x < std::min(0, x0 + width); ++x) dest[x - x0] = left;
+		for (int x = std::max(m_Width, x0); x < x0 + width; ++x) dest[x - x0] = right;
+	}
+}
+
+//Function to copy a buffer with the stride given into a rectangle of samples inside the heightfield
+void CHeightField::WriteRegion(int x0, int z0, int width, int height, const float* in, int stride)
+{
+	for (int row = 0; row < height; ++row)
+	{
+		const int z = z0 + row;
+		const float* source = in + static_cast<size_t>(row) * stride;
+		for (int x = x0; x < x0 + width; )
+		{
+			const int tileX = x >> TileShift;
+			const int count = std::min(x0 + width, (tileX + 1) << TileShift) - x;
+			float* dest = EditTile(tileX, z >> TileShift) + ((z & TileMask) << TileShift) + (x & TileMask);
+			std::copy(source + (x - x0), source + (x - x0) + count, dest);
+			x += count;
+		}
+	}
+}
+
+//Function to set every sample to the same value
+void CHeightField::Fill(float value)
+{
+	MarkAllDirty();
+	CThreadPool::Global().ParallelFor(static_cast<int>(m_Tiles.size()), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			//Shared tiles are replaced rather than copied since every sample is overwritten
+			float*& tile = m_Tiles[i];
+			if (Header(tile)->refCount.load(std::memory_order_acquire) != 1)
+			{
+				ReleaseTile(tile);
+				tile = NewTile();
+			}
+			std::fill(tile, tile + TileSamples, value);
+		}
+	});
+}
+
+//Function to get the index (tileZ * TilesX + tileX) of every tile changed since the last call, in order, and mark them clean
+std::vector<int> CHeightField::TakeDirtyTiles()
+{
+	std::vector<int> dirtyTiles;
+	for (int i = 0; i < static_cast<int>(m_DirtyTiles.size()); ++i)
+	{
+		if (m_DirtyTiles[i]) dirtyTiles.push_back(i);
+	}
+	std::fill(m_DirtyTiles.begin(), m_DirtyTiles.end(), 0);
+	return dirtyTiles;
+}
+
+//Memory used by the tiles that are not shared with any other heightfield
+size_t CHeightField::UniqueMemoryUsage() const
+{
+	size_t uniqueTiles = 0;
+	for (const float* tile : m_Tiles)
+	{
+		if (Header(tile)->refCount.load(std::memory_order_relaxed) == 1) ++uniqueTiles;
+	}
+	return uniqueTiles * TileAllocator().BlockSize();
+}
+
+//Hash of the size and every sample, the same for any two heightfields holding the same values
+uint64_t CHeightField::ContentHash() const
+{
+	//Tiles are hashed on their own in parallel then combined in order. Only the samples in use
+	//are hashed, the rest of an edge tile holds whatever was there before
+	std::vector<uint64_t> tileHashes(m_Tiles.size());
+	CThreadPool::Global().ParallelFor(TileCount(), [&](int begin, int end)
+	{
+		for (int index = begin; index < end; ++index)
+		{
+			const int width = TileWidth(index % m_TilesX);
+			const int height = TileHeight(index / m_TilesX);
+			uint64_t hash = 0;
+			for (int z = 0; z < height; ++z)
+			{
+				hash = HashBytes(m_Tiles[index] + z * TileSize, width * sizeof(float), hash);
+			}
+			tileHashes[index] = hash;
+		}
+	});
+
+	uint64_t hash = HashCombine(HashCombine(0, m_Width), m_Height);
+	for (uint64_t tileHash : tileHashes) hash = HashCombine(hash, tileHash);
+	return hash;
+}
+
+//Allocator shared by every heightfield tile
+CTileAllocator& CHeightField::TileAllocator()
+{
+	static CTileAllocator allocator(TileHeaderBytes + TileSamples * sizeof(float));
+	return allocator;
+}
+
+//Create a new tile with a reference count of one, the samples are uninitialised
+float* CHeightField::NewTile()
+{
+	char* block = static_cast<char*>(TileAllocator().Allocate());
+	TileHeader* header = new (block) TileHeader;
+	header->refCount.store(1, std::memory_order_relaxed);
+	return reinterpret_cast<float*>(block + TileHeaderBytes);
+}
+
+//Create an unshared copy of a tile and release the reference to the original
+float* CHeightField::CopyTile(float* tile)
+{
+	float* copy = NewTile();
+	std::copy(tile, tile + TileSamples, copy);
+	ReleaseTile(tile);
+	return copy;
+}
+
+//Add a reference to a tile
+void CHeightField::AddRef(float* tile)
+{
+	Header(tile)->refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+//Release a reference to a tile, the tile is returned to the allocator with its last reference
+void CHeightField::ReleaseTile(float* tile)
+{
+	TileHeader* header = Header(tile);
+	if (header->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		header->~TileHeader();
+		TileAllocator().Free(header);
+	}
+}
+
+//Release this heightfield's reference to every tile
+void CHeightField::Release()
+{
+	for (float* tile : m_Tiles)
+	{
+		ReleaseTile(tile);
+	}
+	m_Tiles.clear();
+	m_Width = m_Height = m_TilesX = m_TilesZ = 0;
+}
+
+//Function to mark the tiles that differ from the tiles about to be assigned, every tile if the size changes.
+//Both heightfields still hold their tiles here, so a tile that differs can never share an address with the new one
+void CHeightField::MarkReplacedTiles(const CHeightField& other)
+{
+	if (other.m_Width != m_Width || other.m_Height != m_Height)
+	{
+		m_DirtyTiles.assign(other.m_Tiles.size(), 1);
+		return;
+	}
+
+	for (size_t i = 0; i < m_Tiles.size(); ++i)
+	{
+		if (m_Tiles[i] != other.m_Tiles[i]) m_DirtyTiles[i] = 1;
+	}
+}
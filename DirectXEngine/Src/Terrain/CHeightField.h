@@ -0,0 +1,208 @@
+//--------------------------------------------------------------------------------------
+// Tiled grid of height values
+//--------------------------------------------------------------------------------------
+// The heightfield is split into square tiles of TileSize x TileSize samples. Each tile is
+// one block from the shared tile allocator and is stored row by row, so a tile is a small
+// contiguous working set that generators and modifiers can process on their own.
+// Samples are addressed with x along a row and z down the rows, matching HeightMap[z][x].
+//
+// Tiles are reference counted and copied on write. Copying a heightfield only copies the
+// tile pointers, and a tile is duplicated the first time it is written to while shared, so
+// snapshots for undo or A/B comparisons cost one pointer per tile plus the tiles changed.
+//
+// Every tile written to, and every tile replaced by assigning another heightfield with
+// different tiles, is marked dirty. Consumers of the heightfield (mesh, plants, height
+// pyramid) take the dirty tiles after a change and only update what those tiles cover.
+
+#pragma once
+#include "tepch.h"
+#include "Utility/CTileAllocator.h"
+#include <atomic>
+
+class CHeightField
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Size of a tile, in samples along each side
+	static constexpr int TileShift = 6;
+	static constexpr int TileSize = 1 << TileShift;
+	static constexpr int TileMask = TileSize - 1;
+	static constexpr int TileSamples = TileSize * TileSize;
+
+	//Constructors
+	CHeightField() {}
+	CHeightField(int width, int height, float value = 0.0f);
+	CHeightField(const CHeightField& other);
+	CHeightField(CHeightField&& other) noexcept;
+
+	//Destructor, releases this heightfield's reference to every tile
+	~CHeightField();
+
+	CHeightField& operator=(const CHeightField& other);
+	CHeightField& operator=(CHeightField&& other) noexcept;
+
+	//Function to change the size of the heightfield, every sample is set to the value given
+	void Resize(int width, int height, float value = 0.0f);
+
+	//Function to change the size of the heightfield leaving the samples uninitialised, for callers that write every tile
+	void ResizeUninitialised(int width, int height);
+
+	//Function to set every sample to the same value
+	void Fill(float value);
+
+	//Number of samples along each side
+	int Width() const { return m_Width; }
+	int Height() const { return m_Height; }
+
+	//Number of tiles along each side
+	int TilesX() const { return m_TilesX; }
+	int TilesZ() const { return m_TilesZ; }
+	int TileCount() const { return m_TilesX * m_TilesZ; }
+
+	//Number of samples of a tile that lie inside the heightfield, edge tiles can be partially filled
+	int TileWidth(int tileX) const { return std::min(TileSize, m_Width - (tileX << TileShift)); }
+	int TileHeight(int tileZ) const { return std::min(TileSize, m_Height - (tileZ << TileShift)); }
+
+	//Get a single height value
+	float Get(int x, int z) const
+	{
+		return m_Tiles[(z >> TileShift) * m_TilesX + (x >> TileShift)][((z & TileMask) << TileShift) + (x & TileMask)];
+	}
+
+	//Get a height value with the coordinates clamped to the edges of the heightfield
+	float GetClamped(int x, int z) const
+	{
+		return Get(std::min(std::max(x, 0), m_Width - 1), std::min(std::max(z, 0), m_Height - 1));
+	}
+
+	//Set a single height value
+	void Set(int x, int z, float value)
+	{
+		EditTile(x >> TileShift, z >> TileShift)[((z & TileMask) << TileShift) + (x & TileMask)] = value;
+	}
+
+	//Read only access to the samples of a tile, stored row by row with a stride of TileSize
+	const float* Tile(int tileX, int tileZ) const { return m_Tiles[tileZ * m_TilesX + tileX]; }
+
+	//Writable access to the samples of a tile, stored row by row with a stride of TileSize
+	//The tile is copied first if it is shared with another heightfield, and is marked dirty
+	float* EditTile(int tileX, int tileZ)
+	{
+		const int index = tileZ * m_TilesX + tileX;
+		float*& tile = m_Tiles[index];
+		if (Header(tile)->refCount.load(std::memory_order_acquire) != 1)
+		{
+			tile = CopyTile(tile);
+		}
+		m_DirtyTiles[index] = 1;
+		return tile;
+	}
+
+	//Check whether a tile is shared with another heightfield
+	bool IsTileShared(int tileX, int tileZ) const
+	{
+		return Header(m_Tiles[tileZ * m_TilesX + tileX])->refCount.load(std::memory_order_acquire) != 1;
+	}
+
+	//Check whether a tile has changed since the dirty tiles were last taken
+	bool IsTileDirty(int tileX, int tileZ) const { return m_DirtyTiles[tileZ * m_TilesX + tileX] != 0; }
+
+	//Number of tiles that have changed since the dirty tiles were last taken
+	int DirtyTileCount() const { return static_cast<int>(std::count(m_DirtyTiles.begin(), m_DirtyTiles.end(), 1)); }
+
+	//Function to get the index (tileZ * TilesX + tileX) of every tile changed since the last call, in order, and mark them clean
+	std::vector<int> TakeDirtyTiles();
+
+	//Function to mark every tile as changed
+	void MarkAllDirty() { std::fill(m_DirtyTiles.begin(), m_DirtyTiles.end(), 1); }
+
+	//Function to copy a rectangle of samples into a buffer with the stride given, coordinates
+	//outside the heightfield are clamped to the nearest edge so halos can be read
+	void ReadRegion(int x0, int z0, int width, int height, float* out, int stride) const;
+
+	//Function to copy a buffer with the stride given into a rectangle of samples inside the heightfield
+	void WriteRegion(int x0, int z0, int width, int height, const float* in, int stride);
+
+	//Function to call func(tile, x0, z0, width, height) for every tile, where x0 and z0 are the
+	//coordinates of the first sample in the tile and width and height are the samples in use
+	template<typename Func>
+	void ForEachTile(Func func)
+	{
+		for (int tileZ = 0; tileZ < m_TilesZ; ++tileZ)
+		{
+			for (int tileX = 0; tileX < m_TilesX; ++tileX)
+			{
+				func(EditTile(tileX, tileZ), tileX << TileShift, tileZ << TileShift, TileWidth(tileX), TileHeight(tileZ));
+			}
+		}
+	}
+
+	//Memory used by the tiles of this heightfield in bytes, counting shared tiles in full
+	size_t MemoryUsage() const { return m_Tiles.size() * TileAllocator().BlockSize(); }
+
+	//Memory used by the tiles that are not shared with any other heightfield
+	size_t UniqueMemoryUsage() const;
+
+	//Memory the tiles of a heightfield of this size take
+	static size_t MemoryUsage(int width, int height)
+	{
+		return static_cast<size_t>((width + TileMask) >> TileShift) * ((height + TileMask) >> TileShift) * TileAllocator().BlockSize();
+	}
+
+	//Hash of the size and every sample, the same for any two heightfields holding the same values
+	uint64_t ContentHash() const;
+
+	//Allocator shared by every heightfield tile
+	static CTileAllocator& TileAllocator();
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Reference count kept in front of the samples of every tile, padded so the samples stay aligned
+	struct TileHeader
+	{
+		std::atomic<uint32_t> refCount;
+	};
+	static const size_t TileHeaderBytes = CTileAllocator::BlockAlignment;
+
+	//Get the header of a tile from a pointer to its samples
+	static TileHeader* Header(const float* tile)
+	{
+		return reinterpret_cast<TileHeader*>(const_cast<char*>(reinterpret_cast<const char*>(tile) - TileHeaderBytes));
+	}
+
+	//Create a new tile with a reference count of one, the samples are uninitialised
+	static float* NewTile();
+
+	//Create an unshared copy of a tile and release the reference to the original
+	static float* CopyTile(float* tile);
+
+	//Add or release a reference to a tile, the tile is returned to the allocator with its last reference
+	static void AddRef(float* tile);
+	static void ReleaseTile(float* tile);
+
+	//Release this heightfield's reference to every tile
+	void Release();
+
+	//Function to mark the tiles that differ from the tiles about to be assigned, every tile if the size changes
+	void MarkReplacedTiles(const CHeightField& other);
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	//Size of the heightfield in samples and in tiles
+	int m_Width = 0;
+	int m_Height = 0;
+	int m_TilesX = 0;
+	int m_TilesZ = 0;
+
+	//Pointers to the samples of each tile, stored row by row
+	std::vector<float*> m_Tiles;
+
+	//Whether each tile has changed since the dirty tiles were last taken, one byte per tile so workers can mark tiles at once
+	std::vector<uint8_t> m_DirtyTiles;
+};
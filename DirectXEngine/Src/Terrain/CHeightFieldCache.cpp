@@ -0,0 +1,89 @@
+#include "CHeightFieldCache.h"
+
+//Constructor
+CHeightFieldCache::CHeightFieldCache(size_t budgetBytes) : m_Budget(budgetBytes)
+{
+}
+
+//Function to copy the heightfield stored for a key into heightField, returns false (a miss) if there is none
+bool CHeightFieldCache::Find(uint64_t key, CHeightField& heightField)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto found = m_Index.find(key);
+	if (found == m_Index.end())
+	{
+		++m_Misses;
+		return false;
+	}
+
+	//Move the entry to the front without copying it
+	m_Entries.splice(m_Entries.begin(), m_Entries, found->second);
+	heightField = found->second->heightField;
+	++m_Hits;
+	return true;
+}
+
+//Function to store a heightfield for a key, replacing what was stored for it, then drop entries over the budget
+void CHeightFieldCache::Insert(uint64_t key, const CHeightField& heightField)
+{
+	const size_t bytes = heightField.MemoryUsage();
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto found = m_Index.find(key);
+	if (found != m_Index.end())
+	{
+		m_Bytes -= found->second->bytes;
+		m_Entries.erase(found->second);
+		m_Index.erase(found);
+	}
+
+	//Anything bigger than the whole budget would only push everything else out and be dropped itself
+	if (bytes > m_Budget) return;
+
+	m_Entries.push_front({ key, heightField, bytes });
+	m_Index[key] = m_Entries.begin();
+	m_Bytes += bytes;
+	Evict();
+}
+
+//Function to change the byte budget, dropping entries over the new budget
+void CHeightFieldCache::SetBudget(size_t budgetBytes)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Budget = budgetBytes;
+	Evict();
+}
+
+//Function to remove every entry, the counters are kept
+void CHeightFieldCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Entries.clear();
+	m_Index.clear();
+	m_Bytes = 0;
+}
+
+CHeightFieldCache::Stats CHeightFieldCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Stats stats;
+	stats.hits = m_Hits;
+	stats.misses = m_Misses;
+	stats.evictions = m_Evictions;
+	stats.entries = m_Entries.size();
+	stats.bytes = m_Bytes;
+	stats.budget = m_Budget;
+	return stats;
+}
+
+//Function to drop the least recently used entries until the entries fit in the budget
+void CHeightFieldCache::Evict()
+{
+	while (m_Bytes > m_Budget && !m_Entries.empty())
+	{
+		m_Bytes -= m_Entries.back().bytes;
+		m_Index.erase(m_Entries.back().key);
+		m_Entries.pop_back();
+		++m_Evictions;
+	}
+}
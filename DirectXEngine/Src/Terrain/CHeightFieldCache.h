@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------------------------
+// Least recently used cache of generated heightfields
+//--------------------------------------------------------------------------------------
+// Entries are keyed by CTerrainGraph::Hash, which covers the operators, their parameters,
+// their inputs and the size, so finding an entry gives the same heightfield as running the
+// graph again. Entries are heightfield copies that share their tiles, so storing and
+// finding an entry only copies tile pointers. When the entries take more than the byte
+// budget the least recently used ones are dropped. Tiles shared between entries (or with
+// the live heightfield) are counted in full, so the budget is an upper bound. The owner
+// should size the budget from the heightfields it stores, as one that can't hold an entry
+// never keeps it.
+// Every function locks the cache, so it can be used from the background generator and
+// the render thread at once.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+class CHeightFieldCache
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Counters shown in the UI
+	struct Stats
+	{
+		int64_t hits = 0;
+		int64_t misses = 0;
+		int64_t evictions = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+		size_t budget = 0;
+	};
+
+	//Default budget, enough for one 8193 x 8193 heightfield (about 270 MB) and a few small ones
+	static const size_t DefaultBudget = 512 * 1024 * 1024;
+
+	//Constructor
+	CHeightFieldCache(size_t budgetBytes = DefaultBudget);
+
+	//Function to copy the heightfield stored for a key into heightField, returns false (a miss) if there is none
+	bool Find(uint64_t key, CHeightField& heightField);
+
+	//Function to store a heightfield for a key, replacing what was stored for it, then drop entries over the budget
+	void Insert(uint64_t key, const CHeightField& heightField);
+
+	//Function to change the byte budget, dropping entries over the new budget
+	void SetBudget(size_t budgetBytes);
+
+	//Function to remove every entry, the counters are kept
+	void Clear();
+
+	Stats GetStats() const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	struct Entry
+	{
+		uint64_t key;
+		CHeightField heightField;
+		size_t bytes;
+	};
+
+	//Function to drop the least recently used entries until the entries fit in the budget
+	void Evict();
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	mutable std::mutex m_Mutex;
+
+	//Most recently used entry first
+	std::list<Entry> m_Entries;
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> m_Index;
+
+	size_t m_Budget = 0;
+	size_t m_Bytes = 0;
+	int64_t m_Hits = 0;
+	int64_t m_Misses = 0;
+	int64_t m_Evictions = 0;
+};
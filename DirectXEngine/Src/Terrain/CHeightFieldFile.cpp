@@ -0,0 +1,146 @@
+#include "CHeightFieldFile.h"
+#include <cstring>
+
+static const char FileMagic[4] = { 'T', 'H', 'F', 'T' };
+static const uint32_t FileVersion = 1;
+
+//Constructor, creates a file for a map of the size given with every sample 0
+CHeightFieldFile::CHeightFieldFile(const std::string& path, int width, int height)
+	: m_Path(path), m_Width(width), m_Height(height)
+{
+	if (width < 1 || height < 1) throw std::runtime_error("Heightfield file " + path + " must have at least one sample");
+
+	m_TilesX = (width + CHeightField::TileMask) >> CHeightField::TileShift;
+	m_TilesZ = (height + CHeightField::TileMask) >> CHeightField::TileShift;
+
+	m_File.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!m_File) throw std::runtime_error("Could not create heightfield file " + path);
+
+	FileHeader header = {};
+	std::memcpy(header.magic, FileMagic, sizeof(FileMagic));
+	header.version = FileVersion;
+	header.width = width;
+	header.height = height;
+	header.tileSize = CHeightField::TileSize;
+	m_File.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	//Writing the last byte sizes the file, the tiles in between read as 0 until they are written
+	const std::streamoff bytes = static_cast<std::streamoff>(sizeof(FileHeader)) + static_cast<std::streamoff>(m_TilesX) * m_TilesZ * CHeightField::TileSamples * sizeof(float);
+	m_File.seekp(bytes - 1);
+	m_File.put(0);
+	CheckFile("create");
+}
+
+//Constructor, opens a file made before
+CHeightFieldFile::CHeightFieldFile(const std::string& path)
+	: m_Path(path)
+{
+	m_File.open(path, std::ios::in | std::ios::out | std::ios::binary);
+	if (!m_File) throw std::runtime_error("Could not open heightfield file " + path);
+
+	FileHeader header = {};
+	m_File.read(reinterpret_cast<char*>(&header), sizeof(header));
+	CheckFile("read the header of");
+	if (std::memcmp(header.magic, FileMagic, sizeof(FileMagic)) != 0 || header.version != FileVersion)
+	{
+		throw std::runtime_error(path + " is not a heightfield file");
+	}
+	if (header.tileSize != CHeightField::TileSize || header.width < 1 || header.height < 1)
+	{
+		throw std::runtime_error(path + " has tiles of a different size");
+	}
+
+	m_Width = header.width;
+	m_Height = header.height;
+	m_TilesX = (m_Width + CHeightField::TileMask) >> CHeightField::TileShift;
+	m_TilesZ = (m_Height + CHeightField::TileMask) >> CHeightField::TileShift;
+}
+
+//Function to write the TileSamples values of a tile
+void CHeightFieldFile::WriteTile(int tileX, int tileZ, const float* samples)
+{
+	SeekTile(tileX, tileZ, true);
+	m_File.write(reinterpret_cast<const char*>(samples), CHeightField::TileSamples * sizeof(float));
+	CheckFile("write to");
+}
+
+//Function to read the TileSamples values of a tile
+void CHeightFieldFile::ReadTile(int tileX, int tileZ, float* samples)
+{
+	SeekTile(tileX, tileZ, false);
+	m_File.read(reinterpret_cast<char*>(samples), CHeightField::TileSamples * sizeof(float));
+	CheckFile("read from");
+}
+
+//Function to copy a rectangle of samples into a buffer with the stride given, coordinates outside the map are clamped
+void CHeightFieldFile::ReadRegion(int x0, int z0, int width, int height, float* out, int stride)
+{
+	//Each tile the rectangle touches is read once
+	std::vector<float> tile(CHeightField::TileSamples);
+	const int tileX0 = std::min(std::max(x0, 0), m_Width - 1) >> CHeightField::TileShift;
+	const int tileX1 = std::min(std::max(x0 + width - 1, 0), m_Width - 1) >> CHeightField::TileShift;
+	const int tileZ0 = std::min(std::max(z0, 0), m_Height - 1) >> CHeightField::TileShift;
+	const int tileZ1 = std::min(std::max(z0 + height - 1, 0), m_Height - 1) >> CHeightField::TileShift;
+	for (int tileZ = tileZ0; tileZ <= tileZ1; ++tileZ)
+	{
+		for (int tileX = tileX0; tileX <= tileX1; ++tileX)
+		{
+			ReadTile(tileX, tileZ, tile.data());
+			for (int row = 0; row < height; ++row)
+			{
+				const int z = std::min(std::max(z0 + row, 0), m_Height - 1);
+				if ((z >> CHeightField::TileShift) != tileZ) continue;
+				for (int column = 0; column < width; ++column)
+				{
+					const int x = std::min(std::max(x0 + column, 0), m_Width - 1);
+					if ((x >> CHeightField::TileShift) != tileX) continue;
+					out[static_cast<size_t>(row) * stride + column] = tile[((z & CHeightField::TileMask) << CHeightField::TileShift) + (x & CHeightField::TileMask)];
+				}
+			}
+		}
+	}
+}
+
+//Function to load the whole map into a heightfield
+void CHeightFieldFile::Load(CHeightField& field)
+{
+	field.ResizeUninitialised(m_Width, m_Height);
+	for (int tileZ = 0; tileZ < m_TilesZ; ++tileZ)
+	{
+		for (int tileX = 0; tileX < m_TilesX; ++tileX)
+		{
+			ReadTile(tileX, tileZ, field.EditTile(tileX, tileZ));
+		}
+	}
+}
+
+//Function to write any tiles still buffered to the disk
+void CHeightFieldFile::Flush()
+{
+	m_File.flush();
+	CheckFile("flush");
+}
+
+//Function to move the file position to the start of a tile
+void CHeightFieldFile::SeekTile(int tileX, int tileZ, bool bWrite)
+{
+	if (tileX < 0 || tileX >= m_TilesX || tileZ < 0 || tileZ >= m_TilesZ)
+	{
+		throw std::runtime_error("Tile outside of heightfield file " + m_Path);
+	}
+
+	const std::streamoff tile = static_cast<std::streamoff>(tileZ) * m_TilesX + tileX;
+	const std::streamoff offset = static_cast<std::streamoff>(sizeof(FileHeader)) + tile * CHeightField::TileSamples * sizeof(float);
+	if (bWrite) m_File.seekp(offset);
+	else m_File.seekg(offset);
+}
+
+//Function to throw if the last operation on the file failed
+void CHeightFieldFile::CheckFile(const char* action)
+{
+	if (!m_File)
+	{
+		m_File.clear();
+		throw std::runtime_error(std::string("Could not ") + action + " heightfield file " + m_Path);
+	}
+}
@@ -0,0 +1,85 @@
+//--------------------------------------------------------------------------------------
+// Tiled heightfield file, for maps too large to hold in memory
+//--------------------------------------------------------------------------------------
+// The file starts with a header giving the size of the map, followed by every tile in row
+// order (tileZ * TilesX + tileX). Each tile holds TileSize x TileSize floats row by row, the
+// same layout as the tiles of CHeightField, with the samples past the edge of the map set to 0.
+// Any tile can be read or written on its own, so a map can be made or used a few tiles at a
+// time. A file is used by one thread at a time.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include <fstream>
+
+class CHeightFieldFile
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Constructor, creates a file for a map of the size given with every sample 0. Throws std::runtime_error on failure
+	CHeightFieldFile(const std::string& path, int width, int height);
+
+	//Constructor, opens a file made before. Throws std::runtime_error on failure
+	CHeightFieldFile(const std::string& path);
+
+	CHeightFieldFile(const CHeightFieldFile&) = delete;
+	CHeightFieldFile& operator=(const CHeightFieldFile&) = delete;
+
+	//Number of samples along each side
+	int Width() const { return m_Width; }
+	int Height() const { return m_Height; }
+
+	//Number of tiles along each side
+	int TilesX() const { return m_TilesX; }
+	int TilesZ() const { return m_TilesZ; }
+
+	//Function to write the TileSamples values of a tile, stored row by row with a stride of TileSize
+	void WriteTile(int tileX, int tileZ, const float* samples);
+
+	//Function to read the TileSamples values of a tile, stored row by row with a stride of TileSize
+	void ReadTile(int tileX, int tileZ, float* samples);
+
+	//Function to copy a rectangle of samples into a buffer with the stride given, coordinates
+	//outside the map are clamped to the nearest edge, the same as CHeightField::ReadRegion
+	void ReadRegion(int x0, int z0, int width, int height, float* out, int stride);
+
+	//Function to load the whole map into a heightfield, for maps that fit in memory
+	void Load(CHeightField& field);
+
+	//Function to write any tiles still buffered to the disk
+	void Flush();
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Header at the start of every file
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		int32_t width;
+		int32_t height;
+		int32_t tileSize;
+		int32_t reserved[3];
+	};
+
+	//Function to move the file position to the start of a tile
+	void SeekTile(int tileX, int tileZ, bool bWrite);
+
+	//Function to throw if the last operation on the file failed
+	void CheckFile(const char* action);
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	std::fstream m_File;
+	std::string m_Path;
+	int m_Width = 0;
+	int m_Height = 0;
+	int m_TilesX = 0;
+	int m_TilesZ = 0;
+};
@@ -0,0 +1,153 @@
+#include "CHeightFieldHistory.h"
+#include <unordered_set>
+
+//Constructor
+CHeightFieldHistory::CHeightFieldHistory(size_t maxEntries)
+{
+	m_MaxEntries = std::max<size_t>(1, maxEntries);
+}
+
+//Function to record the state of the heightfield before it is changed, clears the redo list
+void CHeightFieldHistory::Record(const CHeightField& heightField, const std::string& label)
+{
+	if (m_Undo.size() >= m_MaxEntries)
+	{
+		m_Undo.erase(m_Undo.begin());
+	}
+	m_Undo.push_back({ heightField, label });
+	m_Redo.clear();
+	m_bMemoryUsageStale = true;
+}
+
+//Function to go back to the previous state, returns false if there is nothing to undo
+bool CHeightFieldHistory::Undo(CHeightField& heightField)
+{
+	if (m_Undo.empty()) return false;
+
+	Entry& entry = m_Undo.back();
+	//Copied rather than moved so heightField keeps its tiles and only the tiles that differ are marked dirty
+	m_Redo.push_back({ heightField, entry.label });
+	heightField = std::move(entry.heightField);
+	m_Undo.pop_back();
+	m_bMemoryUsageStale = true;
+	return true;
+}
+
+//Function to go forward to the state that was last undone, returns false if there is nothing to redo
+bool CHeightFieldHistory::Redo(CHeightField& heightField)
+{
+	if (m_Redo.empty()) return false;
+
+	Entry& entry = m_Redo.back();
+	//Copied rather than moved so heightField keeps its tiles and only the tiles that differ are marked dirty
+	m_Undo.push_back({ heightField, entry.label });
+	heightField = std::move(entry.heightField);
+	m_Redo.pop_back();
+	m_bMemoryUsageStale = true;
+	return true;
+}
+
+//Function to store the heightfield in a comparison slot
+void CHeightFieldHistory::Store(int slot, const CHeightField& heightField, const std::string& label)
+{
+	if (slot < 0 || slot >= NumSlots) return;
+
+	m_Slots[slot].heightField = heightField;
+	m_Slots[slot].label = label;
+	m_bMemoryUsageStale = true;
+}
+
+//Function to copy a comparison slot into the heightfield, recording the current state so it can be undone
+bool CHeightFieldHistory::Recall(int slot, CHeightField& heightField)
+{
+	if (!HasSlot(slot)) return false;
+
+	Record(heightField, "Recall " + m_Slots[slot].label);
+	heightField = m_Slots[slot].heightField;
+	return true;
+}
+
+//Function to remove every entry and slot
+void CHeightFieldHistory::Clear()
+{
+	m_Undo.clear();
+	m_Redo.clear();
+	for (Entry& slot : m_Slots)
+	{
+		slot = Entry();
+	}
+	m_bMemoryUsageStale = true;
+}
+
+//Memory held only by the history, tiles shared with the live heightfield are counted once
+size_t CHeightFieldHistory::MemoryUsage(const CHeightField& current) const
+{
+	if (m_bMemoryUsageStale)
+	{
+		m_MemoryUsage = CountMemoryUsage(current);
+		m_bMemoryUsageStale = false;
+
+		m_LiveTiles.resize(static_cast<size_t>(current.TilesX()) * current.TilesZ());
+		for (int tileZ = 0; tileZ < current.TilesZ(); ++tileZ)
+		{
+			for (int tileX = 0; tileX < current.TilesX(); ++tileX)
+			{
+				m_LiveTiles[static_cast<size_t>(tileZ) * current.TilesX() + tileX] = current.Tile(tileX, tileZ);
+			}
+		}
+	}
+	return m_MemoryUsage;
+}
+
+//Function to tell the history which tiles of the live heightfield have changed
+void CHeightFieldHistory::TilesChanged(const CHeightField& current, const std::vector<int>& tiles)
+{
+	if (m_bMemoryUsageStale) return;
+
+	if (m_LiveTiles.size() != static_cast<size_t>(current.TilesX()) * current.TilesZ())
+	{
+		m_bMemoryUsageStale = true;
+		return;
+	}
+	for (int tile : tiles)
+	{
+		if (current.Tile(tile % current.TilesX(), tile / current.TilesX()) != m_LiveTiles[tile])
+		{
+			m_bMemoryUsageStale = true;
+			return;
+		}
+	}
+}
+
+//Function to count the tiles held only by the history
+size_t CHeightFieldHistory::CountMemoryUsage(const CHeightField& current) const
+{
+	std::unordered_set<const float*> liveTiles;
+	for (int tileZ = 0; tileZ < current.TilesZ(); ++tileZ)
+	{
+		for (int tileX = 0; tileX < current.TilesX(); ++tileX)
+		{
+			liveTiles.insert(current.Tile(tileX, tileZ));
+		}
+	}
+
+	//Count every tile held by the history that is not part of the live heightfield
+	std::unordered_set<const float*> historyTiles;
+	auto addTiles = [&](const CHeightField& heightField)
+	{
+		for (int tileZ = 0; tileZ < heightField.TilesZ(); ++tileZ)
+		{
+			for (int tileX = 0; tileX < heightField.TilesX(); ++tileX)
+			{
+				const float* tile = heightField.Tile(tileX, tileZ);
+				if (liveTiles.count(tile) == 0) historyTiles.insert(tile);
+			}
+		}
+	};
+
+	for (const Entry& entry : m_Undo) addTiles(entry.heightField);
+	for (const Entry& entry : m_Redo) addTiles(entry.heightField);
+	for (const Entry& slot : m_Slots) addTiles(slot.heightField);
+
+	return historyTiles.size() * CHeightField::TileAllocator().BlockSize();
+}
@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// Undo / redo history and A/B comparison slots for a heightfield
+//--------------------------------------------------------------------------------------
+// Every entry is a CHeightField snapshot, which shares its tiles with the heightfield it was
+// taken from. Taking a snapshot is a copy of the tile pointers and only the tiles changed
+// afterwards take up extra memory.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+
+class CHeightFieldHistory
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Number of comparison slots available
+	static const int NumSlots = 2;
+
+	//Constructor
+	CHeightFieldHistory(size_t maxEntries = 64);
+
+	//Function to record the state of the heightfield before it is changed, clears the redo list
+	void Record(const CHeightField& heightField, const std::string& label);
+
+	//Function to go back to the previous state, returns false if there is nothing to undo
+	bool Undo(CHeightField& heightField);
+
+	//Function to go forward to the state that was last undone, returns false if there is nothing to redo
+	bool Redo(CHeightField& heightField);
+
+	//Function to store the heightfield in a comparison slot
+	void Store(int slot, const CHeightField& heightField, const std::string& label);
+
+	//Function to copy a comparison slot into the heightfield, recording the current state so it can be undone
+	bool Recall(int slot, CHeightField& heightField);
+
+	//Function to remove every entry and slot
+	void Clear();
+
+	bool CanUndo() const { return !m_Undo.empty(); }
+	bool CanRedo() const { return !m_Redo.empty(); }
+	bool HasSlot(int slot) const { return slot >= 0 && slot < NumSlots && m_Slots[slot].heightField.Width() > 0; }
+
+	//Label of the next step to undo or redo, and of a comparison slot
+	const std::string& UndoLabel() const { return m_Undo.back().label; }
+	const std::string& RedoLabel() const { return m_Redo.back().label; }
+	const std::string& SlotLabel(int slot) const { return m_Slots[slot].label; }
+
+	//Number of entries that can be undone and redone
+	size_t UndoCount() const { return m_Undo.size(); }
+	size_t RedoCount() const { return m_Redo.size(); }
+
+	//Memory held only by the history, tiles shared with the live heightfield are counted once. The count is kept
+	//and only worked out again after the history changes or a tile of the live heightfield is copied
+	size_t MemoryUsage(const CHeightField& current) const;
+
+	//Function to tell the history which tiles of the live heightfield have changed, the memory usage is counted
+	//again if any of them was copied rather than written in place, as the history may hold the tile it replaced
+	void TilesChanged(const CHeightField& current, const std::vector<int>& tiles);
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Function to count the tiles held only by the history
+	size_t CountMemoryUsage(const CHeightField& current) const;
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	struct Entry
+	{
+		CHeightField heightField;
+		std::string  label;
+	};
+
+	//Largest number of undo entries kept, the oldest entry is dropped past this
+	size_t m_MaxEntries = 0;
+
+	std::vector<Entry> m_Undo;
+	std::vector<Entry> m_Redo;
+	Entry m_Slots[NumSlots];
+
+	//Memory usage from the last count and the tiles of the live heightfield it was counted against
+	mutable size_t m_MemoryUsage = 0;
+	mutable bool m_bMemoryUsageStale = true;
+	mutable std::vector<const float*> m_LiveTiles;
+};
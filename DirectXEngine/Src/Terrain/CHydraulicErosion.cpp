@@ -0,0 +1,221 @@
+#include "CHydraulicErosion.h"
+#include "Math/RandomHelpers.h"
+#include "Utility/HashHelpers.h"
+
+//Constructor, works out the erosion brush
+CHydraulicErosion::CHydraulicErosion(const ErosionSettings& settings) : m_Settings(settings)
+{
+	if (settings.radius < 1 || settings.passes < 1 || settings.droplets < 0 || settings.maxLifetime < 1)
+	{
+		throw std::runtime_error("Hydraulic erosion needs a radius, a pass and a lifetime of at least one");
+	}
+
+	//A cell grown by its margin has to leave room for the brush on both sides
+	if (settings.cellSize < 2 * (settings.radius + 2))
+	{
+		throw std::runtime_error("Hydraulic erosion cells are too small for the brush radius");
+	}
+
+	//Weights fall off linearly to the edge of the brush
+	const int radius = settings.radius;
+	float total = 0.0f;
+	for (int z = -radius; z <= radius; ++z)
+	{
+		for (int x = -radius; x <= radius; ++x)
+		{
+			const float weight = radius - std::sqrt(static_cast<float>(x * x + z * z));
+			if (weight <= 0.0f) continue;
+
+			m_BrushX.push_back(x);
+			m_BrushZ.push_back(z);
+			m_BrushWeights.push_back(weight);
+			total += weight;
+		}
+	}
+	for (float& weight : m_BrushWeights) weight /= total;
+}
+
+//Function to run every droplet over the heightfield in place
+void CHydraulicErosion::Erode(CHeightField& field, CThreadPool& pool, CJobProgress* progress) const
+{
+	const int width = field.Width();
+	const int height = field.Height();
+	if (width < 2 || height < 2 || m_Settings.droplets == 0) return;
+
+	//Droplets wander across tile borders, so they run on one flat array rather than the tiles
+	std::unique_ptr<float[]> heights(new float[static_cast<size_t>(width) * height]);
+	pool.ParallelFor(field.TilesZ(), [&](int begin, int end)
+	{
+		const int z0 = begin << CHeightField::TileShift;
+		const int z1 = std::min(end << CHeightField::TileShift, height);
+		field.ReadRegion(0, z0, width, z1 - z0, heights.get() + static_cast<size_t>(z0) * width, width);
+	});
+
+	//Cells of the same colour are two cells apart, growing each by less than half a cell keeps them apart
+	const int cellSize = m_Settings.cellSize;
+	const int margin = cellSize / 2 - 1;
+	const int64_t mapArea = static_cast<int64_t>(width) * height;
+
+	for (int pass = 0; pass < m_Settings.passes; ++pass)
+	{
+		const uint64_t passSeed = HashCombine(static_cast<uint64_t>(m_Settings.seed), pass);
+
+		//Move the grid so the borders between cells fall somewhere else each pass
+		const int offsetX = RandomInt(passSeed, 0, 0, ERandomStream::ErosionGrid, 0, cellSize - 1);
+		const int offsetZ = RandomInt(passSeed, 1, 0, ERandomStream::ErosionGrid, 0, cellSize - 1);
+		const int cellsX = (width + offsetX + cellSize - 1) / cellSize;
+		const int cellsZ = (height + offsetZ + cellSize - 1) / cellSize;
+
+		//Share the droplets of the pass between the cells by the area of the map they cover
+		const int64_t passDroplets = m_Settings.droplets / m_Settings.passes + (pass < m_Settings.droplets % m_Settings.passes ? 1 : 0);
+		std::vector<int> firstDroplet(static_cast<size_t>(cellsX) * cellsZ + 1, 0);
+		int64_t area = 0;
+		for (int cz = 0; cz < cellsZ; ++cz)
+		{
+			const int cellHeight = std::min((cz + 1) * cellSize - offsetZ, height) - std::max(cz * cellSize - offsetZ, 0);
+			for (int cx = 0; cx < cellsX; ++cx)
+			{
+				const int cellWidth = std::min((cx + 1) * cellSize - offsetX, width) - std::max(cx * cellSize - offsetX, 0);
+				area += static_cast<int64_t>(cellWidth) * cellHeight;
+				firstDroplet[cz * cellsX + cx + 1] = static_cast<int>(passDroplets * area / mapArea);
+			}
+		}
+
+		//The four colours one after another, the cells of each colour in parallel
+		for (int colour = 0; colour < 4; ++colour)
+		{
+			if (progress && progress->IsCancelled()) return;
+
+			const int colourX = colour & 1;
+			const int colourZ = colour >> 1;
+			const int colourCellsX = (cellsX - colourX + 1) / 2;
+			const int colourCellsZ = (cellsZ - colourZ + 1) / 2;
+
+			pool.ParallelForDynamic(colourCellsX * colourCellsZ, [&](int index)
+			{
+				const int cx = colourX + 2 * (index % colourCellsX);
+				const int cz = colourZ + 2 * (index / colourCellsX);
+				const int cell = cz * cellsX + cx;
+
+				const int cellX0 = std::max(cx * cellSize - offsetX, 0);
+				const int cellZ0 = std::max(cz * cellSize - offsetZ, 0);
+				const int cellX1 = std::min((cx + 1) * cellSize - offsetX, width);
+				const int cellZ1 = std::min((cz + 1) * cellSize - offsetZ, height);
+
+				DropletBounds bounds;
+				bounds.x0 = std::max(cellX0 - margin, 0);
+				bounds.z0 = std::max(cellZ0 - margin, 0);
+				bounds.x1 = std::min(cellX1 + margin, width);
+				bounds.z1 = std::min(cellZ1 + margin, height);
+
+				//Droplets start anywhere in the cell, keyed by their number in the cell so the order never changes
+				for (int droplet = firstDroplet[cell]; droplet < firstDroplet[cell + 1]; ++droplet)
+				{
+					const float x = RandomRange(passSeed, droplet, cell, ERandomStream::ErosionX, static_cast<float>(cellX0), static_cast<float>(cellX1));
+					const float z = RandomRange(passSeed, droplet, cell, ERandomStream::ErosionZ, static_cast<float>(cellZ0), static_cast<float>(cellZ1));
+					RunDroplet(heights.get(), width, bounds, x, z);
+				}
+			});
+		}
+	}
+
+	//Copy back a band of tile rows per worker, no two workers touch the same tile
+	pool.ParallelFor(field.TilesZ(), [&](int begin, int end)
+	{
+		const int z0 = begin << CHeightField::TileShift;
+		const int z1 = std::min(end << CHeightField::TileShift, height);
+		field.WriteRegion(0, z0, width, z1 - z0, heights.get() + static_cast<size_t>(z0) * width, width);
+	});
+}
+
+//Function to run one droplet from (x, z), it stops when it would touch samples outside the bounds
+void CHydraulicErosion::RunDroplet(float* heights, int width, const DropletBounds& bounds, float x, float z) const
+{
+	const int radius = m_Settings.radius;
+	const int brushSize = static_cast<int>(m_BrushWeights.size());
+
+	float directionX = 0.0f;
+	float directionZ = 0.0f;
+	float speed = m_Settings.initialSpeed;
+	float water = m_Settings.initialWater;
+	float sediment = 0.0f;
+
+	for (int step = 0; step < m_Settings.maxLifetime; ++step)
+	{
+		//The brush around the node and the four samples under the droplet have to be inside the bounds
+		const int nodeX = static_cast<int>(std::floor(x));
+		const int nodeZ = static_cast<int>(std::floor(z));
+		if (nodeX - radius < bounds.x0 || nodeX + radius >= bounds.x1 || nodeZ - radius < bounds.z0 || nodeZ + radius >= bounds.z1) break;
+
+		const float cellX = x - nodeX;
+		const float cellZ = z - nodeZ;
+
+		//Turn towards the slope, keeping some of the old direction
+		float gradientX, gradientZ;
+		const float oldHeight = HeightAndGradient(heights, width, x, z, gradientX, gradientZ);
+		directionX = directionX * m_Settings.inertia - gradientX * (1.0f - m_Settings.inertia);
+		directionZ = directionZ * m_Settings.inertia - gradientZ * (1.0f - m_Settings.inertia);
+		const float length = std::sqrt(directionX * directionX + directionZ * directionZ);
+		if (length <= 0.0f) break;
+
+		directionX /= length;
+		directionZ /= length;
+		x += directionX;
+		z += directionZ;
+
+		const int newNodeX = static_cast<int>(std::floor(x));
+		const int newNodeZ = static_cast<int>(std::floor(z));
+		if (newNodeX < bounds.x0 || newNodeX + 1 >= bounds.x1 || newNodeZ < bounds.z0 || newNodeZ + 1 >= bounds.z1) break;
+
+		float unusedX, unusedZ;
+		const float deltaHeight = HeightAndGradient(heights, width, x, z, unusedX, unusedZ) - oldHeight;
+
+		//Faster droplets with more water going further downhill can carry more
+		const float capacity = std::max(-deltaHeight * speed * water * m_Settings.capacity, m_Settings.minCapacity);
+
+		float* node = heights + static_cast<size_t>(nodeZ) * width + nodeX;
+		if (sediment > capacity || deltaHeight > 0.0f)
+		{
+			//Going uphill fills the pit behind the droplet, otherwise drop part of the extra sediment
+			const float deposit = deltaHeight > 0.0f ? std::min(deltaHeight, sediment) : (sediment - capacity) * m_Settings.depositSpeed;
+			sediment -= deposit;
+
+			node[0] += deposit * (1.0f - cellX) * (1.0f - cellZ);
+			node[1] += deposit * cellX * (1.0f - cellZ);
+			node[width] += deposit * (1.0f - cellX) * cellZ;
+			node[width + 1] += deposit * cellX * cellZ;
+		}
+		else
+		{
+			//Never dig deeper than the drop, which would leave a hole behind the droplet
+			const float erode = std::min((capacity - sediment) * m_Settings.erodeSpeed, -deltaHeight);
+			for (int i = 0; i < brushSize; ++i)
+			{
+				node[m_BrushZ[i] * width + m_BrushX[i]] -= erode * m_BrushWeights[i];
+			}
+			sediment += erode;
+		}
+
+		speed = std::sqrt(std::max(0.0f, speed * speed - deltaHeight * m_Settings.gravity));
+		water *= 1.0f - m_Settings.evaporateSpeed;
+	}
+}
+
+//Function to get the bilinear height and its gradient at a position
+float CHydraulicErosion::HeightAndGradient(const float* heights, int width, float x, float z, float& gradientX, float& gradientZ)
+{
+	const int nodeX = static_cast<int>(std::floor(x));
+	const int nodeZ = static_cast<int>(std::floor(z));
+	const float cellX = x - nodeX;
+	const float cellZ = z - nodeZ;
+
+	const float* node = heights + static_cast<size_t>(nodeZ) * width + nodeX;
+	const float topLeft = node[0];
+	const float topRight = node[1];
+	const float bottomLeft = node[width];
+	const float bottomRight = node[width + 1];
+
+	gradientX = (topRight - topLeft) * (1.0f - cellZ) + (bottomRight - bottomLeft) * cellZ;
+	gradientZ = (bottomLeft - topLeft) * (1.0f - cellX) + (bottomRight - topRight) * cellX;
+	return topLeft * (1.0f - cellX) * (1.0f - cellZ) + topRight * cellX * (1.0f - cellZ) + bottomLeft * (1.0f - cellX) * cellZ + bottomRight * cellX * cellZ;
+}
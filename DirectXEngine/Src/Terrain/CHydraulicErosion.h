@@ -0,0 +1,87 @@
+//--------------------------------------------------------------------------------------
+// Particle based hydraulic erosion, spread over the thread pool
+//--------------------------------------------------------------------------------------
+// Droplets of water are dropped on the heightfield and run downhill. A droplet picks up
+// sediment where it speeds up and has spare capacity, taking it from a round brush of
+// samples, and drops it bilinearly onto the four samples around it where it slows down or
+// carries more than it can hold. Its water evaporates a little every step.
+//
+// To run droplets at the same time the heightfield is split into square cells, coloured
+// like a checkerboard with four colours (by the parity of the cell x and z). The cells of
+// one colour run in parallel, one worker per cell, and the colours run one after another.
+// A droplet never leaves its cell grown by just under half a cell, and the brush is kept
+// inside that as well, so two cells of the same colour never touch the same sample. The
+// droplets of a cell run in order on one worker, which makes the result the same for a
+// seed whatever the number of threads. Each pass moves the cell grid by a random offset
+// so the borders between cells don't show.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Utility/CJobProgress.h"
+#include "Utility/CThreadPool.h"
+
+//Settings of the hydraulic erosion
+struct ErosionSettings
+{
+	int droplets = 200000;          //Droplets over every pass together
+	int passes = 4;                 //Passes, each with the cell grid in a different place
+	int cellSize = 128;             //Samples along each side of a cell
+	unsigned int seed = 0;
+
+	float inertia = 0.05f;          //How much a droplet keeps its direction instead of following the slope
+	float capacity = 4.0f;          //Sediment a droplet can carry for its speed, water and slope
+	float minCapacity = 0.01f;      //Sediment a droplet can carry on flat ground
+	float erodeSpeed = 0.3f;        //Part of the spare capacity picked up each step
+	float depositSpeed = 0.3f;      //Part of the extra sediment dropped each step
+	float evaporateSpeed = 0.01f;   //Part of the water lost each step
+	float gravity = 4.0f;
+	int maxLifetime = 30;           //Steps before a droplet stops
+	int radius = 3;                 //Radius of the erosion brush, in samples
+
+	float initialWater = 1.0f;
+	float initialSpeed = 1.0f;
+};
+
+class CHydraulicErosion
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Constructor, works out the erosion brush. Throws std::runtime_error if the settings can't be used
+	CHydraulicErosion(const ErosionSettings& settings);
+
+	const ErosionSettings& Settings() const { return m_Settings; }
+
+	//Function to run every droplet over the heightfield in place. The job is checked for cancellation before each
+	//colour of cells, a cancelled run leaves the heightfield as it was
+	void Erode(CHeightField& field, CThreadPool& pool = CThreadPool::Global(), CJobProgress* progress = nullptr) const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Samples a droplet may touch, the cell grown by the margin and clipped to the map
+	struct DropletBounds
+	{
+		int x0, z0, x1, z1;
+	};
+
+	//Function to run one droplet from (x, z), it stops when it would touch samples outside the bounds
+	void RunDroplet(float* heights, int width, const DropletBounds& bounds, float x, float z) const;
+
+	//Function to get the bilinear height and its gradient at a position
+	static float HeightAndGradient(const float* heights, int width, float x, float z, float& gradientX, float& gradientZ);
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	ErosionSettings m_Settings;
+
+	//Offsets and weights of the erosion brush, the weights add up to one
+	std::vector<int> m_BrushX;
+	std::vector<int> m_BrushZ;
+	std::vector<float> m_BrushWeights;
+};
@@ -0,0 +1,340 @@
+#include "CMidpointDisplacement.h"
+#include "Terrain/CHeightFieldFile.h"
+#include "Math/RandomHelpers.h"
+#include "Utility/CThreadPool.h"
+
+//Largest multiple of step at or below the value, for negative values as well
+static int AlignDown(int value, int step)
+{
+	const int quotient = value / step;
+	return (value % step < 0 ? quotient - 1 : quotient) * step;
+}
+
+//Smallest value at or above the value that is offset more than a multiple of step
+static int AlignUp(int value, int step, int offset)
+{
+	return AlignDown(value - offset + step - 1, step) + offset;
+}
+
+//Constructor, works out the coarse levels
+CMidpointDisplacement::CMidpointDisplacement(const MidpointSettings& settings)
+	: m_Settings(settings)
+{
+	if (settings.width < 2 || settings.height < 2)
+	{
+		throw std::runtime_error("Midpoint displacement needs a map of at least 2 x 2 samples");
+	}
+
+	//Smallest power of 2 that holds the map
+	m_Domain = 1;
+	while (m_Domain < std::max(settings.width, settings.height) - 1) m_Domain *= 2;
+	if (settings.bWrap && (settings.width != settings.height || settings.width - 1 != m_Domain))
+	{
+		throw std::runtime_error("A wrapping midpoint displacement map needs to be square with sides of 2^n + 1");
+	}
+
+	//Coarse samples a tile apart, further apart for very large maps so there are never more than 2049^2 of them
+	m_CoarseSpacing = std::min(m_Domain, CHeightField::TileSize);
+	while (m_Domain / m_CoarseSpacing > 2048) m_CoarseSpacing *= 2;
+	m_CoarseSide = m_Domain / m_CoarseSpacing + 1;
+	m_Coarse.resize(static_cast<size_t>(m_CoarseSide) * m_CoarseSide);
+
+	Window window;
+	window.unit = m_CoarseSpacing;
+	window.width = m_CoarseSide;
+	window.height = m_CoarseSide;
+	window.values = m_Coarse.data();
+
+	//Set the corners, then run every level down to the coarse spacing over the whole domain
+	for (int z : { 0, m_Domain })
+	{
+		for (int x : { 0, m_Domain })
+		{
+			window.At(x, z) = RandomRange(m_Settings.seed, Wrap(x), Wrap(z), ERandomStream::MidpointDisplacement, -settings.spread, settings.spread);
+		}
+	}
+	RunLevels(window, { 0, 0, m_Domain, m_Domain }, m_Domain, 2 * m_CoarseSpacing);
+}
+
+//Function to work out a rectangle of samples with the stride given
+void CMidpointDisplacement::GenerateRegion(int x0, int z0, int width, int height, float* out, int stride) const
+{
+	if (width <= 0 || height <= 0) return;
+
+	//Samples outside the map are clamped to its edges unless the map wraps
+	const int lastX = m_Settings.width - 1;
+	const int lastZ = m_Settings.height - 1;
+	auto column = [&](int x) { return m_Settings.bWrap ? x : std::min(std::max(x, 0), lastX); };
+	auto row = [&](int z) { return m_Settings.bWrap ? z : std::min(std::max(z, 0), lastZ); };
+	const Bounds needed = { column(x0), row(z0), column(x0 + width - 1), row(z0 + height - 1) };
+
+	//Coarse samples around the bounds, three coarse spacings out covers everything RunLevels reads
+	const int spacing = m_CoarseSpacing;
+	Window window;
+	window.x0 = AlignDown(needed.x0, spacing) - 3 * spacing;
+	window.z0 = AlignDown(needed.z0, spacing) - 3 * spacing;
+	int windowX1 = AlignUp(needed.x1, spacing, 0) + 3 * spacing;
+	int windowZ1 = AlignUp(needed.z1, spacing, 0) + 3 * spacing;
+	if (!m_Settings.bWrap)
+	{
+		window.x0 = std::max(window.x0, 0);
+		window.z0 = std::max(window.z0, 0);
+		windowX1 = std::min(windowX1, m_Domain);
+		windowZ1 = std::min(windowZ1, m_Domain);
+	}
+	window.width = windowX1 - window.x0 + 1;
+	window.height = windowZ1 - window.z0 + 1;
+
+	//Only the samples each level needs are written, so the rest of the window is left uninitialised
+	thread_local std::vector<float> samples;
+	samples.resize(static_cast<size_t>(window.width) * window.height);
+	window.values = samples.data();
+
+	for (int z = window.z0; z <= windowZ1; z += spacing)
+	{
+		const float* coarseRow = m_Coarse.data() + static_cast<size_t>(Wrap(z) / spacing) * m_CoarseSide;
+		for (int x = window.x0; x <= windowX1; x += spacing)
+		{
+			window.At(x, z) = coarseRow[Wrap(x) / spacing];
+		}
+	}
+
+	RunLevels(window, needed, spacing, 2);
+
+	for (int z = 0; z < height; ++z)
+	{
+		float* dest = out + static_cast<size_t>(z) * stride;
+		for (int x = 0; x < width; ++x)
+		{
+			dest[x] = window.At(column(x0 + x), row(z0 + z));
+		}
+	}
+}
+
+//Function to fill a heightfield with the whole map, spread over the thread pool
+void CMidpointDisplacement::Generate(CHeightField& field) const
+{
+	field.ResizeUninitialised(m_Settings.width, m_Settings.height);
+
+	//Blocks of tiles, large enough that the samples worked out around each block are a small part of it
+	const int BlockSize = 8 * CHeightField::TileSize;
+	const int blocksX = (m_Settings.width + BlockSize - 1) / BlockSize;
+	const int blocksZ = (m_Settings.height + BlockSize - 1) / BlockSize;
+	CThreadPool::Global().ParallelForDynamic(blocksX * blocksZ, [&](int index)
+	{
+		const int x0 = (index % blocksX) * BlockSize;
+		const int z0 = (index / blocksX) * BlockSize;
+		const int width = std::min(BlockSize, m_Settings.width - x0);
+		const int height = std::min(BlockSize, m_Settings.height - z0);
+
+		thread_local std::vector<float> block;
+		block.resize(static_cast<size_t>(width) * height);
+		GenerateRegion(x0, z0, width, height, block.data(), width);
+
+		//Blocks line up with the tiles, so no two workers write the same tile
+		field.WriteRegion(x0, z0, width, height, block.data(), width);
+	});
+}
+
+//Function to write the whole map to a tiled heightfield file, holding only a few blocks of it in memory at once
+bool CMidpointDisplacement::GenerateToFile(const std::string& path, CJobProgress* progress) const
+{
+	CHeightFieldFile file(path, m_Settings.width, m_Settings.height);
+
+	const int BlockSize = 16 * CHeightField::TileSize;
+	const int blocksX = (m_Settings.width + BlockSize - 1) / BlockSize;
+	const int blocksZ = (m_Settings.height + BlockSize - 1) / BlockSize;
+	const int blocks = blocksX * blocksZ;
+	if (progress) progress->AddWork(blocks);
+
+	//One block per worker at a time, written out before the next batch starts
+	CThreadPool& pool = CThreadPool::Global();
+	const int batchSize = pool.NumThreads();
+	std::vector<std::vector<float>> buffers(batchSize);
+	std::vector<float> tile(CHeightField::TileSamples);
+	for (int first = 0; first < blocks; first += batchSize)
+	{
+		if (progress && progress->IsCancelled()) return false;
+
+		const int count = std::min(batchSize, blocks - first);
+		pool.ParallelForDynamic(count, [&](int index)
+		{
+			const int block = first + index;
+			const int x0 = (block % blocksX) * BlockSize;
+			const int z0 = (block / blocksX) * BlockSize;
+			const int width = std::min(BlockSize, m_Settings.width - x0);
+			const int height = std::min(BlockSize, m_Settings.height - z0);
+			buffers[index].resize(static_cast<size_t>(width) * height);
+			GenerateRegion(x0, z0, width, height, buffers[index].data(), width);
+		});
+
+		//The file is written from this thread only, a tile at a time with the samples past the map set to 0
+		for (int index = 0; index < count; ++index)
+		{
+			const int block = first + index;
+			const int x0 = (block % blocksX) * BlockSize;
+			const int z0 = (block / blocksX) * BlockSize;
+			const int width = std::min(BlockSize, m_Settings.width - x0);
+			const int height = std::min(BlockSize, m_Settings.height - z0);
+			for (int tileZ = 0; tileZ * CHeightField::TileSize < height; ++tileZ)
+			{
+				for (int tileX = 0; tileX * CHeightField::TileSize < width; ++tileX)
+				{
+					const int tileWidth = std::min(CHeightField::TileSize, width - tileX * CHeightField::TileSize);
+					const int tileHeight = std::min(CHeightField::TileSize, height - tileZ * CHeightField::TileSize);
+					std::fill(tile.begin(), tile.end(), 0.0f);
+					for (int z = 0; z < tileHeight; ++z)
+					{
+						const float* source = buffers[index].data() + static_cast<size_t>(tileZ * CHeightField::TileSize + z) * width + tileX * CHeightField::TileSize;
+						std::copy(source, source + tileWidth, tile.data() + z * CHeightField::TileSize);
+					}
+					file.WriteTile((x0 >> CHeightField::TileShift) + tileX, (z0 >> CHeightField::TileShift) + tileZ, tile.data());
+				}
+			}
+			if (progress) progress->CompleteWork(1);
+		}
+	}
+
+	file.Flush();
+	return true;
+}
+
+//Function to run the square and diamond steps for every side length from sideFrom down to sideTo
+void CMidpointDisplacement::RunLevels(Window& window, const Bounds& needed, int sideFrom, int sideTo) const
+{
+	for (int side = sideFrom; side >= sideTo; side /= 2)
+	{
+		//A point reads points at most half a side away at each finer level, so everything the finer
+		//levels read is within two sides of the bounds. The diamonds on the edge of that read square
+		//centres another half side out
+		const float spread = LevelSpread(side);
+		SquareStep(window, needed.Grow(2 * side + side / 2), side, spread);
+		DiamondStep(window, needed.Grow(2 * side), side, spread);
+	}
+}
+
+//Function to fill the centre of every square of a level inside the bounds
+void CMidpointDisplacement::SquareStep(Window& window, const Bounds& bounds, int side, float spread) const
+{
+	//Centres whose corners are all in the window
+	const int half = side / 2;
+	const int x0 = AlignUp(std::max(bounds.x0, window.x0 + half), side, half);
+	const int z0 = AlignUp(std::max(bounds.z0, window.z0 + half), side, half);
+	const int x1 = AlignDown(std::min(bounds.x1, window.LastX() - half) - half, side) + half;
+	const int z1 = AlignDown(std::min(bounds.z1, window.LastZ() - half) - half, side) + half;
+	if (x1 < x0 || z1 < z0) return;
+
+	const int count = (x1 - x0) / side + 1;
+	const int rows = (z1 - z0) / side + 1;
+	const int step = side / window.unit;
+	CThreadPool::Global().ParallelFor(rows, [&](int begin, int end)
+	{
+		thread_local std::vector<float> offsets;
+		offsets.resize(count);
+		for (int row = begin; row < end; ++row)
+		{
+			const int z = z0 + row * side;
+			const float* top = &window.At(x0 - half, z - half);
+			const float* bottom = &window.At(x0 - half, z + half);
+			float* centre = &window.At(x0, z);
+
+			//Average of the corners plus a random value, the same as diamond-square
+			FillOffsets(x0, side, z, count, spread, offsets.data());
+			for (int i = 0; i < count; ++i)
+			{
+				const float avg = (top[i * step] + top[i * step + step] + bottom[i * step] + bottom[i * step + step]) * 0.25f;
+				centre[i * step] = std::abs(avg + offsets[i]);
+			}
+		}
+	});
+}
+
+//Function to fill the centre of every diamond of a level inside the bounds
+void CMidpointDisplacement::DiamondStep(Window& window, const Bounds& bounds, int side, float spread) const
+{
+	const int half = side / 2;
+	const int z0 = AlignUp(std::max(bounds.z0, window.z0), half, 0);
+	const int z1 = AlignDown(std::min(bounds.z1, window.LastZ()), half);
+	if (z1 < z0) return;
+
+	const int rows = (z1 - z0) / half + 1;
+	const int step = side / window.unit;
+	const int halfStep = half / window.unit;
+	CThreadPool::Global().ParallelFor(rows, [&](int begin, int end)
+	{
+		thread_local std::vector<float> offsets;
+		for (int row = begin; row < end; ++row)
+		{
+			//Diamonds are staggered, rows on the corners of the squares have them between the corners
+			const int z = z0 + row * half;
+			const int offset = AlignDown(z, side) == z ? half : 0;
+			const int x0 = AlignUp(std::max(bounds.x0, window.x0), side, offset);
+			const int x1 = AlignDown(std::min(bounds.x1, window.LastX()) - offset, side) + offset;
+			if (x1 < x0) continue;
+
+			const int count = (x1 - x0) / side + 1;
+			offsets.resize(count);
+			FillOffsets(x0, side, z, count, spread, offsets.data());
+
+			//Neighbours outside the window are outside the map (the bounds keep every other point
+			//far enough in), points on the edge of a map that doesn't wrap average the ones they have
+			const bool bAbove = z - half >= window.z0;
+			const bool bBelow = z + half <= window.LastZ();
+			float* centre = &window.At(x0, z);
+			const float* above = bAbove ? &window.At(x0, z - half) : nullptr;
+			const float* below = bBelow ? &window.At(x0, z + half) : nullptr;
+			auto edgeDiamond = [&](int i)
+			{
+				const int x = x0 + i * side;
+				float sum = 0.0f;
+				int neighbours = 0;
+				if (x - half >= window.x0) { sum += centre[i * step - halfStep]; ++neighbours; }
+				if (x + half <= window.LastX()) { sum += centre[i * step + halfStep]; ++neighbours; }
+				if (bAbove) { sum += above[i * step]; ++neighbours; }
+				if (bBelow) { sum += below[i * step]; ++neighbours; }
+				centre[i * step] = std::abs(sum / neighbours + offsets[i]);
+			};
+
+			const int first = x0 - half < window.x0 ? 1 : 0;
+			const int last = x1 + half > window.LastX() ? count - 1 : count;
+			if (first == 1) edgeDiamond(0);
+			if (bAbove && bBelow)
+			{
+				for (int i = first; i < last; ++i)
+				{
+					const float avg = (centre[i * step - halfStep] + centre[i * step + halfStep] + above[i * step] + below[i * step]) * 0.25f;
+					centre[i * step] = std::abs(avg + offsets[i]);
+				}
+			}
+			else
+			{
+				for (int i = first; i < last; ++i) edgeDiamond(i);
+			}
+			if (last < count && !(first == 1 && count == 1)) edgeDiamond(count - 1);
+		}
+	});
+}
+
+//Function to fill a row of random offsets for points x0, x0 + step... on row z
+void CMidpointDisplacement::FillOffsets(int x0, int step, int z, int count, float spread, float* out) const
+{
+	//Batches need the coordinates to go up in steps, so rows that wrap across the edge of the domain go one point at a time
+	const int lastX = x0 + (count - 1) * step;
+	if (!m_Settings.bWrap || (x0 >= 0 && lastX < m_Domain))
+	{
+		RandomRangeBatch(m_Settings.seed, x0, step, Wrap(z), ERandomStream::MidpointDisplacement, count, -spread, spread, out);
+		return;
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		out[i] = RandomRange(m_Settings.seed, Wrap(x0 + i * step), Wrap(z), ERandomStream::MidpointDisplacement, -spread, spread);
+	}
+}
+
+//Largest random offset of a level, divided by the reduction once for every level above it
+float CMidpointDisplacement::LevelSpread(int side) const
+{
+	float spread = m_Settings.spread;
+	for (int level = m_Domain; level > side; level /= 2) spread /= m_Settings.spreadReduction;
+	return spread;
+}
@@ -0,0 +1,119 @@
+//--------------------------------------------------------------------------------------
+// Tiled midpoint displacement for maps of any size, including maps larger than memory
+//--------------------------------------------------------------------------------------
+// The map is placed in a square of 2^n samples (the domain) and built with the same square
+// and diamond steps as diamond-square, but it is split into two parts:
+//  - The coarse levels, down to a spacing of CoarseSpacing samples, are worked out over the
+//    whole domain when the generator is made. Only one sample in CoarseSpacing^2 is kept, so
+//    this stays small however large the map is.
+//  - The fine levels are worked out for any rectangle on its own. A point only depends on
+//    points less than CoarseSpacing away, so each rectangle is worked out from the coarse
+//    samples around it and only as much of each level as the rectangle needs.
+// Random offsets come from the counter-based generator keyed by the point's coordinates and
+// every point is worked out from the same inputs in the same order wherever it is asked
+// for, so rectangles that share an edge always agree on it bit for bit.
+//
+// Maps don't wrap unless asked to: points on the edge of the domain average the neighbours
+// they have. Wrapping maps tile with themselves, so they need to be square with sides of
+// 2^n + 1 like diamond-square. Maps of any other size are cut from the corner of the domain.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Utility/CJobProgress.h"
+
+//Settings of a midpoint displacement map
+struct MidpointSettings
+{
+	int width = 257;
+	int height = 257;
+	float spread = 30.0f;           //Largest random offset, at the coarsest level
+	float spreadReduction = 2.0f;   //Amount the spread is divided by at each finer level
+	unsigned int seed = 0;
+	bool bWrap = false;             //Whether the map tiles with itself
+};
+
+class CMidpointDisplacement
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Constructor, works out the coarse levels. Throws std::runtime_error if the settings can't be used
+	CMidpointDisplacement(const MidpointSettings& settings);
+
+	const MidpointSettings& Settings() const { return m_Settings; }
+
+	//Spacing of the samples worked out up front, the fine levels are worked out per rectangle
+	int CoarseSpacing() const { return m_CoarseSpacing; }
+
+	//Function to work out a rectangle of samples with the stride given. Samples outside the map are
+	//clamped to its edges, or wrap if the map wraps. Can be called from any number of threads at once
+	void GenerateRegion(int x0, int z0, int width, int height, float* out, int stride) const;
+
+	//Function to fill a heightfield with the whole map, spread over the thread pool
+	void Generate(CHeightField& field) const;
+
+	//Function to write the whole map to a tiled heightfield file, holding only a few blocks of it
+	//in memory at once. Returns false if cancelled. Throws std::runtime_error if the file can't be written
+	bool GenerateToFile(const std::string& path, CJobProgress* progress = nullptr) const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Samples being worked out, one every unit samples from (x0, z0)
+	struct Window
+	{
+		int x0 = 0;
+		int z0 = 0;
+		int unit = 1;
+		int width = 0;
+		int height = 0;
+		float* values = nullptr;
+
+		float& At(int x, int z) { return values[static_cast<size_t>((z - z0) / unit) * width + (x - x0) / unit]; }
+		int LastX() const { return x0 + (width - 1) * unit; }
+		int LastZ() const { return z0 + (height - 1) * unit; }
+	};
+
+	//Inclusive bounds of the points a level has to work out
+	struct Bounds
+	{
+		int x0, z0, x1, z1;
+
+		Bounds Grow(int amount) const { return { x0 - amount, z0 - amount, x1 + amount, z1 + amount }; }
+	};
+
+	//Function to run the square and diamond steps for every side length from sideFrom down to sideTo
+	void RunLevels(Window& window, const Bounds& needed, int sideFrom, int sideTo) const;
+
+	//Function to fill the centre of every square of a level inside the bounds
+	void SquareStep(Window& window, const Bounds& bounds, int side, float spread) const;
+
+	//Function to fill the centre of every diamond of a level inside the bounds
+	void DiamondStep(Window& window, const Bounds& bounds, int side, float spread) const;
+
+	//Function to fill a row of random offsets for points x0, x0 + step... on row z
+	void FillOffsets(int x0, int step, int z, int count, float spread, float* out) const;
+
+	//Largest random offset of a level
+	float LevelSpread(int side) const;
+
+	//Coordinate inside the domain, the same coordinate unless the map wraps
+	int Wrap(int coordinate) const { return m_Settings.bWrap ? ((coordinate % m_Domain) + m_Domain) % m_Domain : coordinate; }
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	MidpointSettings m_Settings;
+
+	//Side of the square the levels are worked out over, a power of 2
+	int m_Domain = 0;
+
+	//Spacing of the samples worked out up front, and the samples along each side of them
+	int m_CoarseSpacing = 0;
+	int m_CoarseSide = 0;
+	std::vector<float> m_Coarse;
+};
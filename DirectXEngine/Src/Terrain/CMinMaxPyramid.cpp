@@ -0,0 +1,145 @@
+#include "CMinMaxPyramid.h"
+#include "Utility/CThreadPool.h"
+#include <limits>
+
+//Function to build every level from a heightfield
+void CMinMaxPyramid::Build(const CHeightField& field)
+{
+	m_Levels.clear();
+	if (field.TileCount() == 0) return;
+
+	//One level per halving of the tile grid, down to a single cell
+	int width = field.TilesX();
+	int height = field.TilesZ();
+	while (true)
+	{
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.cells.resize(static_cast<size_t>(width) * height);
+		m_Levels.push_back(std::move(level));
+
+		if (width == 1 && height == 1) break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+
+	std::vector<int> tiles(field.TileCount());
+	std::iota(tiles.begin(), tiles.end(), 0);
+	Update(field, tiles);
+}
+
+//Function to update the cells covering the tiles given (indices tileZ * TilesX + tileX), rebuilding if the size has changed
+void CMinMaxPyramid::Update(const CHeightField& field, const std::vector<int>& tiles)
+{
+	if (m_Levels.empty() || m_Levels[0].width != field.TilesX() || m_Levels[0].height != field.TilesZ())
+	{
+		if (field.TileCount() > 0 && !tiles.empty()) Build(field);
+		return;
+	}
+
+	//Tiles are independent, so the bottom level is split over the workers
+	Level& bottom = m_Levels[0];
+	CThreadPool::Global().ParallelFor(static_cast<int>(tiles.size()), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			bottom.cells[tiles[i]] = TileRange(field, tiles[i] % bottom.width, tiles[i] / bottom.width);
+		}
+	});
+
+	//Only the parents of changed cells are reduced on each level above
+	std::vector<int> changed = tiles;
+	for (int level = 1; level < NumLevels(); ++level)
+	{
+		const int childWidth = m_Levels[level - 1].width;
+		std::vector<int> parents;
+		parents.reserve(changed.size());
+		for (int cell : changed)
+		{
+			parents.push_back(((cell / childWidth) / 2) * m_Levels[level].width + (cell % childWidth) / 2);
+		}
+		std::sort(parents.begin(), parents.end());
+		parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+
+		for (int cell : parents)
+		{
+			Reduce(level, cell % m_Levels[level].width, cell / m_Levels[level].width);
+		}
+		changed = std::move(parents);
+	}
+}
+
+//Function to get the range of the tiles overlapping a rectangle of samples
+CMinMaxPyramid::Range CMinMaxPyramid::RegionRange(int x0, int z0, int width, int height) const
+{
+	Range range;
+	if (m_Levels.empty() || width <= 0 || height <= 0) return range;
+
+	const Level& bottom = m_Levels[0];
+	const int firstX = std::max(x0 >> CHeightField::TileShift, 0);
+	const int firstZ = std::max(z0 >> CHeightField::TileShift, 0);
+	const int lastX = std::min((x0 + width - 1) >> CHeightField::TileShift, bottom.width - 1);
+	const int lastZ = std::min((z0 + height - 1) >> CHeightField::TileShift, bottom.height - 1);
+
+	range.min = std::numeric_limits<float>::max();
+	range.max = -std::numeric_limits<float>::max();
+	for (int z = firstZ; z <= lastZ; ++z)
+	{
+		for (int x = firstX; x <= lastX; ++x)
+		{
+			const Range& cell = bottom.cells[z * bottom.width + x];
+			range.min = std::min(range.min, cell.min);
+			range.max = std::max(range.max, cell.max);
+		}
+	}
+	return range;
+}
+
+//Memory used by the cells of every level in bytes
+size_t CMinMaxPyramid::MemoryUsage() const
+{
+	size_t bytes = 0;
+	for (const Level& level : m_Levels) bytes += level.cells.capacity() * sizeof(Range);
+	return bytes;
+}
+
+//Function to work out the range of one tile
+CMinMaxPyramid::Range CMinMaxPyramid::TileRange(const CHeightField& field, int tileX, int tileZ)
+{
+	const float* tile = field.Tile(tileX, tileZ);
+	const int width = field.TileWidth(tileX);
+	const int height = field.TileHeight(tileZ);
+
+	Range range;
+	range.min = range.max = tile[0];
+	for (int z = 0; z < height; ++z)
+	{
+		const float* row = tile + z * CHeightField::TileSize;
+		for (int x = 0; x < width; ++x)
+		{
+			range.min = std::min(range.min, row[x]);
+			range.max = std::max(range.max, row[x]);
+		}
+	}
+	return range;
+}
+
+//Function to work out the range of a cell from the 2x2 cells under it
+void CMinMaxPyramid::Reduce(int level, int x, int z)
+{
+	const Level& below = m_Levels[level - 1];
+	Range& range = m_Levels[level].cells[z * m_Levels[level].width + x];
+	range = below.cells[(2 * z) * below.width + 2 * x];
+
+	//Cells on the right and bottom edges may only have one child in that direction
+	for (int childZ = 2 * z; childZ < std::min(2 * z + 2, below.height); ++childZ)
+	{
+		for (int childX = 2 * x; childX < std::min(2 * x + 2, below.width); ++childX)
+		{
+			const Range& child = below.cells[childZ * below.width + childX];
+			range.min = std::min(range.min, child.min);
+			range.max = std::max(range.max, child.max);
+		}
+	}
+}
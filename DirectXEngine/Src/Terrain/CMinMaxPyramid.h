@@ -0,0 +1,73 @@
+//--------------------------------------------------------------------------------------
+// Pyramid of the lowest and highest heights of a heightfield
+//--------------------------------------------------------------------------------------
+// Level 0 holds the range of each heightfield tile, and each level above holds the range
+// of 2x2 cells of the level below, up to a single cell for the whole heightfield. It gives
+// quick bounds for any part of the terrain (culling, LOD, mask tests) and is updated for
+// the dirty tiles of the heightfield only.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+
+class CMinMaxPyramid
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Lowest and highest height of a cell
+	struct Range
+	{
+		float min = 0.0f;
+		float max = 0.0f;
+	};
+
+	//Function to build every level from a heightfield
+	void Build(const CHeightField& field);
+
+	//Function to update the cells covering the tiles given (indices tileZ * TilesX + tileX), rebuilding if the size has changed
+	void Update(const CHeightField& field, const std::vector<int>& tiles);
+
+	//Number of levels, 0 before the pyramid is built
+	int NumLevels() const { return static_cast<int>(m_Levels.size()); }
+
+	//Number of cells along each side of a level
+	int LevelWidth(int level) const { return m_Levels[level].width; }
+	int LevelHeight(int level) const { return m_Levels[level].height; }
+
+	//Range of a cell of a level
+	const Range& Cell(int level, int x, int z) const { return m_Levels[level].cells[z * m_Levels[level].width + x]; }
+
+	//Range of the whole heightfield
+	Range Total() const { return m_Levels.empty() ? Range() : m_Levels.back().cells[0]; }
+
+	//Function to get the range of the tiles overlapping a rectangle of samples
+	Range RegionRange(int x0, int z0, int width, int height) const;
+
+	//Memory used by the cells of every level in bytes
+	size_t MemoryUsage() const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	struct Level
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<Range> cells;
+	};
+
+	//Function to work out the range of one tile
+	static Range TileRange(const CHeightField& field, int tileX, int tileZ);
+
+	//Function to work out the range of a cell from the 2x2 cells under it
+	void Reduce(int level, int x, int z);
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	std::vector<Level> m_Levels;
+};
@@ -0,0 +1,121 @@
+#include "CSpectralSynthesis.h"
+#include "Math/RandomHelpers.h"
+#include "Math/MathHelpers.h"
+
+//Constructor
+CSpectralSynthesis::CSpectralSynthesis(const SpectralSettings& settings) : m_Settings(settings)
+{
+	if (settings.beta < 0.0f || settings.amplitude < 0.0f)
+	{
+		throw std::runtime_error("Spectral synthesis needs a beta and amplitude of at least zero");
+	}
+
+	m_Directions.resize(1 << DirectionBits);
+	for (int i = 0; i < (1 << DirectionBits); ++i)
+	{
+		const double angle = 2.0 * 3.14159265358979323846 * i / (1 << DirectionBits);
+		m_Directions[i] = CFourierTransform::Complex(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+	}
+}
+
+//Function to fill a square heightfield with sides of 2^n + 1 with the map
+void CSpectralSynthesis::Generate(CHeightField& field, CThreadPool& pool, CJobProgress* progress) const
+{
+	const int size = field.Width() - 1;
+	if (field.Width() != field.Height() || size < 4 || (size & (size - 1)) != 0)
+	{
+		throw std::runtime_error("Spectral synthesis needs a square heightfield with sides of 2^n + 1");
+	}
+
+	CFourierTransform transform(size);
+	const int halfWidth = transform.HalfWidth();
+	const int half = size / 2;
+
+	std::unique_ptr<CFourierTransform::Complex[]> spectrum(new CFourierTransform::Complex[static_cast<size_t>(size) * halfWidth]);
+	pool.ParallelFor(size, [&](int begin, int end)
+	{
+		for (int kz = begin; kz < end; ++kz)
+		{
+			FillSpectrumRow(spectrum.get() + static_cast<size_t>(kz) * halfWidth, kz, size);
+		}
+	});
+
+	//The columns for x frequencies 0 and size / 2 are their own mirror images, so the lower half of each
+	//is the conjugate of the upper half, and the frequencies that are their own mirror are real
+	for (int column : { 0, half })
+	{
+		for (int kz = half + 1; kz < size; ++kz)
+		{
+			spectrum[static_cast<size_t>(kz) * halfWidth + column] = std::conj(spectrum[static_cast<size_t>(size - kz) * halfWidth + column]);
+		}
+		for (int kz : { 0, half })
+		{
+			CFourierTransform::Complex& value = spectrum[static_cast<size_t>(kz) * halfWidth + column];
+			value = CFourierTransform::Complex(value.real(), 0.0f);
+		}
+	}
+
+	if (progress && progress->IsCancelled()) return;
+
+	//The map wraps, so the extra row and column of the heightfield repeat the first ones
+	const int width = size + 1;
+	std::unique_ptr<float[]> values(new float[static_cast<size_t>(width) * width]);
+	transform.InverseReal(spectrum.get(), values.get(), width, pool);
+	spectrum.reset();
+	if (progress && progress->IsCancelled()) return;
+
+	for (int z = 0; z < size; ++z)
+	{
+		values[static_cast<size_t>(z) * width + size] = values[static_cast<size_t>(z) * width];
+	}
+	std::copy(values.get(), values.get() + width, values.get() + static_cast<size_t>(size) * width);
+
+	//Copy into the tiles a band of tile rows per worker, no two workers touch the same tile
+	pool.ParallelFor(field.TilesZ(), [&](int begin, int end)
+	{
+		const int z0 = begin << CHeightField::TileShift;
+		const int z1 = std::min(end << CHeightField::TileShift, width);
+		field.WriteRegion(0, z0, width, z1 - z0, values.get() + static_cast<size_t>(z0) * width, width);
+	});
+}
+
+//Function to give every frequency of a row of the half spectrum its random value
+void CSpectralSynthesis::FillSpectrumRow(CFourierTransform::Complex* row, int kz, int size) const
+{
+	const int halfWidth = size / 2 + 1;
+	thread_local std::vector<uint32_t> bits;
+	bits.resize(halfWidth);
+
+	//Rows past the middle are the negative frequencies. Values are keyed by the frequency rather than the row,
+	//so every size gives the same value to the same frequency
+	const int frequencyZ = kz <= size / 2 ? kz : kz - size;
+	RandomBitsBatch(m_Settings.seed, 0, 1, frequencyZ, ERandomStream::Spectral, halfWidth, bits.data());
+
+	const float fz = static_cast<float>(frequencyZ);
+	const float exponent = -0.25f * m_Settings.beta;
+	for (int kx = 0; kx < halfWidth; ++kx)
+	{
+		const float frequencySquared = static_cast<float>(kx) * kx + fz * fz;
+		if (frequencySquared == 0.0f)
+		{
+			//No average height, the map is centred on zero
+			row[kx] = CFourierTransform::Complex(0.0f, 0.0f);
+			continue;
+		}
+
+		//Box-Muller turns two uniform numbers into a complex normal value, with a uniform angle. The random bits
+		//are the slow part, so both numbers come from one set of 32 bits, 16 bits each. The radius number is moved
+		//into (0, 1] so the log is never of zero, which cuts the normal values off past 4.7 standard deviations
+		const float uniform = static_cast<float>((bits[kx] >> 16) + 1) * (1.0f / 65536.0f);
+		const float radius = std::sqrt(-2.0f * std::log(uniform)) * m_Settings.amplitude * std::exp(exponent * std::log(frequencySquared));
+
+		//The top bits of the angle pick a direction from the table, the rest turn it by a tiny angle where
+		//the first terms of the series for sin and cos are exact in floats
+		const uint32_t angle = bits[kx] & 0xFFFF;
+		const CFourierTransform::Complex direction = m_Directions[angle >> DirectionFractionBits];
+		const float turn = static_cast<float>(angle & ((1u << DirectionFractionBits) - 1)) * (2.0f * PI / 65536.0f);
+		const float turnCos = 1.0f - 0.5f * turn * turn;
+		const float turnSin = turn - turn * turn * turn * (1.0f / 6.0f);
+		row[kx] = CFourierTransform::Complex(radius * (direction.real() * turnCos - direction.imag() * turnSin), radius * (direction.real() * turnSin + direction.imag() * turnCos));
+	}
+}
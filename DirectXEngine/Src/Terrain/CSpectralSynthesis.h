@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// Spectral synthesis of fractal terrain with an inverse Fourier transform
+//--------------------------------------------------------------------------------------
+// Fractal terrain has a power spectrum that falls off as 1 / f^beta: long wavelengths have
+// large amplitudes and short ones small amplitudes. Instead of adding up octaves of noise,
+// every frequency of the map is given a random complex value (white noise) scaled by
+// f^(-beta / 2), then the whole spectrum is turned into heights with one inverse FFT. The
+// time is O(n log n) in the number of samples and doesn't depend on how many octaves of
+// detail there are.
+//
+// The random value of each frequency comes from the counter-based generator keyed by the
+// frequency, so the map is the same whatever the number of threads, and maps of different
+// sizes with the same seed share their long wavelengths. Every frequency is a whole number
+// of waves across the map, so the map wraps: the last row and column repeat the first and
+// the map tiles with itself. Like diamond-square it needs a square heightfield with sides of
+// 2^n + 1.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Math/CFourierTransform.h"
+#include "Utility/CJobProgress.h"
+#include "Utility/CThreadPool.h"
+
+//Settings of a spectral synthesis map
+struct SpectralSettings
+{
+	float beta = 2.2f;              //Fall off of the power spectrum, higher is smoother
+	float amplitude = 2.0f;         //Amplitude of the waves that fit once across the map
+	unsigned int seed = 0;
+};
+
+class CSpectralSynthesis
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Constructor. Throws std::runtime_error if the settings can't be used
+	CSpectralSynthesis(const SpectralSettings& settings);
+
+	const SpectralSettings& Settings() const { return m_Settings; }
+
+	//Function to fill a square heightfield with sides of 2^n + 1 with the map, spread over the thread pool.
+	//Throws std::runtime_error if the heightfield isn't that size. The job is checked for cancellation between
+	//making the spectrum and transforming it, a cancelled run leaves the heightfield as it was
+	void Generate(CHeightField& field, CThreadPool& pool = CThreadPool::Global(), CJobProgress* progress = nullptr) const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Function to give every frequency of a row of the half spectrum its random value, z frequency kz
+	void FillSpectrumRow(CFourierTransform::Complex* row, int kz, int size) const;
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	//The 16 bits of each random angle are split into a direction from the table and a small turn from it
+	static constexpr int DirectionBits = 10;
+	static constexpr int DirectionFractionBits = 16 - DirectionBits;
+
+	SpectralSettings m_Settings;
+
+	//Unit complex numbers at every angle the top bits of a random angle can pick
+	std::vector<CFourierTransform::Complex> m_Directions;
+};
@@ -0,0 +1,235 @@
+#include "CStampGenerator.h"
+#include "Math/RandomHelpers.h"
+#include "Math/MathHelpers.h"
+
+//Smooth step from 0 at edge0 to 1 at edge1
+static float SmoothStep(float edge0, float edge1, float x)
+{
+	const float t = std::min(std::max((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+	return t * t * (3.0f - 2.0f * t);
+}
+
+//Constructor, makes the stamp heightmaps, places every stamp and bins them
+CStampGenerator::CStampGenerator(const StampSettings& settings) : m_Settings(settings)
+{
+	if (settings.count < 0 || settings.width < 1 || settings.height < 1 || settings.minRadius < 1.0f || settings.maxRadius < settings.minRadius)
+	{
+		throw std::runtime_error("Stamps need a size of at least 1 and radii of at least 1 sample, smallest first");
+	}
+
+	std::vector<int> shapes;
+	for (int shape = 0; shape < static_cast<int>(EStampShape::Count); ++shape)
+	{
+		if (settings.bShapes[shape]) shapes.push_back(shape);
+	}
+	if (shapes.empty()) throw std::runtime_error("Stamps need at least one shape to place");
+
+	const CPerlinNoise noise(settings.seed);
+	m_Shapes.assign(static_cast<size_t>(EStampShape::Count) * StampStride * StampStride, 0.0f);
+	for (int shape = 0; shape < static_cast<int>(EStampShape::Count); ++shape)
+	{
+		MakeShape(static_cast<EStampShape>(shape), noise, m_Shapes.data() + static_cast<size_t>(shape) * StampStride * StampStride);
+	}
+
+	//Radii are spread evenly on a log scale, so there are as many small features as each size up
+	const float radiusRatio = std::log(settings.maxRadius / settings.minRadius);
+	m_Stamps.resize(settings.count);
+	for (int i = 0; i < settings.count; ++i)
+	{
+		Stamp& stamp = m_Stamps[i];
+		stamp.centreX = RandomRange(settings.seed, i, 0, ERandomStream::StampX, 0.0f, static_cast<float>(settings.width));
+		stamp.centreZ = RandomRange(settings.seed, i, 0, ERandomStream::StampZ, 0.0f, static_cast<float>(settings.height));
+		stamp.radius = settings.minRadius * std::exp(radiusRatio * RandomFloat(settings.seed, i, 0, ERandomStream::StampRadius));
+		stamp.height = stamp.radius * settings.heightPerRadius * RandomRange(settings.seed, i, 0, ERandomStream::StampHeight, 0.6f, 1.4f);
+		stamp.shape = shapes[RandomInt(settings.seed, i, 0, ERandomStream::StampShape, 0, static_cast<int>(shapes.size()) - 1)];
+
+		//The stamp spans StampSize - 1 texels across its diameter
+		const float angle = RandomRange(settings.seed, i, 0, ERandomStream::StampAngle, 0.0f, 2.0f * PI);
+		const float texelsPerSample = (StampSize - 1) / (2.0f * stamp.radius);
+		stamp.cosStep = std::cos(angle) * texelsPerSample;
+		stamp.sinStep = std::sin(angle) * texelsPerSample;
+	}
+
+	//Every cell a stamp's circle overlaps gets the stamp. Sorting by cell then stamp lays out the run of each cell
+	//in the order the stamps were placed
+	std::vector<std::pair<uint64_t, int>> binned;
+	binned.reserve(static_cast<size_t>(settings.count) * 4);
+	for (int i = 0; i < settings.count; ++i)
+	{
+		const Stamp& stamp = m_Stamps[i];
+		const int cellX0 = static_cast<int>(std::floor(stamp.centreX - stamp.radius)) >> CellShift;
+		const int cellX1 = static_cast<int>(std::floor(stamp.centreX + stamp.radius)) >> CellShift;
+		const int cellZ0 = static_cast<int>(std::floor(stamp.centreZ - stamp.radius)) >> CellShift;
+		const int cellZ1 = static_cast<int>(std::floor(stamp.centreZ + stamp.radius)) >> CellShift;
+		for (int cellZ = cellZ0; cellZ <= cellZ1; ++cellZ)
+		{
+			for (int cellX = cellX0; cellX <= cellX1; ++cellX)
+			{
+				binned.emplace_back(CellKey(cellX, cellZ), i);
+			}
+		}
+	}
+	std::sort(binned.begin(), binned.end());
+
+	m_BinStamps.resize(binned.size());
+	m_Cells.reserve(binned.size() / 2 + 1);
+	for (size_t i = 0; i < binned.size(); ++i)
+	{
+		m_BinStamps[i] = binned[i].second;
+		auto cell = m_Cells.emplace(binned[i].first, std::make_pair(static_cast<int>(i), static_cast<int>(i)));
+		cell.first->second.second = static_cast<int>(i) + 1;
+	}
+}
+
+//Function to blend every stamp onto a rectangle of heights in place
+void CStampGenerator::Apply(int x0, int z0, int width, int height, float* values, int stride) const
+{
+	//Each part of the rectangle in a cell is blended with that cell's stamps only, so no sample sees a stamp twice
+	const int cellX0 = x0 >> CellShift, cellX1 = (x0 + width - 1) >> CellShift;
+	const int cellZ0 = z0 >> CellShift, cellZ1 = (z0 + height - 1) >> CellShift;
+	for (int cellZ = cellZ0; cellZ <= cellZ1; ++cellZ)
+	{
+		for (int cellX = cellX0; cellX <= cellX1; ++cellX)
+		{
+			auto cell = m_Cells.find(CellKey(cellX, cellZ));
+			if (cell == m_Cells.end()) continue;
+
+			const int partX0 = std::max(x0, cellX * CellSize);
+			const int partX1 = std::min(x0 + width, (cellX + 1) * CellSize);
+			const int partZ0 = std::max(z0, cellZ * CellSize);
+			const int partZ1 = std::min(z0 + height, (cellZ + 1) * CellSize);
+			float* part = values + static_cast<size_t>(partZ0 - z0) * stride + (partX0 - x0);
+			for (int i = cell->second.first; i < cell->second.second; ++i)
+			{
+				BlendStamp(m_Stamps[m_BinStamps[i]], partX0, partZ0, partX1, partZ1, part, stride);
+			}
+		}
+	}
+}
+
+//Function to work out the heightmap of a shape, zero outside its circle
+void CStampGenerator::MakeShape(EStampShape shape, const CPerlinNoise& noise, float* texels)
+{
+	for (int j = 0; j < StampSize; ++j)
+	{
+		for (int i = 0; i < StampSize; ++i)
+		{
+			//(u, v) runs from -1 to 1 across the stamp
+			const float u = 2.0f * i / (StampSize - 1) - 1.0f;
+			const float v = 2.0f * j / (StampSize - 1) - 1.0f;
+			const float r = std::sqrt(u * u + v * v);
+			if (r >= 1.0f) continue;
+
+			float value = 0.0f;
+			if (shape == EStampShape::Mountain)
+			{
+				//A rounded cone with ridges running down it from the noise
+				const float ridges = 1.0f - std::abs(static_cast<float>(noise.noise(u * 3.0, 0.5, v * 3.0)));
+				value = SmoothStep(0.0f, 1.0f, 1.0f - r) * (0.7f + 0.3f * ridges);
+			}
+			else if (shape == EStampShape::Crater)
+			{
+				//A bowl below the ground inside a raised rim, fading out past the rim
+				const float bowl = r < 0.7f ? -0.5f * (1.0f - (r * r) / (0.7f * 0.7f)) : 0.0f;
+				const float rim = 0.4f * std::exp(-((r - 0.7f) * (r - 0.7f)) / (0.15f * 0.15f));
+				value = (bowl + rim) * (1.0f - SmoothStep(0.85f, 1.0f, r));
+			}
+			else
+			{
+				//Flat top with steep sides
+				value = 0.5f * (1.0f - SmoothStep(0.55f, 0.8f, r));
+			}
+			texels[(j + StampBorder) * StampStride + i + StampBorder] = value;
+		}
+	}
+}
+
+//Function to blend a stamp onto the samples of a rectangle that it covers, values is the sample at (x0, z0)
+void CStampGenerator::BlendStamp(const Stamp& stamp, int x0, int z0, int x1, int z1, float* values, int stride) const
+{
+	const int rowFirst = std::max(z0, static_cast<int>(std::ceil(stamp.centreZ - stamp.radius)));
+	const int rowLast = std::min(z1 - 1, static_cast<int>(std::floor(stamp.centreZ + stamp.radius)));
+	if (rowFirst > rowLast) return;
+
+	const float* texels = m_Shapes.data() + static_cast<size_t>(stamp.shape) * StampStride * StampStride;
+	const float middle = StampBorder + 0.5f * (StampSize - 1);
+
+	thread_local std::vector<int> indices;
+	thread_local std::vector<float> weightsX, weightsZ, heights;
+
+	for (int z = rowFirst; z <= rowLast; ++z)
+	{
+		//Samples of the row inside the circle
+		const float dz = z - stamp.centreZ;
+		const float halfSpan = std::sqrt(std::max(stamp.radius * stamp.radius - dz * dz, 0.0f));
+		const int spanFirst = static_cast<int>(std::ceil(stamp.centreX - halfSpan));
+		const int first = std::max(x0, spanFirst);
+		const int last = std::min(x1 - 1, static_cast<int>(std::floor(stamp.centreX + halfSpan)));
+		const int count = last - first + 1;
+		if (count <= 0) continue;
+
+		indices.resize(count);
+		weightsX.resize(count);
+		weightsZ.resize(count);
+		heights.resize(count);
+		int* index = indices.data();
+		float* weightX = weightsX.data();
+		float* weightZ = weightsZ.data();
+		float* rowHeights = heights.data();
+
+		//Texel of the first sample of the row in the circle, each sample after it is the same step further through
+		//the turned stamp. Steps are counted from there wherever the rectangle starts, so every sample is worked out
+		//the same way however the heightfield is split up. Samples are inside the circle, so rounding can only take
+		//them a fraction of a texel into the border
+		const float dx = spanFirst - stamp.centreX;
+		const float texelX0 = middle + dx * stamp.cosStep + dz * stamp.sinStep;
+		const float texelZ0 = middle - dx * stamp.sinStep + dz * stamp.cosStep;
+		const float stepX = stamp.cosStep;
+		const float stepZ = -stamp.sinStep;
+		const int skipped = first - spanFirst;
+		for (int i = 0; i < count; ++i)
+		{
+			const float steps = static_cast<float>(skipped + i);
+			const float texelX = texelX0 + steps * stepX;
+			const float texelZ = texelZ0 + steps * stepZ;
+			const int ix = static_cast<int>(texelX);
+			const int iz = static_cast<int>(texelZ);
+			index[i] = iz * StampStride + ix;
+			weightX[i] = texelX - ix;
+			weightZ[i] = texelZ - iz;
+		}
+
+		//Bilinear reads of the four texels around each sample
+		for (int i = 0; i < count; ++i)
+		{
+			const float* texel = texels + index[i];
+			const float top = texel[0] + (texel[1] - texel[0]) * weightX[i];
+			const float bottom = texel[StampStride] + (texel[StampStride + 1] - texel[StampStride]) * weightX[i];
+			rowHeights[i] = (top + (bottom - top) * weightZ[i]) * stamp.height;
+		}
+
+		float* row = values + static_cast<size_t>(z - z0) * stride + (first - x0);
+		switch (m_Settings.blend)
+		{
+		case EStampBlend::Add:
+			for (int i = 0; i < count; ++i) row[i] += rowHeights[i];
+			break;
+		case EStampBlend::Max:
+			//The part above zero is raised to, the part below is cut in
+			for (int i = 0; i < count; ++i) row[i] = std::max(row[i], std::max(rowHeights[i], 0.0f)) + std::min(rowHeights[i], 0.0f);
+			break;
+		case EStampBlend::SmoothMax:
+			//Polynomial smooth maximum with the part above zero, the larger height plus a rounded bump where the two are
+			//closer than the width. The width is a part of the stamp's height there, so the bump fades out with the stamp
+			//at its edge. The part below zero is cut in
+			for (int i = 0; i < count; ++i)
+			{
+				const float raised = std::max(rowHeights[i], 0.0f);
+				const float width = m_Settings.smoothness * raised;
+				const float h = std::max(width - std::abs(row[i] - raised), 0.0f) / std::max(width, 1e-6f);
+				row[i] = std::max(row[i], raised) + h * h * width * 0.25f + std::min(rowHeights[i], 0.0f);
+			}
+			break;
+		}
+	}
+}
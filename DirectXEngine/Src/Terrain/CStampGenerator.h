@@ -0,0 +1,131 @@
+//--------------------------------------------------------------------------------------
+// Thousands of heightmap stamps (mountains, craters, mesas) scattered over the terrain
+//--------------------------------------------------------------------------------------
+// A stamp is a small heightmap of a feature, worked out once when the generator is made.
+// Each placed stamp has a random position, radius, height, rotation and shape from the
+// counter-based generator keyed by its index, so the same seed always places the same
+// stamps. Stamps are blended onto the heights under them by adding, by taking the larger
+// height, or by a smooth maximum that rounds off the crease where two features meet.
+// The parts of a stamp below zero (the bowl of a crater) are always cut into the heights
+// under them: the larger height would never let them show, and the smaller height would
+// drop the bowl to the stamp's own height wherever the ground isn't at zero, leaving a
+// cliff where the bowl meets the rim.
+//
+// The stamps are binned into cells of one heightfield tile with a spatial hash, each
+// stamp in every cell its circle overlaps. A rectangle of samples only looks up the cells
+// it overlaps and only blends the stamps in them, so the work is the area the stamps
+// cover rather than stamps x tiles. Every sample is blended with the stamps of its own
+// cell in the order they were placed, so the result is the same however the heightfield
+// is split up and whatever the number of threads, even for the smooth maximum (which
+// depends on the order).
+//
+// The stamp is sampled along each row of its circle. Moving one sample along the row
+// moves the same step through the rotated stamp, so the texel coordinates and weights of
+// the whole row are worked out first with plain float loops the compiler vectorises, then
+// the texels are read and blended. Stamps are zero outside their circle and have a border
+// of zeros, so no sample needs clamping or a bounds check.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Math/CPerlinNoise.h"
+#include <unordered_map>
+
+//Features a stamp can be
+enum class EStampShape
+{
+	Mountain,
+	Crater,
+	Mesa,
+	Count
+};
+
+//How a stamp is joined to the heights under it
+enum class EStampBlend
+{
+	Add,
+	Max,
+	SmoothMax
+};
+
+//Settings of the stamps
+struct StampSettings
+{
+	int count = 2000;
+	int width = 257;                    //Area the stamps are scattered over, in samples
+	int height = 257;
+	float minRadius = 8.0f;             //In samples
+	float maxRadius = 48.0f;
+	float heightPerRadius = 0.5f;       //Height of a stamp for each sample of its radius, so big features are as steep as small ones
+	EStampBlend blend = EStampBlend::Max;
+	float smoothness = 0.3f;            //Width of the smooth maximum, as a part of the height of the stamp at each sample above zero
+	bool bShapes[static_cast<int>(EStampShape::Count)] = { true, true, true }; //Shapes that can be placed
+	unsigned int seed = 0;
+};
+
+class CStampGenerator
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Constructor, makes the stamp heightmaps, places every stamp and bins them. Throws std::runtime_error if the
+	//settings can't be used
+	CStampGenerator(const StampSettings& settings);
+
+	const StampSettings& Settings() const { return m_Settings; }
+
+	//Function to blend every stamp onto a rectangle of heights in place. Can be called from any number of threads at once
+	void Apply(int x0, int z0, int width, int height, float* values, int stride) const;
+
+	//Number of stamps in the cells, a stamp is counted once for each cell it overlaps
+	int BinnedStamps() const { return static_cast<int>(m_BinStamps.size()); }
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//A placed stamp, with its rotation and size folded into the step through the stamp per sample
+	struct Stamp
+	{
+		float centreX = 0.0f, centreZ = 0.0f;
+		float radius = 0.0f;
+		float cosStep = 0.0f, sinStep = 0.0f;   //Texels of the stamp per sample along x, turned by the rotation
+		float height = 0.0f;
+		int shape = 0;
+	};
+
+	//Function to work out the heightmap of a shape, zero outside its circle. Noise roughens the mountains
+	static void MakeShape(EStampShape shape, const CPerlinNoise& noise, float* texels);
+
+	//Function to blend a stamp onto the samples of a rectangle that it covers
+	void BlendStamp(const Stamp& stamp, int x0, int z0, int x1, int z1, float* values, int stride) const;
+
+	//Key of a cell in the spatial hash
+	static uint64_t CellKey(int cellX, int cellZ) { return (static_cast<uint64_t>(static_cast<uint32_t>(cellX)) << 32) | static_cast<uint32_t>(cellZ); }
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	//Texels along each side of a stamp heightmap, plus a border of zeros on every side wide enough for the
+	//bilinear reads of any sample inside the circle
+	static constexpr int StampSize = 64;
+	static constexpr int StampBorder = 2;
+	static constexpr int StampStride = StampSize + 2 * StampBorder;
+
+	//Cells of the spatial hash are heightfield tiles, so a tile usually only looks in one cell
+	static constexpr int CellShift = CHeightField::TileShift;
+	static constexpr int CellSize = 1 << CellShift;
+
+	StampSettings m_Settings;
+
+	//Heightmaps of every shape, one after the other
+	std::vector<float> m_Shapes;
+
+	std::vector<Stamp> m_Stamps;
+
+	//Stamps of every cell in the order they were placed, and where each cell's run of them starts and ends
+	std::vector<int> m_BinStamps;
+	std::unordered_map<uint64_t, std::pair<int, int>> m_Cells;
+};
@@ -0,0 +1,427 @@
+#include "CTerrainGraph.h"
+#include "Utility/CThreadPool.h"
+#include "Utility/HashHelpers.h"
+#include <atomic>
+#include <chrono>
+
+//Scratch buffer of the calling thread for one level of the fused evaluation.
+//Buffers are kept between tiles so running a chain never touches the heap
+static float* ScratchBuffer(int depth, size_t samples)
+{
+	//Growing the outer vector moves the inner ones, which keeps their data where it was
+	thread_local std::vector<std::vector<float>> buffers;
+	if (static_cast<int>(buffers.size()) <= depth) buffers.resize(depth + 1);
+	if (buffers[depth].size() < samples) buffers[depth].resize(samples);
+	return buffers[depth].data();
+}
+
+//Inputs of blends made and left out by the calling thread, added to the stats after each run of tiles
+struct BlendCounts
+{
+	int made = 0;
+	int skipped = 0;
+};
+static thread_local BlendCounts ThreadBlendCounts;
+
+//Function to add a node reading from the inputs given, returns its id
+CTerrainGraph::NodeId CTerrainGraph::AddNode(std::unique_ptr<CTerrainOperator> op, const std::vector<NodeId>& inputs)
+{
+	//Inputs have to exist before the nodes reading them, which also keeps the graph free of cycles
+	const NodeId id = static_cast<NodeId>(m_Nodes.size());
+	for (NodeId input : inputs)
+	{
+		if (input < 0 || input >= id)
+		{
+			throw std::runtime_error(std::string("Terrain graph node '") + op->Name() + "' reads from a node that does not exist");
+		}
+	}
+
+	const int expected = op->NumInputs();
+	if ((expected >= 0 && static_cast<int>(inputs.size()) != expected) || (expected < 0 && inputs.empty()))
+	{
+		throw std::runtime_error(std::string("Terrain graph node '") + op->Name() + "' has the wrong number of inputs");
+	}
+	if (op->Kind() == EOperatorKind::Blend)
+	{
+		const int controls = static_cast<const CBlendOperator&>(*op).NumControlInputs();
+		const int blended = static_cast<int>(inputs.size()) - controls;
+		if (controls < 0 || blended < 1 || blended > CBlendOperator::MaxInputs)
+		{
+			throw std::runtime_error(std::string("Terrain graph node '") + op->Name() + "' has the wrong number of inputs");
+		}
+	}
+
+	m_Nodes.push_back({ std::move(op), inputs });
+	return id;
+}
+
+//Function to run every node the output depends on and write the output into result, which may also be an input
+bool CTerrainGraph::Execute(NodeId output, CHeightField& result, int width, int height)
+{
+	return Run(output, result, width, height, nullptr);
+}
+
+//Function to rerun only the tiles of the output that overlap the region, every other tile of result is kept.
+//Graphs with a global operator can't be split up and are run over the whole heightfield
+bool CTerrainGraph::ExecuteRegion(NodeId output, CHeightField& result, const TerrainRegion& region)
+{
+	return Run(output, result, result.Width(), result.Height(), &region);
+}
+
+//Function to run the graph, over the region given or the whole heightfield if region is null
+bool CTerrainGraph::Run(NodeId output, CHeightField& result, int width, int height, const TerrainRegion* region)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	m_LastStats = ExecuteStats();
+
+	std::vector<NodeId> order = SortFrom(output);
+	m_LastStats.nodes = static_cast<int>(order.size());
+
+	//Count how many nodes read each node
+	std::vector<int> readers(m_Nodes.size(), 0);
+	for (NodeId node : order)
+	{
+		for (NodeId input : m_Nodes[node].inputs) ++readers[input];
+	}
+
+	//Decide which nodes are written out to a full heightfield, everything else is fused into the nodes reading it
+	std::vector<bool> materialised(m_Nodes.size(), false);
+	materialised[output] = true;
+	bool bHasGlobal = false;
+	for (NodeId node : order)
+	{
+		const EOperatorKind kind = m_Nodes[node].op->Kind();
+		if (kind == EOperatorKind::Input || kind == EOperatorKind::Global || readers[node] > 1 ||
+		    (kind == EOperatorKind::Generator && static_cast<const CGeneratorOperator&>(*m_Nodes[node].op).BlockTiles() > 1))
+		{
+			materialised[node] = true;
+		}
+		if (kind == EOperatorKind::Global)
+		{
+			bHasGlobal = true;
+			for (NodeId input : m_Nodes[node].inputs) materialised[input] = true;
+		}
+	}
+
+	//Work out the region each node is needed over, starting from the output and growing by the halo
+	//of every neighbourhood operator on the way down
+	const TerrainRegion whole = { 0, 0, width, height };
+	const bool bPartial = region != nullptr && !bHasGlobal && result.Width() == width && result.Height() == height;
+	std::vector<TerrainRegion> needed(m_Nodes.size());
+	needed[output] = bPartial ? region->Intersect(whole) : whole;
+	for (auto node = order.rbegin(); node != order.rend(); ++node)
+	{
+		const CTerrainOperator& op = *m_Nodes[*node].op;
+		TerrainRegion inputRegion = needed[*node];
+		if (op.Kind() == EOperatorKind::Neighbourhood)
+		{
+			inputRegion = inputRegion.Grow(static_cast<const CNeighbourhoodOperator&>(op).HaloRadius());
+		}
+		for (NodeId input : m_Nodes[*node].inputs)
+		{
+			needed[input] = needed[input].Union(inputRegion);
+		}
+	}
+	if (needed[output].Empty())
+	{
+		m_Fields.clear();
+		return true;
+	}
+
+	//One unit of work per tile of every node that is run, global operators count as the whole heightfield
+	if (m_Progress)
+	{
+		int64_t work = 0;
+		for (NodeId node : order)
+		{
+			if (!materialised[node] || m_Nodes[node].op->Kind() == EOperatorKind::Input) continue;
+
+			TerrainRegion nodeRegion = m_Nodes[node].op->Kind() == EOperatorKind::Global ? whole : needed[node].Intersect(whole);
+			work += static_cast<int64_t>(((nodeRegion.x + nodeRegion.width - 1) >> CHeightField::TileShift) - (nodeRegion.x >> CHeightField::TileShift) + 1) *
+			        (((nodeRegion.z + nodeRegion.height - 1) >> CHeightField::TileShift) - (nodeRegion.z >> CHeightField::TileShift) + 1);
+		}
+		m_Progress->AddWork(work);
+	}
+
+	//Inputs are copied rather than run, the copy shares its tiles so result can be written while they are read
+	m_Fields.clear();
+	m_Fields.resize(m_Nodes.size());
+	for (NodeId node : order)
+	{
+		if (!materialised[node]) continue;
+
+		m_Fields[node].reset(new CHeightField());
+		if (m_Nodes[node].op->Kind() == EOperatorKind::Input)
+		{
+			*m_Fields[node] = static_cast<const CInputOperator&>(*m_Nodes[node].op).Field();
+			continue;
+		}
+
+		//A partial run starts the output from the current result so the tiles outside the region are kept
+		if (node == output && bPartial) *m_Fields[node] = result;
+		else if (m_Nodes[node].op->Kind() != EOperatorKind::Global) m_Fields[node]->ResizeUninitialised(width, height);
+		else m_Fields[node]->Resize(width, height, 0.0f);
+
+		if (!Materialise(node, *m_Fields[node], needed[node].Intersect(whole)))
+		{
+			m_Fields.clear();
+			return false;
+		}
+		++m_LastStats.passes;
+	}
+
+	//Assigning only marks the tiles of result that were replaced as dirty
+	result = std::move(*m_Fields[output]);
+	m_Fields.clear();
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	m_LastStats.milliseconds = elapsed.count();
+	return true;
+}
+
+//Function to get a hash of everything the output depends on (operators, parameters, inputs and size),
+//so a run with the same hash gives the same result. 0 if the output can't be cached
+uint64_t CTerrainGraph::Hash(NodeId output, int width, int height) const
+{
+	//Inputs come first in the order, so every node's inputs are hashed before it
+	std::vector<uint64_t> hashes(m_Nodes.size(), 0);
+	for (NodeId node : SortFrom(output))
+	{
+		const CTerrainOperator& op = *m_Nodes[node].op;
+		if (!op.Deterministic()) return 0;
+
+		uint64_t hash = HashString(op.Name(), static_cast<uint64_t>(op.Kind()));
+		hash = HashCombine(hash, op.ParameterHash());
+		for (NodeId input : m_Nodes[node].inputs) hash = HashCombine(hash, hashes[input]);
+		hashes[node] = hash;
+	}
+
+	//0 is kept to mean "can't be cached"
+	const uint64_t hash = HashCombine(HashCombine(hashes[output], width), height);
+	return hash != 0 ? hash : 1;
+}
+
+//Function to remove every node
+void CTerrainGraph::Clear()
+{
+	m_Nodes.clear();
+	m_Fields.clear();
+}
+
+//Function to list the nodes the output depends on, inputs before the nodes that read them
+std::vector<CTerrainGraph::NodeId> CTerrainGraph::SortFrom(NodeId output) const
+{
+	if (output < 0 || output >= NumNodes())
+	{
+		throw std::runtime_error("Terrain graph output node does not exist");
+	}
+
+	//Inputs always have lower ids than their readers, so sorting the reachable nodes by id gives a valid order
+	std::vector<bool> reachable(m_Nodes.size(), false);
+	reachable[output] = true;
+	std::vector<NodeId> order;
+	for (NodeId node = output; node >= 0; --node)
+	{
+		if (!reachable[node]) continue;
+
+		order.push_back(node);
+		for (NodeId input : m_Nodes[node].inputs) reachable[input] = true;
+	}
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+//Function to write the tiles of a heightfield that overlap the region with the result of a node
+bool CTerrainGraph::Materialise(NodeId node, CHeightField& field, const TerrainRegion& region)
+{
+	if (m_Progress && m_Progress->IsCancelled()) return false;
+
+	const CTerrainOperator& op = *m_Nodes[node].op;
+	if (op.Kind() == EOperatorKind::Global)
+	{
+		//The input has already been materialised, copying it only shares its tiles
+		if (!m_Nodes[node].inputs.empty()) field = *m_Fields[m_Nodes[node].inputs[0]];
+
+		//Global operators check the job once per iteration or level, a cancelled one leaves the field unfinished
+		static_cast<const CGlobalOperator&>(op).ApplyGlobal(field, m_Progress);
+		if (m_Progress && m_Progress->IsCancelled()) return false;
+		if (m_Progress) m_Progress->CompleteWork(field.TileCount());
+		return true;
+	}
+
+	//Tiles overlapping the region
+	const int firstX = region.x >> CHeightField::TileShift;
+	const int firstZ = region.z >> CHeightField::TileShift;
+	const int tilesX = ((region.x + region.width - 1) >> CHeightField::TileShift) - firstX + 1;
+	const int tilesZ = ((region.z + region.height - 1) >> CHeightField::TileShift) - firstZ + 1;
+
+	//Generators that ask for it are run over blocks of tiles into a buffer, then copied to the tiles
+	const int blockTiles = op.Kind() == EOperatorKind::Generator ? static_cast<const CGeneratorOperator&>(op).BlockTiles() : 1;
+	if (blockTiles > 1)
+	{
+		const int blocksX = (tilesX + blockTiles - 1) / blockTiles;
+		const int blocksZ = (tilesZ + blockTiles - 1) / blockTiles;
+		std::atomic<int> tiles{ 0 };
+		CThreadPool::Global().ParallelForDynamic(blocksX * blocksZ, [&](int block)
+		{
+			if (m_Progress && m_Progress->IsCancelled()) return;
+
+			const int tileX = firstX + (block % blocksX) * blockTiles;
+			const int tileZ = firstZ + (block / blocksX) * blockTiles;
+			const int blockTilesX = std::min(blockTiles, firstX + tilesX - tileX);
+			const int blockTilesZ = std::min(blockTiles, firstZ + tilesZ - tileZ);
+			const int x0 = tileX << CHeightField::TileShift;
+			const int z0 = tileZ << CHeightField::TileShift;
+			const TerrainRegion blockRegion = { x0, z0, std::min(blockTilesX << CHeightField::TileShift, field.Width() - x0),
+			                                    std::min(blockTilesZ << CHeightField::TileShift, field.Height() - z0) };
+
+			thread_local std::vector<float> buffer;
+			buffer.resize(static_cast<size_t>(blockRegion.Samples()));
+			static_cast<const CGeneratorOperator&>(op).Generate(blockRegion, buffer.data(), blockRegion.width);
+			field.WriteRegion(x0, z0, blockRegion.width, blockRegion.height, buffer.data(), blockRegion.width);
+
+			tiles += blockTilesX * blockTilesZ;
+			if (m_Progress) m_Progress->CompleteWork(blockTilesX * blockTilesZ);
+		});
+		m_LastStats.tiles += tiles;
+		return !(m_Progress && m_Progress->IsCancelled());
+	}
+
+	//Tiles are split between the workers the same way as when the heightfield was allocated,
+	//so each worker writes the tiles it touched first
+	std::atomic<int> tiles{ 0 };
+	std::atomic<int> blendInputs{ 0 }, blendInputsSkipped{ 0 };
+	CThreadPool::Global().ParallelFor(tilesX * tilesZ, [&](int begin, int end)
+	{
+		ThreadBlendCounts = BlendCounts();
+		for (int tile = begin; tile < end; ++tile)
+		{
+			if (m_Progress)
+			{
+				if (m_Progress->IsCancelled()) break;
+				m_Progress->CompleteWork(1);
+			}
+
+			const int tileX = firstX + tile % tilesX;
+			const int tileZ = firstZ + tile / tilesX;
+			TerrainRegion tileRegion = { tileX << CHeightField::TileShift, tileZ << CHeightField::TileShift, field.TileWidth(tileX), field.TileHeight(tileZ) };
+			EvaluateRegion(node, tileRegion, field.EditTile(tileX, tileZ), CHeightField::TileSize, 0, true);
+			++tiles;
+		}
+		blendInputs += ThreadBlendCounts.made;
+		blendInputsSkipped += ThreadBlendCounts.skipped;
+	});
+	m_LastStats.tiles += tiles;
+	m_LastStats.blendInputs += blendInputs;
+	m_LastStats.blendInputsSkipped += blendInputsSkipped;
+	return !(m_Progress && m_Progress->IsCancelled());
+}
+
+//Function to write the value of a node over a region, fusing every node below it that isn't materialised
+void CTerrainGraph::EvaluateRegion(NodeId node, const TerrainRegion& region, float* out, int stride, int depth, bool bRoot) const
+{
+	//Materialised nodes have already been run, read them back with clamping so halos off the edge work
+	if (!bRoot && m_Fields[node])
+	{
+		m_Fields[node]->ReadRegion(region.x, region.z, region.width, region.height, out, stride);
+		return;
+	}
+
+	const Node& current = m_Nodes[node];
+	switch (current.op->Kind())
+	{
+	case EOperatorKind::Generator:
+		static_cast<const CGeneratorOperator&>(*current.op).Generate(region, out, stride);
+		break;
+
+	case EOperatorKind::Point:
+		//Modify the input in place, so a chain of point operators stays in the same buffer
+		EvaluateRegion(current.inputs[0], region, out, stride, depth, false);
+		static_cast<const CPointOperator&>(*current.op).Apply(region, out, stride);
+		break;
+
+	case EOperatorKind::Combiner:
+	{
+		//The first input goes straight into the output, the rest are made one at a time in scratch and folded in
+		EvaluateRegion(current.inputs[0], region, out, stride, depth, false);
+		float* scratch = ScratchBuffer(depth, static_cast<size_t>(region.height) * stride);
+		for (size_t i = 1; i < current.inputs.size(); ++i)
+		{
+			EvaluateRegion(current.inputs[i], region, scratch, stride, depth + 1, false);
+			static_cast<const CCombinerOperator&>(*current.op).Combine(region, out, scratch, stride);
+		}
+		break;
+	}
+
+	case EOperatorKind::Blend:
+	{
+		//Scratch holds the weights, then the control inputs, then room for one input. The control inputs are made
+		//first to work out the weights, then only the inputs with a weight somewhere in the region are made
+		const CBlendOperator& op = static_cast<const CBlendOperator&>(*current.op);
+		const size_t blended = current.inputs.size() - op.NumControlInputs();
+		const size_t plane = static_cast<size_t>(region.height) * stride;
+		float* weights = ScratchBuffer(depth, plane * (current.inputs.size() + 1));
+		float* controls = weights + plane * blended;
+		float* scratch = weights + plane * current.inputs.size();
+		for (size_t i = blended; i < current.inputs.size(); ++i)
+		{
+			EvaluateRegion(current.inputs[i], region, controls + (i - blended) * plane, stride, depth + 1, false);
+		}
+		const uint64_t used = op.Weights(region, controls, weights, plane, stride);
+
+		int usedCount = 0;
+		for (size_t i = 0; i < blended; ++i)
+		{
+			if (used & (1ull << i)) ++usedCount;
+		}
+		ThreadBlendCounts.made += usedCount;
+		ThreadBlendCounts.skipped += static_cast<int>(blended) - usedCount;
+
+		//The weights add up to 1, so an input used on its own has a weight of 1 everywhere and is made straight
+		//into the output (or copied if it was materialised)
+		if (usedCount == 1)
+		{
+			size_t only = 0;
+			while (!(used & (1ull << only))) ++only;
+			EvaluateRegion(current.inputs[only], region, out, stride, depth + 1, false);
+			break;
+		}
+
+		//Otherwise each input used is made one at a time in scratch and added on by its weights
+		for (int z = 0; z < region.height; ++z)
+		{
+			std::fill(out + z * stride, out + z * stride + region.width, 0.0f);
+		}
+		for (size_t i = 0; i < blended; ++i)
+		{
+			if (!(used & (1ull << i))) continue;
+
+			EvaluateRegion(current.inputs[i], region, scratch, stride, depth + 1, false);
+			const float* weight = weights + i * plane;
+			for (int z = 0; z < region.height; ++z)
+			{
+				float* row = out + z * stride;
+				const float* in = scratch + z * stride;
+				const float* w = weight + z * stride;
+				for (int x = 0; x < region.width; ++x) row[x] += w[x] * in[x];
+			}
+		}
+		break;
+	}
+
+	case EOperatorKind::Neighbourhood:
+	{
+		//Make the input over the region plus the halo the operator reads
+		const CNeighbourhoodOperator& op = static_cast<const CNeighbourhoodOperator&>(*current.op);
+		TerrainRegion haloRegion = region.Grow(op.HaloRadius());
+		float* scratch = ScratchBuffer(depth, haloRegion.Samples());
+		EvaluateRegion(current.inputs[0], haloRegion, scratch, haloRegion.width, depth + 1, false);
+		op.Filter(region, scratch, haloRegion.width, out, stride);
+		break;
+	}
+
+	default:
+		//Inputs and global operators are always materialised before anything reads them
+		throw std::runtime_error(std::string("Terrain graph node '") + current.op->Name() + "' was read before it was run");
+	}
+}
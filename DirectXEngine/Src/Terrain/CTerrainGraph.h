@@ -0,0 +1,124 @@
+//--------------------------------------------------------------------------------------
+// Graph of terrain operators, run tile by tile
+//--------------------------------------------------------------------------------------
+// Nodes are operators joined into a directed acyclic graph. Running the graph does not
+// run each node over the whole heightfield in turn; instead every chain of generators,
+// point operators, combiners and neighbourhood operators is fused and run one 64x64 tile
+// at a time, so a tile is made, modified and written while it is still in cache and N
+// point operators cost about one pass over memory.
+//
+// Only some nodes are written out to a full heightfield ("materialised"): the node being
+// run, nodes read by a global operator, global operators themselves, nodes read by more
+// than one other node and generators that ask for blocks bigger than a tile (because they
+// work out a margin around every region they make, which a tile at a time would repeat).
+// Those generators are run a block of tiles at a time. Neighbourhood operators read their
+// input over the tile plus a halo, which is made on the fly from the fused chain below
+// them. Generators carry on past the edge of the heightfield to fill a halo, materialised
+// heightfields are clamped to their edge.
+//
+// Blends work out the weights of their inputs over the tile first (from their masks or the
+// biome map) and only make the inputs with a weight somewhere in it, so a tile inside one
+// biome or where a mask is all 0 or all 1 only runs one chain, straight into the output.
+//
+// A graph can also be rerun over a region only, e.g. after a local edit. Each node is then
+// only run over the tiles its readers need (the region grown by the halos above it), and
+// every other tile of the result is kept, so only the tiles in the region are marked dirty.
+//
+// When a job progress is set the graph reports one unit of work per tile it runs and stops
+// at the next tile once the job is cancelled, leaving the result untouched.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Terrain/TerrainOperators.h"
+#include "Utility/CJobProgress.h"
+
+class CTerrainGraph
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Index of a node in the graph
+	typedef int NodeId;
+
+	//Statistics of the last call to Execute
+	struct ExecuteStats
+	{
+		int nodes = 0;              //Nodes the output depends on
+		int passes = 0;             //Full heightfields written, one per materialised node
+		int tiles = 0;              //Tiles run through the fused chains
+		int blendInputs = 0;        //Inputs of blends made over a tile
+		int blendInputsSkipped = 0; //Inputs of blends left out of a tile where they had no weight
+		double milliseconds = 0.0;
+	};
+
+	//Function to add a node reading from the inputs given, returns its id
+	NodeId AddNode(std::unique_ptr<CTerrainOperator> op, const std::vector<NodeId>& inputs = {});
+
+	//Function to construct an operator in place and add it as a node
+	template<typename T, typename... Args>
+	NodeId Add(const std::vector<NodeId>& inputs, Args&&... args)
+	{
+		return AddNode(std::unique_ptr<CTerrainOperator>(new T(std::forward<Args>(args)...)), inputs);
+	}
+
+	//Function to run every node the output depends on and write the output into result, which may also be an input.
+	//Returns false if the run was cancelled, result is then unchanged
+	bool Execute(NodeId output, CHeightField& result, int width, int height);
+
+	//Function to rerun only the tiles of the output that overlap the region, every other tile of result is kept.
+	//Graphs with a global operator can't be split up and are run over the whole heightfield
+	bool ExecuteRegion(NodeId output, CHeightField& result, const TerrainRegion& region);
+
+	//Function to set where runs report their progress and check for cancellation, null for neither
+	void SetProgress(CJobProgress* progress) { m_Progress = progress; }
+
+	//Function to get a hash of everything the output depends on (operators, parameters, inputs and size),
+	//so a run with the same hash gives the same result. 0 if the output can't be cached
+	uint64_t Hash(NodeId output, int width, int height) const;
+
+	//Function to remove every node
+	void Clear();
+
+	int NumNodes() const { return static_cast<int>(m_Nodes.size()); }
+	const CTerrainOperator& Operator(NodeId node) const { return *m_Nodes[node].op; }
+	const std::vector<NodeId>& Inputs(NodeId node) const { return m_Nodes[node].inputs; }
+
+	const ExecuteStats& LastStats() const { return m_LastStats; }
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	struct Node
+	{
+		std::unique_ptr<CTerrainOperator> op;
+		std::vector<NodeId> inputs;
+	};
+
+	//Function to run the graph, over the region given or the whole heightfield if region is null
+	bool Run(NodeId output, CHeightField& result, int width, int height, const TerrainRegion* region);
+
+	//Function to list the nodes the output depends on, inputs before the nodes that read them
+	std::vector<NodeId> SortFrom(NodeId output) const;
+
+	//Function to write the tiles of a heightfield that overlap the region with the result of a node
+	bool Materialise(NodeId node, CHeightField& field, const TerrainRegion& region);
+
+	//Function to write the value of a node over a region, fusing every node below it that isn't materialised
+	void EvaluateRegion(NodeId node, const TerrainRegion& region, float* out, int stride, int depth, bool bRoot) const;
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	std::vector<Node> m_Nodes;
+
+	//Heightfields of the materialised nodes during Execute, indexed by node
+	std::vector<std::unique_ptr<CHeightField>> m_Fields;
+
+	ExecuteStats m_LastStats;
+
+	CJobProgress* m_Progress = nullptr;
+};
@@ -0,0 +1,192 @@
+#include "CThermalErosion.h"
+#include <xmmintrin.h>
+
+//Flow from a sample to one neighbour, the part of their difference past the talus (negative when it flows in)
+static inline float TalusFlow(float difference, float talus)
+{
+	return difference - std::min(std::max(difference, -talus), talus);
+}
+
+//Four lanes of TalusFlow
+static inline __m128 TalusFlow4(__m128 difference, __m128 talus, __m128 negativeTalus)
+{
+	return _mm_sub_ps(difference, _mm_min_ps(_mm_max_ps(difference, negativeTalus), talus));
+}
+
+//Constructor
+CThermalErosion::CThermalErosion(const ThermalSettings& settings) : m_Settings(settings)
+{
+	if (settings.iterations < 0 || settings.blockSize < 16 || settings.iterationsPerBlock < 1)
+	{
+		throw std::runtime_error("Thermal erosion needs blocks of at least 16 samples and one iteration per block");
+	}
+	if (settings.talus < 0.0f || settings.amount < 0.0f || settings.amount > 1.0f)
+	{
+		throw std::runtime_error("Thermal erosion needs a talus slope of at least zero and an amount from 0 to 1");
+	}
+
+	m_Talus = settings.talus;
+	m_DiagonalTalus = settings.talus * std::sqrt(2.0f);
+
+	//With all eight neighbours moving a sixteenth of the excess a sample can't overshoot its neighbours
+	m_Rate = settings.amount / 16.0f;
+}
+
+//Function to run every iteration over the heightfield in place
+void CThermalErosion::Erode(CHeightField& field, CThreadPool& pool, CJobProgress* progress) const
+{
+	const int width = field.Width();
+	const int height = field.Height();
+	if (width == 0 || height == 0 || m_Settings.iterations == 0) return;
+
+	//Blocks read a halo from anywhere around them, so the iterations run on two flat arrays rather than the tiles
+	const size_t samples = static_cast<size_t>(width) * height;
+	std::unique_ptr<float[]> heights(new float[samples]);
+	std::unique_ptr<float[]> next(new float[samples]);
+	pool.ParallelFor(field.TilesZ(), [&](int begin, int end)
+	{
+		const int z0 = begin << CHeightField::TileShift;
+		const int z1 = std::min(end << CHeightField::TileShift, height);
+		field.ReadRegion(0, z0, width, z1 - z0, heights.get() + static_cast<size_t>(z0) * width, width);
+	});
+
+	const int blockSize = m_Settings.blockSize;
+	const int blocksX = (width + blockSize - 1) / blockSize;
+	const int blocksZ = (height + blockSize - 1) / blockSize;
+	for (int done = 0; done < m_Settings.iterations; )
+	{
+		if (progress && progress->IsCancelled()) return;
+
+		//Every block of the step has to finish before the next step reads its halo
+		const int iterations = std::min(m_Settings.iterationsPerBlock, m_Settings.iterations - done);
+		pool.ParallelForDynamic(blocksX * blocksZ, [&](int index)
+		{
+			const int x0 = (index % blocksX) * blockSize;
+			const int z0 = (index / blocksX) * blockSize;
+			RunBlock(heights.get(), next.get(), width, height, x0, z0, std::min(blockSize, width - x0), std::min(blockSize, height - z0), iterations);
+		});
+
+		std::swap(heights, next);
+		done += iterations;
+	}
+
+	//Copy back a band of tile rows per worker, no two workers touch the same tile
+	pool.ParallelFor(field.TilesZ(), [&](int begin, int end)
+	{
+		const int z0 = begin << CHeightField::TileShift;
+		const int z1 = std::min(end << CHeightField::TileShift, height);
+		field.WriteRegion(0, z0, width, z1 - z0, heights.get() + static_cast<size_t>(z0) * width, width);
+	});
+}
+
+//Function to run a number of iterations on one block, reading the map from input and writing the block to output
+void CThermalErosion::RunBlock(const float* input, float* output, int width, int height, int x0, int z0, int blockWidth, int blockHeight, int iterations) const
+{
+	//The block with a halo of one sample per iteration, local (0, 0) is map (left, top)
+	const int halo = iterations;
+	const int left = x0 - halo;
+	const int top = z0 - halo;
+	const int localWidth = blockWidth + 2 * halo;
+	const int localHeight = blockHeight + 2 * halo;
+
+	thread_local std::vector<float> current;
+	thread_local std::vector<float> scratch;
+	current.resize(static_cast<size_t>(localWidth) * localHeight);
+	scratch.resize(current.size());
+
+	//Local columns and rows of the map edges, samples past them repeat the edge
+	const int firstX = std::max(0, -left);
+	const int lastX = std::min(localWidth - 1, width - 1 - left);
+	const int firstZ = std::max(0, -top);
+	const int lastZ = std::min(localHeight - 1, height - 1 - top);
+
+	for (int z = 0; z < localHeight; ++z)
+	{
+		const float* in = input + static_cast<size_t>(std::min(std::max(top + z, 0), height - 1)) * width;
+		float* row = current.data() + static_cast<size_t>(z) * localWidth;
+		std::fill(row, row + firstX, in[left + firstX]);
+		std::copy(in + left + firstX, in + left + lastX + 1, row + firstX);
+		std::fill(row + lastX + 1, row + localWidth, in[left + lastX]);
+	}
+
+	//After each iteration the samples one further in from the edge of the block are no longer correct
+	for (int step = 1; step <= iterations; ++step)
+	{
+		const int begin = step;
+		const int endX = localWidth - step;
+		const int endZ = localHeight - step;
+		for (int z = begin; z < endZ; ++z)
+		{
+			const float* row = current.data() + static_cast<size_t>(z) * localWidth;
+			StencilRow(row - localWidth, row, row + localWidth, scratch.data() + static_cast<size_t>(z) * localWidth, begin, endX);
+		}
+
+		//Samples past the edge of the map take the new edge values, as if read from the map again
+		if (firstX > begin || lastX < endX - 1)
+		{
+			for (int z = begin; z < endZ; ++z)
+			{
+				float* row = scratch.data() + static_cast<size_t>(z) * localWidth;
+				for (int x = begin; x < firstX; ++x) row[x] = row[firstX];
+				for (int x = lastX + 1; x < endX; ++x) row[x] = row[lastX];
+			}
+		}
+		for (int z = begin; z < firstZ; ++z)
+		{
+			std::copy(scratch.begin() + static_cast<size_t>(firstZ) * localWidth + begin, scratch.begin() + static_cast<size_t>(firstZ) * localWidth + endX, scratch.begin() + static_cast<size_t>(z) * localWidth + begin);
+		}
+		for (int z = lastZ + 1; z < endZ; ++z)
+		{
+			std::copy(scratch.begin() + static_cast<size_t>(lastZ) * localWidth + begin, scratch.begin() + static_cast<size_t>(lastZ) * localWidth + endX, scratch.begin() + static_cast<size_t>(z) * localWidth + begin);
+		}
+
+		current.swap(scratch);
+	}
+
+	for (int z = 0; z < blockHeight; ++z)
+	{
+		const float* row = current.data() + static_cast<size_t>(z + halo) * localWidth + halo;
+		std::copy(row, row + blockWidth, output + static_cast<size_t>(z0 + z) * width + x0);
+	}
+}
+
+//Function to run one iteration over part of a row, from the rows above, on and below it
+void CThermalErosion::StencilRow(const float* above, const float* row, const float* below, float* out, int begin, int end) const
+{
+	//x64 always has SSE, so four samples at a time with min and max and no branches
+	const __m128 talus = _mm_set1_ps(m_Talus);
+	const __m128 negativeTalus = _mm_set1_ps(-m_Talus);
+	const __m128 diagonalTalus = _mm_set1_ps(m_DiagonalTalus);
+	const __m128 negativeDiagonalTalus = _mm_set1_ps(-m_DiagonalTalus);
+	const __m128 rate = _mm_set1_ps(m_Rate);
+
+	int x = begin;
+	for (; x + 4 <= end; x += 4)
+	{
+		const __m128 centre = _mm_loadu_ps(row + x);
+		__m128 flow = TalusFlow4(_mm_sub_ps(centre, _mm_loadu_ps(above + x)), talus, negativeTalus);
+		flow = _mm_add_ps(flow, TalusFlow4(_mm_sub_ps(centre, _mm_loadu_ps(below + x)), talus, negativeTalus));
+		flow = _mm_add_ps(flow, TalusFlow4(_mm_sub_ps(centre, _mm_loadu_ps(row + x - 1)), talus, negativeTalus));
+		flow = _mm_add_ps(flow, TalusFlow4(_mm_sub_ps(centre, _mm_loadu_ps(row + x + 1)), talus, negativeTalus));
+		flow = _mm_add_ps(flow, TalusFlow4(_mm_sub_ps(centre, _mm_loadu_ps(above + x - 1)), diagonalTalus, negativeDiagonalTalus));
+		flow = _mm_add_ps(flow, TalusFlow4(_mm_sub_ps(centre, _mm_loadu_ps(above + x + 1)), diagonalTalus, negativeDiagonalTalus));
+		flow = _mm_add_ps(flow, TalusFlow4(_mm_sub_ps(centre, _mm_loadu_ps(below + x - 1)), diagonalTalus, negativeDiagonalTalus));
+		flow = _mm_add_ps(flow, TalusFlow4(_mm_sub_ps(centre, _mm_loadu_ps(below + x + 1)), diagonalTalus, negativeDiagonalTalus));
+		_mm_storeu_ps(out + x, _mm_sub_ps(centre, _mm_mul_ps(rate, flow)));
+	}
+
+	//The last few samples one at a time, adding the flows in the same order as the lanes above
+	for (; x < end; ++x)
+	{
+		const float centre = row[x];
+		float flow = TalusFlow(centre - above[x], m_Talus);
+		flow += TalusFlow(centre - below[x], m_Talus);
+		flow += TalusFlow(centre - row[x - 1], m_Talus);
+		flow += TalusFlow(centre - row[x + 1], m_Talus);
+		flow += TalusFlow(centre - above[x - 1], m_DiagonalTalus);
+		flow += TalusFlow(centre - above[x + 1], m_DiagonalTalus);
+		flow += TalusFlow(centre - below[x - 1], m_DiagonalTalus);
+		flow += TalusFlow(centre - below[x + 1], m_DiagonalTalus);
+		out[x] = centre - m_Rate * flow;
+	}
+}
@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// Thermal (talus angle) erosion, as a blocked stencil spread over the thread pool
+//--------------------------------------------------------------------------------------
+// Every iteration each sample swaps material with its eight neighbours wherever the slope
+// between them is steeper than the talus slope, in proportion to the excess. The flow
+// between two samples only depends on their difference, so it's worked out from the old
+// heights on both sides and material is never made or lost (samples past the edge repeat
+// the edge, like the other neighbourhood operators). Each iteration reads one buffer and
+// writes the other, four samples at a time with SSE min and max and no branches.
+//
+// Running the whole map once per iteration would stream it through memory every time.
+// Instead the map is split into blocks and each block runs several iterations in a row on
+// a copy small enough to stay in cache. A block reads a halo of one sample per iteration
+// around it; every iteration the part that is still correct shrinks by a sample, until only
+// the block itself is left to write out. Blocks run in parallel, one per worker, and the
+// result is the same as running the iterations one at a time.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Utility/CJobProgress.h"
+#include "Utility/CThreadPool.h"
+
+//Settings of the thermal erosion
+struct ThermalSettings
+{
+	int iterations = 100;
+	float talus = 1.0f;             //Steepest slope that doesn't slide, in height per sample
+	float amount = 0.5f;            //Part of the excess moved each iteration, from 0 to 1
+	int blockSize = 128;            //Samples along each side of a block
+	int iterationsPerBlock = 8;     //Iterations run on a block while it is in cache
+};
+
+class CThermalErosion
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Constructor. Throws std::runtime_error if the settings can't be used
+	CThermalErosion(const ThermalSettings& settings);
+
+	const ThermalSettings& Settings() const { return m_Settings; }
+
+	//Function to run every iteration over the heightfield in place. The job is checked for cancellation before each
+	//step of iterationsPerBlock iterations, a cancelled run leaves the heightfield as it was
+	void Erode(CHeightField& field, CThreadPool& pool = CThreadPool::Global(), CJobProgress* progress = nullptr) const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Function to run a number of iterations on one block, reading the map from input and writing the block to output
+	void RunBlock(const float* input, float* output, int width, int height, int x0, int z0, int blockWidth, int blockHeight, int iterations) const;
+
+	//Function to run one iteration over part of a row, from the rows above, on and below it
+	void StencilRow(const float* above, const float* row, const float* below, float* out, int begin, int end) const;
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	ThermalSettings m_Settings;
+
+	//Talus height difference to the side and diagonal neighbours, and the part of the excess moved
+	float m_Talus;
+	float m_DiagonalTalus;
+	float m_Rate;
+};
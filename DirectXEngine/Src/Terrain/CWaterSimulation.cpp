@@ -0,0 +1,358 @@
+#include "CWaterSimulation.h"
+#include <emmintrin.h>
+
+//Water surface of the border, too high for any water to flow into it
+static const float BorderWater = 1.0e20f;
+
+//Water shallower than this has no velocity, rather than dividing by almost nothing
+static const float MinDepth = 1.0e-4f;
+
+//Function to store the first lanes of four floats, the lanes past the end of the row are left alone
+static inline void StoreLanes(float* out, __m128 values, int lanes)
+{
+	if (lanes >= 4)
+	{
+		_mm_storeu_ps(out, values);
+		return;
+	}
+
+	alignas(16) float stored[4];
+	_mm_store_ps(stored, values);
+	for (int i = 0; i < lanes; ++i) out[i] = stored[i];
+}
+
+//Function to pick a where the mask is set and b elsewhere
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+//Function to start again on a copy of the terrain, with no water or sediment
+void CWaterSimulation::Reset(const CHeightField& terrain, const WaterSettings& settings)
+{
+	m_Settings = settings;
+	m_Width = terrain.Width();
+	m_Height = terrain.Height();
+	m_Stride = (m_Width + 5 + 3) & ~3;
+	m_Steps = 0;
+
+	const size_t size = static_cast<size_t>(m_Stride) * (m_Height + 2);
+	m_Terrain.assign(size, 0.0f);
+	m_NextTerrain.assign(size, 0.0f);
+	m_Water.assign(size, BorderWater);
+	m_NextWater.assign(size, BorderWater);
+	m_Sediment.assign(size, 0.0f);
+	m_ErodedSediment.assign(size, 0.0f);
+	m_FluxLeft.assign(size, 0.0f);
+	m_FluxRight.assign(size, 0.0f);
+	m_FluxUp.assign(size, 0.0f);
+	m_FluxDown.assign(size, 0.0f);
+	m_VelocityX.assign(size, 0.0f);
+	m_VelocityZ.assign(size, 0.0f);
+
+	for (int z = 0; z < m_Height; ++z)
+	{
+		terrain.ReadRegion(0, z, m_Width, 1, &m_Terrain[Index(0, z)], m_Stride);
+		std::fill(m_Water.begin() + Index(0, z), m_Water.begin() + Index(m_Width, z), 0.0f);
+		std::fill(m_NextWater.begin() + Index(0, z), m_NextWater.begin() + Index(m_Width, z), 0.0f);
+	}
+	FillTerrainBorder(m_Terrain);
+}
+
+//Function to pour water around a sample, the depth given at the centre falling away to the radius
+void CWaterSimulation::AddWater(float x, float z, float radius, float depth)
+{
+	if (radius <= 0.0f) return;
+
+	const int x0 = std::max(0, static_cast<int>(std::floor(x - radius)));
+	const int z0 = std::max(0, static_cast<int>(std::floor(z - radius)));
+	const int x1 = std::min(m_Width - 1, static_cast<int>(std::ceil(x + radius)));
+	const int z1 = std::min(m_Height - 1, static_cast<int>(std::ceil(z + radius)));
+	for (int sz = z0; sz <= z1; ++sz)
+	{
+		for (int sx = x0; sx <= x1; ++sx)
+		{
+			const float distance = std::sqrt((sx - x) * (sx - x) + (sz - z) * (sz - z)) / radius;
+			if (distance < 1.0f) m_Water[Index(sx, sz)] += depth * (1.0f - distance);
+		}
+	}
+}
+
+//Function to run a number of steps, each pass spread over the thread pool
+void CWaterSimulation::Step(int steps, CThreadPool& pool)
+{
+	if (m_Width == 0 || m_Height == 0) return;
+
+	for (int step = 0; step < steps; ++step)
+	{
+		AddSources();
+
+		//Each pass reads what the pass before wrote around every sample, so they run one after another
+		pool.ParallelFor(m_Height, [&](int begin, int end)
+		{
+			for (int z = begin; z < end; ++z) FluxRow(z);
+		});
+		pool.ParallelFor(m_Height, [&](int begin, int end)
+		{
+			for (int z = begin; z < end; ++z) WaterRow(z);
+		});
+
+		m_Terrain.swap(m_NextTerrain);
+		m_Water.swap(m_NextWater);
+		FillTerrainBorder(m_Terrain);
+
+		pool.ParallelFor(m_Height, [&](int begin, int end)
+		{
+			for (int z = begin; z < end; ++z) TransportRow(z);
+		});
+
+		++m_Steps;
+	}
+}
+
+//Function to work out the flux through every pipe of one row
+void CWaterSimulation::FluxRow(int z)
+{
+	const WaterSettings& s = m_Settings;
+
+	//Rain falls everywhere alike, so it only changes the water there is to flow out, not the differences in height
+	const __m128 rain = _mm_set1_ps(s.rain * s.timeStep);
+	const __m128 acceleration = _mm_set1_ps(s.timeStep * s.pipeArea * s.gravity / s.cellSize);
+	const __m128 area = _mm_set1_ps(s.cellSize * s.cellSize);
+	const __m128 timeStep = _mm_set1_ps(s.timeStep);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 tiny = _mm_set1_ps(1.0e-20f);
+
+	const size_t row = Index(0, z);
+	const float* terrain = m_Terrain.data() + row;
+	const float* water = m_Water.data() + row;
+	float* fluxLeft = m_FluxLeft.data() + row;
+	float* fluxRight = m_FluxRight.data() + row;
+	float* fluxUp = m_FluxUp.data() + row;
+	float* fluxDown = m_FluxDown.data() + row;
+	const int stride = m_Stride;
+
+	for (int x = 0; x < m_Width; x += 4)
+	{
+		const __m128 depth = _mm_loadu_ps(water + x);
+		const __m128 surface = _mm_add_ps(_mm_loadu_ps(terrain + x), depth);
+
+		//The flux through each pipe speeds up with the drop to the neighbour, and can't run backwards
+		__m128 left = _mm_sub_ps(surface, _mm_add_ps(_mm_loadu_ps(terrain + x - 1), _mm_loadu_ps(water + x - 1)));
+		__m128 right = _mm_sub_ps(surface, _mm_add_ps(_mm_loadu_ps(terrain + x + 1), _mm_loadu_ps(water + x + 1)));
+		__m128 up = _mm_sub_ps(surface, _mm_add_ps(_mm_loadu_ps(terrain + x - stride), _mm_loadu_ps(water + x - stride)));
+		__m128 down = _mm_sub_ps(surface, _mm_add_ps(_mm_loadu_ps(terrain + x + stride), _mm_loadu_ps(water + x + stride)));
+		left = _mm_max_ps(zero, _mm_add_ps(_mm_loadu_ps(fluxLeft + x), _mm_mul_ps(acceleration, left)));
+		right = _mm_max_ps(zero, _mm_add_ps(_mm_loadu_ps(fluxRight + x), _mm_mul_ps(acceleration, right)));
+		up = _mm_max_ps(zero, _mm_add_ps(_mm_loadu_ps(fluxUp + x), _mm_mul_ps(acceleration, up)));
+		down = _mm_max_ps(zero, _mm_add_ps(_mm_loadu_ps(fluxDown + x), _mm_mul_ps(acceleration, down)));
+
+		//Scale the flux down where it would take out more water than the column holds
+		const __m128 outflow = _mm_mul_ps(_mm_add_ps(_mm_add_ps(left, right), _mm_add_ps(up, down)), timeStep);
+		const __m128 volume = _mm_mul_ps(_mm_add_ps(depth, rain), area);
+		const __m128 scale = _mm_min_ps(one, _mm_div_ps(volume, _mm_max_ps(outflow, tiny)));
+
+		const int lanes = m_Width - x;
+		StoreLanes(fluxLeft + x, _mm_mul_ps(left, scale), lanes);
+		StoreLanes(fluxRight + x, _mm_mul_ps(right, scale), lanes);
+		StoreLanes(fluxUp + x, _mm_mul_ps(up, scale), lanes);
+		StoreLanes(fluxDown + x, _mm_mul_ps(down, scale), lanes);
+	}
+}
+
+//Function to move the water, work out the velocity and erode or deposit on one row
+void CWaterSimulation::WaterRow(int z)
+{
+	const WaterSettings& s = m_Settings;
+
+	const __m128 rain = _mm_set1_ps(s.rain * s.timeStep);
+	const __m128 volumeToDepth = _mm_set1_ps(s.timeStep / (s.cellSize * s.cellSize));
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 invCellSize = _mm_set1_ps(1.0f / s.cellSize);
+	const __m128 slopeScale = _mm_set1_ps(0.5f / s.cellSize);
+	const __m128 minDepth = _mm_set1_ps(MinDepth);
+	const __m128 minTilt = _mm_set1_ps(s.minTilt);
+	const __m128 capacity = _mm_set1_ps(s.capacity);
+	const __m128 invFullDepth = _mm_set1_ps(1.0f / std::max(s.fullDepth, MinDepth));
+	const __m128 dissolve = _mm_set1_ps(s.dissolveSpeed);
+	const __m128 deposit = _mm_set1_ps(s.depositSpeed);
+	const __m128 keep = _mm_set1_ps(std::max(0.0f, 1.0f - s.evaporation * s.timeStep));
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	const size_t row = Index(0, z);
+	const float* terrain = m_Terrain.data() + row;
+	const float* water = m_Water.data() + row;
+	const float* sediment = m_Sediment.data() + row;
+	const float* fluxLeft = m_FluxLeft.data() + row;
+	const float* fluxRight = m_FluxRight.data() + row;
+	const float* fluxUp = m_FluxUp.data() + row;
+	const float* fluxDown = m_FluxDown.data() + row;
+	float* nextTerrain = m_NextTerrain.data() + row;
+	float* nextWater = m_NextWater.data() + row;
+	float* erodedSediment = m_ErodedSediment.data() + row;
+	float* velocityX = m_VelocityX.data() + row;
+	float* velocityZ = m_VelocityZ.data() + row;
+	const int stride = m_Stride;
+
+	for (int x = 0; x < m_Width; x += 4)
+	{
+		//Flux in from the neighbours' pipes towards this sample, the border never has any
+		const __m128 inLeft = _mm_loadu_ps(fluxRight + x - 1);
+		const __m128 inRight = _mm_loadu_ps(fluxLeft + x + 1);
+		const __m128 inUp = _mm_loadu_ps(fluxDown + x - stride);
+		const __m128 inDown = _mm_loadu_ps(fluxUp + x + stride);
+		const __m128 outLeft = _mm_loadu_ps(fluxLeft + x);
+		const __m128 outRight = _mm_loadu_ps(fluxRight + x);
+		const __m128 outUp = _mm_loadu_ps(fluxUp + x);
+		const __m128 outDown = _mm_loadu_ps(fluxDown + x);
+
+		const __m128 inflow = _mm_add_ps(_mm_add_ps(inLeft, inRight), _mm_add_ps(inUp, inDown));
+		const __m128 outflow = _mm_add_ps(_mm_add_ps(outLeft, outRight), _mm_add_ps(outUp, outDown));
+		const __m128 depth = _mm_add_ps(_mm_loadu_ps(water + x), rain);
+		const __m128 newDepth = _mm_max_ps(zero, _mm_add_ps(depth, _mm_mul_ps(volumeToDepth, _mm_sub_ps(inflow, outflow))));
+
+		//Velocity from the water passing through the sample, none in columns that are almost dry
+		const __m128 averageDepth = _mm_mul_ps(half, _mm_add_ps(depth, newDepth));
+		const __m128 wet = _mm_cmpgt_ps(averageDepth, minDepth);
+		const __m128 toVelocity = _mm_and_ps(wet, _mm_div_ps(_mm_mul_ps(half, invCellSize), _mm_max_ps(averageDepth, minDepth)));
+		const __m128 speedX = _mm_mul_ps(toVelocity, _mm_add_ps(_mm_sub_ps(inLeft, outLeft), _mm_sub_ps(outRight, inRight)));
+		const __m128 speedZ = _mm_mul_ps(toVelocity, _mm_add_ps(_mm_sub_ps(inUp, outUp), _mm_sub_ps(outDown, inDown)));
+
+		//Sine of the slope of the terrain, from the differences across the sample
+		const __m128 ground = _mm_loadu_ps(terrain + x);
+		const __m128 slopeX = _mm_mul_ps(slopeScale, _mm_sub_ps(_mm_loadu_ps(terrain + x + 1), _mm_loadu_ps(terrain + x - 1)));
+		const __m128 slopeZ = _mm_mul_ps(slopeScale, _mm_sub_ps(_mm_loadu_ps(terrain + x + stride), _mm_loadu_ps(terrain + x - stride)));
+		const __m128 slopeSquared = _mm_add_ps(_mm_mul_ps(slopeX, slopeX), _mm_mul_ps(slopeZ, slopeZ));
+		const __m128 tilt = _mm_max_ps(minTilt, _mm_sqrt_ps(_mm_div_ps(slopeSquared, _mm_add_ps(one, slopeSquared))));
+
+		//Pick up part of the spare capacity, or drop part of the sediment past it. A film of water runs
+		//fast for the little flux it has, so the capacity falls away in shallow water
+		const __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(speedX, speedX), _mm_mul_ps(speedZ, speedZ)));
+		const __m128 depthScale = _mm_min_ps(one, _mm_mul_ps(newDepth, invFullDepth));
+		const __m128 carried = _mm_loadu_ps(sediment + x);
+		const __m128 spare = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(capacity, tilt), _mm_mul_ps(speed, depthScale)), carried);
+		const __m128 change = _mm_mul_ps(spare, Select(_mm_cmpgt_ps(spare, zero), dissolve, deposit));
+
+		const int lanes = m_Width - x;
+		StoreLanes(nextTerrain + x, _mm_sub_ps(ground, change), lanes);
+		StoreLanes(erodedSediment + x, _mm_add_ps(carried, change), lanes);
+		StoreLanes(nextWater + x, _mm_mul_ps(newDepth, keep), lanes);
+		StoreLanes(velocityX + x, speedX, lanes);
+		StoreLanes(velocityZ + x, speedZ, lanes);
+	}
+}
+
+//Function to carry the sediment of one row with the water
+void CWaterSimulation::TransportRow(int z)
+{
+	//The sediment here is the sediment that was where the water came from, read between the four samples around it
+	const float stepScale = m_Settings.timeStep / m_Settings.cellSize;
+	const size_t row = Index(0, z);
+	const float* velocityX = m_VelocityX.data() + row;
+	const float* velocityZ = m_VelocityZ.data() + row;
+	float* sediment = m_Sediment.data() + row;
+
+	for (int x = 0; x < m_Width; ++x)
+	{
+		const float fromX = std::min(std::max(x - velocityX[x] * stepScale, 0.0f), static_cast<float>(m_Width - 1));
+		const float fromZ = std::min(std::max(z - velocityZ[x] * stepScale, 0.0f), static_cast<float>(m_Height - 1));
+		const int x0 = std::min(static_cast<int>(fromX), std::max(m_Width - 2, 0));
+		const int z0 = std::min(static_cast<int>(fromZ), std::max(m_Height - 2, 0));
+		const float tx = fromX - x0;
+		const float tz = fromZ - z0;
+
+		//The border holds no sediment, so a map one sample wide reads nothing past its edge
+		const float* corner = m_ErodedSediment.data() + Index(x0, z0);
+		const float top = corner[0] + (corner[1] - corner[0]) * tx;
+		const float bottom = corner[m_Stride] + (corner[m_Stride + 1] - corner[m_Stride]) * tx;
+		sediment[x] = top + (bottom - top) * tz;
+	}
+}
+
+//Function to copy the edges of the terrain into the border, after the terrain has changed
+void CWaterSimulation::FillTerrainBorder(std::vector<float>& terrain) const
+{
+	for (int z = 0; z < m_Height; ++z)
+	{
+		float* row = terrain.data() + Index(0, z);
+		row[-1] = row[0];
+		std::fill(row + m_Width, row + m_Stride - 1, row[m_Width - 1]);
+	}
+	std::copy(terrain.begin() + Index(-1, 0), terrain.begin() + Index(-1, 1), terrain.begin());
+	std::copy(terrain.begin() + Index(-1, m_Height - 1), terrain.begin() + Index(-1, m_Height), terrain.begin() + Index(-1, m_Height));
+}
+
+//Function to add water to the springs for one step
+void CWaterSimulation::AddSources()
+{
+	if (m_Settings.sourceRate > 0.0f)
+	{
+		AddWater(m_Settings.sourceX, m_Settings.sourceZ, m_Settings.sourceRadius, m_Settings.sourceRate * m_Settings.timeStep);
+	}
+}
+
+//Function to write the terrain into a heightfield of the same size, with the depth of the water added if asked for
+void CWaterSimulation::WriteHeights(CHeightField& field, bool bWithWater, CThreadPool& pool) const
+{
+	if (field.Width() != m_Width || field.Height() != m_Height) field.ResizeUninitialised(m_Width, m_Height);
+
+	//A band of tile rows per worker, no two workers touch the same tile
+	pool.ParallelFor(field.TilesZ(), [&](int begin, int end)
+	{
+		const int z0 = begin << CHeightField::TileShift;
+		const int z1 = std::min(end << CHeightField::TileShift, m_Height);
+		if (!bWithWater)
+		{
+			field.WriteRegion(0, z0, m_Width, z1 - z0, m_Terrain.data() + Index(0, z0), m_Stride);
+			return;
+		}
+
+		thread_local std::vector<float> surface;
+		surface.resize(static_cast<size_t>(m_Width) * (z1 - z0));
+		for (int z = z0; z < z1; ++z)
+		{
+			const float* terrain = m_Terrain.data() + Index(0, z);
+			const float* water = m_Water.data() + Index(0, z);
+			float* out = surface.data() + static_cast<size_t>(z - z0) * m_Width;
+			for (int x = 0; x < m_Width; ++x) out[x] = terrain[x] + water[x];
+		}
+		field.WriteRegion(0, z0, m_Width, z1 - z0, surface.data(), m_Width);
+	});
+}
+
+//Water over the whole map
+double CWaterSimulation::TotalWater() const
+{
+	double total = 0.0;
+	for (int z = 0; z < m_Height; ++z)
+	{
+		const float* water = m_Water.data() + Index(0, z);
+		for (int x = 0; x < m_Width; ++x) total += water[x];
+	}
+	return total;
+}
+
+//Sediment over the whole map
+double CWaterSimulation::TotalSediment() const
+{
+	double total = 0.0;
+	for (int z = 0; z < m_Height; ++z)
+	{
+		const float* sediment = m_Sediment.data() + Index(0, z);
+		for (int x = 0; x < m_Width; ++x) total += sediment[x];
+	}
+	return total;
+}
+
+//Memory used by the layers of the simulation in bytes
+size_t CWaterSimulation::MemoryUsage() const
+{
+	const std::vector<float>* layers[] = { &m_Terrain, &m_NextTerrain, &m_Water, &m_NextWater, &m_Sediment, &m_ErodedSediment,
+		&m_FluxLeft, &m_FluxRight, &m_FluxUp, &m_FluxDown, &m_VelocityX, &m_VelocityZ };
+
+	size_t bytes = 0;
+	for (const std::vector<float>* layer : layers) bytes += layer->capacity() * sizeof(float);
+	return bytes;
+}
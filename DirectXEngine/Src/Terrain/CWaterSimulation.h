@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------
+// Shallow water and sediment simulation on a heightfield, using virtual pipes
+//--------------------------------------------------------------------------------------
+// Every sample holds a column of water, and neighbouring columns are joined by virtual
+// pipes. Each step:
+//  - The flux through each pipe speeds up with the difference in water surface height and
+//    is scaled down where it would take out more water than the column holds
+//  - The water in each column changes by what flows in less what flows out, the velocity
+//    comes from the flux through the column, and the water flowing over the terrain picks
+//    up or drops sediment depending on its speed and the slope. Some water evaporates
+//  - The sediment moves with the water, read back from where the water came from
+//
+// The terrain, water, sediment, flux and velocity are kept as separate arrays (structure of
+// arrays) so the first two passes can run four samples at a time with SSE. The arrays have
+// a border of one sample: the border holds a water surface too high to flow into, so no
+// flux leaves the map, and repeats the edge of the terrain for the slope. Rows are spread
+// over the thread pool in every pass.
+//
+// The simulation holds its own copy of the terrain. The scene runs a few steps each frame
+// and writes the terrain (with or without the water on it) back into the HeightMap.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Utility/CThreadPool.h"
+
+//Settings of the water simulation, they can be changed between steps
+struct WaterSettings
+{
+	float timeStep = 0.02f;
+	float cellSize = 1.0f;          //Distance between samples, the length of the pipes
+	float pipeArea = 1.0f;          //Cross section of the pipes
+	float gravity = 9.81f;
+	float rain = 0.1f;              //Depth of rain falling everywhere per unit of time
+	float evaporation = 0.5f;       //Part of the water lost per unit of time
+	float capacity = 1.0f;          //Sediment the water can carry for its speed and the slope
+	float minTilt = 0.05f;          //Least slope used for the capacity, so water on flat ground still carries some
+	float fullDepth = 1.0f;         //Depth the water has its whole capacity at, shallower water carries less
+	float dissolveSpeed = 0.01f;    //Part of the spare capacity picked up from the terrain each step
+	float depositSpeed = 0.02f;     //Part of the extra sediment dropped each step
+
+	//A spring adding water around a sample, the depth per unit of time at its centre
+	float sourceX = 128.0f;
+	float sourceZ = 128.0f;
+	float sourceRadius = 8.0f;
+	float sourceRate = 0.0f;
+};
+
+class CWaterSimulation
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Function to start again on a copy of the terrain, with no water or sediment
+	void Reset(const CHeightField& terrain, const WaterSettings& settings);
+
+	//Function to change the settings, taking effect from the next step
+	void SetSettings(const WaterSettings& settings) { m_Settings = settings; }
+
+	const WaterSettings& Settings() const { return m_Settings; }
+
+	//Function to pour water around a sample, the depth given at the centre falling away to the radius
+	void AddWater(float x, float z, float radius, float depth);
+
+	//Function to run a number of steps, each pass spread over the thread pool
+	void Step(int steps, CThreadPool& pool = CThreadPool::Global());
+
+	//Function to write the terrain into a heightfield of the same size, with the depth of the water added if asked for
+	void WriteHeights(CHeightField& field, bool bWithWater, CThreadPool& pool = CThreadPool::Global()) const;
+
+	//Water and sediment over the whole map
+	double TotalWater() const;
+	double TotalSediment() const;
+
+	int Width() const { return m_Width; }
+	int Height() const { return m_Height; }
+
+	//Steps run since the last reset
+	int64_t Steps() const { return m_Steps; }
+
+	//Memory used by the layers of the simulation in bytes
+	size_t MemoryUsage() const;
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Index of a sample in the arrays, (-1, -1) is the corner of the border
+	size_t Index(int x, int z) const { return static_cast<size_t>(z + 1) * m_Stride + (x + 1); }
+
+	//Function to work out the flux through every pipe of one row
+	void FluxRow(int z);
+
+	//Function to move the water, work out the velocity and erode or deposit on one row
+	void WaterRow(int z);
+
+	//Function to carry the sediment of one row with the water
+	void TransportRow(int z);
+
+	//Function to copy the edges of the terrain into the border, after the terrain has changed
+	void FillTerrainBorder(std::vector<float>& terrain) const;
+
+	//Function to add water to the springs for one step
+	void AddSources();
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	WaterSettings m_Settings;
+
+	int m_Width = 0;
+	int m_Height = 0;
+
+	//Floats per row, the map and its border rounded up so the last group of four can be read whole
+	int m_Stride = 0;
+
+	int64_t m_Steps = 0;
+
+	//Terrain and water are read around each sample while the next values are written, so they have two buffers
+	std::vector<float> m_Terrain;
+	std::vector<float> m_NextTerrain;
+	std::vector<float> m_Water;
+	std::vector<float> m_NextWater;
+
+	//Sediment after erosion, then after it has moved with the water
+	std::vector<float> m_Sediment;
+	std::vector<float> m_ErodedSediment;
+
+	//Flux out of each sample through its pipe to the left, right, up (z - 1) and down (z + 1)
+	std::vector<float> m_FluxLeft;
+	std::vector<float> m_FluxRight;
+	std::vector<float> m_FluxUp;
+	std::vector<float> m_FluxDown;
+
+	std::vector<float> m_VelocityX;
+	std::vector<float> m_VelocityZ;
+};
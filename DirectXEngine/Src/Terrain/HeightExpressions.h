@@ -0,0 +1,216 @@
+//--------------------------------------------------------------------------------------
+// Expression templates for point operators on heightfield values
+//--------------------------------------------------------------------------------------
+// An expression of the value h, e.g. round(h) / k or h * a + b, builds a tree of small
+// types that ApplyExpression runs in one pass over the values, with no temporary buffers.
+
+#pragma once
+#include "tepch.h"
+#include "Utility/HashHelpers.h"
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+//Base of every expression node, only used to pick out expressions for the operators below. Every node works out one
+//float in Scalar and four at once with SSE in Vector, both giving the same results, and adds itself to a hash in Hash
+//so operators made from expressions can be found in the cache of generated heightmaps
+template<typename Derived>
+struct HeightExpression
+{
+	const Derived& Self() const { return static_cast<const Derived&>(*this); }
+};
+
+//The value being changed
+struct HeightValue : HeightExpression<HeightValue>
+{
+	float Scalar(float value) const { return value; }
+	__m128 Vector(__m128 values) const { return values; }
+	uint64_t Hash(uint64_t hash) const { return HashCombine(hash, 1u); }
+};
+
+//A number that is the same for every value
+struct HeightConstant : HeightExpression<HeightConstant>
+{
+	explicit HeightConstant(float value) : m_Value(value) {}
+
+	float Scalar(float) const { return m_Value; }
+	__m128 Vector(__m128) const { return _mm_set1_ps(m_Value); }
+	uint64_t Hash(uint64_t hash) const { return HashCombine(HashCombine(hash, 2u), m_Value); }
+
+	float m_Value;
+};
+
+//----------------------//
+// Operations			//
+//----------------------//
+
+struct HeightAdd
+{
+	static const unsigned int Id = 10;
+	static float Scalar(float a, float b) { return a + b; }
+	static __m128 Vector(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+};
+
+struct HeightSubtract
+{
+	static const unsigned int Id = 11;
+	static float Scalar(float a, float b) { return a - b; }
+	static __m128 Vector(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+};
+
+struct HeightMultiply
+{
+	static const unsigned int Id = 12;
+	static float Scalar(float a, float b) { return a * b; }
+	static __m128 Vector(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+};
+
+struct HeightDivide
+{
+	static const unsigned int Id = 13;
+	static float Scalar(float a, float b) { return a / b; }
+	static __m128 Vector(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+};
+
+struct HeightMin
+{
+	static const unsigned int Id = 14;
+	static float Scalar(float a, float b) { return b < a ? b : a; }
+	static __m128 Vector(__m128 a, __m128 b) { return _mm_min_ps(b, a); }
+};
+
+struct HeightMax
+{
+	static const unsigned int Id = 15;
+	static float Scalar(float a, float b) { return a < b ? b : a; }
+	static __m128 Vector(__m128 a, __m128 b) { return _mm_max_ps(b, a); }
+};
+
+struct HeightAbs
+{
+	static const unsigned int Id = 20;
+	static float Scalar(float a) { return std::abs(a); }
+	static __m128 Vector(__m128 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+};
+
+struct HeightNegate
+{
+	static const unsigned int Id = 21;
+	static float Scalar(float a) { return -a; }
+	static __m128 Vector(__m128 a) { return _mm_xor_ps(_mm_set1_ps(-0.0f), a); }
+};
+
+//Rounds halves away from zero like std::round. SSE2 has no rounding instruction, so the value is
+//truncated and moved one further out where the part cut off was at least a half. Floats of 2^23
+//and above are whole numbers already and are left alone
+struct HeightRound
+{
+	static const unsigned int Id = 22;
+	static float Scalar(float a) { return std::round(a); }
+	static __m128 Vector(__m128 a)
+	{
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		const __m128 magnitude = _mm_andnot_ps(sign, a);
+		const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+		const __m128 cutOff = _mm_andnot_ps(sign, _mm_sub_ps(a, truncated));
+		const __m128 step = _mm_or_ps(_mm_and_ps(sign, a), _mm_set1_ps(1.0f));
+		const __m128 away = _mm_add_ps(truncated, _mm_and_ps(_mm_cmpge_ps(cutOff, _mm_set1_ps(0.5f)), step));
+
+		//Truncating drops the sign of values that round to zero, std::round keeps it
+		const __m128 rounded = _mm_or_ps(away, _mm_and_ps(sign, a));
+		const __m128 small = _mm_cmplt_ps(magnitude, _mm_set1_ps(8388608.0f));
+		return _mm_or_ps(_mm_and_ps(small, rounded), _mm_andnot_ps(small, a));
+	}
+};
+
+//Node joining two expressions
+template<typename Op, typename Left, typename Right>
+struct HeightBinary : HeightExpression<HeightBinary<Op, Left, Right>>
+{
+	HeightBinary(const Left& left, const Right& right) : m_Left(left), m_Right(right) {}
+
+	float Scalar(float value) const { return Op::Scalar(m_Left.Scalar(value), m_Right.Scalar(value)); }
+	__m128 Vector(__m128 values) const { return Op::Vector(m_Left.Vector(values), m_Right.Vector(values)); }
+	uint64_t Hash(uint64_t hash) const { return m_Right.Hash(m_Left.Hash(HashCombine(hash, Op::Id))); }
+
+	Left m_Left;
+	Right m_Right;
+};
+
+//Node changing one expression
+template<typename Op, typename Inner>
+struct HeightUnary : HeightExpression<HeightUnary<Op, Inner>>
+{
+	explicit HeightUnary(const Inner& inner) : m_Inner(inner) {}
+
+	float Scalar(float value) const { return Op::Scalar(m_Inner.Scalar(value)); }
+	__m128 Vector(__m128 values) const { return Op::Vector(m_Inner.Vector(values)); }
+	uint64_t Hash(uint64_t hash) const { return m_Inner.Hash(HashCombine(hash, Op::Id)); }
+
+	Inner m_Inner;
+};
+
+//----------------------//
+// Building expressions	//
+//----------------------//
+
+//Each operation between two expressions, or an expression and a number
+#define HEIGHT_EXPRESSION_BINARY(FUNCTION, OP)                                                                          \
+	template<typename L, typename R>                                                                                    \
+	HeightBinary<OP, L, R> FUNCTION(const HeightExpression<L>& left, const HeightExpression<R>& right)                  \
+	{ return HeightBinary<OP, L, R>(left.Self(), right.Self()); }                                                       \
+	template<typename L>                                                                                                \
+	HeightBinary<OP, L, HeightConstant> FUNCTION(const HeightExpression<L>& left, float right)                          \
+	{ return HeightBinary<OP, L, HeightConstant>(left.Self(), HeightConstant(right)); }                                 \
+	template<typename R>                                                                                                \
+	HeightBinary<OP, HeightConstant, R> FUNCTION(float left, const HeightExpression<R>& right)                          \
+	{ return HeightBinary<OP, HeightConstant, R>(HeightConstant(left), right.Self()); }
+
+HEIGHT_EXPRESSION_BINARY(operator+, HeightAdd)
+HEIGHT_EXPRESSION_BINARY(operator-, HeightSubtract)
+HEIGHT_EXPRESSION_BINARY(operator*, HeightMultiply)
+HEIGHT_EXPRESSION_BINARY(operator/, HeightDivide)
+HEIGHT_EXPRESSION_BINARY(min, HeightMin)
+HEIGHT_EXPRESSION_BINARY(max, HeightMax)
+
+#undef HEIGHT_EXPRESSION_BINARY
+
+template<typename E>
+HeightUnary<HeightNegate, E> operator-(const HeightExpression<E>& inner) { return HeightUnary<HeightNegate, E>(inner.Self()); }
+
+template<typename E>
+HeightUnary<HeightAbs, E> abs(const HeightExpression<E>& inner) { return HeightUnary<HeightAbs, E>(inner.Self()); }
+
+template<typename E>
+HeightUnary<HeightRound, E> round(const HeightExpression<E>& inner) { return HeightUnary<HeightRound, E>(inner.Self()); }
+
+//Function to limit an expression to a range
+template<typename E>
+auto clamp(const HeightExpression<E>& inner, float low, float high) -> decltype(min(max(inner, low), high))
+{
+	return min(max(inner, low), high);
+}
+
+//----------------------//
+// Evaluation			//
+//----------------------//
+
+//Function to replace every value in the region with the expression of it, in one pass along the rows, four values
+//at a time and the last few of each row one at a time
+template<typename E>
+void ApplyExpression(const HeightExpression<E>& expression, int width, int height, float* values, int stride)
+{
+	const E& e = expression.Self();
+	for (int z = 0; z < height; ++z)
+	{
+		float* row = values + static_cast<size_t>(z) * stride;
+		int x = 0;
+		for (; x + 4 <= width; x += 4)
+		{
+			_mm_storeu_ps(row + x, e.Vector(_mm_loadu_ps(row + x)));
+		}
+		for (; x < width; ++x)
+		{
+			row[x] = e.Scalar(row[x]);
+		}
+	}
+}
@@ -0,0 +1,440 @@
+#include "TerrainBenchmarks.h"
+#include "Terrain/CHeightField.h"
+#include "Math/DiamondSquare.h"
+#include "Terrain/CThermalErosion.h"
+#include "Terrain/CSpectralSynthesis.h"
+#include "Terrain/CConstraintSolver.h"
+#include "Terrain/CStampGenerator.h"
+#include "Terrain/CTerrainGraph.h"
+#include "Terrain/CMinMaxPyramid.h"
+#include "Utility/CThreadPool.h"
+#include "Utility/MemoryHelpers.h"
+#include <chrono>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//Counter of data TLB misses on the calling thread, only available through perf on Linux. Windows has no user
+//mode API for the hardware counters, so there it always reports them as unavailable
+class CTlbMissCounter
+{
+public:
+	CTlbMissCounter()
+	{
+#if defined(__linux__)
+		perf_event_attr attr = {};
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_File = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		if (m_File >= 0) ioctl(m_File, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+
+	~CTlbMissCounter()
+	{
+#if defined(__linux__)
+		if (m_File >= 0) close(m_File);
+#endif
+	}
+
+	CTlbMissCounter(const CTlbMissCounter&) = delete;
+	CTlbMissCounter& operator=(const CTlbMissCounter&) = delete;
+
+	//Misses counted since construction, -1 if the counter could not be opened
+	int64_t Stop()
+	{
+#if defined(__linux__)
+		if (m_File < 0) return -1;
+		ioctl(m_File, PERF_EVENT_IOC_DISABLE, 0);
+		int64_t misses = -1;
+		if (read(m_File, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+		close(m_File);
+		m_File = -1;
+		return misses;
+#else
+		return -1;
+#endif
+	}
+
+private:
+	int m_File = -1;
+};
+
+//Function to time random reads from the tiles of a size x size heightfield, once with each page mode
+std::vector<BenchmarkResult> BenchmarkPageModes(int size, int reads)
+{
+	//The tiles come from an allocator of their own with the heightfield's block size, as the heightfields' one
+	//would hand back blocks from slabs it already has whatever the page mode is now. Samples start a header in
+	//from the block and are read through a table of tile pointers, the same as CHeightField::Get
+	const int tilesPerSide = (size + CHeightField::TileMask) >> CHeightField::TileShift;
+	const int tileCount = tilesPerSide * tilesPerSide;
+	const size_t blockBytes = CHeightField::TileAllocator().BlockSize();
+
+	CThreadPool& pool = CThreadPool::Global();
+	std::vector<BenchmarkResult> results;
+
+	for (EPageMode mode : { EPageMode::Normal, EPageMode::TransparentHuge, EPageMode::ExplicitHuge })
+	{
+		BenchmarkResult result;
+		result.name = PageModeName(mode);
+
+		CTileAllocator allocator(blockBytes);
+		allocator.SetPageMode(mode);
+
+		//Every tile is taken and first written by the worker that owns it, as CHeightField::Resize does
+		std::vector<float*> tiles(tileCount);
+		pool.ParallelFor(tileCount, [&](int begin, int end)
+		{
+			for (int tile = begin; tile < end; ++tile)
+			{
+				tiles[tile] = reinterpret_cast<float*>(static_cast<char*>(allocator.Allocate()) + CTileAllocator::BlockAlignment);
+				std::fill(tiles[tile], tiles[tile] + CHeightField::TileSamples, 1.0f);
+			}
+		});
+		result.hugePages = allocator.HugePageSlabs() * CTileAllocator::DefaultSlabBytes == allocator.ReservedBytes();
+
+		std::vector<int64_t> misses(pool.NumThreads(), -1);
+		std::vector<float> sums(pool.NumThreads(), 0.0f);
+		auto start = std::chrono::high_resolution_clock::now();
+
+		pool.ParallelFor(pool.NumThreads(), [&](int begin, int end)
+		{
+			for (int worker = begin; worker < end; ++worker)
+			{
+				CTlbMissCounter counter;
+				uint32_t state = 0x9E3779B9u * (worker + 1);
+				float sum = 0.0f;
+				for (int i = worker; i < reads; i += pool.NumThreads())
+				{
+					//xorshift, cheap enough not to hide the cost of the reads
+					state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+					int x = static_cast<int>(state % static_cast<uint32_t>(size));
+					int z = static_cast<int>((state >> 7) % static_cast<uint32_t>(size));
+					int step = 1 << (state >> 28);
+
+					//Read a sample and its four neighbours at a diamond-square style distance
+					int xs[5] = { x, std::min(x + step, size - 1), std::max(x - step, 0), x, x };
+					int zs[5] = { z, z, z, std::min(z + step, size - 1), std::max(z - step, 0) };
+					for (int n = 0; n < 5; ++n)
+					{
+						const float* tile = tiles[(zs[n] >> CHeightField::TileShift) * tilesPerSide + (xs[n] >> CHeightField::TileShift)];
+						sum += tile[((zs[n] & CHeightField::TileMask) << CHeightField::TileShift) + (xs[n] & CHeightField::TileMask)];
+					}
+				}
+				misses[worker] = counter.Stop();
+				sums[worker] = sum;
+			}
+		});
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		result.milliseconds = elapsed.count();
+		result.nanosecondsPerItem = elapsed.count() * 1.0e6 / std::max(reads, 1);
+		if (std::all_of(misses.begin(), misses.end(), [](int64_t count) { return count >= 0; }))
+		{
+			result.tlbMisses = std::accumulate(misses.begin(), misses.end(), int64_t(0));
+		}
+
+		//Keep the reads from being optimised away
+		if (std::accumulate(sums.begin(), sums.end(), 0.0f) < 0.0f) result.name += "*";
+
+		for (float* tile : tiles)
+		{
+			allocator.Free(reinterpret_cast<char*>(tile) - CTileAllocator::BlockAlignment);
+		}
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+//Function to time diamond-square with 1, 2, 4... workers up to one per hardware thread
+std::vector<BenchmarkResult> BenchmarkDiamondSquare(int size)
+{
+	std::vector<BenchmarkResult> results;
+	const int hardwareThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	const double samples = static_cast<double>(size + 1) * (size + 1);
+
+	CHeightField field;
+	for (int threads = 1; ; threads = std::min(threads * 2, hardwareThreads))
+	{
+		//A pool of its own for each run, the same seed every time so each run does the same work
+		CThreadPool pool(threads);
+		DiamondSquare ds(size, 30.0f, 2.0f);
+		ds.setSeed(1);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		ds.process(field, pool);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		BenchmarkResult result;
+		result.name = "Diamond Square " + std::to_string(size + 1) + ", " + std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+		result.milliseconds = elapsed.count();
+		result.nanosecondsPerItem = elapsed.count() * 1.0e6 / samples;
+		results.push_back(result);
+
+		if (threads == hardwareThreads) break;
+	}
+
+	return results;
+}
+
+//Function to time thermal erosion with and without running several iterations per block
+std::vector<BenchmarkResult> BenchmarkThermalErosion(int size, int iterations)
+{
+	std::vector<BenchmarkResult> results;
+	const double samples = static_cast<double>(size + 1) * (size + 1);
+
+	CHeightField map;
+	DiamondSquare ds(size, 30.0f, 2.0f, 1);
+	ds.process(map);
+
+	for (int iterationsPerBlock : { 1, ThermalSettings().iterationsPerBlock })
+	{
+		ThermalSettings settings;
+		settings.iterations = iterations;
+		settings.iterationsPerBlock = iterationsPerBlock;
+		CThermalErosion erosion(settings);
+
+		//Each run starts from the same map, copying only shares its tiles
+		CHeightField field = map;
+		auto start = std::chrono::high_resolution_clock::now();
+		erosion.Erode(field);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		BenchmarkResult result;
+		result.name = "Thermal " + std::to_string(size + 1) + ", " + std::to_string(iterations) + " iterations, " + std::to_string(iterationsPerBlock) + " per block";
+		result.milliseconds = elapsed.count();
+		result.nanosecondsPerItem = elapsed.count() * 1.0e6 / (samples * iterations);
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+//Function to time each generator making the same size of map
+std::vector<BenchmarkResult> BenchmarkGenerators(int size)
+{
+	std::vector<BenchmarkResult> results;
+	const double samples = static_cast<double>(size + 1) * (size + 1);
+
+	//Each generator starts from a new heightfield so none of them reuses the tiles of the last one
+	auto run = [&](const std::string& name, const std::function<void(CHeightField&)>& generate)
+	{
+		CHeightField field;
+		field.Resize(size + 1, size + 1, 0.0f);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		generate(field);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		BenchmarkResult result;
+		result.name = name + " " + std::to_string(size + 1);
+		result.milliseconds = elapsed.count();
+		result.nanosecondsPerItem = elapsed.count() * 1.0e6 / samples;
+		results.push_back(result);
+	};
+
+	run("Perlin Noise", [&](CHeightField& field)
+	{
+		NoiseSettings settings;
+		settings.scale = 500.0f / size;
+		CTerrainGraph graph;
+		graph.Execute(graph.Add<CPerlinOperator>({}, settings), field, size + 1, size + 1);
+	});
+	run("Diamond Square", [&](CHeightField& field)
+	{
+		DiamondSquare ds(size, 30.0f, 2.0f, 1);
+		ds.process(field);
+	});
+	run("Spectral Synthesis", [&](CHeightField& field)
+	{
+		SpectralSettings settings;
+		settings.seed = 1;
+		CSpectralSynthesis synthesis(settings);
+		synthesis.Generate(field);
+	});
+
+	return results;
+}
+
+//Function to time the constraint solver with multigrid and with plain relaxation
+std::vector<BenchmarkResult> BenchmarkConstraintSolver(int size, int relaxationSweeps)
+{
+	std::vector<BenchmarkResult> results;
+	const double samples = static_cast<double>(size + 1) * (size + 1);
+	const float scale = static_cast<float>(size);
+
+	std::vector<HeightConstraint> constraints(3);
+	constraints[0].x0 = constraints[0].x1 = 0.3f * scale;
+	constraints[0].z0 = constraints[0].z1 = 0.3f * scale;
+	constraints[0].height0 = constraints[0].height1 = 60.0f;
+	constraints[1].x0 = 0.1f * scale;
+	constraints[1].z0 = 0.8f * scale;
+	constraints[1].x1 = 0.9f * scale;
+	constraints[1].z1 = 0.6f * scale;
+	constraints[1].height0 = -10.0f;
+	constraints[1].height1 = -30.0f;
+	constraints[2].x0 = constraints[2].x1 = 0.7f * scale;
+	constraints[2].z0 = constraints[2].z1 = 0.25f * scale;
+	constraints[2].height0 = constraints[2].height1 = 10.0f;
+	constraints[2].radius = 0.04f * scale;
+
+	for (EConstraintFill fill : { EConstraintFill::Harmonic, EConstraintFill::Biharmonic })
+	{
+		const std::string fillName = fill == EConstraintFill::Harmonic ? "Harmonic" : "Biharmonic";
+
+		//Measured by the residual left, as a part of the one of a flat fill, so neither run is measured against
+		//an answer that may not be finished itself
+		auto run = [&](const std::string& name, const ConstraintSettings& runSettings)
+		{
+			CHeightField field;
+			field.Resize(size + 1, size + 1, 0.0f);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			const CConstraintSolver::SolveStats stats = CConstraintSolver(constraints, runSettings).Solve(field);
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+			char text[64];
+			snprintf(text, sizeof(text), ", %d cycles, residual %.3g%s", stats.cycles, stats.residual, stats.bDiverged ? ", stopped" : "");
+			BenchmarkResult result;
+			result.name = fillName + " " + name + " " + std::to_string(size + 1) + text;
+			result.milliseconds = elapsed.count();
+			result.nanosecondsPerItem = elapsed.count() * 1.0e6 / samples;
+			results.push_back(result);
+		};
+
+		ConstraintSettings settings;
+		settings.fill = fill;
+		run("multigrid", settings);
+
+		settings.maxLevels = 1;
+		settings.maxCycles = relaxationSweeps;
+		settings.preSweeps = 1;
+		settings.postSweeps = 0;
+		settings.tolerance = 0.0f;
+		run("relaxation", settings);
+	}
+
+	return results;
+}
+
+//Function to time stamps blended onto a map with each blend
+std::vector<BenchmarkResult> BenchmarkStamps(int size, int count)
+{
+	std::vector<BenchmarkResult> results;
+	const double samples = static_cast<double>(size + 1) * (size + 1);
+
+	const char* blendNames[] = { "Add", "Max", "Smooth Max" };
+	for (EStampBlend blend : { EStampBlend::Add, EStampBlend::Max, EStampBlend::SmoothMax })
+	{
+		StampSettings settings;
+		settings.count = count;
+		settings.width = size + 1;
+		settings.height = size + 1;
+		settings.minRadius = size / 512.0f;
+		settings.maxRadius = size / 42.0f;
+		settings.blend = blend;
+		settings.seed = 1;
+
+		//Placing and binning the stamps is part of the time, it happens when the operator is made
+		CHeightField field;
+		auto start = std::chrono::high_resolution_clock::now();
+		CTerrainGraph graph;
+		CTerrainGraph::NodeId flat = graph.Add<CConstantOperator>({}, 0.0f);
+		CTerrainGraph::NodeId stamps = graph.Add<CStampOperator>({ flat }, settings);
+		graph.Execute(stamps, field, size + 1, size + 1);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		const int binned = CStampGenerator(settings).BinnedStamps();
+		BenchmarkResult result;
+		result.name = "Stamps " + std::string(blendNames[static_cast<int>(blend)]) + " " + std::to_string(size + 1) + ", " + std::to_string(count) + " stamps in " + std::to_string(binned) + " cell entries";
+		result.milliseconds = elapsed.count();
+		result.nanosecondsPerItem = elapsed.count() * 1.0e6 / samples;
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+//Function to time remapping a map with rounding and with curves
+std::vector<BenchmarkResult> BenchmarkRemap(int size)
+{
+	std::vector<BenchmarkResult> results;
+	const double samples = static_cast<double>(size + 1) * (size + 1);
+
+	CHeightField map;
+	DiamondSquare ds(size, 30.0f, 2.0f, 1);
+	ds.process(map);
+
+	//Each remap reads the same map, so only the remap differs between them
+	auto run = [&](const std::string& name, const std::function<CTerrainGraph::NodeId(CTerrainGraph&, CTerrainGraph::NodeId)>& remap)
+	{
+		CHeightField field;
+		auto start = std::chrono::high_resolution_clock::now();
+		CTerrainGraph graph;
+		CTerrainGraph::NodeId input = graph.Add<CInputOperator>({}, map);
+		graph.Execute(remap(graph, input), field, size + 1, size + 1);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		BenchmarkResult result;
+		result.name = name + " " + std::to_string(size + 1);
+		result.milliseconds = elapsed.count();
+		result.nanosecondsPerItem = elapsed.count() * 1.0e6 / samples;
+		results.push_back(result);
+	};
+
+	//Splines from the lowest height to the highest, the many point one zig-zags so every segment is different
+	const CMinMaxPyramid::Range range = [&]()
+	{
+		CMinMaxPyramid pyramid;
+		pyramid.Build(map);
+		return pyramid.Total();
+	}();
+	auto spline = [&](int points)
+	{
+		CurveSettings settings;
+		for (int i = 0; i < points; ++i)
+		{
+			const float t = static_cast<float>(i) / (points - 1);
+			const float bend = points > 5 ? 0.02f * ((i & 1) ? 1.0f : -1.0f) : 0.0f;
+			settings.points.push_back({ range.min + (range.max - range.min) * t, range.min + (range.max - range.min) * std::min(std::max(t * t + bend, 0.0f), 1.0f) });
+		}
+		return settings;
+	};
+
+	run("Rounded Terraces", [&](CTerrainGraph& graph, CTerrainGraph::NodeId input)
+	{
+		return graph.Add<CTerraceOperator>({ input }, 1.1f);
+	});
+	run("Spline 5 Points", [&](CTerrainGraph& graph, CTerrainGraph::NodeId input)
+	{
+		return graph.Add<CRemapOperator>({ input }, spline(5));
+	});
+	run("Spline 200 Points", [&](CTerrainGraph& graph, CTerrainGraph::NodeId input)
+	{
+		return graph.Add<CRemapOperator>({ input }, spline(200));
+	});
+	run("Smooth Terraces", [&](CTerrainGraph& graph, CTerrainGraph::NodeId input)
+	{
+		CurveSettings settings;
+		settings.shape = ECurveShape::Terraces;
+		return graph.Add<CRemapOperator>({ input }, settings);
+	});
+
+	//Curves cost more than rounding, by how much is part of the result
+	for (BenchmarkResult& result : results)
+	{
+		char text[32];
+		snprintf(text, sizeof(text), ", %.2fx rounding", result.milliseconds / results[0].milliseconds);
+		result.name += text;
+	}
+	return results;
+}
@@ -0,0 +1,47 @@
+//--------------------------------------------------------------------------------------
+// Benchmarks of the terrain kernels, run from the UI
+//--------------------------------------------------------------------------------------
+
+#pragma once
+#include "tepch.h"
+
+//Result of one benchmark run
+struct BenchmarkResult
+{
+	std::string name;
+	double milliseconds = 0.0;       //Total time taken
+	double nanosecondsPerItem = 0.0; //Time per read, sample or droplet depending on the benchmark
+	int64_t tlbMisses = -1;          //Data TLB misses, -1 when the hardware counters can't be read
+	bool hugePages = false;          //Whether the memory could be backed by huge pages
+};
+
+//Function to time random reads from the tiles of a size x size heightfield, with the tiles in slabs of a tile allocator
+//set to each page mode. The access pattern matches the neighbour lookups of diamond-square and erosion. Data TLB
+//misses are counted through perf on Linux, Windows has no user mode API for them so they need a profiler there
+std::vector<BenchmarkResult> BenchmarkPageModes(int size, int reads);
+
+//Function to time diamond-square on a (size + 1) x (size + 1) heightfield with 1, 2, 4... workers up to
+//one per hardware thread, to show how it scales. size must be a power of 2
+std::vector<BenchmarkResult> BenchmarkDiamondSquare(int size);
+
+//Function to time thermal erosion on a (size + 1) x (size + 1) diamond-square map, one iteration per pass
+//over the map and then several iterations per block, to show what keeping blocks in cache saves
+std::vector<BenchmarkResult> BenchmarkThermalErosion(int size, int iterations);
+
+//Function to time Perlin noise, diamond-square and spectral synthesis making a (size + 1) x (size + 1) map
+//on the whole pool, to compare the generators. size must be a power of 2
+std::vector<BenchmarkResult> BenchmarkGenerators(int size);
+
+//Function to time the constraint solver filling a (size + 1) x (size + 1) map around a peak, a valley line and a
+//flat site, with multigrid and with plain relaxation for the given number of sweeps. The names give the residual
+//left, as a part of the residual of a flat fill
+std::vector<BenchmarkResult> BenchmarkConstraintSolver(int size, int relaxationSweeps);
+
+//Function to time count stamps blended onto a (size + 1) x (size + 1) map through the graph with each blend, the names
+//give the number of stamps in the cells of the spatial hash
+std::vector<BenchmarkResult> BenchmarkStamps(int size, int count);
+
+//Function to time remapping a (size + 1) x (size + 1) diamond-square map through the graph with rounded terraces, splines
+//of a few and of many points and smooth terraces. The names give the time of each as a multiple of rounding's. size
+//must be a power of 2
+std::vector<BenchmarkResult> BenchmarkRemap(int size);
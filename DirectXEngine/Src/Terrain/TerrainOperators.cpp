@@ -0,0 +1,539 @@
+#include "TerrainOperators.h"
+#include "Math/DiamondSquare.h"
+#include "Utility/HashHelpers.h"
+
+//Function to add the noise settings to a running hash
+static uint64_t HashNoiseSettings(uint64_t hash, const NoiseSettings& settings)
+{
+	hash = HashCombine(hash, settings.seed);
+	hash = HashCombine(hash, settings.amplitude);
+	hash = HashCombine(hash, settings.frequency);
+	hash = HashCombine(hash, settings.scale);
+	hash = HashCombine(hash, settings.offsetX);
+	return HashCombine(hash, settings.offsetZ);
+}
+
+//The input is identified by its samples, so two copies of the same heightfield share cached results
+uint64_t CInputOperator::ParameterHash() const
+{
+	return m_Field.ContentHash();
+}
+
+//----------------------//
+// Generators			//
+//----------------------//
+
+void CConstantOperator::Generate(const TerrainRegion& region, float* out, int stride) const
+{
+	for (int z = 0; z < region.height; ++z)
+	{
+		std::fill(out + z * stride, out + z * stride + region.width, m_Value);
+	}
+}
+
+uint64_t CConstantOperator::ParameterHash() const
+{
+	return HashCombine(0, m_Value);
+}
+
+void CPerlinOperator::Generate(const TerrainRegion& region, float* out, int stride) const
+{
+	//Same coordinates as the original Perlin height map so the terrain keeps its look
+	const double step = m_Settings.frequency * m_Settings.scale / 20.0;
+
+	for (int z = 0; z < region.height; ++z)
+	{
+		float* row = out + z * stride;
+		const double zCoord = (region.z + m_Settings.offsetZ + z) * step;
+		for (int x = 0; x < region.width; ++x)
+		{
+			row[x] = static_cast<float>(m_Noise.noise((region.x + m_Settings.offsetX + x) * step, 0.0, zCoord)) * m_Settings.amplitude;
+		}
+	}
+}
+
+uint64_t CPerlinOperator::ParameterHash() const
+{
+	return HashNoiseSettings(0, m_Settings);
+}
+
+void CFractalPerlinOperator::Generate(const TerrainRegion& region, float* out, int stride) const
+{
+	for (int z = 0; z < region.height; ++z)
+	{
+		std::fill(out + z * stride, out + z * stride + region.width, 0.0f);
+	}
+
+	//Add each octave on to the running total while the region is still in cache
+	float amplitude = m_Settings.amplitude;
+	float frequency = m_Settings.frequency;
+	for (int octave = 0; octave < m_Octaves; ++octave)
+	{
+		const double step = frequency * m_Settings.scale / 20.0;
+		for (int z = 0; z < region.height; ++z)
+		{
+			float* row = out + z * stride;
+			const double zCoord = (region.z + m_Settings.offsetZ + z) * step;
+			for (int x = 0; x < region.width; ++x)
+			{
+				row[x] += static_cast<float>(m_Noise.noise((region.x + m_Settings.offsetX + x) * step, 0.0, zCoord)) * amplitude;
+			}
+		}
+
+		amplitude *= m_AmplitudeReduction;
+		frequency *= m_FrequencyMultiplier;
+	}
+}
+
+uint64_t CFractalPerlinOperator::ParameterHash() const
+{
+	uint64_t hash = HashNoiseSettings(0, m_Settings);
+	hash = HashCombine(hash, m_Octaves);
+	hash = HashCombine(hash, m_AmplitudeReduction);
+	return HashCombine(hash, m_FrequencyMultiplier);
+}
+
+//Function to count the octaves whose waves are at least the given number of samples long
+int CFractalPerlinOperator::OctavesLongerThan(const NoiseSettings& settings, int octaves, float frequencyMultiplier, float samples)
+{
+	//Perlin noise has a wave for every whole coordinate, and a sample steps frequency * scale / 20 coordinates
+	float frequency = settings.frequency;
+	int count = 1;
+	while (count < octaves)
+	{
+		frequency *= frequencyMultiplier;
+		if (20.0f / (frequency * settings.scale) < samples) break;
+		++count;
+	}
+	return std::min(count, std::max(octaves, 0));
+}
+
+void CRigidOperator::Generate(const TerrainRegion& region, float* out, int stride) const
+{
+	const double step = m_Settings.frequency * m_Settings.scale / 20.0;
+	const float sign = m_Inverse ? 1.0f : -1.0f;
+
+	for (int z = 0; z < region.height; ++z)
+	{
+		float* row = out + z * stride;
+		const double zCoord = (region.z + m_Settings.offsetZ + z) * step;
+		for (int x = 0; x < region.width; ++x)
+		{
+			float noise = static_cast<float>(m_Noise.noise((region.x + m_Settings.offsetX + x) * step, 0.0, zCoord)) * m_Settings.amplitude;
+			row[x] = sign * (1.0f - std::abs(noise));
+		}
+	}
+}
+
+uint64_t CRigidOperator::ParameterHash() const
+{
+	return HashCombine(HashNoiseSettings(0, m_Settings), m_Inverse);
+}
+
+void CBumpOperator::Generate(const TerrainRegion& region, float* out, int stride) const
+{
+	const float invRadius = 1.0f / m_Radius;
+	for (int z = 0; z < region.height; ++z)
+	{
+		float* row = out + z * stride;
+		const float dz = (region.z + z - m_CentreZ) * invRadius;
+		for (int x = 0; x < region.width; ++x)
+		{
+			const float dx = (region.x + x - m_CentreX) * invRadius;
+			const float t = std::max(0.0f, 1.0f - std::sqrt(dx * dx + dz * dz));
+
+			//Smoothstep so the edge of the bump meets the terrain without a crease
+			row[x] = m_Height * t * t * (3.0f - 2.0f * t);
+		}
+	}
+}
+
+//Samples that the bump can change
+TerrainRegion CBumpOperator::Bounds() const
+{
+	const int x0 = static_cast<int>(std::floor(m_CentreX - m_Radius));
+	const int z0 = static_cast<int>(std::floor(m_CentreZ - m_Radius));
+	const int size = static_cast<int>(std::ceil(2.0f * m_Radius)) + 2;
+	return { x0, z0, size, size };
+}
+
+uint64_t CBumpOperator::ParameterHash() const
+{
+	uint64_t hash = HashCombine(0, m_CentreX);
+	hash = HashCombine(hash, m_CentreZ);
+	hash = HashCombine(hash, m_Radius);
+	return HashCombine(hash, m_Height);
+}
+
+void CMidpointDisplacementOperator::Generate(const TerrainRegion& region, float* out, int stride) const
+{
+	m_Generator->GenerateRegion(region.x, region.z, region.width, region.height, out, stride);
+}
+
+uint64_t CMidpointDisplacementOperator::ParameterHash() const
+{
+	const MidpointSettings& settings = m_Generator->Settings();
+	uint64_t hash = HashCombine(0, settings.width);
+	hash = HashCombine(hash, settings.height);
+	hash = HashCombine(hash, settings.spread);
+	hash = HashCombine(hash, settings.spreadReduction);
+	hash = HashCombine(hash, settings.seed);
+	return HashCombine(hash, settings.bWrap);
+}
+
+void CUpsampleOperator::Generate(const TerrainRegion& region, float* out, int stride) const
+{
+	m_Upsampler->GenerateRegion(region.x, region.z, region.width, region.height, out, stride);
+}
+
+uint64_t CUpsampleOperator::ParameterHash() const
+{
+	const UpsampleSettings& settings = m_Upsampler->Settings();
+	uint64_t hash = HashCombine(0, m_Upsampler->Coarse().ContentHash());
+	hash = HashCombine(hash, settings.factor);
+	hash = HashCombine(hash, settings.detail);
+	hash = HashCombine(hash, settings.minimumDetail);
+	hash = HashCombine(hash, settings.spreadReduction);
+	return HashCombine(hash, settings.seed);
+}
+
+//----------------------//
+// Point operators		//
+//----------------------//
+
+void CScaleBiasOperator::Apply(const TerrainRegion& region, float* values, int stride) const
+{
+	const HeightValue h;
+	ApplyExpression(h * m_Scale + m_Bias, region.width, region.height, values, stride);
+}
+
+uint64_t CScaleBiasOperator::ParameterHash() const
+{
+	return HashCombine(HashCombine(0, m_Scale), m_Bias);
+}
+
+void CTerraceOperator::Apply(const TerrainRegion& region, float* values, int stride) const
+{
+	const HeightValue h;
+	ApplyExpression(round(h) / m_Multiplier, region.width, region.height, values, stride);
+}
+
+uint64_t CTerraceOperator::ParameterHash() const
+{
+	return HashCombine(0, m_Multiplier);
+}
+
+void CRemapOperator::Apply(const TerrainRegion& region, float* values, int stride) const
+{
+	const HeightValue h;
+	ApplyExpression(remap(*m_Curve, h), region.width, region.height, values, stride);
+}
+
+void CHeightBandOperator::Apply(const TerrainRegion& region, float* values, int stride) const
+{
+	const HeightValue h;
+	const float inverseFade = 1.0f / m_Fade;
+	auto band = min(clamp((h - m_Low) * inverseFade + 1.0f, 0.0f, 1.0f), clamp((m_High - h) * inverseFade + 1.0f, 0.0f, 1.0f));
+	ApplyExpression(band, region.width, region.height, values, stride);
+}
+
+uint64_t CHeightBandOperator::ParameterHash() const
+{
+	return HashCombine(HashCombine(HashCombine(0, m_Low), m_High), m_Fade);
+}
+
+void CStampOperator::Apply(const TerrainRegion& region, float* values, int stride) const
+{
+	m_Generator->Apply(region.x, region.z, region.width, region.height, values, stride);
+}
+
+uint64_t CStampOperator::ParameterHash() const
+{
+	const StampSettings& settings = m_Generator->Settings();
+	uint64_t hash = HashCombine(0, settings.count);
+	hash = HashCombine(hash, settings.width);
+	hash = HashCombine(hash, settings.height);
+	hash = HashCombine(hash, settings.minRadius);
+	hash = HashCombine(hash, settings.maxRadius);
+	hash = HashCombine(hash, settings.heightPerRadius);
+	hash = HashCombine(hash, static_cast<int>(settings.blend));
+	hash = HashCombine(hash, settings.smoothness);
+	for (bool bShape : settings.bShapes) hash = HashCombine(hash, bShape);
+	return HashCombine(hash, settings.seed);
+}
+
+//----------------------//
+// Combiners			//
+//----------------------//
+
+const char* CCombineOperator::Name() const
+{
+	switch (m_Mode)
+	{
+	case ECombineMode::Multiply: return "Multiply";
+	case ECombineMode::Min:      return "Min";
+	case ECombineMode::Max:      return "Max";
+	default:                     return "Add";
+	}
+}
+
+void CCombineOperator::Combine(const TerrainRegion& region, float* result, const float* input, int stride) const
+{
+	for (int z = 0; z < region.height; ++z)
+	{
+		float* row = result + z * stride;
+		const float* in = input + z * stride;
+		switch (m_Mode)
+		{
+		case ECombineMode::Add:      for (int x = 0; x < region.width; ++x) row[x] += in[x]; break;
+		case ECombineMode::Multiply: for (int x = 0; x < region.width; ++x) row[x] *= in[x]; break;
+		case ECombineMode::Min:      for (int x = 0; x < region.width; ++x) row[x] = std::min(row[x], in[x]); break;
+		case ECombineMode::Max:      for (int x = 0; x < region.width; ++x) row[x] = std::max(row[x], in[x]); break;
+		}
+	}
+}
+
+uint64_t CCombineOperator::ParameterHash() const
+{
+	return HashCombine(0, static_cast<int>(m_Mode));
+}
+
+//----------------------//
+// Blends				//
+//----------------------//
+
+uint64_t CBiomeOperator::Weights(const TerrainRegion& region, const float*, float* weights, size_t plane, int stride) const
+{
+	return m_Map.Weights(region.x, region.z, region.width, region.height, weights, plane, stride);
+}
+
+uint64_t CBiomeOperator::ParameterHash() const
+{
+	const BiomeSettings& settings = m_Map.Settings();
+	uint64_t hash = HashCombine(0, settings.frequency);
+	hash = HashCombine(hash, settings.scale);
+	hash = HashCombine(hash, settings.offsetX);
+	hash = HashCombine(hash, settings.offsetZ);
+	hash = HashCombine(hash, settings.transition);
+	for (const BiomeClimate& biome : settings.biomes)
+	{
+		hash = HashCombine(hash, biome.temperature);
+		hash = HashCombine(hash, biome.moisture);
+	}
+	return HashCombine(hash, settings.seed);
+}
+
+uint64_t CMaskBlendOperator::Weights(const TerrainRegion& region, const float* controls, float* weights, size_t plane, int stride) const
+{
+	//Masks are clamped so the weights stay between 0 and 1, which keeps a mask of exactly 0 or 1 to one input
+	bool bAnyBase = false, bAnyLayer = false;
+	for (int z = 0; z < region.height; ++z)
+	{
+		const float* mask = controls + z * stride;
+		float* base = weights + z * stride;
+		float* layer = base + plane;
+		float lowest = 1.0f, highest = 0.0f;
+		for (int x = 0; x < region.width; ++x)
+		{
+			const float weight = std::min(std::max(mask[x], 0.0f), 1.0f);
+			layer[x] = weight;
+			base[x] = 1.0f - weight;
+			lowest = std::min(lowest, weight);
+			highest = std::max(highest, weight);
+		}
+		bAnyBase |= lowest < 1.0f;
+		bAnyLayer |= highest > 0.0f;
+	}
+	return (bAnyBase ? 1u : 0u) | (bAnyLayer ? 2u : 0u);
+}
+
+//----------------------//
+// Neighbourhood		//
+//----------------------//
+
+void CSmoothOperator::Filter(const TerrainRegion& region, const float* input, int inputStride, float* out, int stride) const
+{
+	const int diameter = 2 * m_Radius + 1;
+	const float weight = 1.0f / diameter;
+
+	//Horizontal pass over every input row, leaving the vertical halo in place for the second pass
+	const int rows = region.height + 2 * m_Radius;
+	thread_local std::vector<float> horizontal;
+	horizontal.resize(static_cast<size_t>(rows) * region.width);
+	for (int z = 0; z < rows; ++z)
+	{
+		const float* in = input + z * inputStride;
+		float* row = horizontal.data() + z * region.width;
+
+		//Running sum, one add and one subtract per sample whatever the radius
+		float sum = 0.0f;
+		for (int i = 0; i < diameter; ++i) sum += in[i];
+		for (int x = 0; x < region.width; ++x)
+		{
+			row[x] = sum * weight;
+			if (x + 1 < region.width) sum += in[x + diameter] - in[x];
+		}
+	}
+
+	//Vertical pass, summing whole rows at a time so the inner loop runs along memory
+	thread_local std::vector<float> sum;
+	sum.assign(horizontal.begin(), horizontal.begin() + region.width);
+	for (int i = 1; i < diameter; ++i)
+	{
+		const float* row = horizontal.data() + i * region.width;
+		for (int x = 0; x < region.width; ++x) sum[x] += row[x];
+	}
+	for (int z = 0; z < region.height; ++z)
+	{
+		float* row = out + z * stride;
+		for (int x = 0; x < region.width; ++x) row[x] = sum[x] * weight;
+
+		if (z + 1 < region.height)
+		{
+			const float* add = horizontal.data() + (z + diameter) * region.width;
+			const float* remove = horizontal.data() + z * region.width;
+			for (int x = 0; x < region.width; ++x) sum[x] += add[x] - remove[x];
+		}
+	}
+}
+
+uint64_t CSmoothOperator::ParameterHash() const
+{
+	return HashCombine(0, m_Radius);
+}
+
+void CSlopeMaskOperator::Filter(const TerrainRegion& region, const float* input, int inputStride, float* out, int stride) const
+{
+	//Central differences, the input starts one row and one sample before the region
+	const float inverseRange = 1.0f / (m_To - m_From);
+	for (int z = 0; z < region.height; ++z)
+	{
+		const float* above = input + z * inputStride + 1;
+		const float* centre = above + inputStride;
+		const float* below = centre + inputStride;
+		float* row = out + z * stride;
+		for (int x = 0; x < region.width; ++x)
+		{
+			const float dx = 0.5f * (centre[x + 1] - centre[x - 1]);
+			const float dz = 0.5f * (below[x] - above[x]);
+			const float slope = std::sqrt(dx * dx + dz * dz);
+			row[x] = std::min(std::max((slope - m_From) * inverseRange, 0.0f), 1.0f);
+		}
+	}
+}
+
+uint64_t CSlopeMaskOperator::ParameterHash() const
+{
+	return HashCombine(HashCombine(0, m_From), m_To);
+}
+
+//----------------------//
+// Global				//
+//----------------------//
+
+void CDiamondSquareOperator::ApplyGlobal(CHeightField& field, CJobProgress* progress) const
+{
+	//Diamond-square only works on square heightfields with sides of 2^n + 1, a preview is a sample of a larger one
+	const int size = (field.Width() - 1) * m_SampleStep;
+	if (field.Width() != field.Height() || size < 2 || (size & (size - 1)) != 0 || (m_SampleStep & (m_SampleStep - 1)) != 0)
+	{
+		throw std::runtime_error("Diamond Square needs a square heightfield with sides of 2^n + 1");
+	}
+
+	DiamondSquare ds(size, m_Spread, m_SpreadReduction, m_Seed);
+	if (m_SampleStep > 1)
+	{
+		ds.processLevels(field, m_SampleStep, CThreadPool::Global(), progress);
+		if (m_Levels && !(progress && progress->IsCancelled())) *m_Levels = field;
+	}
+	else if (m_Levels && m_Levels->Width() > 1 && m_Levels->Width() == m_Levels->Height() && size % (m_Levels->Width() - 1) == 0)
+	{
+		ds.process(field, *m_Levels, CThreadPool::Global(), progress);
+	}
+	else
+	{
+		ds.process(field, CThreadPool::Global(), progress);
+	}
+}
+
+uint64_t CDiamondSquareOperator::ParameterHash() const
+{
+	return HashCombine(HashCombine(HashCombine(HashCombine(0, m_Spread), m_SpreadReduction), m_Seed), m_SampleStep);
+}
+
+void CSpectralOperator::ApplyGlobal(CHeightField& field, CJobProgress* progress) const
+{
+	m_Synthesis.Generate(field, CThreadPool::Global(), progress);
+}
+
+uint64_t CSpectralOperator::ParameterHash() const
+{
+	const SpectralSettings& settings = m_Synthesis.Settings();
+	return HashCombine(HashCombine(HashCombine(0, settings.beta), settings.amplitude), settings.seed);
+}
+
+void CConstraintOperator::ApplyGlobal(CHeightField& field, CJobProgress* progress) const
+{
+	const CConstraintSolver::SolveStats stats = m_Solver.Solve(field, CThreadPool::Global(), progress);
+	if (stats.bDiverged)
+	{
+		throw std::runtime_error("The constraint solver stopped after " + std::to_string(stats.cycles) + " cycles as the heights were getting worse");
+	}
+}
+
+uint64_t CConstraintOperator::ParameterHash() const
+{
+	const ConstraintSettings& settings = m_Solver.Settings();
+	uint64_t hash = HashCombine(0, static_cast<int>(settings.fill));
+	hash = HashCombine(hash, settings.maxCycles);
+	hash = HashCombine(hash, settings.preSweeps);
+	hash = HashCombine(hash, settings.postSweeps);
+	hash = HashCombine(hash, settings.maxLevels);
+	hash = HashCombine(hash, settings.tolerance);
+	for (const HeightConstraint& constraint : m_Solver.Constraints())
+	{
+		hash = HashCombine(HashCombine(HashCombine(hash, constraint.x0), constraint.z0), constraint.x1);
+		hash = HashCombine(HashCombine(HashCombine(hash, constraint.z1), constraint.height0), constraint.height1);
+		hash = HashCombine(hash, constraint.radius);
+	}
+	return hash;
+}
+
+void CHydraulicErosionOperator::ApplyGlobal(CHeightField& field, CJobProgress* progress) const
+{
+	m_Erosion.Erode(field, CThreadPool::Global(), progress);
+}
+
+uint64_t CHydraulicErosionOperator::ParameterHash() const
+{
+	const ErosionSettings& settings = m_Erosion.Settings();
+	uint64_t hash = HashCombine(0, settings.droplets);
+	hash = HashCombine(hash, settings.passes);
+	hash = HashCombine(hash, settings.cellSize);
+	hash = HashCombine(hash, settings.seed);
+	hash = HashCombine(hash, settings.inertia);
+	hash = HashCombine(hash, settings.capacity);
+	hash = HashCombine(hash, settings.minCapacity);
+	hash = HashCombine(hash, settings.erodeSpeed);
+	hash = HashCombine(hash, settings.depositSpeed);
+	hash = HashCombine(hash, settings.evaporateSpeed);
+	hash = HashCombine(hash, settings.gravity);
+	hash = HashCombine(hash, settings.maxLifetime);
+	hash = HashCombine(hash, settings.radius);
+	hash = HashCombine(hash, settings.initialWater);
+	return HashCombine(hash, settings.initialSpeed);
+}
+
+void CThermalErosionOperator::ApplyGlobal(CHeightField& field, CJobProgress* progress) const
+{
+	m_Erosion.Erode(field, CThreadPool::Global(), progress);
+}
+
+//The blocking doesn't change the result, so only the iterations, talus and amount are hashed
+uint64_t CThermalErosionOperator::ParameterHash() const
+{
+	const ThermalSettings& settings = m_Erosion.Settings();
+	uint64_t hash = HashCombine(0, settings.iterations);
+	hash = HashCombine(hash, settings.talus);
+	return HashCombine(hash, settings.amount);
+}
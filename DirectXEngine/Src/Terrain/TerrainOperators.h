@@ -0,0 +1,619 @@
+//--------------------------------------------------------------------------------------
+// Operators that can be placed in a terrain graph
+//--------------------------------------------------------------------------------------
+// Every step of the terrain generation is an operator. What an operator needs to see of
+// its inputs decides how the graph can run it:
+//  - Generators make values from the sample coordinates alone (Perlin, fBm, rigid noise)
+//  - Point operators change each value on its own (normalise, terrace, scale and bias)
+//  - Combiners join several inputs value by value (add, multiply, min, max)
+//  - Blends weight several inputs by weights they work out for each value (biomes, masks),
+//    and only need the inputs that have a weight somewhere in the tile
+//  - Neighbourhood operators read a halo of samples around each value (smoothing)
+//  - Global operators need the whole heightfield at once (diamond-square, erosion)
+// All but global operators work on any rectangle of samples so the graph can run them tile by tile.
+
+#pragma once
+#include "tepch.h"
+#include "Terrain/CHeightField.h"
+#include "Terrain/HeightExpressions.h"
+#include "Math/CPerlinNoise.h"
+#include "Terrain/CMidpointDisplacement.h"
+#include "Terrain/CDetailUpsampler.h"
+#include "Terrain/CHydraulicErosion.h"
+#include "Terrain/CThermalErosion.h"
+#include "Terrain/CSpectralSynthesis.h"
+#include "Terrain/CConstraintSolver.h"
+#include "Terrain/CStampGenerator.h"
+#include "Terrain/CBiomeMap.h"
+#include "Terrain/CHeightCurve.h"
+
+//What an operator needs to see of its inputs
+enum class EOperatorKind
+{
+	Input,
+	Generator,
+	Point,
+	Combiner,
+	Neighbourhood,
+	Global,
+	Blend
+};
+
+//Rectangle of samples in heightfield coordinates, may reach outside the heightfield for halos
+struct TerrainRegion
+{
+	int x = 0;
+	int z = 0;
+	int width = 0;
+	int height = 0;
+
+	//Function to get the region grown by the same amount on every side
+	TerrainRegion Grow(int amount) const { return { x - amount, z - amount, width + 2 * amount, height + 2 * amount }; }
+
+	//Number of samples in the region
+	int Samples() const { return width * height; }
+
+	bool Empty() const { return width <= 0 || height <= 0; }
+
+	//Function to get the smallest region holding both regions
+	TerrainRegion Union(const TerrainRegion& other) const
+	{
+		if (Empty()) return other;
+		if (other.Empty()) return *this;
+		int x0 = std::min(x, other.x), z0 = std::min(z, other.z);
+		return { x0, z0, std::max(x + width, other.x + other.width) - x0, std::max(z + height, other.z + other.height) - z0 };
+	}
+
+	//Function to get the part of the region shared with another
+	TerrainRegion Intersect(const TerrainRegion& other) const
+	{
+		int x0 = std::max(x, other.x), z0 = std::max(z, other.z);
+		return { x0, z0, std::min(x + width, other.x + other.width) - x0, std::min(z + height, other.z + other.height) - z0 };
+	}
+};
+
+//Base of every operator. Buffers passed to operators hold region.height rows of
+//region.width values, one row every stride values
+class CTerrainOperator
+{
+public:
+	virtual ~CTerrainOperator() {}
+
+	//What the operator needs to see of its inputs
+	virtual EOperatorKind Kind() const = 0;
+
+	//Name shown in the UI
+	virtual const char* Name() const = 0;
+
+	//Number of inputs the operator takes, -1 for any number of at least one
+	virtual int NumInputs() const = 0;
+
+	//Hash of every parameter that changes the output, used with the name and inputs to find cached results
+	virtual uint64_t ParameterHash() const = 0;
+
+	//Check whether the same parameters and inputs always give the same output, results of other operators are never cached
+	virtual bool Deterministic() const { return true; }
+};
+
+//Heightfield that already exists, e.g. the HeightMap before a modifier is applied.
+//A copy is kept so the result can be written back into the same heightfield
+class CInputOperator : public CTerrainOperator
+{
+public:
+	CInputOperator(const CHeightField& field) : m_Field(field) {}
+
+	EOperatorKind Kind() const override { return EOperatorKind::Input; }
+	const char* Name() const override { return "Input"; }
+	uint64_t ParameterHash() const override;
+	int NumInputs() const override { return 0; }
+
+	const CHeightField& Field() const { return m_Field; }
+
+private:
+	CHeightField m_Field;
+};
+
+//Makes values from the sample coordinates alone
+class CGeneratorOperator : public CTerrainOperator
+{
+public:
+	EOperatorKind Kind() const override { return EOperatorKind::Generator; }
+	int NumInputs() const override { return 0; }
+
+	//Function to write the value of every sample in the region
+	virtual void Generate(const TerrainRegion& region, float* out, int stride) const = 0;
+
+	//Tiles along each side of the blocks the graph runs the generator over. More than 1 writes the generator out
+	//to its own heightfield a block at a time, for generators that work out a margin around every region
+	virtual int BlockTiles() const { return 1; }
+};
+
+//Changes each value without looking at its neighbours
+class CPointOperator : public CTerrainOperator
+{
+public:
+	EOperatorKind Kind() const override { return EOperatorKind::Point; }
+	int NumInputs() const override { return 1; }
+
+	//Function to change every value in the region in place
+	virtual void Apply(const TerrainRegion& region, float* values, int stride) const = 0;
+};
+
+//Joins several inputs value by value
+class CCombinerOperator : public CTerrainOperator
+{
+public:
+	EOperatorKind Kind() const override { return EOperatorKind::Combiner; }
+	int NumInputs() const override { return -1; }
+
+	//Function to combine another input into the running result, called once for every input after the first
+	virtual void Combine(const TerrainRegion& region, float* result, const float* input, int stride) const = 0;
+};
+
+//Adds up its inputs by weights it works out for each value. Only the inputs with a weight somewhere in a region
+//are made over it, so the cost follows the inputs used there rather than the number of inputs. The last inputs
+//can be control inputs (e.g. masks) that are always made first and only decide the weights
+class CBlendOperator : public CTerrainOperator
+{
+public:
+	EOperatorKind Kind() const override { return EOperatorKind::Blend; }
+	int NumInputs() const override { return -1; }
+
+	//Most inputs a blend can add up, one bit each in the mask of inputs used
+	static constexpr int MaxInputs = 64;
+
+	//Number of inputs at the end that are control inputs rather than added up
+	virtual int NumControlInputs() const { return 0; }
+
+	//Function to write the weight of every input added up at every value of the region, input i into
+	//weights + i * plane with the same stride. Control input c is in controls + c * plane. Weights have to add up
+	//to 1 at every value. Returns a bit for every input with a weight above zero anywhere in the region
+	virtual uint64_t Weights(const TerrainRegion& region, const float* controls, float* weights, size_t plane, int stride) const = 0;
+};
+
+//Reads a halo of samples around each value
+class CNeighbourhoodOperator : public CTerrainOperator
+{
+public:
+	EOperatorKind Kind() const override { return EOperatorKind::Neighbourhood; }
+	int NumInputs() const override { return 1; }
+
+	//Number of samples needed on every side of the region being written
+	virtual int HaloRadius() const = 0;
+
+	//Function to write the region, input holds the region grown by HaloRadius with its own stride
+	virtual void Filter(const TerrainRegion& region, const float* input, int inputStride, float* out, int stride) const = 0;
+};
+
+//Needs the whole heightfield at once, so it can't be split into tiles
+class CGlobalOperator : public CTerrainOperator
+{
+public:
+	EOperatorKind Kind() const override { return EOperatorKind::Global; }
+
+	//Function to run over the whole heightfield in place, which holds the input if there is one. The job, which may be
+	//null, is checked for cancellation once per iteration or level, a cancelled run may leave the heightfield unfinished
+	virtual void ApplyGlobal(CHeightField& field, CJobProgress* progress) const = 0;
+};
+
+//----------------------//
+// Generators			//
+//----------------------//
+
+//Same value everywhere
+class CConstantOperator : public CGeneratorOperator
+{
+public:
+	CConstantOperator(float value) : m_Value(value) {}
+
+	const char* Name() const override { return "Constant"; }
+	uint64_t ParameterHash() const override;
+	void Generate(const TerrainRegion& region, float* out, int stride) const override;
+
+private:
+	float m_Value;
+};
+
+//Settings shared by the noise generators, matching the sliders of the scene
+struct NoiseSettings
+{
+	unsigned int seed = 0;
+	float amplitude = 200.0f;
+	float frequency = 0.125f;
+	float scale = 1.0f;       //Resolution of the terrain divided by its size
+	int offsetX = 0;          //Sample of the whole terrain that sample (0, 0) of the heightfield is, so chunks line up
+	int offsetZ = 0;
+};
+
+//One layer of Perlin noise
+class CPerlinOperator : public CGeneratorOperator
+{
+public:
+	CPerlinOperator(const NoiseSettings& settings) : m_Settings(settings), m_Noise(settings.seed) {}
+
+	const char* Name() const override { return "Perlin"; }
+	uint64_t ParameterHash() const override;
+	void Generate(const TerrainRegion& region, float* out, int stride) const override;
+
+private:
+	NoiseSettings m_Settings;
+	CPerlinNoise m_Noise;
+};
+
+//Several layers of Perlin noise, each with a smaller amplitude and a higher frequency (fractional Brownian motion)
+class CFractalPerlinOperator : public CGeneratorOperator
+{
+public:
+	CFractalPerlinOperator(const NoiseSettings& settings, int octaves, float amplitudeReduction, float frequencyMultiplier)
+		: m_Settings(settings), m_Noise(settings.seed), m_Octaves(octaves),
+		  m_AmplitudeReduction(amplitudeReduction), m_FrequencyMultiplier(frequencyMultiplier) {}
+
+	const char* Name() const override { return "Fractal Perlin"; }
+	uint64_t ParameterHash() const override;
+	void Generate(const TerrainRegion& region, float* out, int stride) const override;
+
+	//Function to count the octaves whose waves are at least the given number of samples long, shorter ones can't be
+	//seen between the samples. The first octave is always counted
+	static int OctavesLongerThan(const NoiseSettings& settings, int octaves, float frequencyMultiplier, float samples);
+
+private:
+	NoiseSettings m_Settings;
+	CPerlinNoise m_Noise;
+	int m_Octaves;
+	float m_AmplitudeReduction;
+	float m_FrequencyMultiplier;
+};
+
+//1 - |noise|, negated to carve valleys or left positive (inverse) to raise ridges
+class CRigidOperator : public CGeneratorOperator
+{
+public:
+	CRigidOperator(const NoiseSettings& settings, bool bInverse) : m_Settings(settings), m_Noise(settings.seed), m_Inverse(bInverse) {}
+
+	const char* Name() const override { return m_Inverse ? "Inverse Rigid" : "Rigid"; }
+	uint64_t ParameterHash() const override;
+	void Generate(const TerrainRegion& region, float* out, int stride) const override;
+
+private:
+	NoiseSettings m_Settings;
+	CPerlinNoise m_Noise;
+	bool m_Inverse;
+};
+
+//Smooth round hill, zero outside its radius, used for local edits
+class CBumpOperator : public CGeneratorOperator
+{
+public:
+	CBumpOperator(float centreX, float centreZ, float radius, float height)
+		: m_CentreX(centreX), m_CentreZ(centreZ), m_Radius(std::max(radius, 1.0f)), m_Height(height) {}
+
+	const char* Name() const override { return "Bump"; }
+	uint64_t ParameterHash() const override;
+	void Generate(const TerrainRegion& region, float* out, int stride) const override;
+
+	//Samples that the bump can change
+	TerrainRegion Bounds() const;
+
+private:
+	float m_CentreX;
+	float m_CentreZ;
+	float m_Radius;
+	float m_Height;
+};
+
+//Midpoint displacement, unlike diamond-square any rectangle can be worked out on its own so it runs tile by tile
+class CMidpointDisplacementOperator : public CGeneratorOperator
+{
+public:
+	CMidpointDisplacementOperator(const MidpointSettings& settings) : m_Generator(std::make_shared<CMidpointDisplacement>(settings)) {}
+
+	const char* Name() const override { return "Midpoint Displacement"; }
+	uint64_t ParameterHash() const override;
+	void Generate(const TerrainRegion& region, float* out, int stride) const override;
+
+private:
+	//Made once with the coarse levels, then shared by every tile
+	std::shared_ptr<const CMidpointDisplacement> m_Generator;
+};
+
+//Coarse map made finer with bicubic interpolation and fractal detail, tile by tile. The coarse samples come through exactly
+class CUpsampleOperator : public CGeneratorOperator
+{
+public:
+	CUpsampleOperator(const CHeightField& coarse, const UpsampleSettings& settings) : m_Upsampler(std::make_shared<CDetailUpsampler>(coarse, settings)) {}
+
+	const char* Name() const override { return "Detail Upsample"; }
+	uint64_t ParameterHash() const override;
+	void Generate(const TerrainRegion& region, float* out, int stride) const override;
+
+	//Every region works out the detail of the coarse cells under it and one cell around them. At a factor of 16 a
+	//tile is 4 cells wide, so a tile at a time would work out 6 x 6 cells for 4 x 4 (2.25 times the samples), while
+	//a block of 8 x 8 tiles works out 34 x 34 for 32 x 32 (1.13 times)
+	int BlockTiles() const override { return 8; }
+
+private:
+	//Shares the tiles of the coarse map, and is shared by every tile
+	std::shared_ptr<const CDetailUpsampler> m_Upsampler;
+};
+
+//----------------------//
+// Point operators		//
+//----------------------//
+
+//value * scale + bias, normalising is a scale of 1 / amount
+class CScaleBiasOperator : public CPointOperator
+{
+public:
+	CScaleBiasOperator(float scale, float bias) : m_Scale(scale), m_Bias(bias) {}
+
+	const char* Name() const override { return "Scale Bias"; }
+	uint64_t ParameterHash() const override;
+	void Apply(const TerrainRegion& region, float* values, int stride) const override;
+
+private:
+	float m_Scale;
+	float m_Bias;
+};
+
+//round(value) / multiplier
+class CTerraceOperator : public CPointOperator
+{
+public:
+	CTerraceOperator(float multiplier) : m_Multiplier(multiplier) {}
+
+	const char* Name() const override { return "Terrace"; }
+	uint64_t ParameterHash() const override;
+	void Apply(const TerrainRegion& region, float* values, int stride) const override;
+
+private:
+	float m_Multiplier;
+};
+
+//Heights remapped through a curve (a spline or shaped terraces) baked into a table, in one pass over each tile.
+//Every curve costs the same as rounding
+class CRemapOperator : public CPointOperator
+{
+public:
+	CRemapOperator(const CurveSettings& settings) : m_Curve(std::make_shared<CHeightCurve>(settings)) {}
+
+	const char* Name() const override { return m_Curve->Settings().shape == ECurveShape::Terraces ? "Smooth Terraces" : "Remap Curve"; }
+	uint64_t ParameterHash() const override { return m_Curve->Hash(0); }
+	void Apply(const TerrainRegion& region, float* values, int stride) const override;
+
+private:
+	//Baked once, then shared by every tile
+	std::shared_ptr<const CHeightCurve> m_Curve;
+};
+
+//Mask of the heights inside a band, 1 between low and high and falling to 0 over the fade past either end
+class CHeightBandOperator : public CPointOperator
+{
+public:
+	CHeightBandOperator(float low, float high, float fade) : m_Low(low), m_High(high), m_Fade(std::max(fade, 1e-3f)) {}
+
+	const char* Name() const override { return "Height Band"; }
+	uint64_t ParameterHash() const override;
+	void Apply(const TerrainRegion& region, float* values, int stride) const override;
+
+private:
+	float m_Low;
+	float m_High;
+	float m_Fade;
+};
+
+//Stamps of features blended onto the heights. Only the stamps binned in the cells a tile overlaps are blended,
+//so it runs tile by tile with the rest of the graph
+class CStampOperator : public CPointOperator
+{
+public:
+	CStampOperator(const StampSettings& settings) : m_Generator(std::make_shared<CStampGenerator>(settings)) {}
+
+	const char* Name() const override { return "Stamps"; }
+	uint64_t ParameterHash() const override;
+	void Apply(const TerrainRegion& region, float* values, int stride) const override;
+
+private:
+	//Placed and binned once, then shared by every tile
+	std::shared_ptr<const CStampGenerator> m_Generator;
+};
+
+//Any expression of the value, e.g. round(h * scale) / multiplier, worked out in one pass over each tile.
+//The name tells expressions apart in the UI, the cache tells them apart by their hash
+template<typename E>
+class CExpressionOperator : public CPointOperator
+{
+public:
+	CExpressionOperator(const char* name, const E& expression) : m_Name(name), m_Expression(expression) {}
+
+	const char* Name() const override { return m_Name; }
+	uint64_t ParameterHash() const override { return m_Expression.Hash(0); }
+	void Apply(const TerrainRegion& region, float* values, int stride) const override
+	{
+		ApplyExpression(m_Expression, region.width, region.height, values, stride);
+	}
+
+private:
+	const char* m_Name;
+	E m_Expression;
+};
+
+//----------------------//
+// Combiners			//
+//----------------------//
+
+//How a combiner joins its inputs
+enum class ECombineMode
+{
+	Add,
+	Multiply,
+	Min,
+	Max
+};
+
+class CCombineOperator : public CCombinerOperator
+{
+public:
+	CCombineOperator(ECombineMode mode) : m_Mode(mode) {}
+
+	const char* Name() const override;
+	uint64_t ParameterHash() const override;
+	void Combine(const TerrainRegion& region, float* result, const float* input, int stride) const override;
+
+private:
+	ECombineMode m_Mode;
+};
+
+//----------------------//
+// Blends				//
+//----------------------//
+
+//Terrains of several biomes, one input each in the order of the biomes in the settings, blended by the biome map
+class CBiomeOperator : public CBlendOperator
+{
+public:
+	CBiomeOperator(const BiomeSettings& settings) : m_Map(settings) {}
+
+	const char* Name() const override { return "Biomes"; }
+	int NumInputs() const override { return m_Map.NumBiomes(); }
+	uint64_t ParameterHash() const override;
+	uint64_t Weights(const TerrainRegion& region, const float* controls, float* weights, size_t plane, int stride) const override;
+
+private:
+	CBiomeMap m_Map;
+};
+
+//The second input laid over the first by the mask in the third, from 0 (only the first) to 1 (only the second).
+//Tiles where the mask is 0 or 1 everywhere only make one of the inputs
+class CMaskBlendOperator : public CBlendOperator
+{
+public:
+	const char* Name() const override { return "Mask Blend"; }
+	int NumInputs() const override { return 3; }
+	int NumControlInputs() const override { return 1; }
+	uint64_t ParameterHash() const override { return 0; }
+	uint64_t Weights(const TerrainRegion& region, const float* controls, float* weights, size_t plane, int stride) const override;
+};
+
+//----------------------//
+// Neighbourhood		//
+//----------------------//
+
+//Box blur of the given radius, done as a horizontal then a vertical pass
+class CSmoothOperator : public CNeighbourhoodOperator
+{
+public:
+	CSmoothOperator(int radius) : m_Radius(std::max(radius, 1)) {}
+
+	const char* Name() const override { return "Smooth"; }
+	uint64_t ParameterHash() const override;
+	int HaloRadius() const override { return m_Radius; }
+	void Filter(const TerrainRegion& region, const float* input, int inputStride, float* out, int stride) const override;
+
+private:
+	int m_Radius;
+};
+
+//Mask of the slopes, 0 below the first slope rising to 1 at the second (swapped for a mask of flat ground).
+//Slopes are in height per sample
+class CSlopeMaskOperator : public CNeighbourhoodOperator
+{
+public:
+	CSlopeMaskOperator(float from, float to) : m_From(from), m_To(std::abs(to - from) < 1e-6f ? from + 1e-6f : to) {}
+
+	const char* Name() const override { return "Slope Mask"; }
+	uint64_t ParameterHash() const override;
+	int HaloRadius() const override { return 1; }
+	void Filter(const TerrainRegion& region, const float* input, int inputStride, float* out, int stride) const override;
+
+private:
+	float m_From;
+	float m_To;
+};
+
+//----------------------//
+// Global				//
+//----------------------//
+
+//Diamond-square, every level reads the whole previous level so it runs over the whole heightfield.
+//A preview reading every sampleStep samples only runs the levels down to that spacing and keeps them in
+//the shared levels, then the full map made with the same shared levels only runs the finer levels
+class CDiamondSquareOperator : public CGlobalOperator
+{
+public:
+	CDiamondSquareOperator(float spread, float spreadReduction, unsigned int seed, int sampleStep = 1, std::shared_ptr<CHeightField> levels = nullptr)
+		: m_Spread(spread), m_SpreadReduction(spreadReduction), m_Seed(seed), m_SampleStep(std::max(sampleStep, 1)), m_Levels(std::move(levels)) {}
+
+	const char* Name() const override { return "Diamond Square"; }
+	uint64_t ParameterHash() const override;
+	int NumInputs() const override { return 0; }
+	void ApplyGlobal(CHeightField& field, CJobProgress* progress) const override;
+
+private:
+	float m_Spread;
+	float m_SpreadReduction;
+	unsigned int m_Seed;
+	int m_SampleStep;
+
+	//The levels give the same map as running them again, so they aren't part of the hash
+	std::shared_ptr<CHeightField> m_Levels;
+};
+
+//Spectral synthesis, every sample depends on the whole spectrum so it runs as one inverse FFT
+class CSpectralOperator : public CGlobalOperator
+{
+public:
+	CSpectralOperator(const SpectralSettings& settings) : m_Synthesis(settings) {}
+
+	const char* Name() const override { return "Spectral Synthesis"; }
+	uint64_t ParameterHash() const override;
+	int NumInputs() const override { return 0; }
+	void ApplyGlobal(CHeightField& field, CJobProgress* progress) const override;
+
+private:
+	CSpectralSynthesis m_Synthesis;
+};
+
+//Smooth surface through pinned heights, every sample depends on every pin so it's solved over the whole heightfield
+class CConstraintOperator : public CGlobalOperator
+{
+public:
+	CConstraintOperator(const std::vector<HeightConstraint>& constraints, const ConstraintSettings& settings) : m_Solver(constraints, settings) {}
+
+	const char* Name() const override { return "Height Constraints"; }
+	uint64_t ParameterHash() const override;
+	int NumInputs() const override { return 0; }
+	void ApplyGlobal(CHeightField& field, CJobProgress* progress) const override;
+
+private:
+	CConstraintSolver m_Solver;
+};
+
+//Droplet erosion, droplets run across the whole heightfield so it can't be split into tiles
+class CHydraulicErosionOperator : public CGlobalOperator
+{
+public:
+	CHydraulicErosionOperator(const ErosionSettings& settings) : m_Erosion(settings) {}
+
+	const char* Name() const override { return "Hydraulic Erosion"; }
+	uint64_t ParameterHash() const override;
+	int NumInputs() const override { return 1; }
+	void ApplyGlobal(CHeightField& field, CJobProgress* progress) const override;
+
+private:
+	CHydraulicErosion m_Erosion;
+};
+
+//Talus angle erosion, many iterations run on blocks of the heightfield while they are in cache so it runs as a whole
+class CThermalErosionOperator : public CGlobalOperator
+{
+public:
+	CThermalErosionOperator(const ThermalSettings& settings) : m_Erosion(settings) {}
+
+	const char* Name() const override { return "Thermal Erosion"; }
+	uint64_t ParameterHash() const override;
+	int NumInputs() const override { return 1; }
+	void ApplyGlobal(CHeightField& field, CJobProgress* progress) const override;
+
+private:
+	CThermalErosion m_Erosion;
+};
@@ -1,4 +1,12 @@
 #include "TerrainGenerationScene.h"
+#include <chrono>
+
+//Milliseconds passed since a point in time, for the stage timings
+static float MillisecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return elapsed.count();
+}
 
 //Function to setup all the geometry to be used in the scene
 bool TerrainGenerationScene::InitGeometry(std::string& LastError)
@@ -8,10 +16,15 @@ bool TerrainGenerationScene::InitGeometry(std::string& LastError)
 
     //Update the size of the HeightMap
     // --Has to be equal to 2^n + 1 in order for the Diamond Square algorithm to work on the HeightMap
-    HeightMap.resize(SizeOfTerrain + 1, std::vector<float>(SizeOfTerrain + 1, 0));
+    HeightMap.Resize(TerrainSize + 1, TerrainSize + 1, 0.0f);
 
     //Build the HeightMap with the value of 1
     BuildHeightMap(1);
+
+    //The mesh below is built from the whole HeightMap, so start with no dirty tiles and a full height pyramid
+    HeightMap.TakeDirtyTiles();
+    HeightPyramid.Build(HeightMap);
+    UpdateCacheBudget();
    
     //Update the size of the PlantModels vectors
     PlantModels.resize(plantResizeAmount);
@@ -23,7 +36,7 @@ bool TerrainGenerationScene::InitGeometry(std::string& LastError)
     // add the meshes to the resourceManager to make getting these meshes later easier
     try
     {
-        resourceManager->loadGrid(L"TerrainMesh", TerrainMeshMinPt, TerrainMeshMaxPt, SizeOfTerrainVertices, SizeOfTerrainVertices, HeightMap);
+        resourceManager->loadGrid(L"TerrainMesh", TerrainMeshMinPt, TerrainMeshMaxPt, MeshSize(), MeshSize(), HeightMap, true, true, MeshSampleStep());
         resourceManager->loadMesh(L"plant", std::string("Data/Plant.fbx"), true);
         resourceManager->loadMesh(L"Light", std::string("Data/Light.x"));
 
@@ -159,6 +172,11 @@ bool TerrainGenerationScene::InitScene()
     GroundModel = new Model(resourceManager->getMesh(L"TerrainMesh"), CVector3(0,0,0));
     Light       = new CLight(resourceManager->getMesh(L"Light"), LightScale, LightColour, LightPosition, 0);
 
+    //Memory held by the stages built in InitGeometry, nothing has been timed yet
+    StageStats[static_cast<int>(ETerrainStage::Generation)].bytes = HeightMap.MemoryUsage();
+    StageStats[static_cast<int>(ETerrainStage::Mesh)].bytes = resourceManager->getMesh(L"TerrainMesh")->BufferBytes();
+    StageStats[static_cast<int>(ETerrainStage::Pyramid)].bytes = HeightPyramid.MemoryUsage();
+
     //Loop through every plant in the vector and create a plant model
     for (int i = 0; i < PlantModels.size(); ++i)
     {
@@ -181,6 +199,12 @@ bool TerrainGenerationScene::InitScene()
 //Function to release everything in the scene from memory
 void TerrainGenerationScene::ReleaseResources()
 {
+    //Nothing is collected after this, so stop any generation still running
+    Generator.Cancel();
+    if (ExportProgress) ExportProgress->Cancel();
+    if (ExportThread.joinable()) ExportThread.join();
+    ReleaseAllChunks();
+
     ReleaseStates();
 
     if (gPerModelConstantBuffer)  gPerModelConstantBuffer->Release();
@@ -223,33 +247,53 @@ void TerrainGenerationScene::RenderSceneFromCamera(Camera* camera)
     //Only render these models if the terrain has been chosen to be rendered
     if (enableTerrain)
     {
-        //set the Pixel, Vertex and Geometry shaders that will be used for the ground Model
-        GroundModel->Setup(gWorldTransformVertexShader, gTerrainPixelShader);
-        gD3DContext->GSSetShader(gTriangleGeometryShader, nullptr, 0);
+        //Either the single terrain patch or every streamed chunk is drawn, each with the same shaders and textures
+        std::vector<Model*> terrainModels;
+        std::vector<Model*> plantModels;
+        if (bInfiniteTerrain)
+        {
+            for (auto& chunk : TerrainChunks)
+            {
+                terrainModels.push_back(chunk.second.model);
+                plantModels.insert(plantModels.end(), chunk.second.plants.begin(), chunk.second.plants.end());
+            }
+        }
+        else
+        {
+            terrainModels.push_back(GroundModel);
+            plantModels = PlantModels;
+        }
 
-        //check if the model needs to be renderedin wireframe mode
-        if (enableWireFrame) GroundModel->SetStates(gNoBlendingState, gUseDepthBufferState, gWireframeState);
-        else GroundModel->SetStates(gNoBlendingState, gUseDepthBufferState, gCullBackState);
+        for (Model* terrainModel : terrainModels)
+        {
+            //set the Pixel, Vertex and Geometry shaders that will be used for the ground Model
+            terrainModel->Setup(gWorldTransformVertexShader, gTerrainPixelShader);
+            gD3DContext->GSSetShader(gTriangleGeometryShader, nullptr, 0);
+
+            //check if the model needs to be renderedin wireframe mode
+            if (enableWireFrame) terrainModel->SetStates(gNoBlendingState, gUseDepthBufferState, gWireframeState);
+            else terrainModel->SetStates(gNoBlendingState, gUseDepthBufferState, gCullBackState);
 
-        //Set the resources that the Pixel shader will need to have to work
-        GroundModel->SetShaderResources(0, resourceManager->getTexture(L"Grass"));
-        GroundModel->SetShaderResources(1, resourceManager->getTexture(L"Rock"));
-        GroundModel->SetShaderResources(2, resourceManager->getTexture(L"Dirt"));
+            //Set the resources that the Pixel shader will need to have to work
+            terrainModel->SetShaderResources(0, resourceManager->getTexture(L"Grass"));
+            terrainModel->SetShaderResources(1, resourceManager->getTexture(L"Rock"));
+            terrainModel->SetShaderResources(2, resourceManager->getTexture(L"Dirt"));
 
-        //Render the model
-        GroundModel->Render(gPerModelConstantBuffer, gPerModelConstants);
+            //Render the model
+            terrainModel->Render(gPerModelConstantBuffer, gPerModelConstants);
+        }
 
         //Set the Geometry shader to be a nullptr as we do not need it anymore
         gD3DContext->GSSetShader(nullptr, nullptr, 0);
 
         //Loop through each plant in the scene and update the shaders and the required resources for the shaders.
         //Also update the states for the model and then render the model
-        for (int i = 0; i < PlantModels.size(); ++i)
+        for (Model* plantModel : plantModels)
         {
-            PlantModels[i]->Setup(gNormalMappingVertexShader, gNormalMappingPixelShader);
-            PlantModels[i]->SetShaderResources(0, resourceManager->getTexture(L"plantTexture"), 1, resourceManager->getTexture(L"plantTextureNormal"));
-            PlantModels[i]->SetStates(gAlphaBlendingState, gUseDepthBufferState, gCullBackState);
-            PlantModels[i]->Render(gPerModelConstantBuffer, gPerModelConstants);
+            plantModel->Setup(gNormalMappingVertexShader, gNormalMappingPixelShader);
+            plantModel->SetShaderResources(0, resourceManager->getTexture(L"plantTexture"), 1, resourceManager->getTexture(L"plantTextureNormal"));
+            plantModel->SetStates(gAlphaBlendingState, gUseDepthBufferState, gCullBackState);
+            plantModel->Render(gPerModelConstantBuffer, gPerModelConstants);
         }
 
     }
@@ -362,33 +406,41 @@ void TerrainGenerationScene::UpdateScene(float frameTime, HWND HWnd)
         totalFrameTime = 0;
         frameCount = 0;
     }
+
+    //Swap in the terrain made in the background once it is complete
+    CollectGeneration();
+
+    //Let the water flow for this frame
+    if (bWaterRunning) UpdateWater();
+
+    //Stream the chunks of the infinite terrain around the camera
+    if (bInfiniteTerrain) UpdateChunks();
 }
 
 //Function to update the position of every plant in the scene
 void TerrainGenerationScene::UpdateFoliagePosition()
 {
-    //Creation of a random number generation device
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 1000);
+    //The two ranges to convert the random number to, the width of the terrain mesh and of the HeightMap
+    uint32_t TerrainRange = static_cast<uint32_t>(TerrainMeshMaxPt.x - TerrainMeshMinPt.x);
+    uint32_t HeightMapRange = static_cast<uint32_t>(TerrainSize);
 
-    //The two ranges to convert the random number to
-    uint32_t TerrainRange = 1000;
-    uint32_t HeightMapRange = 256;
+    //Remember the HeightMap sample under each plant so it can be moved when that part of the HeightMap changes
+    PlantSamples.resize(PlantModels.size());
 
     //Loop through each plant in the vector
     for (int i = 0; i < PlantModels.size(); ++i)
     {
-        //Get the random X and Z positions
-        uint32_t randomXPos = dis(gen);
-        uint32_t randomZPos = dis(gen);
+        //Get the random X and Z positions, the same for the same seed and plant
+        uint32_t randomXPos = RandomInt(seed, i, 0, ERandomStream::FoliageX, 0, static_cast<int>(TerrainRange));
+        uint32_t randomZPos = RandomInt(seed, i, 0, ERandomStream::FoliageZ, 0, static_cast<int>(TerrainRange));
 
-        //Convert the X and Z positions from the range (0 - 1000) to (0 - 256)
+        //Convert the X and Z positions from the range of the mesh to the range of the HeightMap
         uint32_t NewXPos = (((randomXPos - 0) * HeightMapRange) / TerrainRange) + 0;
         uint32_t NewZPos = (((randomZPos - 0) * HeightMapRange) / TerrainRange) + 0;
 
         //Get the height Value from these new X and Z coordinates
-        float Heightvalue = HeightMap[NewZPos][NewXPos];
+        float Heightvalue = HeightMap.Get(NewXPos, NewZPos);
+        PlantSamples[i] = { static_cast<int>(NewXPos), static_cast<int>(NewZPos) };
 
         //Create a position Vector with the X and Z positions and the new height value 
         CVector3 position = { (float)randomXPos, (Heightvalue), (float)randomZPos };
@@ -404,156 +456,1060 @@ void TerrainGenerationScene::UpdateFoliagePosition()
     }   
 }
 
+//Function to move the plants standing on tiles of the HeightMap that have changed up or down to the new height
+void TerrainGenerationScene::UpdateFoliageHeights(const std::vector<int>& dirtyTiles)
+{
+    std::vector<uint8_t> bDirty(HeightMap.TileCount(), 0);
+    for (int tile : dirtyTiles) bDirty[tile] = 1;
+
+    for (int i = 0; i < PlantModels.size() && i < PlantSamples.size(); ++i)
+    {
+        const int x = PlantSamples[i].first;
+        const int z = PlantSamples[i].second;
+        if (!bDirty[(z >> CHeightField::TileShift) * HeightMap.TilesX() + (x >> CHeightField::TileShift)]) continue;
+
+        //Keep the plant where it is and only change its height
+        CVector3 position = PlantModels[i]->Position();
+        position.y = HeightMap.Get(x, z) * TerrainYScale.y - 3;
+        PlantModels[i]->SetPosition(position);
+    }
+}
+
+//Function to update the terrain mesh, plants and height pyramid for the tiles of the HeightMap that have changed
+void TerrainGenerationScene::UpdateDirtyTiles()
+{
+    std::vector<int> dirtyTiles = HeightMap.TakeDirtyTiles();
+    LastDirtyTiles = static_cast<int>(dirtyTiles.size());
+    if (dirtyTiles.empty()) return;
+    History.TilesChanged(HeightMap, dirtyTiles);
+
+    //The height pyramid only recomputes the changed tiles and their parents, on this thread alone while the pool is busy
+    auto start = std::chrono::high_resolution_clock::now();
+    HeightPyramid.Update(HeightMap, dirtyTiles);
+    StageStats[static_cast<int>(ETerrainStage::Pyramid)] = { MillisecondsSince(start), HeightPyramid.MemoryUsage() };
+
+    //Only the changed part of the mesh is uploaded, into the buffers it already has so nothing is created
+    //on the GPU mid-frame. When every tile has changed the plants are placed again, otherwise only the
+    //plants on changed tiles move.
+    //Normals are worked out from the vertices in the geometry shader, so they follow the uploaded vertices
+    start = std::chrono::high_resolution_clock::now();
+    GroundModel->UpdateModelTiles(HeightMap, dirtyTiles, MeshSize(), TerrainMeshMinPt, TerrainMeshMaxPt, MeshSampleStep());
+    StageStats[static_cast<int>(ETerrainStage::Mesh)] = { MillisecondsSince(start), resourceManager->getMesh(L"TerrainMesh")->BufferBytes() };
+
+    start = std::chrono::high_resolution_clock::now();
+    if (static_cast<int>(dirtyTiles.size()) == HeightMap.TileCount())
+    {
+        UpdateFoliagePosition();
+    }
+    else
+    {
+        UpdateFoliageHeights(dirtyTiles);
+    }
+    StageStats[static_cast<int>(ETerrainStage::Foliage)] = { MillisecondsSince(start), PlantSamples.capacity() * sizeof(PlantSamples[0]) + PlantModels.capacity() * sizeof(Model*) };
+}
+
+//Function to change the size of the HeightMap, rebuilding the mesh, plants and height pyramid for it.
+//The history and every generation step still running are dropped, as they are for the old size
+void TerrainGenerationScene::ResizeTerrain(int size)
+{
+    if (size == TerrainSize || size < MinTerrainSize || size > MaxTerrainSize) return;
+
+    CancelGeneration();
+    History.Clear();
+    GenerationBase = CHeightField();
+    PaintedMask = CHeightField();
+
+    //Local edits stay over the same part of the terrain
+    EditCentreX = static_cast<int>(static_cast<int64_t>(EditCentreX) * size / TerrainSize);
+    EditCentreZ = static_cast<int>(static_cast<int64_t>(EditCentreZ) * size / TerrainSize);
+    EditRadius *= static_cast<float>(size) / TerrainSize;
+    TerrainSize = size;
+    bPreviewShown = false;
+    UpdateCacheBudget();
+
+    //The new HeightMap starts flat, as after resetting the terrain
+    auto start = std::chrono::high_resolution_clock::now();
+    HeightMap.Resize(TerrainSize + 1, TerrainSize + 1, 0.0f);
+    BuildHeightMap(1);
+    HeightMap.TakeDirtyTiles();
+    StageStats[static_cast<int>(ETerrainStage::Generation)] = { MillisecondsSince(start), HeightMap.MemoryUsage() };
+
+    //The mesh has a different number of vertices, so its buffers are made again rather than updated
+    start = std::chrono::high_resolution_clock::now();
+    GroundModel->ResizeModel(HeightMap, MeshSize(), TerrainMeshMinPt, TerrainMeshMaxPt, MeshSampleStep());
+    StageStats[static_cast<int>(ETerrainStage::Mesh)] = { MillisecondsSince(start), resourceManager->getMesh(L"TerrainMesh")->BufferBytes() };
+
+    start = std::chrono::high_resolution_clock::now();
+    HeightPyramid.Build(HeightMap);
+    StageStats[static_cast<int>(ETerrainStage::Pyramid)] = { MillisecondsSince(start), HeightPyramid.MemoryUsage() };
+
+    start = std::chrono::high_resolution_clock::now();
+    UpdateFoliagePosition();
+    StageStats[static_cast<int>(ETerrainStage::Foliage)] = { MillisecondsSince(start), PlantSamples.capacity() * sizeof(PlantSamples[0]) + PlantModels.capacity() * sizeof(Model*) };
+    LastDirtyTiles = HeightMap.TileCount();
+
+    //Chunks of the infinite terrain use the spacing of the HeightMap
+    if (bInfiniteTerrain) ResetChunks();
+}
+
+//Function to set the budget of the cache of generated HeightMaps from the slider and the size of the HeightMap
+void TerrainGenerationScene::UpdateCacheBudget()
+{
+    //A budget smaller than a HeightMap would never keep one, so there is always room for a few of the current size
+    const size_t mapBytes = CHeightField::MemoryUsage(TerrainSize + 1, TerrainSize + 1);
+    Generator.Cache().SetBudget(std::max(static_cast<size_t>(GenerationCacheMB) * 1024 * 1024, MinCachedMaps * mapBytes));
+}
+
+//Function to run a benchmark on a thread of its own so the frame keeps drawing
+void TerrainGenerationScene::StartBenchmark(const std::string& label, std::vector<BenchmarkResult>& results, std::function<std::vector<BenchmarkResult>()> benchmark)
+{
+    if (RunningBenchmark.valid()) return;
+
+    RunningBenchmarkResults = &results;
+    RunningBenchmarkLabel = label;
+    BenchmarkError.clear();
+    RunningBenchmark = std::async(std::launch::async, [benchmark]()
+    {
+        //Like the background generator, the benchmark waits for the pool instead of running on its own thread
+        CThreadPool::SetWaitWhenBusy(true);
+        return benchmark();
+    });
+}
+
+//Function to hand the results of the running benchmark to the UI once it has finished
+void TerrainGenerationScene::TakeBenchmarkResults()
+{
+    if (!RunningBenchmark.valid() || RunningBenchmark.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+    try
+    {
+        *RunningBenchmarkResults = RunningBenchmark.get();
+    }
+    catch (const std::exception& e)
+    {
+        BenchmarkError = RunningBenchmarkLabel + ": " + e.what();
+    }
+    RunningBenchmarkResults = nullptr;
+}
+
 //Building the HeightMap
 void TerrainGenerationScene::BuildHeightMap(float height)
 {
-    //Loop through the HeightMap and set each value to the chosen height value
-    for (int i = 0; i <= SizeOfTerrain; ++i) {
-        for (int j = 0; j <= SizeOfTerrain; ++j) {
-            HeightMap[i][j] = height;
+    //Set every value in the HeightMap to the chosen height value
+    HeightMap.Fill(height);
+}
+
+//Function to get the settings of the noise generators from the sliders
+NoiseSettings TerrainGenerationScene::GetNoiseSettings(int sampleStep) const
+{
+    NoiseSettings settings;
+    settings.seed = seed;
+    settings.amplitude = Amplitude;
+    settings.frequency = frequency;
+
+    //get the scale to make sure that the terrain looks consistent. A preview steps over the
+    //noise sampleStep times as fast, so its samples land on samples of the full HeightMap
+    settings.scale = (float)resolution / (float)TerrainSize * sampleStep;
+    return settings;
+}
+
+//Function to run a graph of terrain operators and write its output into the HeightMap, only over the region if one is given
+void TerrainGenerationScene::RunTerrainGraph(CTerrainGraph& graph, CTerrainGraph::NodeId output, const TerrainRegion* region)
+{
+    if (region) graph.ExecuteRegion(output, HeightMap, *region);
+    else graph.Execute(output, HeightMap, TerrainSize + 1, TerrainSize + 1);
+    LastGraphStats = graph.LastStats();
+    StageStats[static_cast<int>(ETerrainStage::Generation)] = { LastGraphStats.milliseconds, HeightMap.MemoryUsage() };
+}
+
+//Function to add the nodes of a generation step to a graph, returns the output node
+CTerrainGraph::NodeId TerrainGenerationScene::BuildGeneratorGraph(ETerrainGenerator generator, CTerrainGraph& graph, int sampleStep)
+{
+    switch (generator)
+    {
+    case ETerrainGenerator::Perlin:        return BuildPerlinHeightMap(graph, sampleStep);
+    case ETerrainGenerator::Rigid:         return RigidNoise(graph, false);
+    case ETerrainGenerator::InverseRigid:  return RigidNoise(graph, true);
+    case ETerrainGenerator::Octaves:       return PerlinNoiseWithOctaves(graph, sampleStep);
+    case ETerrainGenerator::DiamondSquare: return DiamondSquareMap(graph, sampleStep);
+    case ETerrainGenerator::Midpoint:      return MidpointDisplacementMap(graph);
+    case ETerrainGenerator::Upsample:      return UpsampleMap(graph);
+    case ETerrainGenerator::Spectral:      return SpectralMap(graph);
+    case ETerrainGenerator::Constraint:    return ConstraintMap(graph, sampleStep);
+    case ETerrainGenerator::Stamps:        return StampMap(graph);
+    case ETerrainGenerator::Biomes:        return BiomeMap(graph, sampleStep);
+    case ETerrainGenerator::MaskLayers:    return MaskLayerMap(graph);
+    case ETerrainGenerator::Remap:         return RemapMap(graph);
+    case ETerrainGenerator::Terracing:     return Terracing(graph);
+    case ETerrainGenerator::Smooth:        return SmoothHeightMap(graph);
+    case ETerrainGenerator::Erosion:       return ErodeHeightMap(graph);
+    case ETerrainGenerator::Thermal:       return ThermalErodeHeightMap(graph);
+    case ETerrainGenerator::Pipeline:      return BuildPipelineHeightMap(graph);
+    default:                               throw std::runtime_error("No terrain generator chosen");
+    }
+}
+
+//Check whether a generation step can make a preview
+bool TerrainGenerationScene::HasPreview(ETerrainGenerator generator)
+{
+    //Spectral maps of every size share their long wavelengths, so the smaller map is its preview.
+    //Midpoint displacement already runs tile by tile from its own coarse levels, so it is left out
+    switch (generator)
+    {
+    case ETerrainGenerator::Perlin:
+    case ETerrainGenerator::Octaves:
+    case ETerrainGenerator::DiamondSquare:
+    case ETerrainGenerator::Spectral:
+    case ETerrainGenerator::Constraint:
+    case ETerrainGenerator::Biomes:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//Name of a generation step shown in the UI and the history
+const char* TerrainGenerationScene::GeneratorName(ETerrainGenerator generator)
+{
+    switch (generator)
+    {
+    case ETerrainGenerator::Perlin:        return "Perlin Noise";
+    case ETerrainGenerator::Rigid:         return "Rigid Noise";
+    case ETerrainGenerator::InverseRigid:  return "Inverse Rigid Noise";
+    case ETerrainGenerator::Octaves:       return "Perlin with Octaves";
+    case ETerrainGenerator::DiamondSquare: return "Diamond Square";
+    case ETerrainGenerator::Midpoint:      return "Midpoint Displacement";
+    case ETerrainGenerator::Upsample:      return "Detail Upsample";
+    case ETerrainGenerator::Spectral:      return "Spectral Synthesis";
+    case ETerrainGenerator::Constraint:    return "Height Constraints";
+    case ETerrainGenerator::Stamps:        return "Stamp Features";
+    case ETerrainGenerator::Biomes:        return "Biome Map";
+    case ETerrainGenerator::MaskLayers:    return "Mask Layers";
+    case ETerrainGenerator::Remap:         return "Remap Curve";
+    case ETerrainGenerator::Terracing:     return "Terracing";
+    case ETerrainGenerator::Smooth:        return "Smooth";
+    case ETerrainGenerator::Erosion:       return "Hydraulic Erosion";
+    case ETerrainGenerator::Thermal:       return "Thermal Erosion";
+    case ETerrainGenerator::Pipeline:      return "Generate Pipeline";
+    default:                               return "None";
+    }
+}
+
+//Function to start a generation step in the background, superseding any step still running.
+//Repeating the last step (when its sliders change) runs it again on the HeightMap it started from
+void TerrainGenerationScene::StartGeneration(ETerrainGenerator generator, bool bRepeat)
+{
+    //Generation starts from the terrain, without the water shown on it
+    StopWater();
+
+    if (!bRepeat)
+    {
+        //Copying only shares the tiles, the HeightMap can keep changing without touching the base
+        GenerationBase = HeightMap;
+        bRecordGeneration = true;
+    }
+    LastGenerator = generator;
+
+    //The graphs are made here from the current settings, then owned and run by the background thread.
+    //The preview is built first so it can share its work with the full graph
+    DiamondSquareLevels = std::make_shared<CHeightField>();
+    std::unique_ptr<CTerrainGraph> preview;
+    CTerrainGraph::NodeId previewOutput = 0;
+    const int previewStep = PreviewStep();
+    if (bProgressivePreview && previewStep > 1 && HasPreview(generator))
+    {
+        preview.reset(new CTerrainGraph());
+        previewOutput = BuildGeneratorGraph(generator, *preview, previewStep);
+    }
+
+    std::unique_ptr<CTerrainGraph> graph(new CTerrainGraph());
+    CTerrainGraph::NodeId output = BuildGeneratorGraph(generator, *graph);
+    const int previewSize = TerrainSize / previewStep + 1;
+    Generator.Start(GeneratorName(generator), std::move(graph), output, TerrainSize + 1, TerrainSize + 1, std::move(preview), previewOutput, previewSize, previewSize);
+}
+
+//Function to swap in the HeightMap of a background generation that has finished, and show its preview until then
+void TerrainGenerationScene::CollectGeneration()
+{
+    CHeightField preview;
+    if (Generator.TakePreview(preview)) ShowPreview(preview);
+
+    CBackgroundGenerator::Result result;
+    if (!Generator.TakeResult(result))
+    {
+        //A step cancelled after its preview was shown leaves the mesh showing the HeightMap again
+        if (bPreviewShown && !Generator.IsBusy())
+        {
+            bPreviewShown = false;
+            HeightMap.MarkAllDirty();
+            UpdateDirtyTiles();
         }
+        return;
     }
+
+    //A step started before the terrain was resized is of no use now
+    if (result.heightField.Width() != HeightMap.Width() || result.heightField.Height() != HeightMap.Height()) return;
+
+    if (bRecordGeneration)
+    {
+        History.Record(HeightMap, result.label);
+        bRecordGeneration = false;
+    }
+
+    //Assigning marks only the tiles that differ from the current HeightMap as dirty, the mesh
+    //needs every tile again if it is showing a preview
+    HeightMap = std::move(result.heightField);
+    if (bPreviewShown)
+    {
+        bPreviewShown = false;
+        HeightMap.MarkAllDirty();
+    }
+    LastGraphStats = result.stats;
+    bLastGraphCached = result.bCached;
+    StageStats[static_cast<int>(ETerrainStage::Generation)] = { result.bCached ? 0.0f : result.stats.milliseconds, HeightMap.MemoryUsage() };
+    UpdateDirtyTiles();
 }
 
-//Normalisation of the HeightMap
-void TerrainGenerationScene::NormaliseHeightMap(float normaliseAmount)
+//Function to show a preview of the HeightMap on the terrain mesh
+void TerrainGenerationScene::ShowPreview(const CHeightField& preview)
 {
-    //Loop through the HeightMap and divide each value by the normalisation amount
-    for (int i = 0; i <= SizeOfTerrain; ++i) {
-        for (int j = 0; j <= SizeOfTerrain; ++j) {
-            HeightMap[i][j] /= normaliseAmount;
+    //A preview started before the terrain was resized is of no use now
+    const int previewStep = PreviewStep();
+    if (preview.Width() != TerrainSize / previewStep + 1 || preview.Height() != preview.Width()) return;
+
+    //Each vertex is interpolated from the four preview samples around the HeightMap sample it reads, so
+    //the time taken depends on the size of the mesh and not of the HeightMap
+    const int vertices = MeshSize() + 1;
+    const float scale = static_cast<float>(MeshSampleStep()) / previewStep;
+    const int last = preview.Width() - 1;
+    PreviewMesh.ResizeUninitialised(vertices, vertices);
+    std::vector<float> row(vertices);
+    for (int z = 0; z < vertices; ++z)
+    {
+        const float previewZ = z * scale;
+        const int z0 = std::min(static_cast<int>(previewZ), last - 1);
+        const float tz = previewZ - z0;
+        for (int x = 0; x < vertices; ++x)
+        {
+            const float previewX = x * scale;
+            const int x0 = std::min(static_cast<int>(previewX), last - 1);
+            const float tx = previewX - x0;
+            const float top = preview.Get(x0, z0) + tx * (preview.Get(x0 + 1, z0) - preview.Get(x0, z0));
+            const float bottom = preview.Get(x0, z0 + 1) + tx * (preview.Get(x0 + 1, z0 + 1) - preview.Get(x0, z0 + 1));
+            row[x] = top + tz * (bottom - top);
         }
+        PreviewMesh.WriteRegion(0, z, vertices, 1, row.data(), vertices);
     }
+
+    //Only the mesh shows the preview, the plants and height pyramid stay with the HeightMap until the step finishes
+    GroundModel->UpdateModelTiles(PreviewMesh, PreviewMesh.TakeDirtyTiles(), MeshSize(), TerrainMeshMinPt, TerrainMeshMaxPt, 1);
+    bPreviewShown = true;
+}
+
+//Function to stop the background generation before the HeightMap is changed on this thread
+void TerrainGenerationScene::CancelGeneration()
+{
+    //The water simulation works on its own copy of the terrain, so its next step would undo the change as well
+    StopWater();
+
+    //The running step started from the HeightMap before this change, so its result would undo it
+    Generator.Cancel();
+    LastGenerator = ETerrainGenerator::None;
 }
 
 //Function to build the height map with the Perlin Noise Algorithm
-void TerrainGenerationScene::BuildPerlinHeightMap(float amplitude, float frequency, bool bOctaves)
+CTerrainGraph::NodeId TerrainGenerationScene::BuildPerlinHeightMap(CTerrainGraph& graph, int sampleStep)
 {
-    //get the scale to make sure that the terrain looks consistent 
-    const float scale = (float)resolution / (float)SizeOfTerrain; 
+    //Perlin noise, normalised in the same pass
+    CTerrainGraph::NodeId noise = graph.Add<CPerlinOperator>({}, GetNoiseSettings(sampleStep));
+    return graph.Add<CScaleBiasOperator>({ noise }, 1.0f / HeightMapNormaliseAmount, 0.0f);
+}
 
-    //Create a PerlinNoise object to get the Perlin Noise values
-    CPerlinNoise* pn = new CPerlinNoise(seed);
+//Perlin Noise with Octaves Function
+CTerrainGraph::NodeId TerrainGenerationScene::PerlinNoiseWithOctaves(CTerrainGraph& graph, int sampleStep)
+{
+    //Every octave is added on to a flat surface of height 1, then normalised
+    CTerrainGraph::NodeId flat = graph.Add<CConstantOperator>({}, 1.0f);
+    CTerrainGraph::NodeId octaveNoise = graph.Add<CFractalPerlinOperator>({}, GetNoiseSettings(sampleStep), octaves, AmplitudeReduction, FrequencyMultiplier);
+    CTerrainGraph::NodeId sum = graph.Add<CCombineOperator>({ flat, octaveNoise }, ECombineMode::Add);
+    return graph.Add<CScaleBiasOperator>({ sum }, 1.0f / HeightMapNormaliseAmount, 0.0f);
+}
+
+//Rigid Noise Function, inverse rigid noise raises ridges instead of carving valleys
+CTerrainGraph::NodeId TerrainGenerationScene::RigidNoise(CTerrainGraph& graph, bool bInverse)
+{
+    //The rigid noise is added on to the HeightMap the step started from, then normalised
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, GenerationBase);
+    CTerrainGraph::NodeId rigid = graph.Add<CRigidOperator>({}, GetNoiseSettings(), bInverse);
+    CTerrainGraph::NodeId sum = graph.Add<CCombineOperator>({ current, rigid }, ECombineMode::Add);
+    return graph.Add<CScaleBiasOperator>({ sum }, 1.0f / HeightMapNormaliseAmount, 0.0f);
+}
 
-    for (int z = 0; z <= SizeOfTerrain; ++z) // loop through the z 
+//Function to call the Diamond Sqaure Algorithm, a preview runs the coarse levels the full map then starts from
+CTerrainGraph::NodeId TerrainGenerationScene::DiamondSquareMap(CTerrainGraph& graph, int sampleStep)
+{
+    //Diamond-square needs the whole HeightMap so it runs on its own
+    return graph.Add<CDiamondSquareOperator>({}, Spread, SpreadReduction, static_cast<unsigned int>(seed), sampleStep, DiamondSquareLevels);
+}
+
+//Function to call the tiled Midpoint Displacement generator, with the same spread as Diamond Square
+CTerrainGraph::NodeId TerrainGenerationScene::MidpointDisplacementMap(CTerrainGraph& graph)
+{
+    //Works on any rectangle, so unlike diamond-square it runs tile by tile with the rest of the graph
+    MidpointSettings settings;
+    settings.width = TerrainSize + 1;
+    settings.height = TerrainSize + 1;
+    settings.spread = Spread;
+    settings.spreadReduction = SpreadReduction;
+    settings.seed = static_cast<unsigned int>(seed);
+    settings.bWrap = bMidpointWrap;
+    return graph.Add<CMidpointDisplacementOperator>({}, settings);
+}
+
+//Function to make the imported map finer with fractal detail, cut to the size of the HeightMap
+CTerrainGraph::NodeId TerrainGenerationScene::UpsampleMap(CTerrainGraph& graph)
+{
+    //Coarse samples covering the HeightMap, from the corner of the imported map. Samples past its edge repeat the edge
+    const int factor = Upsample.factor;
+    const int coarseSize = TerrainSize / factor + 1;
+    CHeightField coarse(coarseSize, coarseSize);
+    std::vector<float> values(static_cast<size_t>(coarseSize) * coarseSize);
+    if (ImportedMap.Width() > 0)
     {
-        for (int x = 0; x <= SizeOfTerrain; ++x) //loop through the x
+        ImportedMap.ReadRegion(0, 0, coarseSize, coarseSize, values.data(), coarseSize);
+    }
+    else
+    {
+        std::vector<float> row(TerrainSize + 1);
+        for (int z = 0; z < coarseSize; ++z)
         {
-            //Get the current X and Z coordinates 
-            double ZCoord = z * frequency * scale / 20;
-            double XCoord = x * frequency * scale / 20;
+            GenerationBase.ReadRegion(0, z * factor, TerrainSize + 1, 1, row.data(), TerrainSize + 1);
+            for (int x = 0; x < coarseSize; ++x) values[static_cast<size_t>(z) * coarseSize + x] = row[x * factor];
+        }
+    }
+    coarse.WriteRegion(0, 0, coarseSize, coarseSize, values.data(), coarseSize);
 
-            //get the Current Perlin Noise value
-            float noiseValue = (float)pn->noise(XCoord, 0.0f, ZCoord) * amplitude;
+    UpsampleSettings settings = Upsample;
+    settings.seed = static_cast<unsigned int>(seed);
+    return graph.Add<CUpsampleOperator>({}, coarse, settings);
+}
 
-            //Check if Perlin with Octaves has been selected and add it to the current HeightMap value if it has
-            //Otherwise just update the HeightMap value to the new noiseValue
-            if (bOctaves)
-            {
-                HeightMap[z][x] += noiseValue;
-            }
-            else
-            {        
-                HeightMap[z][x] = noiseValue;
-            }
-        }
+//Function to load a tiled heightfield file as the coarse map to upsample
+void TerrainGenerationScene::ImportMap()
+{
+    try
+    {
+        CHeightFieldFile file(ImportPath);
+        file.Load(ImportedMap);
+        ImportMessage = "Imported " + std::to_string(ImportedMap.Width()) + " x " + std::to_string(ImportedMap.Height()) + " map";
+    }
+    catch (const std::exception& e)
+    {
+        ImportedMap = CHeightField();
+        ImportMessage = std::string("Import failed: ") + e.what();
     }
 }
 
-//Perlin Noise with Octaves Function
-void TerrainGenerationScene::PerlinNoiseWithOctaves(float Amplitude, float frequency, int octaves)
+//Function to shape white noise with a 1 / f^beta spectrum and turn it into a HeightMap with an inverse FFT
+CTerrainGraph::NodeId TerrainGenerationScene::SpectralMap(CTerrainGraph& graph)
+{
+    //Like diamond-square every sample depends on the whole map, so it runs on its own
+    SpectralSettings settings = Spectral;
+    settings.seed = static_cast<unsigned int>(seed);
+    return graph.Add<CSpectralOperator>({}, settings);
+}
+
+//Function to fill in the HeightMap smoothly between the pinned heights, with Perlin octaves on top
+CTerrainGraph::NodeId TerrainGenerationScene::ConstraintMap(CTerrainGraph& graph, int sampleStep)
 {
-    //loop through the number of octaves
-    for (int i = 0; i < octaves; ++i)
+    //The pins are kept as parts of the map size, the solver wants samples
+    const float size = static_cast<float>(TerrainSize / sampleStep);
+    std::vector<HeightConstraint> constraints = Constraints;
+    for (HeightConstraint& constraint : constraints)
     {
-        //Update the HeightMap with the Perlin noise function using the current Amplitude and Frequency
-        BuildPerlinHeightMap(Amplitude, frequency, true);
+        constraint.x0 *= size;
+        constraint.z0 *= size;
+        constraint.x1 *= size;
+        constraint.z1 *= size;
+        constraint.radius *= size;
+    }
+
+    //The smooth surface needs every pin at once so it is solved on its own, the noise goes on top tile by tile
+    CTerrainGraph::NodeId base = graph.Add<CConstraintOperator>({}, constraints, ConstraintSolve);
+    CTerrainGraph::NodeId noise = graph.Add<CFractalPerlinOperator>({}, GetNoiseSettings(sampleStep), octaves, AmplitudeReduction, FrequencyMultiplier);
+    CTerrainGraph::NodeId scaledNoise = graph.Add<CScaleBiasOperator>({ noise }, ConstraintNoise, 0.0f);
+    return graph.Add<CCombineOperator>({ base, scaledNoise }, ECombineMode::Add);
+}
+
+//Function to get the pinned heights the constraint terrain starts with
+std::vector<HeightConstraint> TerrainGenerationScene::DefaultConstraints()
+{
+    std::vector<HeightConstraint> constraints(3);
+
+    //A peak
+    constraints[0].x0 = constraints[0].x1 = 0.3f;
+    constraints[0].z0 = constraints[0].z1 = 0.3f;
+    constraints[0].height0 = constraints[0].height1 = 60.0f;
+    constraints[0].radius = 0.0f;
+
+    //A valley line falling across the map
+    constraints[1].x0 = 0.1f;
+    constraints[1].z0 = 0.8f;
+    constraints[1].x1 = 0.9f;
+    constraints[1].z1 = 0.6f;
+    constraints[1].height0 = -10.0f;
+    constraints[1].height1 = -30.0f;
+    constraints[1].radius = 0.0f;
+
+    //A flat town site
+    constraints[2].x0 = constraints[2].x1 = 0.7f;
+    constraints[2].z0 = constraints[2].z1 = 0.25f;
+    constraints[2].height0 = constraints[2].height1 = 10.0f;
+    constraints[2].radius = 0.04f;
+    return constraints;
+}
+
+//Function to pin a height at the edit centre, over the edit radius or just the nearest samples
+void TerrainGenerationScene::AddConstraint(float radius)
+{
+    HeightConstraint constraint;
+    constraint.x0 = constraint.x1 = static_cast<float>(EditCentreX) / TerrainSize;
+    constraint.z0 = constraint.z1 = static_cast<float>(EditCentreZ) / TerrainSize;
+    constraint.height0 = constraint.height1 = EditHeight;
+    constraint.radius = radius / TerrainSize;
+    Constraints.push_back(constraint);
+}
+
+//Function to scatter stamps of mountains, craters and mesas over the HeightMap the step started from
+CTerrainGraph::NodeId TerrainGenerationScene::StampMap(CTerrainGraph& graph)
+{
+    //Stamps only blend onto the samples they cover, so they run tile by tile on top of the HeightMap
+    const float sampleSpacing = (TerrainMeshMaxPt.x - TerrainMeshMinPt.x) / TerrainSize;
+    StampSettings settings = Stamps;
+    settings.width = TerrainSize + 1;
+    settings.height = TerrainSize + 1;
+    settings.minRadius = std::max(StampMinRadius * TerrainSize, 1.0f);
+    settings.maxRadius = std::max(StampMaxRadius * TerrainSize, settings.minRadius);
+    settings.heightPerRadius = StampSteepness * sampleSpacing;
+    settings.seed = static_cast<unsigned int>(seed);
+
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, GenerationBase);
+    return graph.Add<CStampOperator>({ current }, settings);
+}
 
-        //Update the Amplitude and Frequency variables
-        Amplitude *= AmplitudeReduction;
-        frequency *= FrequencyMultiplier;
+//Function to make a terrain of biomes, each with a generator of its own, blended where the climate is between them
+CTerrainGraph::NodeId TerrainGenerationScene::BiomeMap(CTerrainGraph& graph, int sampleStep)
+{
+    //Each biome's terrain has its own seed so the biomes don't share their hills
+    const NoiseSettings noise = GetNoiseSettings(sampleStep);
+    BiomeSettings settings;
+    settings.frequency = Biomes.frequency;
+    settings.transition = Biomes.transition;
+    settings.scale = noise.scale;
+    settings.seed = noise.seed;
+    std::vector<CTerrainGraph::NodeId> terrains;
+
+    //Mountains, octaves with ridges raised on top
+    if (bBiomes[0])
+    {
+        NoiseSettings ridgeNoise = noise;
+        ridgeNoise.seed = noise.seed + 1;
+        ridgeNoise.amplitude = 1.0f;
+        CTerrainGraph::NodeId octaveNoise = graph.Add<CFractalPerlinOperator>({}, noise, octaves, AmplitudeReduction, FrequencyMultiplier);
+        CTerrainGraph::NodeId ridges = graph.Add<CRigidOperator>({}, ridgeNoise, true);
+        CTerrainGraph::NodeId scaledRidges = graph.Add<CScaleBiasOperator>({ ridges }, Amplitude, 0.0f);
+        CTerrainGraph::NodeId sum = graph.Add<CCombineOperator>({ octaveNoise, scaledRidges }, ECombineMode::Add);
+        terrains.push_back(graph.Add<CScaleBiasOperator>({ sum }, 1.0f / HeightMapNormaliseAmount, 0.0f));
+        settings.biomes.push_back(Biomes.biomes[0]);
     }
+
+    //Plains, a few low octaves
+    if (bBiomes[1])
+    {
+        NoiseSettings plainNoise = noise;
+        plainNoise.seed = noise.seed + 2;
+        plainNoise.amplitude = Amplitude * 0.2f;
+        CTerrainGraph::NodeId octaveNoise = graph.Add<CFractalPerlinOperator>({}, plainNoise, std::min(octaves, 3), AmplitudeReduction, FrequencyMultiplier);
+        terrains.push_back(graph.Add<CScaleBiasOperator>({ octaveNoise }, 1.0f / HeightMapNormaliseAmount, 0.0f));
+        settings.biomes.push_back(Biomes.biomes[1]);
+    }
+
+    //Mesas, octaves normalised and cut into flat steps in one pass
+    if (bBiomes[2])
+    {
+        NoiseSettings mesaNoise = noise;
+        mesaNoise.seed = noise.seed + 3;
+        mesaNoise.amplitude = Amplitude * 0.6f;
+        CTerrainGraph::NodeId octaveNoise = graph.Add<CFractalPerlinOperator>({}, mesaNoise, octaves, AmplitudeReduction, FrequencyMultiplier);
+        const HeightValue h;
+        auto normaliseTerrace = round(h * (1.0f / (HeightMapNormaliseAmount * BiomeTerraceHeight))) * BiomeTerraceHeight;
+        terrains.push_back(graph.Add<CExpressionOperator<decltype(normaliseTerrace)>>({ octaveNoise }, "Normalise Mesa Steps", normaliseTerrace));
+        settings.biomes.push_back(Biomes.biomes[2]);
+    }
+
+    //Only the terrains of the biomes found in a tile are made over it
+    return graph.Add<CBiomeOperator>(terrains, settings);
 }
 
-//Rigid Noise Function
-void TerrainGenerationScene::RigidNoise()
+//Function to get the biomes the biome map starts with: cold mountains, mild wet plains and hot dry mesas
+BiomeSettings TerrainGenerationScene::DefaultBiomes()
 {
-    //get the scale to make sure that the terrain looks consistent 
-    const float scale = (float)resolution / (float)SizeOfTerrain;
+    BiomeSettings settings;
+    settings.biomes.resize(3);
+    settings.biomes[0] = { 0.2f, 0.5f };
+    settings.biomes[1] = { 0.55f, 0.75f };
+    settings.biomes[2] = { 0.85f, 0.2f };
+    settings.frequency = 0.05f;
+    settings.transition = 0.08f;
+    return settings;
+}
 
-    //Create a PerlinNoise object to get the Perlin Noise values
-    CPerlinNoise* pn = new CPerlinNoise(seed);
+//Function to lay a layer over the HeightMap the step started from through a mask, the layer is only made in
+//the tiles the mask covers
+CTerrainGraph::NodeId TerrainGenerationScene::MaskLayerMap(CTerrainGraph& graph)
+{
+    CTerrainGraph::NodeId base = graph.Add<CInputOperator>({}, GenerationBase);
 
-    for (int z = 0; z <= SizeOfTerrain; ++z) // loop through the z
+    //The layer, fused into the blend so it only runs where the mask isn't zero
+    CTerrainGraph::NodeId layer = base;
+    switch (MaskLayer)
+    {
+    case EMaskLayer::Ridges:
     {
-        for (int x = 0; x < SizeOfTerrain; ++x) //loop through the x
+        //Three octaves of raised ridges added on to the HeightMap
+        NoiseSettings ridgeNoise = GetNoiseSettings();
+        ridgeNoise.amplitude = 1.0f;
+        std::vector<CTerrainGraph::NodeId> octaveRidges;
+        float amplitude = Amplitude * 0.5f / HeightMapNormaliseAmount;
+        for (int octave = 0; octave < 3; ++octave)
         {
-            //Get the current X and Z coordinates 
-            double XCoord = x * frequency * scale / 20;
-            double ZCoord = z * frequency * scale / 20;
-
-            //Get the absolute value of the perlin noise function and subtract it from 1
-            float value = (1.0f - abs((float)pn->noise(XCoord, 0.0f, ZCoord) * (float)Amplitude));
+            CTerrainGraph::NodeId ridges = graph.Add<CRigidOperator>({}, ridgeNoise, true);
+            octaveRidges.push_back(graph.Add<CScaleBiasOperator>({ ridges }, amplitude, 0.0f));
+            ridgeNoise.frequency *= 2.0f;
+            amplitude *= 0.5f;
+        }
+        octaveRidges.insert(octaveRidges.begin(), base);
+        layer = graph.Add<CCombineOperator>(octaveRidges, ECombineMode::Add);
+        break;
+    }
+    case EMaskLayer::Smooth:
+        layer = graph.Add<CSmoothOperator>({ base }, smoothRadius);
+        break;
+    case EMaskLayer::Terraces:
+        layer = graph.Add<CTerraceOperator>({ base }, terracingMultiplier);
+        break;
+    }
 
-            //Then add the negated value to the current HeighMap value
-            HeightMap[z][x] += -value;
+    CTerrainGraph::NodeId mask = base;
+    switch (MaskType)
+    {
+    case EMaskType::HeightBand:
+        mask = graph.Add<CHeightBandOperator>({ base }, MaskBandLow, MaskBandHigh, MaskBandFade);
+        break;
+    case EMaskType::Slope:
+        mask = graph.Add<CSlopeMaskOperator>({ base }, MaskSlopeFrom, MaskSlopeTo);
+        break;
+    case EMaskType::Painted:
+        if (PaintedMask.Width() != HeightMap.Width() || PaintedMask.Height() != HeightMap.Height())
+        {
+            PaintedMask.Resize(HeightMap.Width(), HeightMap.Height(), 0.0f);
         }
+        mask = graph.Add<CInputOperator>({}, PaintedMask);
+        break;
+    case EMaskType::Noise:
+    {
+        //The noise runs from 0 to 1 around a half, the mask rises steeply from 0 to 1 past the threshold
+        NoiseSettings maskNoise = GetNoiseSettings();
+        maskNoise.seed += 7;
+        maskNoise.amplitude = 1.0f;
+        CTerrainGraph::NodeId noise = graph.Add<CPerlinOperator>({}, maskNoise);
+        const HeightValue h;
+        auto threshold = clamp((h - MaskNoiseThreshold) * 20.0f, 0.0f, 1.0f);
+        mask = graph.Add<CExpressionOperator<decltype(threshold)>>({ noise }, "Noise Mask", threshold);
+        break;
+    }
     }
+
+    return graph.Add<CMaskBlendOperator>({ base, layer, mask });
 }
 
-//Inverse Rigid Noise Function
-void TerrainGenerationScene::InverseRigidNoise()
+//Function to paint the mask at the edit centre over the edit radius, or rub it out
+void TerrainGenerationScene::PaintMask(bool bErase)
 {
-    //get the scale to make sure that the terrain looks consistent 
-    const float scale = (float)resolution / (float)SizeOfTerrain;
+    if (PaintedMask.Width() != HeightMap.Width() || PaintedMask.Height() != HeightMap.Height())
+    {
+        PaintedMask.Resize(HeightMap.Width(), HeightMap.Height(), 0.0f);
+    }
 
-    //Create a PerlinNoise object to get the Perlin Noise values
-    CPerlinNoise* pn = new CPerlinNoise(seed);
+    //Full strength in the middle, falling smoothly to nothing at the edit radius
+    const TerrainRegion region = GetEditRegion().Intersect({ 0, 0, PaintedMask.Width(), PaintedMask.Height() });
+    if (region.Empty()) return;
+    std::vector<float> values(region.Samples());
+    PaintedMask.ReadRegion(region.x, region.z, region.width, region.height, values.data(), region.width);
+    for (int z = 0; z < region.height; ++z)
+    {
+        for (int x = 0; x < region.width; ++x)
+        {
+            const float dx = static_cast<float>(region.x + x - EditCentreX);
+            const float dz = static_cast<float>(region.z + z - EditCentreZ);
+            const float t = std::min(std::sqrt(dx * dx + dz * dz) / std::max(EditRadius, 1.0f), 1.0f);
+            const float strength = 1.0f - t * t * (3.0f - 2.0f * t);
+            float& value = values[z * region.width + x];
+            value = bErase ? std::min(value, 1.0f - strength) : std::max(value, strength);
+        }
+    }
+    PaintedMask.WriteRegion(region.x, region.z, region.width, region.height, values.data(), region.width);
+}
 
-    for (int z = 0; z <= SizeOfTerrain; ++z) // loop through the z
+//Function to write a midpoint displacement map of the export size to a tiled file, on a thread of its own
+void TerrainGenerationScene::StartMapExport()
+{
+    if (bExportRunning) return;
+    if (ExportThread.joinable()) ExportThread.join();
+
+    MidpointSettings settings;
+    settings.width = ExportWidth;
+    settings.height = ExportHeight;
+    settings.spread = Spread;
+    settings.spreadReduction = SpreadReduction;
+    settings.seed = static_cast<unsigned int>(seed);
+    settings.bWrap = bMidpointWrap;
+    const std::string path = ExportPath;
+
+    std::shared_ptr<CJobProgress> progress = std::make_shared<CJobProgress>();
+    ExportProgress = progress;
+    bExportRunning = true;
+    {
+        std::lock_guard<std::mutex> lock(ExportMutex);
+        ExportMessage = "Exporting " + path;
+    }
+
+    ExportThread = std::thread([this, settings, path, progress]()
     {
-        for (int x = 0; x <= SizeOfTerrain; ++x) //loop through the x
+        //Only a few blocks of the map are held at once, each batch is spread over the pool
+        CThreadPool::SetWaitWhenBusy(true);
+        std::string message;
+        try
         {
-            //Get the current X and Z coordinates 
-             double currentX = x * frequency * scale / 20;
-             double currentZ = z * frequency * scale / 20;
+            CMidpointDisplacement generator(settings);
+            message = generator.GenerateToFile(path, progress.get()) ? "Exported " + path : std::string("Export cancelled");
+        }
+        catch (const std::exception& e)
+        {
+            message = std::string("Export failed: ") + e.what();
+        }
 
-             //Get the absolute value of the perlin noise function and subtract it from 1
-             float value = (1.0f - abs((float)pn->noise(currentX, 0.0f, currentZ) * (float)Amplitude));
+        std::lock_guard<std::mutex> lock(ExportMutex);
+        ExportMessage = message;
+        bExportRunning = false;
+    });
+}
+
+//Function to write the whole imported map upsampled to the export path, on a thread of its own
+void TerrainGenerationScene::StartUpsampleExport()
+{
+    if (bExportRunning || ImportedMap.Width() == 0) return;
+    if (ExportThread.joinable()) ExportThread.join();
+
+    UpsampleSettings settings = Upsample;
+    settings.seed = static_cast<unsigned int>(seed);
+    const CHeightField coarse = ImportedMap;
+    const std::string path = ExportPath;
 
-             //Then add the value to the current HeighMap value
-             HeightMap[z][x] += value;
+    std::shared_ptr<CJobProgress> progress = std::make_shared<CJobProgress>();
+    ExportProgress = progress;
+    bExportRunning = true;
+    {
+        std::lock_guard<std::mutex> lock(ExportMutex);
+        ExportMessage = "Exporting " + path;
+    }
+
+    ExportThread = std::thread([this, coarse, settings, path, progress]()
+    {
+        //The fine map is streamed to the file a few blocks at a time, only the coarse map is held whole
+        CThreadPool::SetWaitWhenBusy(true);
+        std::string message;
+        try
+        {
+            CDetailUpsampler upsampler(coarse, settings);
+            message = upsampler.GenerateToFile(path, progress.get()) ? "Exported " + path : std::string("Export cancelled");
+        }
+        catch (const std::exception& e)
+        {
+            message = std::string("Export failed: ") + e.what();
         }
+
+        std::lock_guard<std::mutex> lock(ExportMutex);
+        ExportMessage = message;
+        bExportRunning = false;
+    });
+}
+
+//Terracing Function, hard steps from rounding or smooth steps from a curve
+CTerrainGraph::NodeId TerrainGenerationScene::Terracing(CTerrainGraph& graph)
+{
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, GenerationBase);
+    if (!bSmoothTerraces) return graph.Add<CTerraceOperator>({ current }, terracingMultiplier);
+
+    CurveSettings settings;
+    settings.shape = ECurveShape::Terraces;
+    settings.terraceHeight = TerraceHeight;
+    settings.sharpness = TerraceSharpness;
+    return graph.Add<CRemapOperator>({ current }, settings);
+}
+
+//Function to remap the heights of the HeightMap the step started from through a spline
+CTerrainGraph::NodeId TerrainGenerationScene::RemapMap(CTerrainGraph& graph)
+{
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, GenerationBase);
+
+    CurveSettings settings;
+    const int points = static_cast<int>(IM_ARRAYSIZE(RemapCurve));
+    for (int i = 0; i < points; ++i)
+    {
+        const float height = RemapLow + (RemapHigh - RemapLow) * i / (points - 1);
+        settings.points.push_back({ height, RemapLow + (RemapHigh - RemapLow) * RemapCurve[i] });
     }
+    return graph.Add<CRemapOperator>({ current }, settings);
+}
+
+//Function to smooth the HeightMap with a box blur
+CTerrainGraph::NodeId TerrainGenerationScene::SmoothHeightMap(CTerrainGraph& graph)
+{
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, GenerationBase);
+    return graph.Add<CSmoothOperator>({ current }, smoothRadius);
+}
+
+//Function to run droplets of water over the HeightMap, wearing valleys into the slopes
+CTerrainGraph::NodeId TerrainGenerationScene::ErodeHeightMap(CTerrainGraph& graph)
+{
+    ErosionSettings settings = Erosion;
+    settings.seed = static_cast<unsigned int>(seed);
+
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, GenerationBase);
+    return graph.Add<CHydraulicErosionOperator>({ current }, settings);
+}
+
+//Function to let material slide down the slopes of the HeightMap that are steeper than the talus slope
+CTerrainGraph::NodeId TerrainGenerationScene::ThermalErodeHeightMap(CTerrainGraph& graph)
+{
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, GenerationBase);
+    return graph.Add<CThermalErosionOperator>({ current }, ThermalErosion);
+}
+
+//Function to add every selected step of the generation to a graph, which runs them as one fused pass
+CTerrainGraph::NodeId TerrainGenerationScene::BuildPipelineHeightMap(CTerrainGraph& graph)
+{
+    return BuildPipelineGraph(graph, GetPipelineSettings());
 }
 
-//Function to call the Diamond Sqaure Algorithm
-void TerrainGenerationScene::DiamondSquareMap()
+//Function to get the settings of the pipeline from the sliders
+PipelineSettings TerrainGenerationScene::GetPipelineSettings() const
 {
-    //Create a new DiamondSqaure object with the required information
-    DiamondSquare ds(SizeOfTerrain, Spread, SpreadReduction);
+    PipelineSettings settings;
+    settings.noise = GetNoiseSettings();
+    settings.octaves = octaves;
+    settings.amplitudeReduction = AmplitudeReduction;
+    settings.frequencyMultiplier = FrequencyMultiplier;
+    settings.normaliseAmount = HeightMapNormaliseAmount;
+    settings.terracingMultiplier = terracingMultiplier;
+    settings.smoothRadius = smoothRadius;
+    settings.bRigid = bPipelineRigid;
+    settings.bSmooth = bPipelineSmooth;
+    settings.bTerrace = bPipelineTerrace;
+    return settings;
+}
 
-    //perform the Diamond Square Algorithm on the HeightMap
-    ds.process(HeightMap);
+//Function to add the steps of a pipeline to a graph, only reads the settings given so it can run on any thread
+CTerrainGraph::NodeId TerrainGenerationScene::BuildPipelineGraph(CTerrainGraph& graph, const PipelineSettings& settings)
+{
+    //Octaves on a flat surface, optionally rigid noise on top, smoothed, terraced and normalised.
+    //Nothing in the chain is read twice, so it all runs in one pass over the HeightMap
+    CTerrainGraph::NodeId flat = graph.Add<CConstantOperator>({}, 1.0f);
+    CTerrainGraph::NodeId octaveNoise = graph.Add<CFractalPerlinOperator>({}, settings.noise, settings.octaves, settings.amplitudeReduction, settings.frequencyMultiplier);
+    std::vector<CTerrainGraph::NodeId> layers = { flat, octaveNoise };
+    if (settings.bRigid) layers.push_back(graph.Add<CRigidOperator>({}, settings.noise, false));
+
+    CTerrainGraph::NodeId node = graph.Add<CCombineOperator>(layers, ECombineMode::Add);
+    if (settings.bSmooth) node = graph.Add<CSmoothOperator>({ node }, settings.smoothRadius);
+    if (!settings.bTerrace) return graph.Add<CScaleBiasOperator>({ node }, 1.0f / settings.normaliseAmount, 0.0f);
+
+    //Normalising and terracing as one expression, one loop over each tile instead of two
+    const HeightValue h;
+    auto normaliseTerrace = round(h * (1.0f / settings.normaliseAmount)) / settings.terracingMultiplier;
+    return graph.Add<CExpressionOperator<decltype(normaliseTerrace)>>({ node }, "Normalise Terrace", normaliseTerrace);
 }
 
-//Terracing Function
-void TerrainGenerationScene::Terracing(float terracingMultiplier)
+//Function to start streaming chunks of the pipeline with the current settings, every chunk is built again
+void TerrainGenerationScene::ResetChunks()
 {
-    for (int x = 0; x <= SizeOfTerrain; ++x) // loop through the x
+    //Chunks use the same spacing and texture tiling as the single terrain patch
+    ChunkSettings settings;
+    settings.sampleSpacing = (TerrainMeshMaxPt.x - TerrainMeshMinPt.x) / TerrainSize;
+    settings.uvScale = 1.0f / TerrainSize;
+    settings.viewRadius = ChunkViewRadius;
+    settings.maxLod = ChunkMaxLod;
+    settings.lodPixels = ChunkLodPixels;
+    settings.worldSeed = static_cast<unsigned int>(seed);
+    settings.plantsPerChunk = plantResizeAmount;
+
+    //The graphs are built from a copy of the settings, as chunks are built on the workers while the sliders keep changing
+    const PipelineSettings pipeline = GetPipelineSettings();
+    ChunkManager.Reset(settings, [pipeline](CTerrainGraph& graph, int originX, int originZ, int sampleStep, unsigned int)
     {
-        for (int z = 0; z <= SizeOfTerrain; ++z) //loop through the z
+        //Far chunks step over the noise sampleStep times as fast, so their samples are samples of the full terrain
+        //and the long waves don't change with the detail level. Octaves too short to show between two of their
+        //samples are left out, and smoothing covers the same ground
+        PipelineSettings chunkPipeline = pipeline;
+        chunkPipeline.noise.offsetX = originX / sampleStep;
+        chunkPipeline.noise.offsetZ = originZ / sampleStep;
+        chunkPipeline.noise.scale *= sampleStep;
+        if (sampleStep > 1)
         {
-            //Get the current height value
-            float MapValue = HeightMap[x][z];
+            chunkPipeline.octaves = CFractalPerlinOperator::OctavesLongerThan(pipeline.noise, pipeline.octaves, pipeline.frequencyMultiplier, 2.0f * sampleStep);
+            chunkPipeline.smoothRadius = pipeline.smoothRadius / sampleStep;
+            chunkPipeline.bSmooth = pipeline.bSmooth && chunkPipeline.smoothRadius > 0;
+        }
+        return BuildPipelineGraph(graph, chunkPipeline);
+    });
+}
 
-            //Round this height value
-            float roundedValue = round(MapValue);
+//Function to release the chunks that have been retired and create the meshes of built chunks, within the frame budget
+void TerrainGenerationScene::UpdateChunks()
+{
+    //Retired chunks go first, a chunk can be built again once it is back in range
+    for (const ChunkCoord& coord : ChunkManager.TakeRetiredChunks())
+    {
+        auto chunk = TerrainChunks.find(coord);
+        if (chunk == TerrainChunks.end()) continue;
+        ReleaseChunk(chunk->second);
+        TerrainChunks.erase(chunk);
+    }
 
-            //and then set the height to the rounded value divided by the multiplier
-            HeightMap[x][z] = roundedValue / terracingMultiplier;
+    //The chunks are placed before the model is scaled. Scaling moves the camera and the quads alike, so the
+    //size of a quad on screen is the same either way
+    const CVector3 cameraPosition = MainCamera->Position();
+    ChunkManager.Update(cameraPosition.x / TerrainYScale.x, cameraPosition.z / TerrainYScale.z, textureWidth / MainCamera->FOV());
+
+    //Creating the buffers is the only part done on this thread, so stop once the budget for the frame is
+    //used up. At least one chunk is made every frame so the terrain always catches up with the camera
+    auto start = std::chrono::high_resolution_clock::now();
+    ChunksUploadedLastFrame = 0;
+    ChunkData data;
+    while (ChunkManager.TakeReadyChunk(data))
+    {
+        TerrainChunk& chunk = TerrainChunks[data.coord];
+        ReleaseChunk(chunk);
+        chunk.mesh = new Mesh(data.vertices.data(), static_cast<unsigned int>(data.vertices.size()), data.indices.data(), static_cast<unsigned int>(data.indices.size()));
+        chunk.model = new Model(chunk.mesh);
+        for (const CVector3& plant : data.plants)
+        {
+            CVector3 position = plant;
+            position *= TerrainYScale;
+            Model* plantModel = new Model(resourceManager->getMesh(L"plant"));
+            plantModel->SetPosition({ position.x, position.y - 3, position.z });
+            chunk.plants.push_back(plantModel);
         }
+        ++ChunksUploadedLastFrame;
+
+        std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        if (elapsed.count() >= ChunkUploadBudgetMs) break;
     }
+
+    for (auto& chunk : TerrainChunks) chunk.second.model->SetScale(TerrainYScale);
+}
+
+//Function to release the mesh, model and plants of a chunk
+void TerrainGenerationScene::ReleaseChunk(TerrainChunk& chunk)
+{
+    delete chunk.model; chunk.model = nullptr;
+    delete chunk.mesh;  chunk.mesh = nullptr;
+    for (Model* plant : chunk.plants) delete plant;
+    chunk.plants.clear();
+}
+
+//Function to stop streaming and release every chunk
+void TerrainGenerationScene::ReleaseAllChunks()
+{
+    ChunkManager.Stop();
+    ChunkManager.TakeRetiredChunks();
+    for (auto& chunk : TerrainChunks) ReleaseChunk(chunk.second);
+    TerrainChunks.clear();
+}
+
+//Function to get the square of the HeightMap chosen for local edits
+TerrainRegion TerrainGenerationScene::GetEditRegion() const
+{
+    const int radius = static_cast<int>(std::ceil(EditRadius));
+    return { EditCentreX - radius, EditCentreZ - radius, 2 * radius + 1, 2 * radius + 1 };
+}
+
+//Function to raise (or lower with a negative height) a round hill in the edit region
+void TerrainGenerationScene::RaiseRegion(float height)
+{
+    CBumpOperator bump((float)EditCentreX, (float)EditCentreZ, EditRadius, height);
+    const TerrainRegion bounds = bump.Bounds();
+
+    CTerrainGraph graph;
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, HeightMap);
+    CTerrainGraph::NodeId hill = graph.Add<CBumpOperator>({}, bump);
+    CTerrainGraph::NodeId sum = graph.Add<CCombineOperator>({ current, hill }, ECombineMode::Add);
+    RunTerrainGraph(graph, sum, &bounds);
+}
+
+//Function to start the water simulation on the HeightMap as it is now
+void TerrainGenerationScene::StartWater()
+{
+    CancelGeneration();
+    History.Record(HeightMap, "Water Simulation");
+    Water.Reset(HeightMap, WaterParameters);
+    bWaterRunning = true;
+}
+
+//Function to stop the water simulation, leaving the eroded terrain without the water in the HeightMap
+void TerrainGenerationScene::StopWater()
+{
+    if (!bWaterRunning) return;
+
+    bWaterRunning = false;
+    Water.WriteHeights(HeightMap, false);
+    UpdateDirtyTiles();
+
+    //The layers of a large map take several times the memory of the HeightMap, so they are let go
+    Water = CWaterSimulation();
+}
+
+//Function to run the steps of the water simulation for this frame and show the result
+void TerrainGenerationScene::UpdateWater()
+{
+    //The spring sits at the centre of the local edits
+    WaterSettings settings = WaterParameters;
+    settings.sourceX = static_cast<float>(EditCentreX);
+    settings.sourceZ = static_cast<float>(EditCentreZ);
+    settings.sourceRadius = EditRadius;
+    Water.SetSettings(settings);
+
+    //While a generation or benchmark holds the thread pool the steps run on this thread alone, so the time per step
+    //shown rises until the pool is free again
+    auto start = std::chrono::high_resolution_clock::now();
+    Water.Step(WaterStepsPerFrame);
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    WaterMsPerStep = elapsed.count() / WaterStepsPerFrame;
+
+    //Every tile changes while water flows, the mesh is updated from the dirty tiles as for any other change
+    Water.WriteHeights(HeightMap, bShowWater);
+    UpdateDirtyTiles();
+}
+
+//Function to smooth the edit region only
+void TerrainGenerationScene::SmoothRegion()
+{
+    const TerrainRegion region = GetEditRegion();
+
+    CTerrainGraph graph;
+    CTerrainGraph::NodeId current = graph.Add<CInputOperator>({}, HeightMap);
+    CTerrainGraph::NodeId smoothed = graph.Add<CSmoothOperator>({ current }, smoothRadius);
+    RunTerrainGraph(graph, smoothed, &region);
 }
 
 //Function to contain all of the ImGui code
@@ -621,6 +1577,106 @@ void TerrainGenerationScene::IMGUI()
             ImGui::Begin("Information", 0, windowFlags);;
             ImGui::Text("Camera Position: (%.2f, %.2f, %.2f)", MainCamera->Position().x,  MainCamera->Position().y,  MainCamera->Position().z);
             ImGui::Text("Camera Rotation: (%.2f, %.2f, %.2f)", MainCamera->Rotation().x,  MainCamera->Rotation().y,  MainCamera->Rotation().z);
+
+            //Usage of the pool that every heightfield tile is allocated from
+            CTileAllocator& tilePool = CHeightField::TileAllocator();
+            ImGui::Text("Tile Pool: %zu tiles in use, %zu high water, %.1f MB reserved", tilePool.BlocksInUse(), tilePool.HighWaterBlocks(), tilePool.ReservedBytes() / (1024.0f * 1024.0f));
+            ImGui::Text("Huge Page Slabs: %zu, NUMA Nodes: %d", tilePool.HugePageSlabs(), NumaNodeCount());
+
+            //Choose the pages that new tile slabs are backed by
+            const char* pageModes[] = { PageModeName(EPageMode::Normal), PageModeName(EPageMode::TransparentHuge), PageModeName(EPageMode::ExplicitHuge) };
+            if (ImGui::Combo("Tile Pages", &TilePageMode, pageModes, IM_ARRAYSIZE(pageModes)))
+            {
+                tilePool.SetPageMode(static_cast<EPageMode>(TilePageMode));
+            }
+
+            //Benchmarks run on a thread of their own and take seconds, the results show once they finish
+            TakeBenchmarkResults();
+            if (RunningBenchmark.valid()) ImGui::Text("Running %s...", RunningBenchmarkLabel.c_str());
+            if (!BenchmarkError.empty()) ImGui::Text("Benchmark failed: %s", BenchmarkError.c_str());
+
+            //Time random reads from the tiles of an 8k heightfield with the tile slabs in each page mode, with the dTLB misses where they can be counted
+            if (ImGui::Button("Page Benchmark", ButtonSize))
+            {
+                StartBenchmark("Page Benchmark", PageBenchmarkResults, []() { return BenchmarkPageModes(8192, 1 << 24); });
+            }
+            for (const BenchmarkResult& result : PageBenchmarkResults)
+            {
+                const std::string misses = result.tlbMisses >= 0 ? std::to_string(result.tlbMisses) + " dTLB misses" : "dTLB misses unavailable";
+                ImGui::Text("%s: %.1f ms, %.1f ns/read, %s%s", result.name.c_str(), result.milliseconds, result.nanosecondsPerItem, misses.c_str(), result.hugePages ? "" : " (no huge pages)");
+            }
+
+            //Time diamond-square at 4k and 8k with more and more workers, to show how it scales
+            if (ImGui::Button("Diamond Square Benchmark", ButtonSize))
+            {
+                StartBenchmark("Diamond Square Benchmark", DiamondSquareBenchmarkResults, []()
+                {
+                    std::vector<BenchmarkResult> results = BenchmarkDiamondSquare(4096);
+                    std::vector<BenchmarkResult> large = BenchmarkDiamondSquare(8192);
+                    results.insert(results.end(), large.begin(), large.end());
+                    return results;
+                });
+            }
+            for (const BenchmarkResult& result : DiamondSquareBenchmarkResults)
+            {
+                ImGui::Text("%s: %.1f ms, %.2f ns/sample", result.name.c_str(), result.milliseconds, result.nanosecondsPerItem);
+            }
+
+            //Time a few hundred iterations of thermal erosion on a 4k map, with and without blocking
+            if (ImGui::Button("Thermal Benchmark", ButtonSize))
+            {
+                StartBenchmark("Thermal Benchmark", ThermalBenchmarkResults, []() { return BenchmarkThermalErosion(4096, 200); });
+            }
+            for (const BenchmarkResult& result : ThermalBenchmarkResults)
+            {
+                ImGui::Text("%s: %.1f ms, %.2f ns/sample", result.name.c_str(), result.milliseconds, result.nanosecondsPerItem);
+            }
+
+            //Time Perlin noise, diamond-square and spectral synthesis against each other at 4k and 8k
+            if (ImGui::Button("Generator Benchmark", ButtonSize))
+            {
+                StartBenchmark("Generator Benchmark", GeneratorBenchmarkResults, []()
+                {
+                    std::vector<BenchmarkResult> results = BenchmarkGenerators(4096);
+                    std::vector<BenchmarkResult> large = BenchmarkGenerators(8192);
+                    results.insert(results.end(), large.begin(), large.end());
+                    return results;
+                });
+            }
+            for (const BenchmarkResult& result : GeneratorBenchmarkResults)
+            {
+                ImGui::Text("%s: %.1f ms, %.2f ns/sample", result.name.c_str(), result.milliseconds, result.nanosecondsPerItem);
+            }
+
+            //Time multigrid against a few hundred sweeps of plain relaxation for the constraint terrain at 4k
+            if (ImGui::Button("Constraint Benchmark", ButtonSize))
+            {
+                StartBenchmark("Constraint Benchmark", ConstraintBenchmarkResults, []() { return BenchmarkConstraintSolver(4096, 500); });
+            }
+            for (const BenchmarkResult& result : ConstraintBenchmarkResults)
+            {
+                ImGui::Text("%s: %.1f ms, %.2f ns/sample", result.name.c_str(), result.milliseconds, result.nanosecondsPerItem);
+            }
+
+            //Time 10k stamps on a 4k map with each blend
+            if (ImGui::Button("Stamp Benchmark", ButtonSize))
+            {
+                StartBenchmark("Stamp Benchmark", StampBenchmarkResults, []() { return BenchmarkStamps(4096, 10000); });
+            }
+            for (const BenchmarkResult& result : StampBenchmarkResults)
+            {
+                ImGui::Text("%s: %.1f ms, %.2f ns/sample", result.name.c_str(), result.milliseconds, result.nanosecondsPerItem);
+            }
+
+            //Time rounded terraces against curves on a 4k map
+            if (ImGui::Button("Remap Benchmark", ButtonSize))
+            {
+                StartBenchmark("Remap Benchmark", RemapBenchmarkResults, []() { return BenchmarkRemap(4096); });
+            }
+            for (const BenchmarkResult& result : RemapBenchmarkResults)
+            {
+                ImGui::Text("%s: %.1f ms, %.2f ns/sample", result.name.c_str(), result.milliseconds, result.nanosecondsPerItem);
+            }
             ImGui::Text("");
             if(ImGui::Button("Toggle FPS", ButtonSize)) lockFPS = !lockFPS;
             ImGui::SameLine();
@@ -646,13 +1702,10 @@ void TerrainGenerationScene::IMGUI()
             //then goes through each plant in the scene and updates its position to the new height map
             if (ImGui::Button("Reset Terrain", ButtonSize))
             {
+                CancelGeneration();
+                History.Record(HeightMap, "Reset Terrain");
                 BuildHeightMap(1);
-                GroundModel->ResizeModel(HeightMap, SizeOfTerrainVertices, TerrainMeshMinPt, TerrainMeshMaxPt);
-                for (auto i : PlantModels)
-                {
-                    i->SetPosition(CVector3{i->Position().x, 1, i->Position().z});
-                }
-
+                UpdateDirtyTiles();
             }
             ImGui::SameLine();
 
@@ -666,10 +1719,25 @@ void TerrainGenerationScene::IMGUI()
                 MainCamera->SetRotation(CameraRotation);
             }
 
+            //--------------//
+            // Terrain Size //
+            //--------------//
+            //samples along each side of the HeightMap, every stage is sized from it. Maps larger than
+            //the mesh are shown with every few samples, the generation still works on all of them
+            const char* terrainSizes[] = { "257 x 257", "513 x 513", "1025 x 1025", "2049 x 2049", "4097 x 4097", "8193 x 8193" };
+            int terrainSizeIndex = 0;
+            while ((MinTerrainSize << terrainSizeIndex) < TerrainSize) ++terrainSizeIndex;
+            if (ImGui::Combo("Terrain Size", &terrainSizeIndex, terrainSizes, IM_ARRAYSIZE(terrainSizes)))
+            {
+                ResizeTerrain(MinTerrainSize << terrainSizeIndex);
+            }
+            ImGui::Text("Mesh: %d x %d vertices, every %d samples", MeshSize() + 1, MeshSize() + 1, MeshSampleStep());
+
             //----------------------//
             // Reset Terrain Button //
             //----------------------//
             //resets every variable that affects the terrain generation to their starting values
+            bool bSettingsChanged = false;
             if (ImGui::Button("Reset Terrain Settings", ButtonSize))
             {
                 frequency = 0.125f;
@@ -678,12 +1746,43 @@ void TerrainGenerationScene::IMGUI()
                 seed = 0;
                 TerrainYScale = { 10, 30, 10 };
                 terracingMultiplier = 1.1f;
+                bSmoothTerraces = false;
+                TerraceHeight = 10.0f;
+                TerraceSharpness = 4.0f;
+                smoothRadius = 2;
+                Erosion = ErosionSettings();
+                ThermalErosion = ThermalSettings();
+                Spectral = SpectralSettings();
+                Constraints = DefaultConstraints();
+                ConstraintSolve = ConstraintSettings();
+                ConstraintNoise = 0.5f;
+                Stamps = StampSettings();
+                StampMinRadius = 0.005f;
+                StampMaxRadius = 0.04f;
+                StampSteepness = 1.0f;
+                Biomes = DefaultBiomes();
+                bBiomes[0] = bBiomes[1] = bBiomes[2] = true;
+                BiomeTerraceHeight = 10.0f;
+                MaskLayer = EMaskLayer::Ridges;
+                MaskType = EMaskType::HeightBand;
+                MaskBandLow = 40.0f;
+                MaskBandHigh = 1000.0f;
+                MaskBandFade = 10.0f;
+                MaskSlopeFrom = 0.5f;
+                MaskSlopeTo = 1.0f;
+                MaskNoiseThreshold = 0.55f;
+                PaintedMask = CHeightField();
+                RemapLow = 0.0f;
+                RemapHigh = 100.0f;
+                RemapCurve[0] = 0.0f; RemapCurve[1] = 0.1f; RemapCurve[2] = 0.5f; RemapCurve[3] = 0.9f; RemapCurve[4] = 1.0f;
 
                 octaves = 5;
                 AmplitudeReduction = 0.33f;
                 FrequencyMultiplier = 1.5f;
                 Spread = 30.0;
                 SpreadReduction = 2.0f;
+                Upsample = UpsampleSettings();
+                bSettingsChanged = true;
             }
             ImGui::Text("");
 
@@ -691,10 +1790,10 @@ void TerrainGenerationScene::IMGUI()
             // Terrain Information and Variables //
             //-----------------------------------//
             //Sliders to update the terrain generation variables
-            ImGui::SliderFloat("Terrain Frequency", &frequency, 0.0f, 0.25f);
-            ImGui::SliderFloat("Terrain amplitude", &Amplitude, 100.0f, 300.0f);
-            ImGui::SliderInt("Terrain Resolution", &resolution, 250, 750);
-            ImGui::SliderInt("Perlin Noise Seed", &seed, 0, 250);
+            bSettingsChanged |= ImGui::SliderFloat("Terrain Frequency", &frequency, 0.0f, 0.25f);
+            bSettingsChanged |= ImGui::SliderFloat("Terrain amplitude", &Amplitude, 100.0f, 300.0f);
+            bSettingsChanged |= ImGui::SliderInt("Terrain Resolution", &resolution, 250, 750);
+            bSettingsChanged |= ImGui::SliderInt("Perlin Noise Seed", &seed, 0, 250);
             ImGui::SliderFloat("Terrain Scale", &TerrainYScale.y, 0.5f, 60.0f);
             ImGui::Text("");
 
@@ -706,10 +1805,7 @@ void TerrainGenerationScene::IMGUI()
             //finally updates the positions of the plants in the scene
             if (ImGui::Button("Perlin Noise", ButtonSize))
             {
-                BuildPerlinHeightMap(Amplitude, frequency, false);
-                NormaliseHeightMap(HeightMapNormaliseAmount);
-                GroundModel->ResizeModel(HeightMap, SizeOfTerrainVertices, TerrainMeshMinPt, TerrainMeshMaxPt);
-                UpdateFoliagePosition();
+                StartGeneration(ETerrainGenerator::Perlin);
             }
 
             //-----------------------------------------------------//
@@ -721,10 +1817,7 @@ void TerrainGenerationScene::IMGUI()
             ImGui::SameLine();
             if (ImGui::Button("Rigid Noise", ButtonSize))
             {
-                RigidNoise();
-                NormaliseHeightMap(HeightMapNormaliseAmount);
-                GroundModel->ResizeModel(HeightMap, SizeOfTerrainVertices, TerrainMeshMinPt, TerrainMeshMaxPt);
-                UpdateFoliagePosition();
+                StartGeneration(ETerrainGenerator::Rigid);
             }
 
             //-------------------------------------------------------------//
@@ -735,10 +1828,7 @@ void TerrainGenerationScene::IMGUI()
             //finally updates the positions of the plants in the scene
             if (ImGui::Button("Inverse Rigid Noise", ButtonSize))
             {
-                InverseRigidNoise();
-                NormaliseHeightMap(HeightMapNormaliseAmount);
-                GroundModel->ResizeModel(HeightMap, SizeOfTerrainVertices, TerrainMeshMinPt, TerrainMeshMaxPt);
-                UpdateFoliagePosition();
+                StartGeneration(ETerrainGenerator::InverseRigid);
             }
             
             ImGui::Text("");
@@ -749,12 +1839,12 @@ void TerrainGenerationScene::IMGUI()
             // Terrain Information and Variables //
             //-----------------------------------//
             //Sliders to update the terrain generation variables
-            ImGui::SliderInt("Number of Octaves", &octaves, 1, 20);
-            ImGui::SliderFloat("Amplitude Reduction", &AmplitudeReduction, 0.1f, 0.5f);
-            ImGui::SliderFloat("Frequency Multiplier", &FrequencyMultiplier, 1.0f, 2.0f);
-            ImGui::SliderFloat("DS Spread", &Spread, 10.0f, 40.0f);
-            ImGui::SliderFloat("DS Spread Reduction", &SpreadReduction, 2.0f, 2.5f);
-            ImGui::SliderFloat("Terracing multiplier", &terracingMultiplier, 0.950f, 1.25f);
+            bSettingsChanged |= ImGui::SliderInt("Number of Octaves", &octaves, 1, 20);
+            bSettingsChanged |= ImGui::SliderFloat("Amplitude Reduction", &AmplitudeReduction, 0.1f, 0.5f);
+            bSettingsChanged |= ImGui::SliderFloat("Frequency Multiplier", &FrequencyMultiplier, 1.0f, 2.0f);
+            bSettingsChanged |= ImGui::SliderFloat("DS Spread", &Spread, 10.0f, 40.0f);
+            bSettingsChanged |= ImGui::SliderFloat("DS Spread Reduction", &SpreadReduction, 2.0f, 2.5f);
+            bSettingsChanged |= ImGui::SliderFloat("Terracing multiplier", &terracingMultiplier, 0.950f, 1.25f);
             ImGui::Text("");
 
             //-----------------------------------------------------------------------//
@@ -765,12 +1855,7 @@ void TerrainGenerationScene::IMGUI()
             //finally updates the positions of the plants in the scene
             if (ImGui::Button("Perlin with Octaves", ButtonSize))
             {
-                //Reset the height map to a flat surface
-                BuildHeightMap(1);
-                PerlinNoiseWithOctaves(Amplitude, frequency, octaves);
-                NormaliseHeightMap(HeightMapNormaliseAmount);
-                GroundModel->ResizeModel(HeightMap, SizeOfTerrainVertices, TerrainMeshMinPt, TerrainMeshMaxPt);
-                UpdateFoliagePosition();
+                StartGeneration(ETerrainGenerator::Octaves);
             }
 
             //-------------------------------------------------------------//
@@ -782,12 +1867,261 @@ void TerrainGenerationScene::IMGUI()
             ImGui::SameLine();
             if (ImGui::Button("Diamond Square", ButtonSize))
             {
-                //Reset the height map to a flat surface
-                BuildHeightMap(1);
-                DiamondSquareMap();
-                GroundModel->ResizeModel(HeightMap, SizeOfTerrainVertices, TerrainMeshMinPt, TerrainMeshMaxPt);
-                UpdateFoliagePosition();
+                StartGeneration(ETerrainGenerator::DiamondSquare);
+            }
+
+            //-------------------------------------------------------------//
+            // Generate new Terrain with tiled Midpoint Displacement       //
+            //-------------------------------------------------------------//
+            //the same steps as diamond-square, worked out tile by tile so maps of any size can be
+            //made, with or without wrapping edges. Large maps are exported to a tiled file
+            if (ImGui::Button("Midpoint Displacement", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Midpoint);
+            }
+            ImGui::SameLine();
+            bSettingsChanged |= ImGui::Checkbox("Wrap Edges", &bMidpointWrap);
+            ImGui::InputInt("Export Width", &ExportWidth);
+            ImGui::InputInt("Export Height", &ExportHeight);
+            ImGui::InputText("Export Path", ExportPath, IM_ARRAYSIZE(ExportPath));
+            if (bExportRunning)
+            {
+                ImGui::ProgressBar(ExportProgress->Progress(), ImVec2(ButtonSize.x, 0));
+                ImGui::SameLine();
+                if (ImGui::Button("Cancel Export", ButtonSize)) ExportProgress->Cancel();
+            }
+            else if (ImGui::Button("Export Map", ButtonSize))
+            {
+                StartMapExport();
+            }
+            {
+                std::lock_guard<std::mutex> lock(ExportMutex);
+                if (!ExportMessage.empty()) ImGui::Text("%s", ExportMessage.c_str());
+            }
+
+            //-------------------------------------------------------------//
+            // Upsample a Coarse Map with Fractal Detail                   //
+            //-------------------------------------------------------------//
+            //makes an imported map (or every few samples of the terrain) finer with a bicubic curve
+            //and midpoint displacement detail, keeping the coarse samples exactly. The whole imported
+            //map can be streamed upsampled to the export path
+            ImGui::InputText("Import Path", ImportPath, IM_ARRAYSIZE(ImportPath));
+            if (ImGui::Button("Import Map", ButtonSize))
+            {
+                ImportMap();
+                bSettingsChanged = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Detail Upsample", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Upsample);
+            }
+            if (!ImportMessage.empty()) ImGui::Text("%s", ImportMessage.c_str());
+            const char* upsampleFactors[] = { "2x", "4x", "8x", "16x" };
+            int upsampleFactor = 0;
+            while ((2 << upsampleFactor) < Upsample.factor) ++upsampleFactor;
+            if (ImGui::Combo("Upsample Factor", &upsampleFactor, upsampleFactors, IM_ARRAYSIZE(upsampleFactors)))
+            {
+                Upsample.factor = 2 << upsampleFactor;
+                bSettingsChanged = true;
+            }
+            bSettingsChanged |= ImGui::SliderFloat("Upsample Detail", &Upsample.detail, 0.0f, 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Flat Ground Detail", &Upsample.minimumDetail, 0.0f, 5.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Detail Reduction", &Upsample.spreadReduction, 1.5f, 3.0f);
+            if (ImportedMap.Width() > 0 && !bExportRunning && ImGui::Button("Upsample to File", ButtonSize))
+            {
+                StartUpsampleExport();
+            }
+
+            //-------------------------------------------------------------//
+            // Generate new Terrain with Spectral Synthesis                //
+            //-------------------------------------------------------------//
+            //gives every frequency of the map a random value that falls off as 1 / f^beta
+            //and turns the whole spectrum into heights with one inverse FFT. The map tiles
+            if (ImGui::Button("Spectral Synthesis", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Spectral);
+            }
+            bSettingsChanged |= ImGui::SliderFloat("Spectral Beta", &Spectral.beta, 1.0f, 3.5f);
+            bSettingsChanged |= ImGui::SliderFloat("Spectral Amplitude", &Spectral.amplitude, 0.5f, 8.0f);
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Generate new Terrain from pinned Heights                    //
+            //-------------------------------------------------------------//
+            //fills in the terrain as smoothly as it can between the pinned heights with multigrid,
+            //then adds Perlin octaves on top. Pins are placed at the edit centre with the edit height
+            if (ImGui::Button("Height Constraints", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Constraint);
+            }
+            if (ImGui::Button("Pin Peak", ButtonSize))
+            {
+                AddConstraint(0.0f);
+                bSettingsChanged = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Pin Flat Site", ButtonSize))
+            {
+                AddConstraint(EditRadius);
+                bSettingsChanged = true;
+            }
+            if (ImGui::Button("Clear Pins", ButtonSize))
+            {
+                Constraints.clear();
+                bSettingsChanged = true;
+            }
+            ImGui::SameLine();
+            ImGui::Text("%d pins", static_cast<int>(Constraints.size()));
+            bool bBiharmonic = ConstraintSolve.fill == EConstraintFill::Biharmonic;
+            if (ImGui::Checkbox("Biharmonic Fill", &bBiharmonic))
+            {
+                ConstraintSolve.fill = bBiharmonic ? EConstraintFill::Biharmonic : EConstraintFill::Harmonic;
+                bSettingsChanged = true;
+            }
+            bSettingsChanged |= ImGui::SliderInt("Constraint Cycles", &ConstraintSolve.maxCycles, 0, 32);
+            bSettingsChanged |= ImGui::SliderFloat("Constraint Noise", &ConstraintNoise, 0.0f, 2.0f);
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Update the Terrain with Stamps of Features                  //
+            //-------------------------------------------------------------//
+            //scatters small heightmaps of mountains, craters and mesas over the terrain with random
+            //sizes and rotations, blended on by adding, the larger height or a smooth maximum. Crater bowls are always cut in
+            if (ImGui::Button("Stamp Features", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Stamps);
+            }
+            const char* stampBlends[] = { "Add", "Max", "Smooth Max" };
+            int stampBlend = static_cast<int>(Stamps.blend);
+            if (ImGui::Combo("Stamp Blend", &stampBlend, stampBlends, IM_ARRAYSIZE(stampBlends)))
+            {
+                Stamps.blend = static_cast<EStampBlend>(stampBlend);
+                bSettingsChanged = true;
+            }
+            bSettingsChanged |= ImGui::Checkbox("Mountains", &Stamps.bShapes[static_cast<int>(EStampShape::Mountain)]);
+            ImGui::SameLine();
+            bSettingsChanged |= ImGui::Checkbox("Craters", &Stamps.bShapes[static_cast<int>(EStampShape::Crater)]);
+            ImGui::SameLine();
+            bSettingsChanged |= ImGui::Checkbox("Mesas", &Stamps.bShapes[static_cast<int>(EStampShape::Mesa)]);
+
+            //At least one shape is always placed
+            if (!Stamps.bShapes[0] && !Stamps.bShapes[1] && !Stamps.bShapes[2]) Stamps.bShapes[0] = true;
+            bSettingsChanged |= ImGui::SliderInt("Stamp Count", &Stamps.count, 0, 20000);
+            bSettingsChanged |= ImGui::SliderFloat("Stamp Min Radius", &StampMinRadius, 0.001f, 0.05f);
+            bSettingsChanged |= ImGui::SliderFloat("Stamp Max Radius", &StampMaxRadius, 0.005f, 0.2f);
+            bSettingsChanged |= ImGui::SliderFloat("Stamp Steepness", &StampSteepness, 0.1f, 4.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Stamp Smoothness", &Stamps.smoothness, 0.05f, 1.0f);
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Generate a Terrain of Biomes                                //
+            //-------------------------------------------------------------//
+            //picks a biome for every part of the terrain from slowly changing temperature and moisture,
+            //each biome with a generator of its own, and blends them where the climate is between two.
+            //Only the generators of the biomes in a tile are run over it
+            if (ImGui::Button("Biome Map", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Biomes);
+            }
+            bSettingsChanged |= ImGui::Checkbox("Mountains##Biome", &bBiomes[0]);
+            ImGui::SameLine();
+            bSettingsChanged |= ImGui::Checkbox("Plains##Biome", &bBiomes[1]);
+            ImGui::SameLine();
+            bSettingsChanged |= ImGui::Checkbox("Mesas##Biome", &bBiomes[2]);
+
+            //At least one biome is always made
+            if (!bBiomes[0] && !bBiomes[1] && !bBiomes[2]) bBiomes[0] = true;
+
+            //Climates are (temperature, moisture)
+            bSettingsChanged |= ImGui::SliderFloat2("Mountain Climate", &Biomes.biomes[0].temperature, 0.0f, 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat2("Plain Climate", &Biomes.biomes[1].temperature, 0.0f, 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat2("Mesa Climate", &Biomes.biomes[2].temperature, 0.0f, 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Climate Frequency", &Biomes.frequency, 0.005f, 0.5f);
+            bSettingsChanged |= ImGui::SliderFloat("Biome Transition", &Biomes.transition, 0.01f, 0.5f);
+            bSettingsChanged |= ImGui::SliderFloat("Mesa Step Height", &BiomeTerraceHeight, 1.0f, 50.0f);
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Lay a Layer over the Terrain through a Mask                 //
+            //-------------------------------------------------------------//
+            //lays ridges, smoothing or terraces over the terrain through a mask of a band of heights,
+            //the slopes, a painted mask or noise. The layer is only made in the tiles the mask covers,
+            //and tiles the mask covers completely only make the layer
+            if (ImGui::Button("Mask Layers", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::MaskLayers);
+            }
+            const char* maskLayers[] = { "Ridges", "Smooth", "Terraces" };
+            int maskLayer = static_cast<int>(MaskLayer);
+            if (ImGui::Combo("Mask Layer", &maskLayer, maskLayers, IM_ARRAYSIZE(maskLayers)))
+            {
+                MaskLayer = static_cast<EMaskLayer>(maskLayer);
+                bSettingsChanged = true;
+            }
+            const char* maskTypes[] = { "Height Band", "Slope", "Painted", "Noise" };
+            int maskType = static_cast<int>(MaskType);
+            if (ImGui::Combo("Mask", &maskType, maskTypes, IM_ARRAYSIZE(maskTypes)))
+            {
+                MaskType = static_cast<EMaskType>(maskType);
+                bSettingsChanged = true;
+            }
+            switch (MaskType)
+            {
+            case EMaskType::HeightBand:
+                bSettingsChanged |= ImGui::SliderFloat("Mask Band Low", &MaskBandLow, -100.0f, 200.0f);
+                bSettingsChanged |= ImGui::SliderFloat("Mask Band High", &MaskBandHigh, -100.0f, 1000.0f);
+                bSettingsChanged |= ImGui::SliderFloat("Mask Band Fade", &MaskBandFade, 0.1f, 50.0f);
+                break;
+            case EMaskType::Slope:
+                bSettingsChanged |= ImGui::SliderFloat("Mask Slope From", &MaskSlopeFrom, 0.0f, 4.0f);
+                bSettingsChanged |= ImGui::SliderFloat("Mask Slope To", &MaskSlopeTo, 0.0f, 4.0f);
+                break;
+            case EMaskType::Painted:
+                //painted at the edit centre over the edit radius
+                if (ImGui::Button("Paint Mask", ButtonSize))
+                {
+                    PaintMask(false);
+                    bSettingsChanged = true;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Erase Mask", ButtonSize))
+                {
+                    PaintMask(true);
+                    bSettingsChanged = true;
+                }
+                break;
+            case EMaskType::Noise:
+                bSettingsChanged |= ImGui::SliderFloat("Mask Noise Threshold", &MaskNoiseThreshold, 0.3f, 0.7f);
+                break;
+            }
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Remap the Terrain Heights through a Curve                   //
+            //-------------------------------------------------------------//
+            //moves every height through a spline from the low to the high height, baked into
+            //a table so the remap costs the same whatever the shape of the curve
+            if (ImGui::Button("Remap Curve", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Remap);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Fit Curve to Terrain", ButtonSize))
+            {
+                const CMinMaxPyramid::Range range = HeightPyramid.Total();
+                RemapLow = range.min;
+                RemapHigh = range.max;
+                bSettingsChanged = true;
             }
+            bSettingsChanged |= ImGui::SliderFloat("Remap Low", &RemapLow, -500.0f, 500.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Remap High", &RemapHigh, -500.0f, 1000.0f);
+            //the points of the spline need increasing heights
+            RemapHigh = std::max(RemapHigh, RemapLow + 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Remap 25%", &RemapCurve[1], 0.0f, 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Remap 50%", &RemapCurve[2], 0.0f, 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Remap 75%", &RemapCurve[3], 0.0f, 1.0f);
+            ImGui::Text("");
 
             //-------------------------------------------------------------//
             // Update the Terrain with Terraces                            //
@@ -795,12 +2129,289 @@ void TerrainGenerationScene::IMGUI()
             //updates the values of the heightMap to generate terraces in the terrain
             //then resizes the terrain mesh with these new height values
             //finally updates the positions of the plants in the scene
+            //smooth terraces shape each step with a curve instead of rounding
+            bSettingsChanged |= ImGui::Checkbox("Smooth Terraces", &bSmoothTerraces);
+            if (bSmoothTerraces)
+            {
+                bSettingsChanged |= ImGui::SliderFloat("Terrace Height", &TerraceHeight, 1.0f, 50.0f);
+                bSettingsChanged |= ImGui::SliderFloat("Terrace Sharpness", &TerraceSharpness, 1.0f, 16.0f);
+            }
             if (ImGui::Button("Terracing", ButtonSize))
             {
-                Terracing(terracingMultiplier);
-                GroundModel->ResizeModel(HeightMap, SizeOfTerrainVertices, TerrainMeshMinPt, TerrainMeshMaxPt);
-                UpdateFoliagePosition();
+                StartGeneration(ETerrainGenerator::Terracing);
             }
+
+            //-------------------------------------------------------------//
+            // Smooth the Terrain                                          //
+            //-------------------------------------------------------------//
+            //blurs the heightMap over the chosen radius to soften sharp edges
+            //then resizes the terrain mesh with these new height values
+            //finally updates the positions of the plants in the scene
+            ImGui::SameLine();
+            if (ImGui::Button("Smooth", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Smooth);
+            }
+            bSettingsChanged |= ImGui::SliderInt("Smooth Radius", &smoothRadius, 1, 8);
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Hydraulic Erosion                                           //
+            //-------------------------------------------------------------//
+            //runs droplets of water downhill over the heightMap, picking up sediment on
+            //the slopes and dropping it where they slow down, spread over every core
+            if (ImGui::Button("Hydraulic Erosion", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Erosion);
+            }
+            bSettingsChanged |= ImGui::SliderInt("Droplets", &Erosion.droplets, 1000, 1000000);
+            bSettingsChanged |= ImGui::SliderInt("Erosion Passes", &Erosion.passes, 1, 8);
+            bSettingsChanged |= ImGui::SliderInt("Droplet Lifetime", &Erosion.maxLifetime, 1, 60);
+            bSettingsChanged |= ImGui::SliderInt("Erosion Radius", &Erosion.radius, 1, 8);
+            bSettingsChanged |= ImGui::SliderFloat("Inertia", &Erosion.inertia, 0.0f, 0.5f);
+            bSettingsChanged |= ImGui::SliderFloat("Sediment Capacity", &Erosion.capacity, 0.5f, 16.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Erode Speed", &Erosion.erodeSpeed, 0.0f, 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Deposit Speed", &Erosion.depositSpeed, 0.0f, 1.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Evaporate Speed", &Erosion.evaporateSpeed, 0.0f, 0.1f);
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Thermal Erosion                                             //
+            //-------------------------------------------------------------//
+            //moves material from slopes steeper than the talus slope to the samples below
+            //them, over and over, until the cliffs have crumbled into screes
+            if (ImGui::Button("Thermal Erosion", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Thermal);
+            }
+            bSettingsChanged |= ImGui::SliderInt("Thermal Iterations", &ThermalErosion.iterations, 1, 500);
+            bSettingsChanged |= ImGui::SliderFloat("Talus Slope", &ThermalErosion.talus, 0.0f, 8.0f);
+            bSettingsChanged |= ImGui::SliderFloat("Thermal Amount", &ThermalErosion.amount, 0.0f, 1.0f);
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Generate new Terrain with the whole pipeline                //
+            //-------------------------------------------------------------//
+            //runs octaves, rigid noise, smoothing, normalisation and terracing as one graph
+            //so every tile goes through all of the steps while it is in cache
+            bSettingsChanged |= ImGui::Checkbox("Rigid", &bPipelineRigid);
+            ImGui::SameLine();
+            bSettingsChanged |= ImGui::Checkbox("Smooth##Pipeline", &bPipelineSmooth);
+            ImGui::SameLine();
+            bSettingsChanged |= ImGui::Checkbox("Terrace", &bPipelineTerrace);
+            if (ImGui::Button("Generate Pipeline", ButtonSize))
+            {
+                StartGeneration(ETerrainGenerator::Pipeline);
+            }
+            if (bLastGraphCached) ImGui::Text("Last Graph: taken from the cache");
+            else ImGui::Text("Last Graph: %d nodes, %d passes, %d tiles, %.2f ms", LastGraphStats.nodes, LastGraphStats.passes, LastGraphStats.tiles, LastGraphStats.milliseconds);
+            if (!bLastGraphCached && LastGraphStats.blendInputs + LastGraphStats.blendInputsSkipped > 0)
+            {
+                ImGui::Text("Blend Inputs: %d made, %d left out of their tiles", LastGraphStats.blendInputs, LastGraphStats.blendInputsSkipped);
+            }
+
+            //-------------------------------------------------------------//
+            // Background generation                                       //
+            //-------------------------------------------------------------//
+            //every step above runs on a background thread and the finished HeightMap is swapped in
+            //whole, so the frame never waits for it. Changing a setting while auto regenerate is on
+            //reruns the last step with the new value and cancels the run it supersedes. With progressive
+            //previews the generators show a coarse version on the mesh first, while the rest runs
+            ImGui::Checkbox("Auto Regenerate", &bAutoRegenerate);
+            ImGui::SameLine();
+            ImGui::Checkbox("Progressive Preview", &bProgressivePreview);
+            if (bSettingsChanged && bAutoRegenerate && LastGenerator != ETerrainGenerator::None)
+            {
+                StartGeneration(LastGenerator, true);
+            }
+            if (Generator.IsBusy())
+            {
+                ImGui::ProgressBar(Generator.Progress(), ImVec2(ButtonSize.x, 0), Generator.RunningLabel().c_str());
+                ImGui::SameLine();
+                if (ImGui::Button("Cancel", ButtonSize)) Generator.Cancel();
+            }
+            else
+            {
+                ImGui::Text("Generation: idle");
+            }
+            ImGui::Text("Generations: %d finished, %d cancelled", Generator.FinishedJobs(), Generator.CancelledJobs());
+            const std::string generationError = Generator.LastError();
+            if (!generationError.empty()) ImGui::Text("Generation failed: %s", generationError.c_str());
+
+            //finished HeightMaps are cached by the hash of their generator and settings, so going back
+            //to settings used before swaps in the cached tiles instead of generating them again
+            CHeightFieldCache& generationCache = Generator.Cache();
+            if (ImGui::SliderInt("Cache Budget (MB)", &GenerationCacheMB, 16, 2048)) UpdateCacheBudget();
+            CHeightFieldCache::Stats cacheStats = generationCache.GetStats();
+            ImGui::Text("Cache: %zu entries, %.1f of %.0f MB", cacheStats.entries, cacheStats.bytes / (1024.0f * 1024.0f), cacheStats.budget / (1024.0f * 1024.0f));
+            ImGui::Text("Cache: %lld hits, %lld misses, %lld evictions", static_cast<long long>(cacheStats.hits), static_cast<long long>(cacheStats.misses), static_cast<long long>(cacheStats.evictions));
+            if (ImGui::Button("Clear Cache", ButtonSize)) generationCache.Clear();
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Infinite terrain                                            //
+            //-------------------------------------------------------------//
+            //replaces the single patch with chunks of the pipeline streamed around the camera. Chunks
+            //are built on the thread pool and only a few milliseconds a frame go on making their meshes
+            if (ImGui::Checkbox("Infinite Terrain", &bInfiniteTerrain))
+            {
+                if (bInfiniteTerrain) ResetChunks();
+                else ReleaseAllChunks();
+            }
+            if (bInfiniteTerrain)
+            {
+                if (bSettingsChanged) ResetChunks();
+                if (ImGui::SliderInt("Chunk View Radius", &ChunkViewRadius, 1, 12)) ChunkManager.SetViewRadius(ChunkViewRadius);
+                ImGui::SliderFloat("Chunk Upload Budget (ms)", &ChunkUploadBudgetMs, 0.5f, 8.0f);
+
+                //Far chunks generate every 2nd, 4th, 8th... sample, refined as the camera comes closer
+                bool bLodChanged = ImGui::SliderInt("Chunk Detail Levels", &ChunkMaxLod, 0, CChunkManager::MaxLod);
+                bLodChanged |= ImGui::SliderFloat("Chunk Quad Size (pixels)", &ChunkLodPixels, 1.0f, 32.0f);
+                if (bLodChanged) ChunkManager.SetLod(ChunkMaxLod, ChunkLodPixels);
+
+                CChunkManager::Stats chunkStats = ChunkManager.GetStats();
+                ImGui::Text("Chunks: %d loaded, %d queued, %d building", chunkStats.loaded, chunkStats.queued, chunkStats.building);
+                ImGui::Text("Chunks: %lld built, %lld retired, %.2f ms each, %d uploaded last frame", static_cast<long long>(chunkStats.built), static_cast<long long>(chunkStats.retired), chunkStats.averageMilliseconds, ChunksUploadedLastFrame);
+                ImGui::Text("Chunks at each detail level: %d, %d, %d, %d, %d, %d", chunkStats.levels[0], chunkStats.levels[1], chunkStats.levels[2], chunkStats.levels[3], chunkStats.levels[4], chunkStats.levels[5]);
+            }
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Local edits                                                 //
+            //-------------------------------------------------------------//
+            //changes only the part of the HeightMap around the chosen point, then only the
+            //tiles that changed are uploaded to the mesh and only the plants on them are moved
+            ImGui::SliderInt("Edit X", &EditCentreX, 0, TerrainSize);
+            ImGui::SliderInt("Edit Z", &EditCentreZ, 0, TerrainSize);
+            ImGui::SliderFloat("Edit Radius", &EditRadius, 4.0f, 96.0f * TerrainSize / MinTerrainSize);
+            ImGui::SliderFloat("Edit Height", &EditHeight, 1.0f, 100.0f);
+            bool bEdited = false;
+            if (ImGui::Button("Raise Region", ButtonSize))
+            {
+                CancelGeneration();
+                History.Record(HeightMap, "Raise Region");
+                RaiseRegion(EditHeight);
+                bEdited = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Lower Region", ButtonSize))
+            {
+                CancelGeneration();
+                History.Record(HeightMap, "Lower Region");
+                RaiseRegion(-EditHeight);
+                bEdited = true;
+            }
+            if (ImGui::Button("Smooth Region", ButtonSize))
+            {
+                CancelGeneration();
+                History.Record(HeightMap, "Smooth Region");
+                SmoothRegion();
+                bEdited = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Regenerate Region", ButtonSize))
+            {
+                CancelGeneration();
+                History.Record(HeightMap, "Regenerate Region");
+                const TerrainRegion region = GetEditRegion();
+                CTerrainGraph graph;
+                RunTerrainGraph(graph, BuildPipelineHeightMap(graph), &region);
+                bEdited = true;
+            }
+            if (bEdited) UpdateDirtyTiles();
+
+            //-------------------------------------------------------------//
+            // Water Simulation                                            //
+            //-------------------------------------------------------------//
+            //water flows over the HeightMap through virtual pipes between the samples,
+            //carving rivers and filling lakes. The spring at the edit centre adds water
+            if (ImGui::Button(bWaterRunning ? "Stop Water" : "Start Water", ButtonSize))
+            {
+                if (bWaterRunning) StopWater();
+                else StartWater();
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Pour Water", ButtonSize) && bWaterRunning)
+            {
+                Water.AddWater(static_cast<float>(EditCentreX), static_cast<float>(EditCentreZ), EditRadius, 5.0f);
+            }
+            ImGui::Checkbox("Show Water", &bShowWater);
+            ImGui::SliderInt("Water Steps per Frame", &WaterStepsPerFrame, 1, 16);
+            ImGui::SliderFloat("Rain", &WaterParameters.rain, 0.0f, 1.0f);
+            ImGui::SliderFloat("Evaporation", &WaterParameters.evaporation, 0.0f, 2.0f);
+            ImGui::SliderFloat("Spring Rate", &WaterParameters.sourceRate, 0.0f, 50.0f);
+            ImGui::SliderFloat("Sediment Capacity##Water", &WaterParameters.capacity, 0.0f, 4.0f);
+            ImGui::SliderFloat("Dissolve Speed", &WaterParameters.dissolveSpeed, 0.0f, 0.1f);
+            ImGui::SliderFloat("Deposit Speed##Water", &WaterParameters.depositSpeed, 0.0f, 0.1f);
+            if (bWaterRunning)
+            {
+                ImGui::Text("Water: %lld steps, %.3f ms per step", static_cast<long long>(Water.Steps()), WaterMsPerStep);
+                ImGui::Text("Water: %.1f volume, %.1f sediment", Water.TotalWater(), Water.TotalSediment());
+            }
+
+            CMinMaxPyramid::Range heightRange = HeightPyramid.Total();
+            ImGui::Text("Last Update: %d of %d tiles, Heights %.1f to %.1f", LastDirtyTiles, HeightMap.TileCount(), heightRange.min, heightRange.max);
+
+            //time each stage took on the last update and the memory it holds, to see where large maps go
+            const char* stageNames[] = { "Generation", "Mesh", "Pyramid", "Foliage" };
+            size_t totalBytes = 0;
+            for (int stage = 0; stage < static_cast<int>(ETerrainStage::Count); ++stage)
+            {
+                ImGui::Text("%s: %.2f ms, %.2f MB", stageNames[stage], StageStats[stage].milliseconds, StageStats[stage].bytes / (1024.0f * 1024.0f));
+                totalBytes += StageStats[stage].bytes;
+            }
+            const size_t waterBytes = Water.MemoryUsage();
+            totalBytes += waterBytes + History.MemoryUsage(HeightMap) + generationCache.GetStats().bytes;
+            ImGui::Text("Water: %.2f MB, Total with history and cache: %.2f MB", waterBytes / (1024.0f * 1024.0f), totalBytes / (1024.0f * 1024.0f));
+            ImGui::Text("");
+            ImGui::Separator();
+            ImGui::Text("");
+
+            //-------------------------------------------------------------//
+            // Undo / Redo and A/B comparison of the HeightMap             //
+            //-------------------------------------------------------------//
+            //snapshots share their tiles with the HeightMap so stepping through the history
+            //only swaps tile pointers, then the terrain mesh and plants are updated to match
+            bool bHistoryChanged = false;
+            //The water is stopped first so the terrain recorded for redo doesn't have the water on it
+            if (ImGui::Button("Undo", ButtonSize))
+            {
+                StopWater();
+                bHistoryChanged = History.Undo(HeightMap);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Redo", ButtonSize))
+            {
+                StopWater();
+                bHistoryChanged = History.Redo(HeightMap);
+            }
+
+            for (int slot = 0; slot < CHeightFieldHistory::NumSlots; ++slot)
+            {
+                const char slotName = static_cast<char>('A' + slot);
+                ImGui::PushID(slot);
+                if (ImGui::Button((std::string("Store ") + slotName).c_str(), ButtonSize))
+                {
+                    History.Store(slot, HeightMap, std::string(1, slotName));
+                }
+                ImGui::SameLine();
+                if (ImGui::Button((std::string("Show ") + slotName).c_str(), ButtonSize))
+                {
+                    StopWater();
+                    bHistoryChanged = History.Recall(slot, HeightMap);
+                }
+                ImGui::PopID();
+            }
+
+            if (bHistoryChanged)
+            {
+                CancelGeneration();
+                UpdateDirtyTiles();
+            }
+
+            ImGui::Text("Undo: %s", History.CanUndo() ? History.UndoLabel().c_str() : "-");
+            ImGui::Text("Redo: %s", History.CanRedo() ? History.RedoLabel().c_str() : "-");
+            ImGui::Text("History Memory: %.2f MB", History.MemoryUsage(HeightMap) / (1024.0f * 1024.0f));
             ImGui::Text("");
             ImGui::Separator();
 
@@ -828,6 +2439,9 @@ void TerrainGenerationScene::IMGUI()
                     
                 }
                 UpdateFoliagePosition();    
+
+                //Chunks place their own plants, so they are built again with the new amount
+                if (bInfiniteTerrain) ResetChunks();
             }
         }
         //End of the Terrain Generation window
@@ -3,7 +3,97 @@
 #include "System/System.h"
 #include "Math/CPerlinNoise.h"
 #include "Math/DiamondSquare.h"
+#include "Math/RandomHelpers.h"
 #include "Math/CVector3.h"
+#include "Terrain/CHeightField.h"
+#include "Terrain/CHeightFieldHistory.h"
+#include "Terrain/CTerrainGraph.h"
+#include "Terrain/CBackgroundGenerator.h"
+#include "Terrain/CChunkManager.h"
+#include "Terrain/CMidpointDisplacement.h"
+#include "Terrain/CDetailUpsampler.h"
+#include "Terrain/CHeightFieldFile.h"
+#include "Terrain/CHydraulicErosion.h"
+#include "Terrain/CThermalErosion.h"
+#include "Terrain/CWaterSimulation.h"
+#include "Terrain/CConstraintSolver.h"
+#include "Terrain/CStampGenerator.h"
+#include "Terrain/CMinMaxPyramid.h"
+#include "Terrain/TerrainBenchmarks.h"
+#include <future>
+
+//Generation steps that run in the background
+enum class ETerrainGenerator
+{
+    None,
+    Perlin,
+    Rigid,
+    InverseRigid,
+    Octaves,
+    DiamondSquare,
+    Midpoint,
+    Upsample,
+    Spectral,
+    Constraint,
+    Stamps,
+    Biomes,
+    MaskLayers,
+    Remap,
+    Terracing,
+    Smooth,
+    Erosion,
+    Thermal,
+    Pipeline
+};
+
+//Layers that can be laid over the HeightMap through a mask
+enum class EMaskLayer
+{
+    Ridges,
+    Smooth,
+    Terraces
+};
+
+//Masks a layer can be laid through
+enum class EMaskType
+{
+    HeightBand,
+    Slope,
+    Painted,
+    Noise
+};
+
+//Settings of the fused generation pipeline, copied so the pipeline can be built away from the sliders
+struct PipelineSettings
+{
+    NoiseSettings noise;
+    int octaves = 5;
+    float amplitudeReduction = 0.33f;
+    float frequencyMultiplier = 1.5f;
+    float normaliseAmount = 2.0f;
+    float terracingMultiplier = 1.1f;
+    int smoothRadius = 2;
+    bool bRigid = true;
+    bool bSmooth = false;
+    bool bTerrace = false;
+};
+
+//Stages between the settings and the terrain on screen, timed and measured for the UI
+enum class ETerrainStage
+{
+    Generation,
+    Mesh,
+    Pyramid,
+    Foliage,
+    Count
+};
+
+//Time the last run of a stage took and the memory it holds
+struct TerrainStageStats
+{
+    float milliseconds = 0.0f;
+    size_t bytes = 0;
+};
 
 class TerrainGenerationScene :
     public BaseScene
@@ -12,11 +102,17 @@ class TerrainGenerationScene :
 // Construction / Usage	//
 //----------------------//
 public:
-	//The size of the HeightMap
-	const int SizeOfTerrain = 256;	
+	//Smallest and largest size of the HeightMap that can be chosen
+	static const int MinTerrainSize = 256;
+	static const int MaxTerrainSize = 8192;
+
+	//Most grid squares along each side of the terrain mesh, larger HeightMaps are shown with every few samples
+	//so the vertex buffer stays within what a single D3D11 buffer can hold
+	static const int MaxMeshSize = 1024;
 
-	//The Number of the vertices for the HeightMap
-	const int SizeOfTerrainVertices = 255;
+	//Most samples along each side of the preview made before a generation step runs on the whole HeightMap,
+	//so the preview takes the same few milliseconds however large the HeightMap is
+	static const int PreviewSize = 256;
 
 	//Function to setup all the geometry to be used in the scene
 	virtual bool InitGeometry(std::string& LastError) override;
@@ -51,37 +147,207 @@ private:
 	//Building the HeightMap
 	void BuildHeightMap(float height);
 
+	//Function to get the settings of the noise generators from the sliders, for a map reading every sampleStep samples
+	NoiseSettings GetNoiseSettings(int sampleStep = 1) const;
+
+	//Function to run a graph of terrain operators and write its output into the HeightMap, only over the region if one is given
+	void RunTerrainGraph(CTerrainGraph& graph, CTerrainGraph::NodeId output, const TerrainRegion* region = nullptr);
+
+	//Function to add the nodes of a generation step to a graph, returns the output node. A preview of the step
+	//reads every sampleStep samples of the HeightMap
+	CTerrainGraph::NodeId BuildGeneratorGraph(ETerrainGenerator generator, CTerrainGraph& graph, int sampleStep = 1);
+
+	//Check whether a generation step can make a preview, the modifiers need the whole HeightMap they start from
+	static bool HasPreview(ETerrainGenerator generator);
+
+	//Name of a generation step shown in the UI and the history
+	static const char* GeneratorName(ETerrainGenerator generator);
+
+	//Function to start a generation step in the background, superseding any step still running.
+	//Repeating the last step (when its sliders change) runs it again on the HeightMap it started from
+	void StartGeneration(ETerrainGenerator generator, bool bRepeat = false);
+
+	//Function to swap in the HeightMap of a background generation that has finished, and show its preview until then
+	void CollectGeneration();
+
+	//Function to show a preview of the HeightMap on the terrain mesh, the HeightMap itself is left as it is
+	void ShowPreview(const CHeightField& preview);
+
+	//Function to stop the background generation before the HeightMap is changed on this thread
+	void CancelGeneration();
+
 	//Function to build the height map with the Perlin Noise Algorithm
-	void BuildPerlinHeightMap(float amplitude, float frequency, bool bBrownianMotion);
+	CTerrainGraph::NodeId BuildPerlinHeightMap(CTerrainGraph& graph, int sampleStep = 1);
 	
 	//Perlin Noise with Octaves Function
-	void PerlinNoiseWithOctaves(float Amplitude, float frequency, int octaves);
-	
-	//Rigid Noise Function
-	void RigidNoise();
+	CTerrainGraph::NodeId PerlinNoiseWithOctaves(CTerrainGraph& graph, int sampleStep = 1);
 	
-	//Inverse Rigid Noise Function
-	void InverseRigidNoise();
+	//Rigid Noise Function, inverse rigid noise raises ridges instead of carving valleys
+	CTerrainGraph::NodeId RigidNoise(CTerrainGraph& graph, bool bInverse);
 	
-	//Function to call the Diamond Sqaure Algorithm
-	void DiamondSquareMap();
-	
-	//Terracing Function
-	void Terracing(float terracingMultiplier);
+	//Function to call the Diamond Sqaure Algorithm, a preview runs the coarse levels the full map then starts from
+	CTerrainGraph::NodeId DiamondSquareMap(CTerrainGraph& graph, int sampleStep = 1);
+
+	//Function to call the tiled Midpoint Displacement generator, with the same spread as Diamond Square
+	CTerrainGraph::NodeId MidpointDisplacementMap(CTerrainGraph& graph);
+
+	//Function to make the imported map finer with fractal detail, cut to the size of the HeightMap. Without an
+	//imported map every upsample factor-th sample of the HeightMap the step started from is kept and the rest remade
+	CTerrainGraph::NodeId UpsampleMap(CTerrainGraph& graph);
+
+	//Function to load a tiled heightfield file as the coarse map to upsample
+	void ImportMap();
+
+	//Function to shape white noise with a 1 / f^beta spectrum and turn it into a HeightMap with an inverse FFT
+	CTerrainGraph::NodeId SpectralMap(CTerrainGraph& graph);
+
+	//Function to fill in the HeightMap smoothly between the pinned heights, with Perlin octaves on top
+	CTerrainGraph::NodeId ConstraintMap(CTerrainGraph& graph, int sampleStep = 1);
+
+	//Function to get the pinned heights the constraint terrain starts with: a peak, a valley line and a flat town site
+	static std::vector<HeightConstraint> DefaultConstraints();
+
+	//Function to pin a height at the edit centre, over the edit radius or just the nearest samples
+	void AddConstraint(float radius);
+
+	//Function to scatter stamps of mountains, craters and mesas over the HeightMap the step started from
+	CTerrainGraph::NodeId StampMap(CTerrainGraph& graph);
+
+	//Function to make a terrain of biomes, each with a generator of its own, blended where the climate is between them
+	CTerrainGraph::NodeId BiomeMap(CTerrainGraph& graph, int sampleStep = 1);
+
+	//Function to get the biomes the biome map starts with: cold mountains, mild wet plains and hot dry mesas
+	static BiomeSettings DefaultBiomes();
+
+	//Function to lay a layer over the HeightMap the step started from through a mask, the layer is only made in
+	//the tiles the mask covers
+	CTerrainGraph::NodeId MaskLayerMap(CTerrainGraph& graph);
+
+	//Function to paint the mask at the edit centre over the edit radius, or rub it out
+	void PaintMask(bool bErase);
+
+	//Function to remap the heights of the HeightMap the step started from through a spline
+	CTerrainGraph::NodeId RemapMap(CTerrainGraph& graph);
+
+	//Function to write a midpoint displacement map of the export size to a tiled file, on a thread of its own
+	void StartMapExport();
+
+	//Function to write the whole imported map upsampled to the export path, on a thread of its own
+	void StartUpsampleExport();
 	
-	//Normalisation of the HeightMap
-	void NormaliseHeightMap(float normaliseAmount);
+	//Terracing Function, hard steps from rounding or smooth steps from a curve
+	CTerrainGraph::NodeId Terracing(CTerrainGraph& graph);
+
+	//Function to smooth the HeightMap with a box blur
+	CTerrainGraph::NodeId SmoothHeightMap(CTerrainGraph& graph);
+
+	//Function to run droplets of water over the HeightMap, wearing valleys into the slopes
+	CTerrainGraph::NodeId ErodeHeightMap(CTerrainGraph& graph);
+
+	//Function to let material slide down the slopes of the HeightMap that are steeper than the talus slope
+	CTerrainGraph::NodeId ThermalErodeHeightMap(CTerrainGraph& graph);
+
+	//Function to add every selected step of the generation to a graph, which runs them as one fused pass
+	CTerrainGraph::NodeId BuildPipelineHeightMap(CTerrainGraph& graph);
+
+	//Function to get the settings of the pipeline from the sliders
+	PipelineSettings GetPipelineSettings() const;
+
+	//Function to add the steps of a pipeline to a graph, only reads the settings given so it can run on any thread
+	static CTerrainGraph::NodeId BuildPipelineGraph(CTerrainGraph& graph, const PipelineSettings& settings);
+
+	//A streamed chunk of the infinite terrain, with its own mesh and plants
+	struct TerrainChunk
+	{
+		Mesh* mesh = nullptr;
+		Model* model = nullptr;
+		std::vector<Model*> plants;
+	};
+
+	//Function to start streaming chunks of the pipeline with the current settings, every chunk is built again
+	void ResetChunks();
+
+	//Function to release the chunks that have been retired and create the meshes of built chunks, within the frame budget
+	void UpdateChunks();
+
+	//Function to release the mesh, model and plants of a chunk
+	void ReleaseChunk(TerrainChunk& chunk);
+
+	//Function to stop streaming and release every chunk
+	void ReleaseAllChunks();
+
+	//Function to start the water simulation on the HeightMap as it is now
+	void StartWater();
+
+	//Function to stop the water simulation, leaving the eroded terrain without the water in the HeightMap
+	void StopWater();
+
+	//Function to run the steps of the water simulation for this frame and show the result
+	void UpdateWater();
+
+	//Function to get the square of the HeightMap chosen for local edits
+	TerrainRegion GetEditRegion() const;
+
+	//Function to raise (or lower with a negative height) a round hill in the edit region
+	void RaiseRegion(float height);
+
+	//Function to smooth the edit region only
+	void SmoothRegion();
 
 	//Function to update the position of every plant in the scene
 	void UpdateFoliagePosition();
 
+	//Function to move the plants standing on tiles of the HeightMap that have changed up or down to the new height
+	void UpdateFoliageHeights(const std::vector<int>& dirtyTiles);
+
+	//Function to update the terrain mesh, plants and height pyramid for the tiles of the HeightMap that have changed
+	void UpdateDirtyTiles();
+
+	//Function to change the size of the HeightMap, rebuilding the mesh, plants and height pyramid for it.
+	//The history and every generation step still running are dropped, as they are for the old size
+	void ResizeTerrain(int size);
+
+	//Function to set the budget of the cache of generated HeightMaps from the slider and the size of the HeightMap
+	void UpdateCacheBudget();
+
+	//Function to run a benchmark on a thread of its own so the frame keeps drawing, its results replace results
+	//once it finishes. Does nothing while another benchmark is running
+	void StartBenchmark(const std::string& label, std::vector<BenchmarkResult>& results, std::function<std::vector<BenchmarkResult>()> benchmark);
+
+	//Function to hand the results of the running benchmark to the UI once it has finished
+	void TakeBenchmarkResults();
+
+	//Number of HeightMap samples between neighbouring vertices of the terrain mesh
+	int MeshSampleStep() const { return TerrainSize > MaxMeshSize ? TerrainSize / MaxMeshSize : 1; }
+
+	//Number of grid squares along each side of the terrain mesh
+	int MeshSize() const { return TerrainSize / MeshSampleStep() - 1; }
+
+	//Number of HeightMap samples between neighbouring samples of a preview, 1 if the HeightMap is small enough not to need one
+	int PreviewStep() const { return TerrainSize > PreviewSize ? TerrainSize / PreviewSize : 1; }
+
 //-------------//
 // Member data //
 //-------------//
 private:
 
+	//Size of the HeightMap less one, a power of two so diamond-square can run on it (the HeightMap is 2^n + 1 samples)
+	int TerrainSize = 256;
+
 	//HeightMap
-	std::vector<std::vector<float>> HeightMap;
+	CHeightField HeightMap;
+
+	//Undo / redo history and A/B comparison slots of the HeightMap
+	CHeightFieldHistory History;
+
+	//Lowest and highest heights of each tile of the HeightMap
+	CMinMaxPyramid HeightPyramid;
+
+	//Number of HeightMap tiles changed by the last update
+	int LastDirtyTiles = 0;
+
+	//Time and memory of each stage of the last update
+	TerrainStageStats StageStats[static_cast<int>(ETerrainStage::Count)];
 	
 	//Original Position of the Camera
 	CVector3 CameraPosition{ 5500.55f, 7602.11f, -7040.85f };
@@ -103,11 +369,14 @@ private:
 	//Resolution of the HeightMap
 	int resolution = 500;
 
-	//Seed for the Perlin Noise Algorithm
+	//Seed for the Perlin Noise Algorithm, diamond-square and the plant positions
 	int seed = 0;
 
 	//Vector of plants in the scene
 	std::vector<Model*> PlantModels;
+
+	//HeightMap sample (x, z) under each plant
+	std::vector<std::pair<int, int>> PlantSamples;
 	
 	//Variables that control the number of plants in the scene
 	int plantResizeAmount = 2;
@@ -129,10 +398,184 @@ private:
 	//Amount to Terrace the terrain by
 	float terracingMultiplier = 1.1f;
 
+	//Smooth terraces step up by the terrace height, higher sharpness gives flatter steps and steeper risers
+	bool bSmoothTerraces = false;
+	float TerraceHeight = 10.0f;
+	float TerraceSharpness = 4.0f;
+
+	//Radius of the box blur used to smooth the terrain
+	int smoothRadius = 2;
+
+	//Settings of the hydraulic erosion, the droplets are shared between the passes
+	ErosionSettings Erosion;
+
+	//Settings of the thermal erosion
+	ThermalSettings ThermalErosion;
+
+	//Steps included in the fused generation pipeline
+	bool bPipelineRigid = true;
+	bool bPipelineSmooth = false;
+	bool bPipelineTerrace = false;
+
+	//Statistics of the last terrain graph that was run, and whether its result came from the cache instead
+	CTerrainGraph::ExecuteStats LastGraphStats;
+	bool bLastGraphCached = false;
+
+	//Byte budget of the cache of generated HeightMaps, in MB. The cache always gets room for at least
+	//MinCachedMaps HeightMaps of the current size, whatever the slider says
+	int GenerationCacheMB = 512;
+	static const int MinCachedMaps = 2;
+
+	//Runs the generation steps on a background thread
+	CBackgroundGenerator Generator;
+
+	//Last generation step started, rerun when its sliders change if bAutoRegenerate is set
+	ETerrainGenerator LastGenerator = ETerrainGenerator::None;
+	bool bAutoRegenerate = true;
+
+	//HeightMap the last generation step started from, modifiers read it rather than the HeightMap
+	//so rerunning them with new settings doesn't pile up on their last result
+	CHeightField GenerationBase;
+
+	//Whether the next finished generation gets an undo entry, repeats of the same step share one
+	bool bRecordGeneration = false;
+
+	//Whether generation steps show a coarse preview first, and whether the mesh is showing one instead of the HeightMap
+	bool bProgressivePreview = true;
+	bool bPreviewShown = false;
+
+	//Heights of the vertices of the terrain mesh worked out from the last preview
+	CHeightField PreviewMesh;
+
+	//Diamond-square levels made by the preview of the running step, which its full map starts from
+	std::shared_ptr<CHeightField> DiamondSquareLevels;
+
+	//Infinite terrain, chunks of the pipeline streamed around the camera instead of the single HeightMap patch
+	bool bInfiniteTerrain = false;
+	CChunkManager ChunkManager;
+	std::map<ChunkCoord, TerrainChunk> TerrainChunks;
+
+	//Chunks loaded on each side of the camera
+	int ChunkViewRadius = 4;
+
+	//Detail levels far chunks may drop, and the widest a quad may look on screen before its chunk is refined
+	int ChunkMaxLod = 3;
+	float ChunkLodPixels = 8.0f;
+
+	//Time each frame may spend creating chunk meshes, and the number created last frame
+	float ChunkUploadBudgetMs = 2.0f;
+	int ChunksUploadedLastFrame = 0;
+
+	//Water simulation run on the HeightMap a few steps every frame, the spring is placed at the edit centre
+	CWaterSimulation Water;
+	WaterSettings WaterParameters;
+	bool bWaterRunning = false;
+	bool bShowWater = true;
+	int WaterStepsPerFrame = 4;
+	float WaterMsPerStep = 0.0f;
+
+	//Centre, radius and height of local edits, in HeightMap samples
+	int EditCentreX = 128;
+	int EditCentreZ = 128;
+	float EditRadius = 24.0f;
+	float EditHeight = 20.0f;
+
 	//Spread used by the Diamond Square Algorithm
 	float Spread = 30.0;
 	float SpreadReduction = 2.0f;
 
+	//Whether midpoint displacement maps wrap so they tile
+	bool bMidpointWrap = false;
+
+	//Coarse map imported to be upsampled, and the settings of the upsampling. The seed is the Perlin noise seed
+	CHeightField ImportedMap;
+	char ImportPath[260] = "Coarse.thf";
+	std::string ImportMessage;
+	UpsampleSettings Upsample;
+
+	//Settings of spectral synthesis, the seed is the Perlin noise seed
+	SpectralSettings Spectral;
+
+	//Pinned heights of the constraint terrain. Positions and radii are parts of the map size, so they stay over
+	//the same part of the terrain when it is resized
+	std::vector<HeightConstraint> Constraints = DefaultConstraints();
+	ConstraintSettings ConstraintSolve;
+	float ConstraintNoise = 0.5f;
+
+	//Stamps scattered over the terrain. Radii are parts of the map size and the height of a stamp is its radius
+	//times the steepness, so the features keep their look at every terrain size. The seed is the Perlin noise seed
+	StampSettings Stamps;
+	float StampMinRadius = 0.005f;
+	float StampMaxRadius = 0.04f;
+	float StampSteepness = 1.0f;
+
+	//Biomes of the biome map in the order of DefaultBiomes, each can be left out. Mesas step up by the terrace
+	//height. The seed and scale are those of the Perlin noise
+	BiomeSettings Biomes = DefaultBiomes();
+	bool bBiomes[3] = { true, true, true };
+	float BiomeTerraceHeight = 10.0f;
+
+	//Layer laid over the HeightMap and the mask it is laid through. Height bands and slopes are of the HeightMap
+	//the step started from, slopes in height per sample. The noise mask covers the noise above the threshold
+	EMaskLayer MaskLayer = EMaskLayer::Ridges;
+	EMaskType MaskType = EMaskType::HeightBand;
+	float MaskBandLow = 40.0f;
+	float MaskBandHigh = 1000.0f;
+	float MaskBandFade = 10.0f;
+	float MaskSlopeFrom = 0.5f;
+	float MaskSlopeTo = 1.0f;
+	float MaskNoiseThreshold = 0.55f;
+
+	//Mask painted at the edit centre, the size of the HeightMap once painted
+	CHeightField PaintedMask;
+
+	//Spline the remap curve passes through, at evenly spaced heights from low to high. Each point is the part of
+	//the way from low to high its height is moved to
+	float RemapLow = 0.0f;
+	float RemapHigh = 100.0f;
+	float RemapCurve[5] = { 0.0f, 0.1f, 0.5f, 0.9f, 1.0f };
+
+	//Export of large midpoint displacement maps, which never have to fit in memory
+	std::thread ExportThread;
+	std::shared_ptr<CJobProgress> ExportProgress;
+	std::atomic<bool> bExportRunning{ false };
+	std::mutex ExportMutex;
+	std::string ExportMessage;
+	int ExportWidth = 32769;
+	int ExportHeight = 32769;
+	char ExportPath[260] = "Terrain.thf";
+
 	//Vector to scale the Terrain by
 	CVector3 TerrainYScale = { 10, 30, 10 };
+
+	//Pages used for new heightfield tiles (index into EPageMode)
+	int TilePageMode = 0;
+
+	//Results of the last page mode benchmark
+	std::vector<BenchmarkResult> PageBenchmarkResults;
+
+	//Results of the last diamond-square scaling benchmark
+	std::vector<BenchmarkResult> DiamondSquareBenchmarkResults;
+
+	//Results of the last thermal erosion benchmark
+	std::vector<BenchmarkResult> ThermalBenchmarkResults;
+
+	//Results of the last benchmark of the generators against each other
+	std::vector<BenchmarkResult> GeneratorBenchmarkResults;
+
+	//Results of the last benchmark of multigrid against plain relaxation for the constraint terrain
+	std::vector<BenchmarkResult> ConstraintBenchmarkResults;
+
+	//Results of the last benchmark of the stamps with each blend
+	std::vector<BenchmarkResult> StampBenchmarkResults;
+
+	//Results of the last benchmark of remapping with rounding and with curves
+	std::vector<BenchmarkResult> RemapBenchmarkResults;
+
+	//Benchmark running on a thread of its own, the results it replaces and its label. Declared after the results so
+	//it is destroyed (waiting for the benchmark) first
+	std::future<std::vector<BenchmarkResult>> RunningBenchmark;
+	std::vector<BenchmarkResult>* RunningBenchmarkResults = nullptr;
+	std::string RunningBenchmarkLabel;
+	std::string BenchmarkError;
 };
\ No newline at end of file
@@ -0,0 +1,37 @@
+//--------------------------------------------------------------------------------------
+// Progress and cancellation shared between a background job and the thread watching it
+//--------------------------------------------------------------------------------------
+// The job adds the amount of work it expects and completes it piece by piece, and checks
+// IsCancelled between pieces. Cancelling never interrupts the job, it stops at the next check.
+
+#pragma once
+#include "tepch.h"
+#include <atomic>
+
+class CJobProgress
+{
+public:
+	//Function to ask the job to stop at its next check
+	void Cancel() { m_Cancelled.store(true, std::memory_order_relaxed); }
+
+	//Check whether the job has been asked to stop
+	bool IsCancelled() const { return m_Cancelled.load(std::memory_order_relaxed); }
+
+	//Function to add work the job expects to do, in any unit as long as it matches CompleteWork
+	void AddWork(int64_t amount) { m_TotalWork.fetch_add(amount, std::memory_order_relaxed); }
+
+	//Function to mark part of the work as done
+	void CompleteWork(int64_t amount) { m_DoneWork.fetch_add(amount, std::memory_order_relaxed); }
+
+	//Fraction of the work done so far, between 0 and 1
+	float Progress() const
+	{
+		const int64_t total = m_TotalWork.load(std::memory_order_relaxed);
+		return total > 0 ? std::min(1.0f, static_cast<float>(m_DoneWork.load(std::memory_order_relaxed)) / total) : 0.0f;
+	}
+
+private:
+	std::atomic<bool> m_Cancelled{ false };
+	std::atomic<int64_t> m_TotalWork{ 0 };
+	std::atomic<int64_t> m_DoneWork{ 0 };
+};
@@ -76,10 +76,10 @@ void CResourceManager::loadMesh(const wchar_t* uniqueID, std::string &filename,
 }
 
 //Function to load a grid mesh into the meshMap
-void CResourceManager::loadGrid(const wchar_t* uniqueID, CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, std::vector<std::vector<float>>& HeightMap, bool normals, bool uvs)
+void CResourceManager::loadGrid(const wchar_t* uniqueID, CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, const CHeightField& HeightMap, bool normals, bool uvs, int sampleStep)
 {
 	//Create a new Grid Mesh
-	mesh = new Mesh(minPt, maxPt, subDivX, subDivZ, HeightMap, normals, uvs);
+	mesh = new Mesh(minPt, maxPt, subDivX, subDivZ, HeightMap, normals, uvs, sampleStep);
 
 	//Add the new mesh to the meshMap paired with the unique ID Created
 	meshMap.insert(std::make_pair(const_cast<wchar_t*>(uniqueID), mesh));
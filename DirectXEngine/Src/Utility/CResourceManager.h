@@ -25,7 +25,7 @@ public:
 	void loadMesh(const wchar_t* uniqueID, std::string &filename, bool requireTangents = false);
 
 	//Function to load a grid mesh into the meshMap
-	void CResourceManager::loadGrid(const wchar_t* uniqueID, CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, std::vector<std::vector<float>>& temp, bool normals = true, bool uvs = true);
+	void CResourceManager::loadGrid(const wchar_t* uniqueID, CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, const CHeightField& heightMap, bool normals = true, bool uvs = true, int sampleStep = 1);
 
 	//Function to return the Texture at the given ID in the textureMap
 	ID3D11ShaderResourceView* getTexture(const wchar_t* uid);
@@ -0,0 +1,184 @@
+#include "CThreadPool.h"
+#include "Utility/MemoryHelpers.h"
+
+//Index of the worker running the current thread
+static thread_local int tWorkerIndex = -1;
+
+//Whether the current thread waits for the pool when another thread is using it
+static thread_local bool tWaitWhenBusy = false;
+
+//Constructor, 0 threads uses one worker per hardware thread but one, which is left for the render thread
+CThreadPool::CThreadPool(int numThreads)
+{
+	if (numThreads <= 0)
+	{
+		numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+	}
+
+	for (int worker = 0; worker < numThreads; ++worker)
+	{
+		m_Workers.emplace_back(&CThreadPool::WorkerLoop, this, worker);
+	}
+}
+
+//Destructor, waits for the workers to finish
+CThreadPool::~CThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_WakeWorkers.notify_all();
+
+	for (std::thread& worker : m_Workers)
+	{
+		worker.join();
+	}
+}
+
+//Function to run func(begin, end) over [0, count), one contiguous part per worker. Blocks until done, then
+//throws the first exception func threw
+void CThreadPool::ParallelFor(int count, const std::function<void(int begin, int end)>& func)
+{
+	if (count <= 0) return;
+
+	//Nested calls and single items run on the calling thread
+	if (WorkerIndex() >= 0 || count == 1 || NumThreads() == 1)
+	{
+		func(0, count);
+		return;
+	}
+
+	Run([&](int worker)
+	{
+		int begin = PartBegin(count, worker);
+		int end = PartBegin(count, worker + 1);
+		if (begin < end) func(begin, end);
+	});
+}
+
+//Function to run func(index) for every index in [0, count), handing indices to free workers. Blocks until done,
+//then throws the first exception func threw
+void CThreadPool::ParallelForDynamic(int count, const std::function<void(int index)>& func)
+{
+	if (count <= 0) return;
+
+	if (WorkerIndex() >= 0 || count == 1 || NumThreads() == 1)
+	{
+		for (int index = 0; index < count; ++index) func(index);
+		return;
+	}
+
+	std::atomic<int> next{ 0 };
+	Run([&](int)
+	{
+		for (int index = next.fetch_add(1); index < count; index = next.fetch_add(1))
+		{
+			func(index);
+		}
+	});
+}
+
+//Worker that ParallelFor gives an index to
+int CThreadPool::PartOwner(int count, int index) const
+{
+	int worker = static_cast<int>(static_cast<int64_t>(index) * NumThreads() / count);
+	while (worker > 0 && PartBegin(count, worker) > index) --worker;
+	while (worker + 1 < NumThreads() && PartBegin(count, worker + 1) <= index) ++worker;
+	return worker;
+}
+
+//Index of the worker running the calling thread, -1 if called from outside the pool
+int CThreadPool::WorkerIndex()
+{
+	return tWorkerIndex;
+}
+
+//Pool shared by the whole engine
+CThreadPool& CThreadPool::Global()
+{
+	static CThreadPool pool;
+	return pool;
+}
+
+//Function to choose whether calls from the calling thread wait for the pool when another thread
+//is using it (background jobs) or run on the calling thread straight away (the default)
+void CThreadPool::SetWaitWhenBusy(bool bWait)
+{
+	tWaitWhenBusy = bWait;
+}
+
+//Function run by every worker thread
+void CThreadPool::WorkerLoop(int worker)
+{
+	tWorkerIndex = worker;
+
+	//Spread the workers evenly over the NUMA nodes so each part of a ParallelFor stays on one node
+	int nodes = NumaNodeCount();
+	if (nodes > 1)
+	{
+		BindThreadToNumaNode(static_cast<int>(static_cast<int64_t>(worker) * nodes / NumThreads()));
+	}
+
+	uint64_t lastJob = 0;
+	while (true)
+	{
+		const std::function<void(int)>* job = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WakeWorkers.wait(lock, [&]() { return m_Stop || m_JobNumber != lastJob; });
+			if (m_Stop) return;
+
+			lastJob = m_JobNumber;
+			job = m_Job;
+		}
+
+		//An exception can't leave the thread, it's handed to the caller of Run instead. Only the first is kept
+		std::exception_ptr error;
+		try
+		{
+			(*job)(worker);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (error && !m_JobError) m_JobError = error;
+			if (--m_WorkersRunning == 0) m_JobFinished.notify_all();
+		}
+	}
+}
+
+//Function to run job(worker) once on every worker and wait for all of them, then throw the first exception a
+//worker caught
+void CThreadPool::Run(const std::function<void(int worker)>& job)
+{
+	std::unique_lock<std::mutex> runLock(m_RunMutex, std::defer_lock);
+	if (tWaitWhenBusy)
+	{
+		runLock.lock();
+	}
+	else if (!runLock.try_lock())
+	{
+		//Another thread has the workers, do every part here rather than wait for it to finish
+		for (int worker = 0; worker < NumThreads(); ++worker) job(worker);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Job = &job;
+	m_WorkersRunning = NumThreads();
+	++m_JobNumber;
+	m_WakeWorkers.notify_all();
+
+	m_JobFinished.wait(lock, [&]() { return m_WorkersRunning == 0; });
+	m_Job = nullptr;
+
+	//Thrown once every worker is done with the job, as it refers to the caller's stack
+	std::exception_ptr error;
+	error.swap(m_JobError);
+	if (error) std::rethrow_exception(error);
+}
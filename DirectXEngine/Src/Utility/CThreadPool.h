@@ -0,0 +1,96 @@
+//--------------------------------------------------------------------------------------
+// Pool of worker threads used to run terrain kernels across every core
+//--------------------------------------------------------------------------------------
+// ParallelFor splits a range into one contiguous part per worker and always gives the same
+// part to the same worker, so memory first touched by a worker keeps being processed by it
+// (and stays on its NUMA node). ParallelForDynamic hands out single indices to whichever
+// worker is free, for work where the cost of each index varies.
+// Calls made from inside a worker run on the calling thread, so kernels can be nested.
+// An exception thrown by a kernel on a worker is thrown again on the calling thread once
+// every worker has finished (the first one, if several throw).
+// Calls made while another thread is using the pool also run on the calling thread, so the
+// render thread never stalls behind a background job. The price is that the render thread's own
+// kernels (height pyramid, water) run single threaded while a generation or benchmark holds the
+// pool. Background threads that would rather wait for the workers call SetWaitWhenBusy.
+
+#pragma once
+#include "tepch.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class CThreadPool
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Constructor, 0 threads uses one worker per hardware thread but one, which is left for the render thread
+	CThreadPool(int numThreads = 0);
+
+	//Destructor, waits for the workers to finish
+	~CThreadPool();
+
+	CThreadPool(const CThreadPool&) = delete;
+	CThreadPool& operator=(const CThreadPool&) = delete;
+
+	//Number of worker threads
+	int NumThreads() const { return static_cast<int>(m_Workers.size()); }
+
+	//Function to run func(begin, end) over [0, count), one contiguous part per worker. Blocks until done, then
+	//throws the first exception func threw
+	void ParallelFor(int count, const std::function<void(int begin, int end)>& func);
+
+	//Function to run func(index) for every index in [0, count), handing indices to free workers. Blocks until done,
+	//then throws the first exception func threw
+	void ParallelForDynamic(int count, const std::function<void(int index)>& func);
+
+	//First index of the part of [0, count) given to a worker by ParallelFor
+	int PartBegin(int count, int worker) const { return static_cast<int>(static_cast<int64_t>(count) * worker / NumThreads()); }
+
+	//Worker that ParallelFor gives an index to
+	int PartOwner(int count, int index) const;
+
+	//Index of the worker running the calling thread, -1 if called from outside the pool
+	static int WorkerIndex();
+
+	//Pool shared by the whole engine
+	static CThreadPool& Global();
+
+	//Function to choose whether calls from the calling thread wait for the pool when another thread
+	//is using it (background jobs) or run on the calling thread straight away (the default)
+	static void SetWaitWhenBusy(bool bWait);
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Function run by every worker thread
+	void WorkerLoop(int worker);
+
+	//Function to run job(worker) once on every worker and wait for all of them, then throw the first exception a
+	//worker caught
+	void Run(const std::function<void(int worker)>& job);
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	std::vector<std::thread> m_Workers;
+
+	//Only one job runs at a time, callers that wait when busy wait here
+	std::mutex m_RunMutex;
+
+	//State shared with the workers, guarded by m_Mutex
+	std::mutex m_Mutex;
+	std::condition_variable m_WakeWorkers;
+	std::condition_variable m_JobFinished;
+	const std::function<void(int)>* m_Job = nullptr;
+	uint64_t m_JobNumber = 0;
+	int m_WorkersRunning = 0;
+	std::exception_ptr m_JobError;
+	bool m_Stop = false;
+};
@@ -0,0 +1,284 @@
+#include "CTileAllocator.h"
+
+//Free list of one thread for one allocator
+struct CTileAllocator::ThreadCache
+{
+	uint32_t   allocatorId = 0;
+	int        node = 0;
+	FreeBlock* head = nullptr;
+	size_t     count = 0;
+};
+
+//Every free list owned by a thread, handed back to the allocators when the thread exits
+struct CTileAllocator::ThreadCacheList
+{
+	std::vector<ThreadCache> caches;
+
+	//Number of allocators destroyed when the list was last pruned
+	uint32_t destroyedSeen = 0;
+
+	~ThreadCacheList();
+};
+
+//Registry of live allocators, used so exiting threads only return blocks to allocators that still exist
+//Never destroyed, as threads can exit after static destructors have run
+static std::mutex& RegistryMutex()
+{
+	static std::mutex* mutex = new std::mutex;
+	return *mutex;
+}
+
+static std::map<uint32_t, CTileAllocator*>& Registry()
+{
+	static std::map<uint32_t, CTileAllocator*>* registry = new std::map<uint32_t, CTileAllocator*>;
+	return *registry;
+}
+
+//Ids are never reused so a stale thread cache can never be mistaken for a new allocator
+static std::atomic<uint32_t> gNextAllocatorId{ 1 };
+
+//Number of allocators destroyed so far, threads prune the caches of destroyed allocators when it changes
+static std::atomic<uint32_t> gDestroyedAllocators{ 0 };
+
+//Constructor, the block size is rounded up to a multiple of the alignment
+CTileAllocator::CTileAllocator(size_t blockSize, size_t slabBytes)
+{
+	blockSize = std::max(blockSize, sizeof(FreeBlock));
+	m_BlockSize = (blockSize + BlockAlignment - 1) & ~(BlockAlignment - 1);
+	m_SlabBytes = std::max(slabBytes, m_BlockSize);
+	m_BlocksPerSlab = m_SlabBytes / m_BlockSize;
+	m_BatchSize = std::max<size_t>(1, std::min<size_t>(32, m_BlocksPerSlab / 4));
+	m_Id = gNextAllocatorId.fetch_add(1);
+	m_SharedFree.resize(NumaNodeCount(), nullptr);
+
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+	Registry()[m_Id] = this;
+}
+
+//Destructor, releases every slab back to the system
+CTileAllocator::~CTileAllocator()
+{
+	{
+		std::lock_guard<std::mutex> lock(RegistryMutex());
+		Registry().erase(m_Id);
+	}
+	gDestroyedAllocators.fetch_add(1, std::memory_order_release);
+
+	for (const Slab& slab : m_Slabs)
+	{
+		FreePages(slab.memory, m_SlabBytes);
+	}
+	m_Slabs.clear();
+	m_SlabNodes.clear();
+	std::fill(m_SharedFree.begin(), m_SharedFree.end(), nullptr);
+}
+
+//Function to get a block, the contents are uninitialised
+void* CTileAllocator::Allocate()
+{
+	ThreadCache& cache = LocalCache();
+	if (cache.head == nullptr)
+	{
+		Refill(cache);
+	}
+
+	FreeBlock* block = cache.head;
+	cache.head = block->next;
+	--cache.count;
+
+	TrackAllocation();
+	return block;
+}
+
+//Function to return a block that was given out by this allocator
+void CTileAllocator::Free(void* block)
+{
+	if (block == nullptr) return;
+
+	ThreadCache& cache = LocalCache();
+	FreeBlock* node = static_cast<FreeBlock*>(block);
+	node->next = cache.head;
+	cache.head = node;
+	++cache.count;
+
+	TrackFree();
+
+	//Stop one thread hoarding blocks that another thread is freeing into
+	if (cache.count > 2 * m_BatchSize)
+	{
+		Drain(cache, m_BatchSize);
+	}
+}
+
+//Bytes reserved from the system for slabs
+size_t CTileAllocator::ReservedBytes()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Slabs.size() * m_SlabBytes;
+}
+
+//Number of slabs that are backed by huge pages
+size_t CTileAllocator::HugePageSlabs()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return std::count_if(m_Slabs.begin(), m_Slabs.end(), [](const Slab& slab) { return slab.hugePages; });
+}
+
+//Function to get the allocator shared by every user of blocks of this size (after rounding)
+CTileAllocator& CTileAllocator::Shared(size_t blockSize)
+{
+	//Like the registry these are never destroyed, as blocks can be freed after static destructors have run
+	static std::mutex* mutex = new std::mutex;
+	static std::map<size_t, CTileAllocator*>* allocators = new std::map<size_t, CTileAllocator*>;
+
+	blockSize = (std::max(blockSize, sizeof(FreeBlock)) + BlockAlignment - 1) & ~(BlockAlignment - 1);
+	std::lock_guard<std::mutex> lock(*mutex);
+	CTileAllocator*& allocator = (*allocators)[blockSize];
+	if (allocator == nullptr)
+	{
+		allocator = new CTileAllocator(blockSize);
+	}
+	return *allocator;
+}
+
+//Get the free list of the calling thread for this allocator
+CTileAllocator::ThreadCache& CTileAllocator::LocalCache()
+{
+	thread_local ThreadCacheList threadCaches;
+
+	//The blocks cached for a destroyed allocator went with its slabs, so its entries are dropped rather than drained
+	const uint32_t destroyed = gDestroyedAllocators.load(std::memory_order_acquire);
+	if (destroyed != threadCaches.destroyedSeen)
+	{
+		threadCaches.destroyedSeen = destroyed;
+		std::lock_guard<std::mutex> lock(RegistryMutex());
+		threadCaches.caches.erase(std::remove_if(threadCaches.caches.begin(), threadCaches.caches.end(),
+			[](const ThreadCache& cache) { return Registry().count(cache.allocatorId) == 0; }), threadCaches.caches.end());
+	}
+
+	for (ThreadCache& cache : threadCaches.caches)
+	{
+		if (cache.allocatorId == m_Id) return cache;
+	}
+
+	threadCaches.caches.push_back(ThreadCache());
+	threadCaches.caches.back().allocatorId = m_Id;
+	threadCaches.caches.back().node = std::min(CurrentNumaNode(), static_cast<int>(m_SharedFree.size()) - 1);
+	return threadCaches.caches.back();
+}
+
+//Move up to a batch of blocks from the shared free list of the cache's node into the cache, creating a new slab if required
+void CTileAllocator::Refill(ThreadCache& cache)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	FreeBlock*& sharedFree = m_SharedFree[cache.node];
+	if (sharedFree == nullptr)
+	{
+		AddSlab(cache.node);
+	}
+
+	for (size_t i = 0; i < m_BatchSize && sharedFree != nullptr; ++i)
+	{
+		FreeBlock* block = sharedFree;
+		sharedFree = block->next;
+		block->next = cache.head;
+		cache.head = block;
+		++cache.count;
+	}
+}
+
+//Move blocks from a thread cache back to the shared free lists of the nodes they came from
+void CTileAllocator::Drain(ThreadCache& cache, size_t count)
+{
+	if (count == 0 || cache.head == nullptr) return;
+
+	//Detach the first blocks of the cache as a chain
+	FreeBlock* first = cache.head;
+	FreeBlock* last = first;
+	size_t moved = 1;
+	while (moved < count && last->next != nullptr)
+	{
+		last = last->next;
+		++moved;
+	}
+	cache.head = last->next;
+	cache.count -= moved;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_SharedFree.size() == 1)
+	{
+		last->next = m_SharedFree[0];
+		m_SharedFree[0] = first;
+		return;
+	}
+
+	//Blocks freed by a thread on another node go back to the node their slab lives on
+	last->next = nullptr;
+	while (first != nullptr)
+	{
+		FreeBlock* next = first->next;
+		FreeBlock*& sharedFree = m_SharedFree[NodeOfBlock(first)];
+		first->next = sharedFree;
+		sharedFree = first;
+		first = next;
+	}
+}
+
+//Reserve a new slab on a node and push all of its blocks on to that node's free list (mutex must be held)
+void CTileAllocator::AddSlab(int node)
+{
+	bool hugePages = false;
+	char* slab = static_cast<char*>(AllocatePages(m_SlabBytes, m_PageMode.load(), m_SharedFree.size() > 1 ? node : -1, &hugePages));
+	if (slab == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	m_Slabs.push_back({ slab, node, hugePages });
+	m_SlabNodes[reinterpret_cast<uintptr_t>(slab)] = node;
+
+	//Push in reverse so blocks are handed out in address order
+	FreeBlock*& sharedFree = m_SharedFree[node];
+	for (size_t i = m_BlocksPerSlab; i-- > 0;)
+	{
+		FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * m_BlockSize);
+		block->next = sharedFree;
+		sharedFree = block;
+	}
+}
+
+//Get the node of the slab a block belongs to (mutex must be held)
+int CTileAllocator::NodeOfBlock(const void* block) const
+{
+	auto slab = m_SlabNodes.upper_bound(reinterpret_cast<uintptr_t>(block));
+	return slab == m_SlabNodes.begin() ? 0 : std::prev(slab)->second;
+}
+
+//Update the in-use counters after a block is handed out
+void CTileAllocator::TrackAllocation()
+{
+	size_t inUse = m_BlocksInUse.fetch_add(1, std::memory_order_relaxed) + 1;
+	size_t highWater = m_HighWaterBlocks.load(std::memory_order_relaxed);
+	while (inUse > highWater && !m_HighWaterBlocks.compare_exchange_weak(highWater, inUse, std::memory_order_relaxed))
+	{
+	}
+}
+
+//Update the in-use counters after a block is returned
+void CTileAllocator::TrackFree()
+{
+	m_BlocksInUse.fetch_sub(1, std::memory_order_relaxed);
+}
+
+//Hand any cached blocks back to allocators that are still alive when a thread exits
+CTileAllocator::ThreadCacheList::~ThreadCacheList()
+{
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+	for (ThreadCache& cache : caches)
+	{
+		auto it = Registry().find(cache.allocatorId);
+		if (it != Registry().end())
+		{
+			it->second->Drain(cache, cache.count);
+		}
+	}
+}
@@ -0,0 +1,202 @@
+//--------------------------------------------------------------------------------------
+// Fixed size block allocator used for terrain tiles
+//--------------------------------------------------------------------------------------
+// Every block handed out is the same size and aligned to a cache line. Blocks are carved
+// out of large slabs that are never returned to the heap while the allocator is alive,
+// so generating, streaming and caching tiles does not fragment the general heap.
+// Each thread keeps a small free list of its own so most allocations never take a lock.
+//
+// Heightfield tiles have an allocator of their own. Other buffers that are made and thrown
+// away again and again at a few fixed sizes (the meshes of streamed chunks) take a
+// CTileArray from the shared allocator of their size.
+//
+// Slabs can be backed by huge pages to cut TLB misses on large heightfields. On machines
+// with several NUMA nodes every node has its own shared free list and slabs are placed on
+// the node of the thread that needs them, so tiles stay local to the worker that owns them.
+
+#pragma once
+#include "tepch.h"
+#include "Utility/MemoryHelpers.h"
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+
+class CTileAllocator
+{
+//----------------------//
+// Construction / Usage	//
+//----------------------//
+public:
+	//Alignment of every block that is handed out (one cache line)
+	static const size_t BlockAlignment = 64;
+
+	//Default size of a slab, blocks are carved out of slabs of this size
+	static const size_t DefaultSlabBytes = 2 * 1024 * 1024;
+
+	//Constructor, the block size is rounded up to a multiple of the alignment
+	CTileAllocator(size_t blockSize, size_t slabBytes = DefaultSlabBytes);
+
+	//Destructor, releases every slab back to the system
+	~CTileAllocator();
+
+	CTileAllocator(const CTileAllocator&) = delete;
+	CTileAllocator& operator=(const CTileAllocator&) = delete;
+
+	//Function to get a block, the contents are uninitialised
+	void* Allocate();
+
+	//Function to return a block that was given out by this allocator
+	void Free(void* block);
+
+	//Size in bytes of every block this allocator hands out
+	size_t BlockSize() const { return m_BlockSize; }
+
+	//Number of blocks currently handed out
+	size_t BlocksInUse() const { return m_BlocksInUse.load(std::memory_order_relaxed); }
+
+	//Largest number of blocks that have been handed out at the same time
+	size_t HighWaterBlocks() const { return m_HighWaterBlocks.load(std::memory_order_relaxed); }
+
+	//Bytes reserved from the system for slabs
+	size_t ReservedBytes();
+
+	//Function to choose the pages used for slabs reserved from now on
+	void SetPageMode(EPageMode mode) { m_PageMode.store(mode); }
+	EPageMode PageMode() const { return m_PageMode.load(); }
+
+	//Number of slabs that are backed by huge pages
+	size_t HugePageSlabs();
+
+	//Function to get the allocator shared by every user of blocks of this size (after rounding). These allocators
+	//are never destroyed, so blocks from them can outlive any owner
+	static CTileAllocator& Shared(size_t blockSize);
+
+//--------------------------//
+// Private helper functions	//
+//--------------------------//
+private:
+	//Intrusive free list node stored inside a free block
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	//Per-thread free list, and the list of them owned by each thread
+	struct ThreadCache;
+	struct ThreadCacheList;
+
+	//Get the free list of the calling thread for this allocator
+	ThreadCache& LocalCache();
+
+	//Move up to a batch of blocks from the shared free list of the cache's node into the cache, creating a new slab if required
+	void Refill(ThreadCache& cache);
+
+	//Move blocks from a thread cache back to the shared free lists of the nodes they came from
+	void Drain(ThreadCache& cache, size_t count);
+
+	//Reserve a new slab on a node and push all of its blocks on to that node's free list (mutex must be held)
+	//Writing the free list touches every block from the calling thread, which places the pages on its node
+	void AddSlab(int node);
+
+	//Get the node of the slab a block belongs to (mutex must be held)
+	int NodeOfBlock(const void* block) const;
+
+	//Update the in-use counters after blocks are handed out or returned
+	void TrackAllocation();
+	void TrackFree();
+
+//-------------//
+// Member data //
+//-------------//
+private:
+	//Size of each block and the number of blocks that fit in one slab
+	size_t m_BlockSize = 0;
+	size_t m_SlabBytes = 0;
+	size_t m_BlocksPerSlab = 0;
+
+	//Number of blocks moved between a thread cache and the shared list at once
+	size_t m_BatchSize = 0;
+
+	//Unique id used by the thread caches to tell allocators apart
+	uint32_t m_Id = 0;
+
+	//Pages used for new slabs
+	std::atomic<EPageMode> m_PageMode{ EPageMode::Normal };
+
+	//A slab and where it lives
+	struct Slab
+	{
+		void* memory;
+		int   node;
+		bool  hugePages;
+	};
+
+	//Shared free list of each NUMA node and the slabs they are built from, all guarded by the mutex
+	std::mutex m_Mutex;
+	std::vector<FreeBlock*> m_SharedFree;
+	std::vector<Slab> m_Slabs;
+	std::map<uintptr_t, int> m_SlabNodes;
+
+	//Usage statistics
+	std::atomic<size_t> m_BlocksInUse{ 0 };
+	std::atomic<size_t> m_HighWaterBlocks{ 0 };
+};
+
+
+//Fixed number of values in one block of a tile allocator, the block is returned when the array is destroyed
+template<typename T>
+class CTileArray
+{
+	static_assert(std::is_trivially_destructible<T>::value, "Values are never destroyed, only their block is freed");
+
+public:
+	CTileArray() {}
+
+	//Constructor, takes a block of the shared allocator of this size. The values are uninitialised
+	explicit CTileArray(size_t count) : m_Count(count)
+	{
+		if (count == 0) return;
+		m_Allocator = &CTileAllocator::Shared(count * sizeof(T));
+		m_Values = static_cast<T*>(m_Allocator->Allocate());
+	}
+
+	CTileArray(CTileArray&& other) noexcept { Swap(other); }
+	CTileArray& operator=(CTileArray&& other) noexcept
+	{
+		CTileArray moved(std::move(other));
+		Swap(moved);
+		return *this;
+	}
+
+	~CTileArray()
+	{
+		if (m_Values) m_Allocator->Free(m_Values);
+	}
+
+	CTileArray(const CTileArray&) = delete;
+	CTileArray& operator=(const CTileArray&) = delete;
+
+	T* data() { return m_Values; }
+	const T* data() const { return m_Values; }
+	size_t size() const { return m_Count; }
+
+	T& operator[](size_t index) { return m_Values[index]; }
+	const T& operator[](size_t index) const { return m_Values[index]; }
+
+	T* begin() { return m_Values; }
+	T* end() { return m_Values + m_Count; }
+	const T* begin() const { return m_Values; }
+	const T* end() const { return m_Values + m_Count; }
+
+private:
+	void Swap(CTileArray& other)
+	{
+		std::swap(m_Allocator, other.m_Allocator);
+		std::swap(m_Values, other.m_Values);
+		std::swap(m_Count, other.m_Count);
+	}
+
+	CTileAllocator* m_Allocator = nullptr;
+	T* m_Values = nullptr;
+	size_t m_Count = 0;
+};
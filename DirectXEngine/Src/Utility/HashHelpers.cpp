@@ -0,0 +1,30 @@
+#include "HashHelpers.h"
+
+//Function to hash a block of memory, starting from the seed given
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = HashCombine(seed, static_cast<uint64_t>(size));
+
+	//Eight bytes at a time, then whatever is left over
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		std::memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ HashMix(word)) * 0x9E3779B97F4A7C15ull;
+	}
+
+	uint64_t tail = 0;
+	for (int shift = 0; i < size; ++i, shift += 8)
+	{
+		tail |= static_cast<uint64_t>(bytes[i]) << shift;
+	}
+	return HashMix(hash ^ HashMix(tail));
+}
+
+//Function to hash a null terminated string, starting from the seed given
+uint64_t HashString(const char* text, uint64_t seed)
+{
+	return HashBytes(text, std::strlen(text), seed);
+}
@@ -0,0 +1,45 @@
+//--------------------------------------------------------------------------------------
+// Helper functions for stable 64 bit hashes
+//--------------------------------------------------------------------------------------
+// Hashes made with these functions only depend on the values hashed, never on addresses or
+// the order things were allocated in, so the same values give the same hash on every run.
+
+#pragma once
+#include "tepch.h"
+#include <cstring>
+
+//Function to scramble a 64 bit value so every input bit affects every output bit (splitmix64 finaliser)
+inline uint64_t HashMix(uint64_t value)
+{
+	value ^= value >> 30;
+	value *= 0xBF58476D1CE4E5B9ull;
+	value ^= value >> 27;
+	value *= 0x94D049BB133111EBull;
+	value ^= value >> 31;
+	return value;
+}
+
+//Function to add a value to a running hash, the order values are added in matters
+inline uint64_t HashCombine(uint64_t hash, uint64_t value)
+{
+	return HashMix(hash ^ (HashMix(value) + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2)));
+}
+
+//Function to add a float to a running hash by its bits, with -0 treated as 0
+inline uint64_t HashCombine(uint64_t hash, float value)
+{
+	if (value == 0.0f) value = 0.0f;
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return HashCombine(hash, static_cast<uint64_t>(bits));
+}
+
+inline uint64_t HashCombine(uint64_t hash, int value) { return HashCombine(hash, static_cast<uint64_t>(static_cast<int64_t>(value))); }
+inline uint64_t HashCombine(uint64_t hash, unsigned int value) { return HashCombine(hash, static_cast<uint64_t>(value)); }
+inline uint64_t HashCombine(uint64_t hash, bool value) { return HashCombine(hash, static_cast<uint64_t>(value ? 1 : 0)); }
+
+//Function to hash a block of memory, starting from the seed given
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+//Function to hash a null terminated string, starting from the seed given
+uint64_t HashString(const char* text, uint64_t seed = 0);
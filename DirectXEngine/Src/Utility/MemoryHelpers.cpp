@@ -0,0 +1,290 @@
+#include "MemoryHelpers.h"
+
+#if defined(DXE_PLATFORM_WINDOWS) || defined(_WIN32)
+#define DXE_PAGES_WINDOWS
+#elif defined(__linux__)
+#define DXE_PAGES_LINUX
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#if defined(DXE_PAGES_WINDOWS)
+
+//Round a size up to a multiple of another
+static size_t RoundUp(size_t value, size_t multiple)
+{
+	return multiple == 0 ? value : (value + multiple - 1) / multiple * multiple;
+}
+
+//Large pages need the "Lock pages in memory" privilege to be enabled on the process token, try once
+static bool EnableLockMemoryPrivilege()
+{
+	static const bool enabled = []()
+	{
+		HANDLE token = nullptr;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+
+		TOKEN_PRIVILEGES privileges = {};
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+		bool result = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+					  AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+					  GetLastError() == ERROR_SUCCESS;
+		CloseHandle(token);
+		return result;
+	}();
+	return enabled;
+}
+
+//Function to reserve and commit memory, placed on the NUMA node given (-1 for no preference)
+void* AllocatePages(size_t bytes, EPageMode mode, int numaNode, bool* usedHugePages)
+{
+	if (usedHugePages) *usedHugePages = false;
+
+	//Windows has no transparent huge pages, both huge modes ask for large pages
+	size_t largePage = HugePageSize();
+	if (mode != EPageMode::Normal && largePage != 0 && EnableLockMemoryPrivilege())
+	{
+		DWORD flags = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+		size_t size = RoundUp(bytes, largePage);
+		void* memory = (numaNode >= 0 && NumaNodeCount() > 1)
+			? VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, flags, PAGE_READWRITE, static_cast<DWORD>(numaNode))
+			: VirtualAlloc(nullptr, size, flags, PAGE_READWRITE);
+		if (memory != nullptr)
+		{
+			if (usedHugePages) *usedHugePages = true;
+			return memory;
+		}
+	}
+
+	DWORD flags = MEM_RESERVE | MEM_COMMIT;
+	if (numaNode >= 0 && NumaNodeCount() > 1)
+	{
+		return VirtualAllocExNuma(GetCurrentProcess(), nullptr, bytes, flags, PAGE_READWRITE, static_cast<DWORD>(numaNode));
+	}
+	return VirtualAlloc(nullptr, bytes, flags, PAGE_READWRITE);
+}
+
+//Function to release memory returned by AllocatePages
+void FreePages(void* memory, size_t bytes)
+{
+	if (memory) VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+//Size of a huge page in bytes, 0 if the platform does not support them
+size_t HugePageSize()
+{
+	static const size_t size = GetLargePageMinimum();
+	return size;
+}
+
+//Number of NUMA nodes in the machine, 1 on machines without NUMA
+int NumaNodeCount()
+{
+	static const int count = []()
+	{
+		ULONG highestNode = 0;
+		return GetNumaHighestNodeNumber(&highestNode) ? static_cast<int>(highestNode) + 1 : 1;
+	}();
+	return count;
+}
+
+//NUMA node of the processor running the calling thread
+int CurrentNumaNode()
+{
+	PROCESSOR_NUMBER processor;
+	GetCurrentProcessorNumberEx(&processor);
+	USHORT node = 0;
+	return GetNumaProcessorNodeEx(&processor, &node) ? node : 0;
+}
+
+//Function to restrict the calling thread to the processors of a NUMA node, returns false on failure
+bool BindThreadToNumaNode(int node)
+{
+	GROUP_AFFINITY affinity = {};
+	if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity)) return false;
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+#elif defined(DXE_PAGES_LINUX)
+
+//mbind is not wrapped by glibc, these match the values in linux/mempolicy.h
+static const int MemPolicyPreferred = 1;
+
+//Read the list of processors of a NUMA node, in the "0-3,8-11" format used by sysfs
+static std::vector<int> NumaNodeCpus(int node)
+{
+	std::vector<int> cpus;
+	std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+	std::string range;
+	while (std::getline(file, range, ','))
+	{
+		int first = 0, last = 0;
+		size_t dash = range.find('-');
+		first = std::stoi(range.substr(0, dash));
+		last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+//Whether transparent huge pages are turned on for memory that asks for them, they are off when the system
+//setting is "never"
+static bool TransparentHugePagesEnabled()
+{
+	static const bool enabled = []()
+	{
+		std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+		std::string setting;
+		return std::getline(file, setting) && setting.find("[never]") == std::string::npos;
+	}();
+	return enabled;
+}
+
+//Function to map memory starting on a huge page boundary, as the kernel only backs whole aligned huge pages
+//with them. A huge page more is mapped, then the part before the boundary and after the end are unmapped
+static void* MapAlignedToHugePage(size_t bytes, int protection, int flags)
+{
+	const size_t hugePage = HugePageSize();
+	const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t mappedBytes = (bytes + pageSize - 1) / pageSize * pageSize;
+	char* mapping = static_cast<char*>(mmap(nullptr, mappedBytes + hugePage, protection, flags, -1, 0));
+	if (mapping == MAP_FAILED) return MAP_FAILED;
+
+	char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(mapping) + hugePage - 1) / hugePage * hugePage);
+	const size_t head = aligned - mapping;
+	if (head > 0) munmap(mapping, head);
+	munmap(aligned + mappedBytes, hugePage - head);
+	return aligned;
+}
+
+//Function to reserve and commit memory, placed on the NUMA node given (-1 for no preference)
+void* AllocatePages(size_t bytes, EPageMode mode, int numaNode, bool* usedHugePages)
+{
+	if (usedHugePages) *usedHugePages = false;
+
+	const int protection = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void* memory = MAP_FAILED;
+
+	//hugetlbfs mappings must be released in whole huge pages, so only sizes that are a multiple can use them
+	if (mode == EPageMode::ExplicitHuge && bytes % HugePageSize() == 0)
+	{
+		memory = mmap(nullptr, bytes, protection, flags | MAP_HUGETLB, -1, 0);
+		if (memory != MAP_FAILED && usedHugePages) *usedHugePages = true;
+	}
+	if (memory == MAP_FAILED && mode != EPageMode::Normal && bytes >= HugePageSize())
+	{
+		//Huge pages are only reported when the kernel can give them: the range starts on a huge page, asking
+		//for them worked and they aren't turned off. The kernel can still back parts with normal pages when
+		//it is short of free huge pages
+		memory = MapAlignedToHugePage(bytes, protection, flags);
+		if (memory != MAP_FAILED && madvise(memory, bytes, MADV_HUGEPAGE) == 0 && TransparentHugePagesEnabled() && usedHugePages)
+		{
+			*usedHugePages = true;
+		}
+	}
+	if (memory == MAP_FAILED)
+	{
+		memory = mmap(nullptr, bytes, protection, flags, -1, 0);
+		if (memory == MAP_FAILED) return nullptr;
+	}
+
+	//Prefer the node given, pages are still only placed when they are first touched
+	if (numaNode >= 0 && numaNode < 64 && NumaNodeCount() > 1)
+	{
+		unsigned long nodeMask = 1ul << numaNode;
+		syscall(SYS_mbind, memory, bytes, MemPolicyPreferred, &nodeMask, sizeof(nodeMask) * 8, 0);
+	}
+	return memory;
+}
+
+//Function to release memory returned by AllocatePages
+void FreePages(void* memory, size_t bytes)
+{
+	if (memory) munmap(memory, bytes);
+}
+
+//Size of a huge page in bytes, 0 if the platform does not support them
+size_t HugePageSize()
+{
+	static const size_t size = []()
+	{
+		std::ifstream meminfo("/proc/meminfo");
+		std::string line;
+		while (std::getline(meminfo, line))
+		{
+			if (line.compare(0, 13, "Hugepagesize:") == 0)
+			{
+				return static_cast<size_t>(std::stoul(line.substr(13))) * 1024;
+			}
+		}
+		return static_cast<size_t>(2 * 1024 * 1024);
+	}();
+	return size;
+}
+
+//Number of NUMA nodes in the machine, 1 on machines without NUMA
+int NumaNodeCount()
+{
+	static const int count = []()
+	{
+		int nodes = 0;
+		while (std::ifstream("/sys/devices/system/node/node" + std::to_string(nodes) + "/cpulist").good()) ++nodes;
+		return std::max(nodes, 1);
+	}();
+	return count;
+}
+
+//NUMA node of the processor running the calling thread
+int CurrentNumaNode()
+{
+	unsigned cpu = 0, node = 0;
+	return syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? static_cast<int>(node) : 0;
+}
+
+//Function to restrict the calling thread to the processors of a NUMA node, returns false on failure
+bool BindThreadToNumaNode(int node)
+{
+	std::vector<int> cpus = NumaNodeCpus(node);
+	if (cpus.empty()) return false;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus) CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+
+//Function to reserve and commit memory, other platforms only get normal pages
+void* AllocatePages(size_t bytes, EPageMode mode, int numaNode, bool* usedHugePages)
+{
+	if (usedHugePages) *usedHugePages = false;
+	return ::operator new(bytes, std::align_val_t(64), std::nothrow);
+}
+
+void FreePages(void* memory, size_t bytes)
+{
+	::operator delete(memory, std::align_val_t(64));
+}
+
+size_t HugePageSize() { return 0; }
+int NumaNodeCount() { return 1; }
+int CurrentNumaNode() { return 0; }
+bool BindThreadToNumaNode(int node) { return false; }
+
+#endif
+
+//Name of a page mode to show in the UI
+const char* PageModeName(EPageMode mode)
+{
+	switch (mode)
+	{
+	case EPageMode::TransparentHuge: return "Transparent Huge Pages";
+	case EPageMode::ExplicitHuge:    return "Explicit Huge Pages";
+	default:                         return "Normal Pages";
+	}
+}
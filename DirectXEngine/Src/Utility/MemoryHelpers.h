@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------------
+// Helper functions for large page allocations and NUMA placement
+//--------------------------------------------------------------------------------------
+// Large heightfields span gigabytes, so random access kernels spend a lot of time on TLB
+// misses with normal 4KB pages. These functions reserve memory backed by huge pages where
+// the platform allows it and place memory and threads on NUMA nodes.
+//
+// Windows: huge pages are large pages (MEM_LARGE_PAGES, needs the "Lock pages in memory"
+//          privilege), NUMA placement uses VirtualAllocExNuma.
+// Linux:   transparent huge pages use madvise(MADV_HUGEPAGE), explicit huge pages use
+//          mmap(MAP_HUGETLB) from the hugetlbfs pool, NUMA placement uses mbind and the
+//          first-touch policy of the thread that writes the memory first.
+// Every request falls back to normal pages when huge pages cannot be provided.
+
+#pragma once
+#include "tepch.h"
+
+//Kind of pages used to back large allocations
+enum class EPageMode
+{
+	Normal,          //Normal pages
+	TransparentHuge, //Ask the kernel to back the memory with huge pages when it can
+	ExplicitHuge,    //Reserve huge pages up front
+};
+
+//Function to reserve and commit memory, placed on the NUMA node given (-1 for no preference)
+//usedHugePages is set to whether huge pages could be used. Returns nullptr on failure
+void* AllocatePages(size_t bytes, EPageMode mode, int numaNode, bool* usedHugePages = nullptr);
+
+//Function to release memory returned by AllocatePages
+void FreePages(void* memory, size_t bytes);
+
+//Size of a huge page in bytes, 0 if the platform does not support them
+size_t HugePageSize();
+
+//Number of NUMA nodes in the machine, 1 on machines without NUMA
+int NumaNodeCount();
+
+//NUMA node of the processor running the calling thread
+int CurrentNumaNode();
+
+//Function to restrict the calling thread to the processors of a NUMA node, returns false on failure
+bool BindThreadToNumaNode(int node);
+
+//Name of a page mode to show in the UI
+const char* PageModeName(EPageMode mode);
@@ -4,7 +4,9 @@
 #ifndef _COMMON_H_INCLUDED_
 #define _COMMON_H_INCLUDED_
 
+#ifndef NOMINMAX
 #define NOMINMAX
+#endif
 
 #include "Math/CVector3.h"
 #include "Math/CMatrix4x4.h"
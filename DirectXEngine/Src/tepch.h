@@ -1,5 +1,10 @@
 #pragma once
 
+//Windows.h defines min and max as macros otherwise, which break std::min, std::max and the height expressions
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
 //------------------------//
 //	 String Manipulation
 //------------------------//
@@ -16,7 +21,6 @@
 #include <algorithm>
 #include <cmath>
 #include <vector>
-#include <random>
 #include <numeric>
 
 